@@ -213,7 +213,7 @@ mo_forcejoin(struct Client *client_p, struct Client *source_p, int parc, const c
 
 		sendto_channel_local(ALL_MEMBERS, chptr, ":%s MODE %s +nt", me.name, chptr->chname);
 
-		target_p->localClient->last_join_time = rb_current_time();
+		target_p->localClient->reg->last_join_time = rb_current_time();
 		channel_member_names(chptr, target_p, 1);
 
 		/* we do this to let the oper know that a channel was created, this will be
@@ -95,6 +95,7 @@ mo_opme(struct Client *client_p, struct Client *source_p, int parc, const char *
 	if(msptr == NULL)
 		return 0;
 
+	set_channel_member_op(msptr, true);
 	msptr->flags |= CHFL_CHANOP;
 
 	sendto_wallops_flags(UMODE_WALLOP, &me,
@@ -130,7 +130,10 @@ mr_webirc(struct Client *client_p, struct Client *source_p, int parc, const char
 	else
 		rb_strlcpy(source_p->host, source_p->sockhost, sizeof(source_p->host));
 
+	/* the ip index has to follow the client to its real address */
+	del_client_ip_index(source_p);
 	rb_inet_pton_sock(parv[4], (struct sockaddr *)&source_p->localClient->ip);
+	add_client_ip_index(source_p);
 
 	/* Check dlines now, k/glines will be checked on registration */
 	if((aconf = find_dline((struct sockaddr *)&source_p->localClient->ip)))
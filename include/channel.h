@@ -67,11 +67,15 @@ struct Channel
 
 	rb_dlink_list members[2];	/* channel members */
 	rb_dlink_list locmembers;	/* local channel members */
+	rb_dlink_list links;		/* server links with members behind them */
+	rb_dlink_list oplinks;		/* server links with chanops behind them */
 
 	rb_dlink_list invites;
 	rb_dlink_list banlist;
 	rb_dlink_list exceptlist;
 	rb_dlink_list invexlist;
+	struct BanIndex *banindex;	/* built once banlist/exceptlist are */
+	struct BanIndex *exceptindex;	/* ban_index_threshold long */
 
 	time_t first_received_message_time;	/* channel flood control */
 	int received_number_of_privmsgs;
@@ -94,13 +98,59 @@ struct membership
 	uint32_t ban_serial;
 };
 
+/* a server link we have remote members behind, refcounted by the
+ * number of members reached through it
+ */
+struct chanlink
+{
+	rb_dlink_node node;
+	struct Client *client_p;
+	unsigned int count;
+};
+
 #define BANLEN NICKLEN+USERLEN+HOSTLEN+6
+
+/* one nick, user or host piece of a compiled ban */
+#define BANPART_ANY	0	/* "*" */
+#define BANPART_EXACT	1	/* no wildcards */
+#define BANPART_PREFIX	2	/* "foo*" */
+#define BANPART_SUFFIX	3	/* "*foo" */
+#define BANPART_GLOB	4	/* anything else, match() */
+
+struct BanPart
+{
+	const char *str;
+	unsigned int len;
+	unsigned int type;
+};
+
 struct Ban
 {
 	char *banstr;
 	char *who;
 	time_t when;
 	rb_dlink_node node;
+	/* compiled by allocate_ban(), nick!user@host bans are matched a
+	 * piece at a time, anything else falls back to match() on banstr
+	 */
+	char *pattern;		/* banstr with '!' and '@' nulled out */
+	struct BanPart part[3];	/* nick, user, host */
+	unsigned char split;
+	unsigned char cidr_af;	/* host is ip/len, 0 if not */
+	unsigned char cidr_len;
+	unsigned char cidr_addr[16];
+};
+
+/* what a client looks like to match_ban(), filled in as needed */
+struct BanTarget
+{
+	struct Client *who;
+	const char *host;	/* nick!user@host, for unsplit bans */
+	const char *iphost;	/* nick!user@sockhost */
+	int ip_af;		/* -1 not parsed yet, 0 not an address */
+	unsigned char ip[16];
+	char hostbuf[BANLEN];
+	char iphostbuf[BANLEN];
 };
 
 struct ChModeChange
@@ -185,6 +235,12 @@ struct Channel *find_channel(const char *name);
 
 struct Ban *allocate_ban(const char *, const char *);
 void free_ban(struct Ban *bptr);
+void init_ban_target(struct BanTarget *, struct Client *, const char *, const char *);
+bool match_ban(struct Ban *, struct BanTarget *);
+struct Ban *find_ban(struct Channel *, rb_dlink_list *, const char *);
+void add_channel_ban(struct Channel *, rb_dlink_list *, struct Ban *);
+void del_channel_ban(struct Channel *, rb_dlink_list *, struct Ban *);
+void free_ban_index(struct Channel *, rb_dlink_list *);
 
 
 void destroy_channel(struct Channel *);
@@ -199,6 +255,7 @@ const char *find_channel_status(struct membership *msptr, int combine);
 void add_user_to_channel(struct Channel *, struct Client *, int flags);
 void remove_user_from_channel(struct membership *);
 void remove_user_from_channels(struct Client *);
+void set_channel_member_op(struct membership *, bool);
 void invalidate_bancache_user(struct Client *);
 
 void free_channel_list(rb_dlink_list *);
@@ -139,6 +139,12 @@ enum {
 #define LFLAGS_SENTUSER		0x00000008
 #define LFLAGS_RBL		0x00000010
 #define LFLAGS_DELAY		0x00000020
+#define LFLAGS_DIRTY		0x00000040
+#define LFLAGS_PARKED		0x00000080
+#define LFLAGS_HANDOFF		0x00000100
+#define LFLAGS_SSLDRING		0x00000200
+#define LFLAGS_SSLDHOLD		0x00000400
+#define LFLAGS_SSLDOPEN		0x00000800
 
 /* umodes, settable flags */
 
@@ -238,6 +244,30 @@ enum {
 #define SetDelayExit(x)		((x)->localClient->localflags |= LFLAGS_DELAY)
 #define ClearDelayExit(x)	((x)->localClient->localflags &= ~LFLAGS_DELAY)
 
+#define IsDirty(x)		((x)->localClient->localflags & LFLAGS_DIRTY)
+#define SetDirty(x)		((x)->localClient->localflags |= LFLAGS_DIRTY)
+#define ClearDirty(x)		((x)->localClient->localflags &= ~LFLAGS_DIRTY)
+
+#define IsParked(x)		((x)->localClient->localflags & LFLAGS_PARKED)
+#define SetParked(x)		((x)->localClient->localflags |= LFLAGS_PARKED)
+#define ClearParked(x)		((x)->localClient->localflags &= ~LFLAGS_PARKED)
+
+/* ssld is handing us the kernel TLS socket, hold output until it is done */
+#define IsHandoff(x)		((x)->localClient->localflags & LFLAGS_HANDOFF)
+#define SetHandoff(x)		((x)->localClient->localflags |= LFLAGS_HANDOFF)
+#define ClearHandoff(x)		((x)->localClient->localflags &= ~LFLAGS_HANDOFF)
+
+/* data goes through the ssld's shared ring rather than localClient->F,
+ * held while ssld wants no more output, open once its handshake is done
+ */
+#define IsSSLDRing(x)		((x)->localClient->localflags & LFLAGS_SSLDRING)
+#define SetSSLDRing(x)		((x)->localClient->localflags |= LFLAGS_SSLDRING)
+#define IsSSLDHold(x)		((x)->localClient->localflags & LFLAGS_SSLDHOLD)
+#define SetSSLDHold(x)		((x)->localClient->localflags |= LFLAGS_SSLDHOLD)
+#define ClearSSLDHold(x)	((x)->localClient->localflags &= ~LFLAGS_SSLDHOLD)
+#define IsSSLDOpen(x)		((x)->localClient->localflags & LFLAGS_SSLDOPEN)
+#define SetSSLDOpen(x)		((x)->localClient->localflags |= LFLAGS_SSLDOPEN)
+
 /* oper flags */
 #define MyOper(x)		(MyConnect(x) && IsOper(x))
 
@@ -328,10 +358,25 @@ enum
 	G_LINED
 };
 
+/* HASH_CLIENTIP keys are the address family then the leading bits of ip */
+#define CLIENT_IP_KEYLEN	5
+#define CLIENT_IP4_BITS		16
+#define CLIENT_IP6_BITS		32
+
 void check_banned_lines(void);
+void check_banned_mask(int type, const char *mask);
+void queue_kline_check(const char *mask);
 void check_klines_event(void *unused);
 void check_klines(void);
 
+typedef void client_walk_cb(struct Client *client_p, void *data);
+
+void walk_clients_by_hostmask(const char *mask, bool local, client_walk_cb *walk_cb, void *data);
+void add_client_ip_index(struct Client *client_p);
+void del_client_ip_index(struct Client *client_p);
+void add_client_host_index(struct Client *client_p);
+void del_client_host_index(struct Client *client_p);
+
 const char *get_client_name(struct Client *client, int show_ip);
 const char *log_client_name(struct Client *, int);
 void init_client(void);
@@ -355,7 +400,7 @@ void notify_banned_client(struct Client *client_p, struct ConfItem *aconf, int b
 
 void del_from_accept(struct Client *source, struct Client *target);
 
-#define accept_message(s, t) ((s) == (t) || (rb_dlinkFind((s), &((t)->localClient->allow_list))))
+#define accept_message(s, t) ((s) == (t) || (rb_dlinkFind((s), &((t)->localClient->reg->allow_list))))
 void del_all_accepts(struct Client *client_p);
 
 void dead_link(struct Client *client_p, bool sendqex);
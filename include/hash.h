@@ -37,6 +37,8 @@ typedef struct _hash_function hash_f;
 #include <s_newconf.h>
 
 
+/* initial table sizes, hash.c resizes tables to follow their load */
+
 #define HELP_MAX_BITS 7
 #define HELP_MAX (1<<HELP_MAX_BITS)
 
@@ -59,6 +61,13 @@ typedef struct _hash_function hash_f;
 #define HOST_MAX_BITS 17
 #define HOST_MAX (1<<HOST_MAX_BITS)	/* 2^17 */
 
+/* client IP prefix and host suffix tables, used by client.c */
+#define CLIENTIP_MAX_BITS 12
+#define CLIENTIP_MAX (1<<CLIENTIP_MAX_BITS)
+
+#define CLIENTHOST_MAX_BITS 14
+#define CLIENTHOST_MAX (1<<CLIENTHOST_MAX_BITS)
+
 /* RESV/XLINE hash table size, used in hash.c */
 #define R_MAX_BITS 10
 #define R_MAX (1<<R_MAX_BITS)	/* 2^10 */
@@ -95,6 +104,16 @@ typedef enum
 	CMP_MEMCMP = 2,
 } hash_cmptype;
 
+/* HASH_FLAT tables keep entries in one open addressed array and have no
+ * hash_node, so hash_find()/hash_add() return NULL for them, use the
+ * _data and _list lookups and delete by key and pointer.
+ */
+typedef enum
+{
+	HASH_CHAINED = 0,
+	HASH_FLAT = 1,
+} hash_backend;
+
 
 
 extern hash_f *hash_client;
@@ -111,6 +130,8 @@ extern hash_f *hash_connid;
 extern hash_f *hash_zconnid;
 extern hash_f *hash_monitor;
 extern hash_f *hash_command;
+extern hash_f *hash_clientip;
+extern hash_f *hash_clienthost;
 
 #define	HASH_CLIENT hash_client
 #define	HASH_ID hash_id
@@ -126,6 +147,8 @@ extern hash_f *hash_command;
 #define	HASH_ZCONNID hash_zconnid
 #define	HASH_MONITOR hash_monitor
 #define	HASH_COMMAND hash_command
+#define	HASH_CLIENTIP hash_clientip
+#define	HASH_CLIENTHOST hash_clienthost
 
 
 struct _hash_node
@@ -142,7 +165,8 @@ typedef void hash_walk_cb(void *a, void *);
 
 
 void init_hash(void);
-hash_f *hash_create(const char *name, hash_cmptype cmptype, unsigned int hashbits, unsigned int maxkeylen);
+hash_f *hash_create(const char *name, hash_cmptype cmptype, hash_backend backend, unsigned int hashbits,
+		    unsigned int maxkeylen);
 
 hash_node *hash_add(hash_f *, const char *, void *);
 void hash_del(hash_f *, const char *, void *);
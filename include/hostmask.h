@@ -44,7 +44,7 @@ void add_conf_by_address(const char *, int, const char *, struct ConfItem *);
 void delete_one_address_conf(const char *, struct ConfItem *);
 void clear_out_address_conf(void);
 void clear_out_address_conf_bans(void);
-void init_host_hash(void);
+const char *mask_domain(const char *);
 const char *show_iline_prefix(struct Client *, struct ConfItem *, const char *);
 
 struct ConfItem *find_address_conf(const char *host, const char *sockhost,
@@ -62,19 +62,16 @@ int match_ipv6(struct sockaddr *, struct sockaddr *, int);
 #endif
 int match_ipv4(struct sockaddr *, struct sockaddr *, int);
 
-/* Hashtable stuff... */
-#define ATABLE_BITS 12
-#define ATABLE_SIZE (1<<ATABLE_BITS)
+/* every address record, in no particular order */
+extern rb_dlink_list address_recs;
 
-extern struct AddressRec *atable[ATABLE_SIZE];
-
-#define HOSTHASH_WALK(i, arec) for (i = 0; i < ATABLE_SIZE; i++) { for(arec = atable[i]; arec; arec = arec->next)
-#define HOSTHASH_WALK_SAFE(i, arec, arecn) \
-	for(i = 0; i < ATABLE_SIZE; i++) { \
-		for(arec = atable[i], arecn = arec ? arec->next : NULL; arec; \
-			arec = arecn, arecn = arecn ? arecn->next : NULL)
+#define HOSTHASH_WALK(ptr, arec) RB_DLINK_FOREACH(ptr, address_recs.head) { arec = ptr->data;
+#define HOSTHASH_WALK_SAFE(ptr, nptr, arec) \
+	RB_DLINK_FOREACH_SAFE(ptr, nptr, address_recs.head) { arec = ptr->data;
 #define HOSTHASH_WALK_END }
 
+struct AddressIndex;
+
 struct AddressRec
 {
 	/* masktype: HM_HOST, HM_IPV4, HM_IPV6 -A1kmm */
@@ -105,8 +102,11 @@ struct AddressRec
 	const char *username;
 	struct ConfItem *aconf;
 
-	/* The next record in this hash bucket. */
-	struct AddressRec *next;
+	rb_dlink_node node;		/* on address_recs */
+	rb_dlink_node inode;		/* on the index entry below */
+	struct AddressIndex *aindex;	/* index for this type */
+	void *index;			/* patricia node or host trie node,
+					 * NULL for the wildcard list */
 };
 
 
@@ -27,20 +27,34 @@
 #ifndef INCLUDED_listener_h
 #define INCLUDED_listener_h
 
+#define LISTENER_MAX_SHARDS	16	/* SO_REUSEPORT sockets per listener */
+#define ACCEPT_BUDGET_MAX	1024	/* connections accepted per wakeup */
+#define LISTENER_RATE_PERIOD	60	/* seconds the accept rates are over */
+
 struct Listener
 {
 	rb_dlink_node node;
 	const char *name;	/* listener name */
 	char *printable_name;	/* printable listener name */
 	rb_fde_t *F;		/* file descriptor */
+	rb_fde_t *shard_F[LISTENER_MAX_SHARDS - 1];	/* more sockets bound to addr */
+	int shards;		/* number of sockets, F included */
 	int ref_count;		/* number of connection references */
 	bool active;		/* current state of listener */
 	bool ssl;		/* ssl listener */
 	struct rb_sockaddr_storage addr;
 	char vhost[HOSTLEN + 1];	/* virtual name of listener */
+
+	unsigned long accepted;	/* connections accepted */
+	unsigned long refused;	/* connections refused before add_connection() */
+	time_t rate_time;	/* start of the current rate period */
+	unsigned int rate_accepted;	/* counts in the current period */
+	unsigned int rate_refused;
+	unsigned int last_accepted;	/* counts in the previous period */
+	unsigned int last_refused;
 };
 
-void add_listener(int port, const char *vaddr_ip, int family, bool ssl);
+void add_listener(int port, const char *vaddr_ip, int family, bool ssl, int shards);
 void close_listener(struct Listener *listener);
 void close_listeners(void);
 const char *get_listener_name(struct Listener *listener);
@@ -43,6 +43,35 @@ int match_cidr(const char *mask, const char *name);
 int match_ips(const char *mask, const char *addr);
 
 
+/*
+ * match_set - a set of match_esc() masks searched in one pass over the
+ * name.  each mask is filed under the longest run of literal chars it
+ * holds, the runs are found with Aho-Corasick and the masks behind them
+ * checked with match_esc().  masks with no usable run are always checked.
+ *
+ * match_set_find() returns the data of the most recently added mask
+ * that matches, the same one a walk of an rb_dlinkAddAlloc() list would
+ * find first.
+ */
+struct match_set_node;
+
+struct match_set
+{
+	struct match_set_node *root[256];
+	rb_dlink_list entries;
+	rb_dlink_list always;		/* masks with no anchor */
+	unsigned long nodes;
+	unsigned long anchorlen;	/* total length of live anchors */
+	unsigned long seq;
+	unsigned long gen;
+	bool dirty;			/* failure links need rebuilding */
+};
+
+void match_set_add(struct match_set *, const char *mask, void *data);
+void match_set_del(struct match_set *, void *data);
+void *match_set_find(struct match_set *, const char *name);
+
+
 /*
  * comp_with_mask - compares to IP address
  */
@@ -129,6 +158,34 @@ extern const unsigned int CharAttrs[];
 #define IsEol(c) (CharAttrs[(unsigned char)(c)] & EOL_C)
 
 
+/*
+ * SSE2 case folding, used by irccmp()
+ *
+ * irc_toupper16 - ToUpperTab applied to 16 bytes, 'a' to '~' lose 0x20
+ *		   and nothing else changes
+ * IRC_SIMD_SAFE - a 16 byte load from p stays within p's page, so it
+ *		   can read past a terminating NUL without faulting
+ */
+#if defined(__SSE2__) && defined(__GNUC__)
+#define HAVE_SIMD_CASEFOLD 1
+#include <emmintrin.h>
+
+static inline __m128i
+irc_toupper16(__m128i v)
+{
+	__m128i off = _mm_sub_epi8(v, _mm_set1_epi8('a'));
+	__m128i range = _mm_set1_epi8('~' - 'a');
+	__m128i lower = _mm_cmpeq_epi8(_mm_min_epu8(off, range), off);
+
+	return _mm_sub_epi8(v, _mm_and_si128(lower, _mm_set1_epi8(0x20)));
+}
+
+#define IRC_SIMD_PAGE	4096
+#define IRC_SIMD_SAFE(p) ((((uintptr_t)(p)) & (IRC_SIMD_PAGE - 1)) <= IRC_SIMD_PAGE - 16)
+
+int irccmp_simd(const char *s1, const char *s2);
+#endif
+
 /*
  * irccmp - case insensitive comparison of s1 and s2
  */
@@ -137,6 +194,9 @@ extern const unsigned int CharAttrs[];
 static inline int
 irccmp(const char *s1, const char *s2)
 {
+#ifdef HAVE_SIMD_CASEFOLD
+	return irccmp_simd(s1, s2);
+#else
 	const unsigned char *str1 = (const unsigned char *)s1;
 	const unsigned char *str2 = (const unsigned char *)s2;
 	int res;
@@ -149,6 +209,7 @@ irccmp(const char *s1, const char *s2)
 		str2++;
 	}
 	return (res);
+#endif
 }
 
 #endif /* INCLUDED_match_h */
@@ -63,7 +63,7 @@
 #define NUMERIC_STR_217	/*** RPL_STATSQLINE ***/	"%c %d %s :%s"
 #define NUMERIC_STR_218	/*** RPL_STATSYLINE ***/	"Y %s %d %d %d %u %d.%d %d.%d %u"
 #define NUMERIC_STR_219	/*** RPL_ENDOFSTATS ***/	"%c :End of /STATS report"
-#define NUMERIC_STR_220	/*** RPL_STATSPLINE ***/	"%c %d %s %d :%s%s"
+#define NUMERIC_STR_220	/*** RPL_STATSPLINE ***/	"%c %d %s %d :%s%s%s"
 #define NUMERIC_STR_221	/*** RPL_UMODEIS ***/		"%s"
 #define NUMERIC_STR_225	/*** RPL_STATSDLINE ***/	"%c %s :%s%s%s"
 #define NUMERIC_STR_241	/*** RPL_STATSLLINE ***/	"L %s * %s 0 -1"
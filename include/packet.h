@@ -51,4 +51,7 @@ extern PF read_ctrl_packet;
 extern PF read_packet;
 extern EVH flood_recalc;
 
+void flood_unpark(struct Client *);
+void read_packet_buf(struct Client *, char *, int);
+
 #endif /* INCLUDED_packet_h */
@@ -53,6 +53,24 @@ struct MessageEntry
 	int min_para;
 };
 
+/* handler timing, buckets are powers of two in microseconds */
+#define MSG_TIME_BUCKETS	24
+
+enum
+{
+	MSG_TIME_LOCAL,
+	MSG_TIME_SERVER,
+	MSG_TIME_LAST
+};
+
+struct MessageTime
+{
+	unsigned long count;	/* number of timed calls */
+	unsigned long long total;	/* total usec spent in handler */
+	unsigned long max;	/* slowest call in usec */
+	unsigned long hist[MSG_TIME_BUCKETS];
+};
+
 /* Message table structure */
 struct Message
 {
@@ -64,6 +82,7 @@ struct Message
 	 * UNREGISTERED, CLIENT, RCLIENT, SERVER, OPER, LAST
 	 */
 	struct MessageEntry handlers[LAST_HANDLER_TYPE];
+	struct MessageTime times[MSG_TIME_LAST];	/* local clients, servers */
 };
 
 
@@ -74,6 +93,9 @@ void handle_encap(struct Client *, struct Client *, const char *, int, const cha
 void clear_hash_parse(void);
 void mod_add_cmd(struct Message *msg);
 void mod_del_cmd(struct Message *msg);
+struct Message *lookup_command(const char *);
+void clear_command_times(void);
+unsigned long command_time_percentile(const struct MessageTime *, unsigned int);
 
 /* generic handlers */
 int m_ignore(struct Client *, struct Client *, int, const char **);
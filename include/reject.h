@@ -49,6 +49,8 @@ void add_delay_exit(rb_fde_t *F, const char *reason);
 
 int throttle_add(struct sockaddr *addr);
 unsigned long throttle_size(void);
+void setup_ip_caches(void);
+void report_ip_caches(struct Client *);
 
 int inc_global_cidr_count(struct Client *client_p);
 void dec_global_cidr_count(struct Client *client_p);
@@ -194,9 +194,11 @@ struct config_file_entry
 	int post_registration_delay;
 	int burst_away;
 	int reject_after_count;
+	int accept_budget;
 	int reject_duration;
 	int throttle_count;
 	int throttle_duration;
+	int ip_cache_size;
 	int target_change;
 	int collision_fnc;
 	int hide_spoof_ips;
@@ -219,6 +221,7 @@ struct config_channel_entry
 	unsigned int knock_delay;
 	unsigned int knock_delay_channel;
 	unsigned int max_bans;
+	unsigned int ban_index_threshold;
 	unsigned int max_chans_per_user;
 	unsigned int no_create_on_split;
 	unsigned int no_join_on_split;
@@ -268,6 +271,9 @@ struct server_info
 	char *ssl_ecdh_named_curve;
 	rb_tls_ver_t tls_min_ver;
 	int ssld_count;
+	int ssl_ktls;
+	int ssld_max_handshakes;
+	int ssld_ring;
 	char *vhost_dns;
 #ifdef RB_IPV6
 	char *vhost6_dns;
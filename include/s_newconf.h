@@ -58,8 +58,8 @@ void init_s_newconf(void);
 void clear_s_newconf(void);
 void clear_s_newconf_bans(void);
 
-#define FREE_TARGET(x) ((x)->localClient->targinfo[0])
-#define USED_TARGETS(x) ((x)->localClient->targinfo[1])
+#define FREE_TARGET(x) ((x)->localClient->reg->targinfo[0])
+#define USED_TARGETS(x) ((x)->localClient->reg->targinfo[1])
 
 typedef struct
 {
@@ -238,6 +238,10 @@ struct ConfItem *find_xline(const char *, int);
 struct ConfItem *find_nick_resv(const char *name);
 struct ConfItem *find_xline_mask(const char *);
 struct ConfItem *find_nick_resv_mask(const char *name);
+void add_xline_conf(struct ConfItem *);
+void del_xline_conf(rb_dlink_node *);
+void add_nick_resv(struct ConfItem *);
+void del_nick_resv(rb_dlink_node *);
 
 
 
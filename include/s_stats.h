@@ -62,6 +62,9 @@ struct ServerStatistics
 	unsigned int is_abad;	/* bad auth requests */
 	unsigned int is_rej;	/* rejected from cache */
 	unsigned int is_thr;	/* number of throttled connections */
+	unsigned int is_rbl;	/* rbl lookups sent to the resolver */
+	unsigned int is_rbl_shared;	/* rbl checks that joined a lookup in flight */
+	unsigned int is_rbl_cached;	/* rbl checks answered from the cache */
 };
 
 /* declared in ircd.c */
@@ -38,6 +38,8 @@ typedef enum _loglevel {
 
 
 void send_pop_queue(struct Client *);
+void send_flush_dirty(void);
+void send_cancel_flush(struct Client *);
 void sendto_one(struct Client *target_p, const char *, ...) AFP(2, 3);
 void sendto_one_buffer(struct Client *target_p, const char *buffer);
 void sendto_one_notice(struct Client *target_p, const char *, ...) AFP(2, 3);
@@ -0,0 +1,215 @@
+/*
+ *  ssld_ring.h: Shared memory rings between the ircd and ssld
+ *  Copyright (C) 2007-2015 ircd-ratbox development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ *
+ *  $Id$
+ */
+
+#ifndef INCLUDED_ssld_ring_h
+#define INCLUDED_ssld_ring_h
+
+/*
+ * Instead of a socketpair per client, the ircd and an ssld can share a
+ * pair of rings, one each way, and carry every client's data through
+ * them tagged with its connid.  Each side waits on one eventfd for the
+ * other to kick it, and only gets kicked when it has gone to sleep on an
+ * empty ring or is waiting for room in a full one.
+ */
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#if defined(MFD_CLOEXEC) && defined(EFD_NONBLOCK)
+#define HAVE_SSLD_RING 1
+#endif
+#endif
+
+#ifdef HAVE_SSLD_RING
+
+#define SSLD_RING_SIZE		(1 << 20)	/* each way, must be a power of two */
+#define SSLD_RING_MASK		(SSLD_RING_SIZE - 1)
+#define SSLD_RING_MAXDATA	16384		/* biggest payload in one record */
+
+/* record types */
+#define SSLD_RING_DATA		'd'
+#define SSLD_RING_CLOSE		'c'	/* payload is the reason, if there is one */
+#define SSLD_RING_CORK		'k'	/* ssld has enough queued for this client */
+#define SSLD_RING_UNCORK	'u'	/* go ahead, also sent once the handshake is done */
+
+struct ssld_ring_rec
+{
+	uint32_t connid;
+	uint16_t len;
+	uint8_t type;
+	uint8_t pad;
+};
+
+/*
+ * head is only moved by the producer and tail only by the consumer, both
+ * count up forever and are masked on use.  Records are padded to 8 bytes
+ * so a header never wraps, only a payload can.
+ */
+struct ssld_ring
+{
+	uint32_t head;
+	uint32_t blocked;	/* producer is waiting for room */
+	char pad0[56];
+	uint32_t tail;
+	uint32_t sleeping;	/* consumer is waiting for records */
+	char pad1[56];
+	uint8_t data[SSLD_RING_SIZE];
+};
+
+struct ssld_rings
+{
+	struct ssld_ring to_ssld;
+	struct ssld_ring to_ircd;
+};
+
+static inline uint32_t
+ssld_ring_reclen(size_t len)
+{
+	return (sizeof(struct ssld_ring_rec) + len + 7) & ~7U;
+}
+
+static inline bool
+ssld_ring_room(struct ssld_ring *r, size_t len)
+{
+	uint32_t used = r->head - __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST);
+	return ssld_ring_reclen(len) <= SSLD_RING_SIZE - used;
+}
+
+/*
+ * ssld_ring_reserve - is there room for a record of len, if not mark the
+ * ring blocked so the consumer kicks us once there is
+ */
+static inline bool
+ssld_ring_reserve(struct ssld_ring *r, size_t len)
+{
+	if(ssld_ring_room(r, len))
+		return true;
+	__atomic_store_n(&r->blocked, 1, __ATOMIC_SEQ_CST);
+	/* the consumer may have made room before it could see that */
+	return ssld_ring_room(r, len);
+}
+
+static inline bool
+ssld_ring_put(struct ssld_ring *r, uint32_t connid, uint8_t type, const void *data, size_t len)
+{
+	struct ssld_ring_rec *rec;
+	uint32_t head = r->head, off;
+	size_t first;
+
+	if(!ssld_ring_reserve(r, len))
+		return false;
+
+	rec = (struct ssld_ring_rec *)&r->data[head & SSLD_RING_MASK];
+	rec->connid = connid;
+	rec->len = (uint16_t)len;
+	rec->type = type;
+	rec->pad = 0;
+
+	off = (head + sizeof(struct ssld_ring_rec)) & SSLD_RING_MASK;
+	first = SSLD_RING_SIZE - off;
+	if(first > len)
+		first = len;
+	memcpy(&r->data[off], data, first);
+	memcpy(&r->data[0], (const uint8_t *)data + first, len - first);
+
+	__atomic_store_n(&r->head, head + ssld_ring_reclen(len), __ATOMIC_RELEASE);
+	return true;
+}
+
+/*
+ * ssld_ring_get - take the next record, buf must hold SSLD_RING_MAXDATA
+ */
+static inline bool
+ssld_ring_get(struct ssld_ring *r, struct ssld_ring_rec *rec, void *buf)
+{
+	uint32_t tail = r->tail, next, off;
+	size_t first, len;
+
+	if(tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+		return false;
+
+	memcpy(rec, &r->data[tail & SSLD_RING_MASK], sizeof(struct ssld_ring_rec));
+	next = tail + ssld_ring_reclen(rec->len);
+	len = rec->len;
+	if(len > SSLD_RING_MAXDATA)
+		len = rec->len = SSLD_RING_MAXDATA;
+
+	off = (tail + sizeof(struct ssld_ring_rec)) & SSLD_RING_MASK;
+	first = SSLD_RING_SIZE - off;
+	if(first > len)
+		first = len;
+	memcpy(buf, &r->data[off], first);
+	memcpy((uint8_t *)buf + first, &r->data[0], len - first);
+
+	__atomic_store_n(&r->tail, next, __ATOMIC_SEQ_CST);
+	return true;
+}
+
+/*
+ * ssld_ring_sleep - the consumer found the ring empty and is about to wait
+ * on its eventfd.  False means a record came in meanwhile, keep reading.
+ */
+static inline bool
+ssld_ring_sleep(struct ssld_ring *r)
+{
+	__atomic_store_n(&r->sleeping, 1, __ATOMIC_SEQ_CST);
+	if(r->tail != __atomic_load_n(&r->head, __ATOMIC_SEQ_CST))
+	{
+		__atomic_store_n(&r->sleeping, 0, __ATOMIC_SEQ_CST);
+		return false;
+	}
+	return true;
+}
+
+/* after putting records, does the consumer need kicking */
+static inline bool
+ssld_ring_wake_consumer(struct ssld_ring *r)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&r->sleeping, __ATOMIC_SEQ_CST) && __atomic_exchange_n(&r->sleeping, 0, __ATOMIC_SEQ_CST);
+}
+
+/* after taking records, does the producer need kicking */
+static inline bool
+ssld_ring_wake_producer(struct ssld_ring *r)
+{
+	return __atomic_load_n(&r->blocked, __ATOMIC_SEQ_CST) && __atomic_exchange_n(&r->blocked, 0, __ATOMIC_SEQ_CST);
+}
+
+static inline void
+ssld_ring_kick(int efd)
+{
+	uint64_t one = 1;
+	if(write(efd, &one, sizeof(one)) < 0)
+		return;		/* only if the count would overflow, it's kicked anyway */
+}
+
+static inline void
+ssld_ring_unkick(int efd)
+{
+	uint64_t count;
+	if(read(efd, &count, sizeof(count)) < 0)
+		return;
+}
+
+#endif /* HAVE_SSLD_RING */
+#endif /* INCLUDED_ssld_ring_h */
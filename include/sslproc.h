@@ -31,13 +31,18 @@ void init_ssld(void);
 int start_ssldaemon(int count, const char *ssl_ca_cert, const char *ssl_cert, const char *ssl_private_key,
 		    const char *ssl_dh_params, const char *ssl_cipher_string, 
 		    const char *ecdh_named_curve, int tls_min_ver);
-ssl_ctl_t *start_ssld_accept(rb_fde_t *sslF, rb_fde_t *plainF, uint32_t id);
+ssl_ctl_t *start_ssld_accept(rb_fde_t *sslF, rb_fde_t *plainF, uint32_t id, struct sockaddr *addr);
 ssl_ctl_t *start_ssld_connect(rb_fde_t *sslF, rb_fde_t *plainF, uint32_t id);
+ssl_ctl_t *start_ssld_accept_ring(rb_fde_t *sslF, uint32_t id, struct sockaddr *addr);
+void ssld_ring_send(struct Client *);
+void ssld_ring_close(struct Client *);
 void start_zlib_session(void *data);
 void send_new_ssl_certs(const char *ssl_ca_cert, const char *ssl_cert, const char *ssl_private_key,
 			const char *ssl_dh_params, const char *ssl_cipher_list, 
 			const char *ecdh_named_curve, int tls_min_ver);
 void ssld_decrement_clicount(ssl_ctl_t * ctl);
+void ssld_flush_dirty(void);
 int get_ssld_count(void);
+void report_ssld(struct Client *);
 
 #endif
@@ -61,6 +61,17 @@ struct ZipStats
 	double out_ratio;
 };
 
+struct ClientIndexBucket;
+
+/* a client's place in one bucket of the HASH_CLIENTIP or
+ * HASH_CLIENTHOST tables, see client.c
+ */
+struct ClientIndexRef
+{
+	struct ClientIndexBucket *bucket;
+	rb_dlink_node node;
+};
+
 struct Client
 {
 	rb_dlink_node node;
@@ -108,6 +119,9 @@ struct Client
 	 */
 	rb_dlink_list on_allow_list;
 
+	struct ClientIndexRef ipref;	/* bucket for the leading bits of the ip */
+	struct ClientIndexRef *hostrefs;	/* one bucket per dot suffix of host */
+	unsigned int nhostrefs;
 
 	struct LocalUser *localClient;
 };
@@ -117,6 +131,7 @@ struct _ssl_ctl;
 struct LocalUser
 {
 	rb_dlink_node tnode;	/* This is the node for the local list type the client is on */
+	rb_dlink_node dirtynode;	/* node for the end of loop sendq flush list */
 	rb_fde_t *F;
 	uint32_t connid;
 	uint32_t caps;
@@ -134,10 +149,6 @@ struct LocalUser
 
 	time_t last;
 
-	time_t last_caller_id_time;
-	time_t first_received_message_time;
-	int received_number_of_privmsgs;
-	int flood_noticed;
 	unsigned int number_of_nick_changes;
 	unsigned int cork_count;
 
@@ -155,41 +166,20 @@ struct LocalUser
 	struct ConfItem *att_conf;	/* attached conf */
 	struct server_conf *att_sconf;
 
-	time_t last_nick_change;
-
-
-	/* challenge stuff */
-	uint8_t *chal_resp;
-	time_t chal_time;
-	
-	/* clients allowed to talk through +g */
-	rb_dlink_list allow_list;
-
-	/* nicknames theyre monitoring */
-	rb_dlink_list monitor_list;
-
-	rb_dlink_list invited;	/* chain of invite pointer blocks */
-
-
-
 	/*
 	 * Anti-flood stuff. We track how many messages were parsed and how
 	 * many we were allowed in the current second, and apply a simple decay
 	 * to avoid flooding.
 	 *   -- adrian
+	 *
+	 * The decay is applied lazily from flood_lasttime when the client
+	 * is next parsed, clients with throttled lines sit on parknode.
 	 */
 	unsigned int allow_read;/* how many we're allowed to read in this second */
 	int actually_read;	/* how many we've actually read in this second */
 	int sent_parsed;	/* how many messages we've parsed in this second */
-
-	int join_leave_count;	/* count of JOIN/LEAVE in less than 
-				   MIN_JOIN_LEAVE_TIME seconds */
-	time_t last_join_time;	/* when this client last 
-				   joined a channel */
-	time_t last_knock;	/* time of last knock */
-	time_t last_leave_time;	/* when this client last * left a channel */
-	unsigned int oper_warn_count_down; /* warn opers of this possible 
-					   spambot every time this gets to 0 */
+	time_t flood_lasttime;	/* when sent_parsed was last decayed */
+	rb_dlink_node parknode;	/* node for the throttled client list */
 
 	uint32_t localflags;
 	uint32_t random_ping;
@@ -204,11 +194,47 @@ struct LocalUser
 	struct ZipStats *zipstats;	/* zipstats */
 	rb_ev_entry *event;	/* used for associated events */
 
+	struct LocalUserReg *reg;	/* NULL until the client registers as a user */
+};
+
+/*
+ * What a local user only needs once registered.  Connections spend their
+ * unknown phase without it, most of a connection flood never gets here.
+ */
+struct LocalUserReg
+{
+	time_t last_caller_id_time;
+	time_t first_received_message_time;
+	int received_number_of_privmsgs;
+	int flood_noticed;
+
+	time_t last_nick_change;
+
+	/* challenge stuff */
+	uint8_t *chal_resp;
+	time_t chal_time;
+
+	/* clients allowed to talk through +g */
+	rb_dlink_list allow_list;
+
+	/* nicknames theyre monitoring */
+	rb_dlink_list monitor_list;
+
+	rb_dlink_list invited;	/* chain of invite pointer blocks */
+
+	int join_leave_count;	/* count of JOIN/LEAVE in less than 
+				   MIN_JOIN_LEAVE_TIME seconds */
+	time_t last_join_time;	/* when this client last 
+				   joined a channel */
+	time_t last_knock;	/* time of last knock */
+	time_t last_leave_time;	/* when this client last * left a channel */
+	unsigned int oper_warn_count_down; /* warn opers of this possible 
+					   spambot every time this gets to 0 */
+
 	/* target change stuff */
 	time_t target_last;	/* last time we cleared a slot */
 	unsigned int targinfo[2];	/* cyclic array, no in use */
 	void *targets[10];	/* targets were aware of */
-
 };
 
 
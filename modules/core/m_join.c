@@ -247,7 +247,7 @@ m_join(struct Client *client_p, struct Client *source_p, int parc, const char *p
 		{
 			sendto_one_numeric(source_p, s_RPL(ERR_TOOMANYCHANNELS), name);
 			if(successful_join_count)
-				source_p->localClient->last_join_time = rb_current_time();
+				source_p->localClient->reg->last_join_time = rb_current_time();
 			return 0;
 		}
 
@@ -336,7 +336,7 @@ m_join(struct Client *client_p, struct Client *source_p, int parc, const char *p
 		channel_member_names(chptr, source_p, 1);
 
 		if(successful_join_count)
-			source_p->localClient->last_join_time = rb_current_time();
+			source_p->localClient->reg->last_join_time = rb_current_time();
 	}
 
 	return 0;
@@ -935,6 +935,7 @@ can_join(struct Client *source_p, struct Channel *chptr, char *key)
 {
 	rb_dlink_node *ptr;
 	struct Ban *invex = NULL;
+	struct BanTarget target;
 	char src_host[NICKLEN + USERLEN + HOSTLEN + 6];
 	char src_iphost[NICKLEN + USERLEN + HOSTLEN + 6];
 
@@ -948,18 +949,17 @@ can_join(struct Client *source_p, struct Channel *chptr, char *key)
 
 	if(chptr->mode.mode & MODE_INVITEONLY)
 	{
-		rb_dlink_node *lp = rb_dlinkFind(chptr, &source_p->localClient->invited);
+		rb_dlink_node *lp = rb_dlinkFind(chptr, &source_p->localClient->reg->invited);
 
 		if(lp == NULL)
 		{
 			if(!ConfigChannel.use_invex)
 				return (ERR_INVITEONLYCHAN);
+			init_ban_target(&target, source_p, src_host, src_iphost);
 			RB_DLINK_FOREACH(ptr, chptr->invexlist.head)
 			{
 				invex = ptr->data;
-				if(match(invex->banstr, src_host)
-				   || match(invex->banstr, src_iphost)
-				   || match_cidr(invex->banstr, src_iphost))
+				if(match_ban(invex, &target))
 					break;
 			}
 			if(ptr == NULL)
@@ -1147,7 +1147,7 @@ remove_our_modes(struct Channel *chptr)
 				lpara[count++] = msptr->client_p->name;
 				*mbuf++ = 'o';
 				
-				rb_dlinkMoveNode(&msptr->channode, &chptr->members[MEMBER_OP], &chptr->members[MEMBER_NOOP]);
+				set_channel_member_op(msptr, false);
 
 				/* +ov, might not fit so check. */
 				if(is_voiced(msptr))
@@ -1235,6 +1235,8 @@ remove_ban_list(struct Channel *chptr, struct Client *source_p,
 
 	pbuf = lparabuf;
 
+	free_ban_index(chptr, list);
+
 	cur_len = mlen = sprintf(lmodebuf, ":%s MODE %s -", source_p->name, chptr->chname);
 	mbuf = lmodebuf + mlen;
 
@@ -546,7 +546,7 @@ add_target(struct Client *source_p, struct Client *target_p)
 		for(i = PREV_FREE_TARGET(source_p), j = USED_TARGETS(source_p);
 		    j; --j, PREV_TARGET(i))
 		{
-			if(source_p->localClient->targets[i] == target_p)
+			if(source_p->localClient->reg->targets[i] == target_p)
 				return 1;
 		}
 
@@ -556,17 +556,17 @@ add_target(struct Client *source_p, struct Client *target_p)
 		if(!IsTGChange(source_p))
 		{
 			SetTGChange(source_p);
-			source_p->localClient->target_last = rb_current_time();
+			source_p->localClient->reg->target_last = rb_current_time();
 		}
 		/* clear as many targets as we can */
-		else if((i = (rb_current_time() - source_p->localClient->target_last) / 60))
+		else if((i = (rb_current_time() - source_p->localClient->reg->target_last) / 60))
 		{
 			if(i > USED_TARGETS(source_p))
 				USED_TARGETS(source_p) = 0;
 			else
 				USED_TARGETS(source_p) -= i;
 
-			source_p->localClient->target_last = rb_current_time();
+			source_p->localClient->reg->target_last = rb_current_time();
 		}
 		/* cant clear any, full target list */
 		else if(USED_TARGETS(source_p) == 10)
@@ -580,11 +580,11 @@ add_target(struct Client *source_p, struct Client *target_p)
 	 */
 	else
 	{
-		source_p->localClient->target_last = rb_current_time();
+		source_p->localClient->reg->target_last = rb_current_time();
 		SetTGChange(source_p);
 	}
 
-	source_p->localClient->targets[FREE_TARGET(source_p)] = target_p;
+	source_p->localClient->reg->targets[FREE_TARGET(source_p)] = target_p;
 	NEXT_TARGET(FREE_TARGET(source_p));
 	++USED_TARGETS(source_p);
 	return 1;
@@ -674,7 +674,7 @@ msg_client(int p_or_n, const char *command,
 							   target_p->name);
 				}
 
-				if((target_p->localClient->last_caller_id_time +
+				if((target_p->localClient->reg->last_caller_id_time +
 				    ConfigFileEntry.caller_id_wait) < rb_current_time())
 				{
 					if(p_or_n != NOTICE)
@@ -684,7 +684,7 @@ msg_client(int p_or_n, const char *command,
 					sendto_one_numeric(target_p, s_RPL(RPL_UMODEGMSG), source_p->name,
 						   source_p->username, source_p->host);
 
-					target_p->localClient->last_caller_id_time =
+					target_p->localClient->reg->last_caller_id_time =
 						rb_current_time();
 				}
 				/* Only so opers can watch for floods */
@@ -726,32 +726,32 @@ flood_attack_client(int p_or_n, struct Client *source_p, struct Client *target_p
 
 	if(GlobalSetOptions.floodcount && MyConnect(target_p) && IsClient(source_p))
 	{
-		if((target_p->localClient->first_received_message_time + 1) < rb_current_time())
+		if((target_p->localClient->reg->first_received_message_time + 1) < rb_current_time())
 		{
 			delta = rb_current_time() -
-				target_p->localClient->first_received_message_time;
-			target_p->localClient->received_number_of_privmsgs -= delta;
-			target_p->localClient->first_received_message_time = rb_current_time();
-			if(target_p->localClient->received_number_of_privmsgs <= 0)
+				target_p->localClient->reg->first_received_message_time;
+			target_p->localClient->reg->received_number_of_privmsgs -= delta;
+			target_p->localClient->reg->first_received_message_time = rb_current_time();
+			if(target_p->localClient->reg->received_number_of_privmsgs <= 0)
 			{
-				target_p->localClient->received_number_of_privmsgs = 0;
-				target_p->localClient->flood_noticed = 0;
+				target_p->localClient->reg->received_number_of_privmsgs = 0;
+				target_p->localClient->reg->flood_noticed = 0;
 			}
 		}
 
-		if((target_p->localClient->received_number_of_privmsgs >=
-		    GlobalSetOptions.floodcount) || target_p->localClient->flood_noticed)
+		if((target_p->localClient->reg->received_number_of_privmsgs >=
+		    GlobalSetOptions.floodcount) || target_p->localClient->reg->flood_noticed)
 		{
-			if(target_p->localClient->flood_noticed == 0)
+			if(target_p->localClient->reg->flood_noticed == 0)
 			{
 				sendto_realops_flags(UMODE_BOTS, L_ALL,
 						     "Possible Flooder %s[%s@%s] on %s target: %s",
 						     source_p->name, source_p->username,
 						     source_p->host,
 						     source_p->servptr->name, target_p->name);
-				target_p->localClient->flood_noticed = 1;
+				target_p->localClient->reg->flood_noticed = 1;
 				/* add a bit of penalty */
-				target_p->localClient->received_number_of_privmsgs += 2;
+				target_p->localClient->reg->received_number_of_privmsgs += 2;
 			}
 			if(MyClient(source_p) && (p_or_n != NOTICE))
 				sendto_one_notice(source_p,
@@ -760,7 +760,7 @@ flood_attack_client(int p_or_n, struct Client *source_p, struct Client *target_p
 			return 1;
 		}
 		else
-			target_p->localClient->received_number_of_privmsgs++;
+			target_p->localClient->reg->received_number_of_privmsgs++;
 	}
 
 	return 0;
@@ -430,15 +430,8 @@ add_id(struct Client *source_p, struct Channel *chptr, const char *banid,
 		}
 	}
 	/* dont let remotes set duplicates */
-	else
-	{
-		RB_DLINK_FOREACH(ptr, list->head)
-		{
-			actualBan = ptr->data;
-			if(!irccmp(actualBan->banstr, realban))
-				return 0;
-		}
-	}
+	else if(find_ban(chptr, list, realban) != NULL)
+		return 0;
 
 
 	if(IsClient(source_p))
@@ -449,7 +442,7 @@ add_id(struct Client *source_p, struct Channel *chptr, const char *banid,
 	actualBan = allocate_ban(realban, who);
 	actualBan->when = rb_current_time();
 
-	rb_dlinkAdd(actualBan, &actualBan->node, list);
+	add_channel_ban(chptr, list, actualBan);
 
 	/* invalidate the can_send() cache */
 	if(mode_type == CHFL_BAN || mode_type == CHFL_EXCEPTION)
@@ -467,29 +460,22 @@ add_id(struct Client *source_p, struct Channel *chptr, const char *banid,
 static int
 del_id(struct Channel *chptr, const char *banid, rb_dlink_list * list, long mode_type)
 {
-	rb_dlink_node *ptr;
+	struct Ban *banptr;
 
 	if(EmptyString(banid))
 		return 0;
 
-	RB_DLINK_FOREACH(ptr, list->head)
-	{
-		struct Ban *banptr = ptr->data;
-
-		if(irccmp(banid, banptr->banstr) == 0)
-		{
-			rb_dlinkDelete(&banptr->node, list);
-			free_ban(banptr);
+	if((banptr = find_ban(chptr, list, banid)) == NULL)
+		return 0;
 
-			/* invalidate the can_send() cache */
-			if(mode_type == CHFL_BAN || mode_type == CHFL_EXCEPTION)
-				chptr->ban_serial++;
+	del_channel_ban(chptr, list, banptr);
+	free_ban(banptr);
 
-			return 1;
-		}
-	}
+	/* invalidate the can_send() cache */
+	if(mode_type == CHFL_BAN || mode_type == CHFL_EXCEPTION)
+		chptr->ban_serial++;
 
-	return 0;
+	return 1;
 }
 
 /* check_string()
@@ -993,7 +979,7 @@ chm_op(struct Client *source_p, struct Channel *chptr,
 		mode_changes[mode_count++].client = targ_p;
 		
 		if(!(mstptr->flags & CHFL_CHANOP))
-		        rb_dlinkMoveNode(&mstptr->channode, &chptr->members[MEMBER_NOOP], &chptr->members[MEMBER_OP]);
+			set_channel_member_op(mstptr, true);
 
 		mstptr->flags |= CHFL_CHANOP;
 		mstptr->flags &= ~CHFL_DEOPPED;
@@ -1019,7 +1005,7 @@ chm_op(struct Client *source_p, struct Channel *chptr,
 		mode_changes[mode_count++].client = targ_p;
 
 		if(mstptr->flags & CHFL_CHANOP)
-		          rb_dlinkMoveNode(&mstptr->channode, &chptr->members[MEMBER_OP], &chptr->members[MEMBER_NOOP]);      
+			set_channel_member_op(mstptr, false);
 		mstptr->flags &= ~CHFL_CHANOP;
 	}
 }
@@ -217,7 +217,7 @@ m_nick(struct Client *client_p, struct Client *source_p, int parc, const char *p
 		return 0;
 	}
 
-	if(hash_find(HASH_CLIENT, nick) != NULL)
+	if(hash_find_data(HASH_CLIENT, nick) != NULL)
 	{
 		sendto_one_numeric(source_p, s_RPL(ERR_UNAVAILRESOURCE), nick);
 		return 0;
@@ -659,7 +659,7 @@ change_local_nick(struct Client *client_p, struct Client *source_p, char *nick,
 
 	if(dosend)
 	{
-		if((source_p->localClient->last_nick_change + ConfigFileEntry.max_nick_time) <
+		if((source_p->localClient->reg->last_nick_change + ConfigFileEntry.max_nick_time) <
 		   rb_current_time())
 			source_p->localClient->number_of_nick_changes = 0;
 
@@ -672,7 +672,7 @@ change_local_nick(struct Client *client_p, struct Client *source_p, char *nick,
 			return;
 		}
 
-		source_p->localClient->last_nick_change = rb_current_time();
+		source_p->localClient->reg->last_nick_change = rb_current_time();
 		source_p->localClient->number_of_nick_changes++;
 	}
 
@@ -730,7 +730,7 @@ change_local_nick(struct Client *client_p, struct Client *source_p, char *nick,
 	{
 		struct Client *target_p = ptr->data;
 
-		rb_dlinkFindDestroy(source_p, &target_p->localClient->allow_list);
+		rb_dlinkFindDestroy(source_p, &target_p->localClient->reg->allow_list);
 		rb_dlinkDestroy(ptr, &source_p->on_allow_list);
 	}
 
@@ -1143,6 +1143,8 @@ register_client(struct Client *client_p, struct Client *server,
 
 	hash_add(HASH_CLIENT, nick, source_p);
 	hash_add(HASH_HOSTNAME, source_p->host, source_p);
+	add_client_ip_index(source_p);
+	add_client_host_index(source_p);
 	inc_global_cidr_count(source_p);
 	monitor_signon(source_p);
 
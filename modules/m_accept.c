@@ -98,13 +98,13 @@ m_accept(struct Client *client_p, struct Client *source_p, int parc, const char
 			continue;
 		}
 
-		rb_dlinkFindDestroy(target_p, &source_p->localClient->allow_list);
+		rb_dlinkFindDestroy(target_p, &source_p->localClient->reg->allow_list);
 		rb_dlinkFindDestroy(source_p, &target_p->on_allow_list);
 
 	}
 
 	/* get the number of accepts they have */
-	accept_num = rb_dlink_list_length(&source_p->localClient->allow_list);
+	accept_num = rb_dlink_list_length(&source_p->localClient->reg->allow_list);
 
 	/* parse the add list */
 	for(nick = rb_strtok_r(addbuf, ",", &p); nick;
@@ -212,7 +212,7 @@ build_nicklist(struct Client *source_p, char *addbuf, char *delbuf, const char *
 static void
 add_accept(struct Client *source_p, struct Client *target_p)
 {
-	rb_dlinkAddAlloc(target_p, &source_p->localClient->allow_list);
+	rb_dlinkAddAlloc(target_p, &source_p->localClient->reg->allow_list);
 	rb_dlinkAddAlloc(source_p, &target_p->on_allow_list);
 }
 
@@ -240,7 +240,7 @@ list_accepts(struct Client *source_p)
 
 	SetCork(source_p);
 
-	RB_DLINK_FOREACH(ptr, source_p->localClient->allow_list.head)
+	RB_DLINK_FOREACH(ptr, source_p->localClient->reg->allow_list.head)
 	{
 		struct Client *target_p = ptr->data;
 		if(target_p != NULL)
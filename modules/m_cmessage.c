@@ -146,7 +146,7 @@ m_cmessage(int p_or_n, const char *command,
 			sendto_one_numeric(source_p, ERR_TARGUMODEG,
 					   form_str(ERR_TARGUMODEG), target_p->name);
 
-		if((target_p->localClient->last_caller_id_time +
+		if((target_p->localClient->reg->last_caller_id_time +
 		    ConfigFileEntry.caller_id_wait) < rb_current_time())
 		{
 			if(p_or_n != NOTICE)
@@ -157,7 +157,7 @@ m_cmessage(int p_or_n, const char *command,
 				   source_p->name,
 				   source_p->username, source_p->host);
 
-			target_p->localClient->last_caller_id_time = rb_current_time();
+			target_p->localClient->reg->last_caller_id_time = rb_current_time();
 		}
 
 		return 0;
@@ -84,7 +84,6 @@ static int valid_dline(struct Client *source_p, const char *dlhost);
 static int already_placed_dline(struct Client *source_p, const char *dlhost);
 static void set_dline(struct Client *source_p, const char *dlhost,
 		      const char *lreason, int tkline_time, int admin);
-static void check_dlines(void);
 
 /* mo_dline()
  * 
@@ -130,7 +129,6 @@ mo_dline(struct Client *client_p, struct Client *source_p, int parc, const char
 		return 0;
 
 	set_dline(source_p, dlhost, reason, tdline_time, 0);
-	check_dlines();
 
 	return 0;
 }
@@ -158,7 +156,6 @@ mo_admindline(struct Client *client_p, struct Client *source_p, int parc, const
 		return 0;
 
 	set_dline(source_p, parv[1], parv[2], 0, 1);
-	check_dlines();
 
 	return 0;
 }
@@ -376,54 +373,6 @@ set_dline(struct Client *source_p, const char *dlhost, const char *lreason, int
 		bandb_add(BANDB_DLINE, source_p, aconf->host, NULL,
 			  reason, EmptyString(aconf->spasswd) ? NULL : aconf->spasswd, admin);
 	}
-}
-
-/* check_dlines()
- *
- * inputs	-
- * outputs	-
- * side effects - all clients will be checked for dlines
- */
-static void
-check_dlines(void)
-{
-	rb_dlink_node *ptr;
-	rb_dlink_node *next_ptr;
-
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, lclient_list.head)
-	{
-		struct Client *client_p = ptr->data;
-		struct ConfItem *aconf;
-
-		if(IsMe(client_p))
-			continue;
-
-		if((aconf = find_dline((struct sockaddr *) &client_p->localClient->ip)) != NULL)
-		{
-			if(aconf->status & CONF_EXEMPTDLINE)
-				continue;
 
-			sendto_realops_flags(UMODE_ALL, L_ALL,
-					     "DLINE active for %s",
-					     get_client_name(client_p, HIDE_IP));
-
-			notify_banned_client(client_p, aconf, D_LINED);
-			continue;
-		}
-	}
-
-	/* dlines need to be checked against unknowns too */
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, unknown_list.head)
-	{
-		struct Client *client_p = ptr->data;
-		struct ConfItem *aconf;
-
-		if((aconf = find_dline((struct sockaddr *) &client_p->localClient->ip)) != NULL)
-		{
-			if(aconf->status & CONF_EXEMPTDLINE)
-				continue;
-
-			notify_banned_client(client_p, aconf, D_LINED);
-		}
-	}
+	check_banned_mask(CONF_DLINE, aconf->host);
 }
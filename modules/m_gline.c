@@ -551,55 +551,6 @@ find_is_glined(const char *host, const char *user)
 	return NULL;
 }
 
-/* check_glines()
- *
- * inputs	-
- * outputs	-
- * side effects - all clients will be checked for glines
- */
-static void
-check_glines(void)
-{
-	struct Client *client_p;
-	struct ConfItem *aconf;
-	rb_dlink_node *ptr;
-	rb_dlink_node *next_ptr;
-
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, lclient_list.head)
-	{
-		client_p = ptr->data;
-
-		if(IsMe(client_p) || !IsClient(client_p))
-			continue;
-
-		if((aconf = find_gline(client_p)) != NULL)
-		{
-			if(IsExemptKline(client_p))
-			{
-				sendto_realops_flags(UMODE_ALL, L_ALL,
-						     "GLINE over-ruled for %s, client is kline_exempt",
-						     get_client_name(client_p, HIDE_IP));
-				continue;
-			}
-
-			if(IsExemptGline(client_p))
-			{
-				sendto_realops_flags(UMODE_ALL, L_ALL,
-						     "GLINE over-ruled for %s, client is gline_exempt",
-						     get_client_name(client_p, HIDE_IP));
-				continue;
-			}
-
-			sendto_realops_flags(UMODE_ALL, L_ALL,
-					     "GLINE active for %s",
-					     get_client_name(client_p, HIDE_IP));
-
-			notify_banned_client(client_p, aconf, G_LINED);
-			continue;
-		}
-	}
-}
-
 /*
  * set_local_gline
  *
@@ -655,7 +606,7 @@ set_local_gline(struct Client *source_p, const char *user, const char *host, con
 	     source_p->name, source_p->username, source_p->host,
 	     source_p->servptr->name, user, host, reason);
 
-	check_glines();
+	check_banned_mask(CONF_GLINE, aconf->host);
 }
 
 /* majority_gline()
@@ -295,6 +295,12 @@ static struct InfoStruct info_table[] = {
 		{ (void *)TS_MAX_DELTA_DEFAULT },
 		"Maximum Allowed TS Delta from another Server"
 	},
+	{
+		"accept_budget",
+		OUTPUT_DECIMAL,
+		{ &ConfigFileEntry.accept_budget },
+		"Connections accepted per listener wakeup",
+	},
 	{
 		"anti_nick_flood",
 		OUTPUT_BOOLEAN,
@@ -494,6 +500,12 @@ static struct InfoStruct info_table[] = {
 		{ &ServerInfo.hub }, 
 		"Server is a hub"
 	},
+	{
+		"ip_cache_size",
+		OUTPUT_DECIMAL,
+		{ &ConfigFileEntry.ip_cache_size },
+		"Memory ceiling for throttle and reject counts",
+	},
 	{
 		"kline_delay",
 		OUTPUT_DECIMAL,
@@ -770,6 +782,12 @@ static struct InfoStruct info_table[] = {
 		{ &ConfigChannel.max_bans }, 
 		"Total +b/e/I modes allowed in a channel",
 	},
+	{
+		"ban_index_threshold",
+		OUTPUT_DECIMAL,
+		{ &ConfigChannel.ban_index_threshold },
+		"Number of +b or +e modes before the list is indexed",
+	},
 	{
 		"max_chans_per_user",
 		OUTPUT_DECIMAL,
@@ -176,13 +176,13 @@ static void
 add_invite(struct Channel *chptr, struct Client *who)
 {
 	/* already invited? */
-	if(rb_dlinkFind(chptr, &who->localClient->invited) != NULL)
+	if(rb_dlinkFind(chptr, &who->localClient->reg->invited) != NULL)
 	        return;
 
 	/* ok, if their invite list is too long, remove the tail */
-	if(rb_dlink_list_length(&who->localClient->invited) >= ConfigChannel.max_chans_per_user)
+	if(rb_dlink_list_length(&who->localClient->reg->invited) >= ConfigChannel.max_chans_per_user)
 	{
-		rb_dlink_node *ptr = who->localClient->invited.tail;
+		rb_dlink_node *ptr = who->localClient->reg->invited.tail;
 		del_invite(ptr->data, who);
 	}
 
@@ -190,5 +190,5 @@ add_invite(struct Channel *chptr, struct Client *who)
 	rb_dlinkAddAlloc(who, &chptr->invites);
 
 	/* add channel to user invite list */
-	rb_dlinkAddAlloc(chptr, &who->localClient->invited);
+	rb_dlinkAddAlloc(chptr, &who->localClient->reg->invited);
 }
@@ -377,6 +377,8 @@ set_kline(struct Client *source_p, const char *user, const char *host, const cha
 
 	if(ConfigFileEntry.kline_delay)
 	{
+		queue_kline_check(host);
+
 		if(kline_queued == 0)
 		{
 			rb_event_addonce("check_klines", check_klines_event, NULL,
@@ -385,7 +387,7 @@ set_kline(struct Client *source_p, const char *user, const char *host, const cha
 		}
 	}
 	else
-		check_klines();
+		check_banned_mask(CONF_KILL, host);
 }
 
 /* apply_kline()
@@ -709,10 +711,10 @@ remove_perm_kline(struct Client *source_p, const char *user, const char *host)
 {
 	struct AddressRec *arec;
 	struct ConfItem *aconf;
-	int i;
+	rb_dlink_node *hptr;
 
 	/* dont need to be safe, as we're quitting once we've done anything */
-	HOSTHASH_WALK(i, arec)
+	HOSTHASH_WALK(hptr, arec)
 	{
 		if((arec->type & ~CONF_SKIPUSER) == CONF_KILL)
 		{
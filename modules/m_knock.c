@@ -137,7 +137,7 @@ m_knock(struct Client *client_p, struct Client *source_p, int parc, const char *
 		 * allow one knock per channel per knock_delay_channel
 		 */
 		if(!IsOper(source_p) &&
-		   (source_p->localClient->last_knock + ConfigChannel.knock_delay) >
+		   (source_p->localClient->reg->last_knock + ConfigChannel.knock_delay) >
 		   rb_current_time())
 		{
 			sendto_one_numeric(source_p, s_RPL(ERR_TOOMANYKNOCK),
@@ -152,7 +152,7 @@ m_knock(struct Client *client_p, struct Client *source_p, int parc, const char *
 		}
 
 		/* ok, we actually can send the knock, tell client */
-		source_p->localClient->last_knock = rb_current_time();
+		source_p->localClient->reg->last_knock = rb_current_time();
 
 		sendto_one_numeric(source_p, s_RPL(RPL_KNOCKDLVR), name);
 	}
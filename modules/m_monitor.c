@@ -102,7 +102,7 @@ add_monitor(struct Client *client_p, const char *nicks)
 		if(EmptyString(name) || strlen(name) > ServerInfo.nicklen - 1)
 			continue;
 
-		if((int) rb_dlink_list_length(&client_p->localClient->monitor_list) >=
+		if((int) rb_dlink_list_length(&client_p->localClient->reg->monitor_list) >=
 		   ConfigFileEntry.max_monitor)
 		{
 			char buf[100];
@@ -129,7 +129,7 @@ add_monitor(struct Client *client_p, const char *nicks)
 			continue;
 
 		rb_dlinkAddAlloc(client_p, &monptr->users);
-		rb_dlinkAddAlloc(monptr, &client_p->localClient->monitor_list);
+		rb_dlinkAddAlloc(monptr, &client_p->localClient->reg->monitor_list);
 
 		if((target_p = find_named_person(name)) != NULL)
 		{
@@ -185,7 +185,7 @@ del_monitor(struct Client *client_p, const char *nicks)
 	char *tmp;
 	char *p;
 
-	if(!rb_dlink_list_length(&client_p->localClient->monitor_list))
+	if(!rb_dlink_list_length(&client_p->localClient->reg->monitor_list))
 		return;
 
 	tmp = LOCAL_COPY(nicks);
@@ -200,7 +200,7 @@ del_monitor(struct Client *client_p, const char *nicks)
 			continue;
 
 		rb_dlinkFindDestroy(client_p, &monptr->users);
-		rb_dlinkFindDestroy(monptr, &client_p->localClient->monitor_list);
+		rb_dlinkFindDestroy(monptr, &client_p->localClient->reg->monitor_list);
 		free_monitor(monptr);
 	}
 }
@@ -213,7 +213,7 @@ list_monitor(struct Client *client_p)
 	rb_dlink_node *ptr;
 	int mlen, arglen, cur_len;
 
-	if(!rb_dlink_list_length(&client_p->localClient->monitor_list))
+	if(!rb_dlink_list_length(&client_p->localClient->reg->monitor_list))
 	{
 		sendto_one_numeric(client_p, s_RPL(RPL_ENDOFMONLIST));
 		return;
@@ -222,7 +222,7 @@ list_monitor(struct Client *client_p)
 	cur_len = mlen = sprintf(buf, form_str(RPL_MONLIST), me.name, client_p->name, "");
 	nbuf = buf + mlen;
 	SetCork(client_p);
-	RB_DLINK_FOREACH(ptr, client_p->localClient->monitor_list.head)
+	RB_DLINK_FOREACH(ptr, client_p->localClient->reg->monitor_list.head)
 	{
 		struct monitor *monptr = ptr->data;
 
@@ -263,7 +263,7 @@ show_monitor_status(struct Client *client_p)
 	onptr = onbuf + mlen;
 	offptr = offbuf + mlen;
 	SetCork(client_p);
-	RB_DLINK_FOREACH(ptr, client_p->localClient->monitor_list.head)
+	RB_DLINK_FOREACH(ptr, client_p->localClient->reg->monitor_list.head)
 	{
 		struct monitor *monptr = ptr->data;
 		struct Client *target_p;
@@ -302,11 +302,11 @@ cleanup_challenge(struct Client *target_p)
 	if(target_p->localClient == NULL)
 		return;
 
-	rb_free(target_p->localClient->chal_resp);
+	rb_free(target_p->localClient->reg->chal_resp);
 	rb_free(target_p->localClient->opername);
-	target_p->localClient->chal_resp = NULL;
+	target_p->localClient->reg->chal_resp = NULL;
 	target_p->localClient->opername = NULL;
-	target_p->localClient->chal_time = 0;
+	target_p->localClient->reg->chal_time = 0;
 }
 
 /*
@@ -335,10 +335,10 @@ m_challenge(struct Client *client_p, struct Client *source_p, int parc, const ch
 
 	if(*parv[1] == '+')
 	{
-		if(source_p->localClient->chal_resp == NULL)
+		if(source_p->localClient->reg->chal_resp == NULL)
 			return 0;
 
-		if((rb_current_time() - source_p->localClient->chal_time) > CHALLENGE_EXPIRES)
+		if((rb_current_time() - source_p->localClient->reg->chal_time) > CHALLENGE_EXPIRES)
 		{
 			sendto_one_numeric(source_p, s_RPL(ERR_PASSWDMISMATCH));
 			ilog(L_FOPER, "EXPIRED CHALLENGE (%s) by (%s!%s@%s)",
@@ -359,7 +359,7 @@ m_challenge(struct Client *client_p, struct Client *source_p, int parc, const ch
 			rb_base64_decode((const unsigned char *) parv[1], strlen(parv[1]), &len);
 
 		if(len != SHA_DIGEST_LENGTH
-		   || memcmp(source_p->localClient->chal_resp, b_response, SHA_DIGEST_LENGTH))
+		   || memcmp(source_p->localClient->reg->chal_resp, b_response, SHA_DIGEST_LENGTH))
 		{
 			sendto_one_numeric(source_p, s_RPL(ERR_PASSWDMISMATCH));
 			ilog(L_FOPER, "FAILED CHALLENGE (%s) by (%s!%s@%s)",
@@ -447,10 +447,10 @@ m_challenge(struct Client *client_p, struct Client *source_p, int parc, const ch
 	}
 
 
-	if(!generate_challenge(&challenge, &source_p->localClient->chal_resp, oper_p->rsa_pubkey))
+	if(!generate_challenge(&challenge, &source_p->localClient->reg->chal_resp, oper_p->rsa_pubkey))
 	{
 		char *chal = (char *) challenge;
-		source_p->localClient->chal_time = rb_current_time();
+		source_p->localClient->reg->chal_time = rb_current_time();
 		SetCork(source_p);
 		for(;;)
 		{
@@ -198,39 +198,26 @@ rehash_txlines(struct Client *source_p)
 		if((aconf->flags & CONF_FLAGS_TEMPORARY) == 0)
 			continue;
 
+		del_xline_conf(ptr);
 		free_conf(aconf);
-		rb_dlinkDestroy(ptr, &xline_conf_list);
 	}
 }
 
 static void
 rehash_tresvs(struct Client *source_p)
 {
-        rb_dlink_list *resv_lists;
 	rb_dlink_node *ptr, *next;
 
 	sendto_realops_flags(UMODE_ALL, L_ALL, "%s is clearing temp resvs",
 			     get_oper_name(source_p));
 
-        resv_lists = hash_get_tablelist(HASH_RESV);
-        if(resv_lists == NULL)
-                return;
-                
-        RB_DLINK_FOREACH_SAFE(ptr, next, resv_lists->head)
-        {
-                rb_dlink_node *lptr, *lnext;
-                rb_dlink_list *list = ptr->data;
-                RB_DLINK_FOREACH_SAFE(lptr, lnext, list->head)
-                {
-                        struct ConfItem *aconf = lptr->data;
-                        if((aconf->flags & CONF_FLAGS_TEMPORARY) == false)
-                                continue;
-                        free_conf(aconf);
-                        rb_dlinkDestroy(lptr, list);
-                }
-                
-        }
-        hash_free_tablelist(resv_lists);
+	RB_DLINK_FOREACH_SAFE(ptr, next, resv_channel_temp_list.head)
+	{
+		struct ConfItem *aconf = ptr->data;
+
+		del_channel_hash_resv(aconf);	/* takes it off the temp list too */
+		free_conf(aconf);
+	}
 }
 
 static void
@@ -242,6 +229,14 @@ rehash_rejectcache(struct Client *source_p)
 
 }
 
+static void
+rehash_cmdstats(struct Client *source_p)
+{
+	sendto_realops_flags(UMODE_ALL, L_ALL, "%s is clearing command timings",
+			     get_oper_name(source_p));
+	clear_command_times();
+}
+
 static void
 rehash_help(struct Client *source_p)
 {
@@ -266,6 +261,7 @@ static struct hash_commands rehash_commands[] =
 	{"TRESVS",	rehash_tresvs		},
 	{"REJECTCACHE",	rehash_rejectcache	},
 	{"HELP",	rehash_help		},
+	{"CMDSTATS",	rehash_cmdstats		},
 	{NULL,		NULL			}
 };
 /* *INDENT-ON* */
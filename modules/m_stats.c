@@ -52,6 +52,7 @@
 #include <operhash.h>
 #include <scache.h>
 #include <s_log.h>
+#include <sslproc.h>
 
 #ifdef HAVE_STRUCT_MALLINFO
 #include <malloc.h>
@@ -131,6 +132,7 @@ static void stats_memory(struct Client *);
 static void stats_servlinks(struct Client *);
 static void stats_ltrace(struct Client *, int, const char **);
 static void stats_ziplinks(struct Client *);
+static void stats_ssld(struct Client *);
 static void stats_comm(struct Client *);
 /* This table contains the possible stats items, in order:
  * stats letter,  function to call, operonly? adminonly?
@@ -170,6 +172,8 @@ static struct StatsStruct stats_cmd_table[] = {
 	{'Q', stats_resv, 1, 0,},
 	{'r', stats_usage, 1, 0,},
 	{'R', stats_usage, 1, 0,},
+	{'s', stats_ssld, 1, 0,},
+	{'S', stats_ssld, 1, 0,},
 	{'t', stats_tstats, 1, 0,},
 	{'T', stats_tstats, 1, 0,},
 	{'u', stats_uptime, 0, 0,},
@@ -495,7 +499,8 @@ stats_auth(struct Client *source_p)
 	const char *name, *host, *pass, *user, *classname;
 	struct AddressRec *arec;
 	struct ConfItem *aconf;
-	int i, port;
+	rb_dlink_node *hptr;
+	int port;
 
 	/* Oper only, if unopered, return ERR_NOPRIVS */
 	if((ConfigFileEntry.stats_i_oper_only == 2) && !IsOper(source_p))
@@ -525,7 +530,7 @@ stats_auth(struct Client *source_p)
 	/* Theyre opered, or allowed to see all auth blocks */
 	else
 	{
-		HOSTHASH_WALK(i, arec)
+		HOSTHASH_WALK(hptr, arec)
 		{
 			if((arec->type & ~CONF_SKIPUSER) == CONF_CLIENT)
 			{
@@ -618,7 +623,7 @@ stats_klines(struct Client *source_p)
 	struct ConfItem *aconf;
 	const char *host, *pass, *user, *oper_reason;
 	struct AddressRec *arec;
-	int i;
+	rb_dlink_node *hptr;
 
 	/* Oper only, if unopered, return ERR_NOPRIVS */
 	if((ConfigFileEntry.stats_k_oper_only == 2) && !IsOper(source_p))
@@ -655,7 +660,7 @@ stats_klines(struct Client *source_p)
 	/* Theyre opered, or allowed to see all klines */
 	else
 	{
-		HOSTHASH_WALK(i, arec)
+		HOSTHASH_WALK(hptr, arec)
 		{
 			if((arec->type & ~CONF_SKIPUSER) == CONF_KILL)
 			{
@@ -694,11 +699,42 @@ list_msg_cb(void *data, void *cbptr)
 		  	   msg->cmd, msg->count, msg->bytes, msg->rcount);
 }
 
+static void
+list_msg_time_cb(void *data, void *cbptr)
+{
+	static const char *which_name[MSG_TIME_LAST] = { "local", "server" };
+	struct Client *source_p = (struct Client *)cbptr;
+	struct Message *msg = (struct Message *)data;
+	struct MessageTime *mt;
+	int i;
+
+	if(source_p == NULL || msg == NULL)
+		return;
+
+	for(i = 0; i < MSG_TIME_LAST; i++)
+	{
+		mt = &msg->times[i];
+
+		if(mt->count == 0)
+			continue;
+
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				   "m :%s %s %lu calls avg %lluus p50 %luus p99 %luus max %luus",
+				   msg->cmd, which_name[i], mt->count, mt->total / mt->count,
+				   command_time_percentile(mt, 50),
+				   command_time_percentile(mt, 99), mt->max);
+	}
+}
+
 
 static void
 stats_messages(struct Client *source_p)
 {
 	hash_walkall(HASH_COMMAND, list_msg_cb, source_p);
+
+	/* handler latency, clear with REHASH CMDSTATS */
+	if(IsOper(source_p))
+		hash_walkall(HASH_COMMAND, list_msg_time_cb, source_p);
 }
 
 
@@ -914,6 +950,7 @@ stats_tstats(struct Client *source_p)
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 			   "T :throttled refused %u throttle list size %lu", sp.is_thr,
 			   throttle_size());
+	report_ip_caches(source_p);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "T :nicks being delayed %lu", get_nd_count());
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 			   "T :unknown commands %u prefixes %u", sp.is_unco, sp.is_unpf);
@@ -925,6 +962,9 @@ stats_tstats(struct Client *source_p)
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "T :numerics seen %u", sp.is_num);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 			   "T :auth successes %u fails %u", sp.is_asuc, sp.is_abad);
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "T :rbl lookups %u shared %u cached %u", sp.is_rbl,
+			   sp.is_rbl_shared, sp.is_rbl_cached);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "T :Client Server");
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "T :connected %u %u", sp.is_cl, sp.is_sv);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
@@ -1205,9 +1245,9 @@ stats_memory(struct Client *source_p)
 		if(target_p->user)
 		{
 			users_counted++;
-			if(MyConnect(target_p))
+			if(MyClient(target_p))
 				users_invited_count +=
-					rb_dlink_list_length(&target_p->localClient->invited);
+					rb_dlink_list_length(&target_p->localClient->reg->invited);
 			user_channels += rb_dlink_list_length(&target_p->user->channel);
 			if(target_p->user->away)
 			{
@@ -1229,7 +1269,7 @@ stats_memory(struct Client *source_p)
 
 		channel_users += chan_member_count(chptr);
 		channel_invites += rb_dlink_list_length(&chptr->invites);
-#define ban_size(b) sizeof(struct Ban) + strlen(b->banstr)+ 1 + strlen(b->who) + 1;
+#define ban_size(b) sizeof(struct Ban) + (strlen(b->banstr) + 1) * 2 + strlen(b->who) + 1;
 		RB_DLINK_FOREACH(dlink, chptr->banlist.head)
 		{
 			actualBan = dlink->data;
@@ -1395,6 +1435,12 @@ stats_ziplinks(struct Client *source_p)
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "Z :%u ziplink(s)", sent_data);
 }
 
+static void
+stats_ssld(struct Client *source_p)
+{
+	report_ssld(source_p);
+}
+
 static void
 stats_servlinks(struct Client *source_p)
 {
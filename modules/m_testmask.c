@@ -63,16 +63,56 @@ mapi_clist_av1 testmask_clist[] = { &testmask_msgtab, NULL };
 
 DECLARE_MODULE_AV1(testmask, NULL, NULL, testmask_clist, NULL, NULL, "$Revision$");
 
+struct testmask_query
+{
+	struct Client *source_p;
+	const char *name;
+	const char *username;
+	const char *hostname;
+	const char *gecos;
+	int lcount;
+	int gcount;
+};
+
+static void
+testmask_client(struct Client *target_p, void *data)
+{
+	struct testmask_query *query = data;
+	const char *sockhost;
+
+	if(!IsClient(target_p))
+		return;
+
+	if(EmptyString(target_p->sockhost))
+		sockhost = "255.255.255.255";
+	else if(!show_ip(query->source_p, target_p))
+		sockhost = "0";
+	else
+		sockhost = target_p->sockhost;
+
+	if(match(query->username, target_p->username) &&
+	   (match(query->hostname, target_p->host) || match(query->hostname, sockhost)
+	    || match_ips(query->hostname, sockhost)))
+	{
+		if(query->name && !match(query->name, target_p->name))
+			return;
+
+		if(query->gecos && !match_esc(query->gecos, target_p->info))
+			return;
+
+		if(MyClient(target_p))
+			query->lcount++;
+		else
+			query->gcount++;
+	}
+}
 
 static int
 mo_testmask(struct Client *client_p, struct Client *source_p, int parc, const char *parv[])
 {
-	int lcount = 0;
-	int gcount = 0;
+	struct testmask_query query;
 	char *name, *username, *hostname;
-	const char *sockhost;
 	char *gecos = NULL;
-	rb_dlink_node *ptr;
 
 	name = LOCAL_COPY(parv[1]);
 	collapse(name);
@@ -107,38 +147,17 @@ mo_testmask(struct Client *client_p, struct Client *source_p, int parc, const ch
 		collapse_esc(gecos);
 	}
 
-	RB_DLINK_FOREACH(ptr, global_client_list.head)
-	{
-		struct Client *target_p = ptr->data;
-
-		if(!IsClient(target_p))
-			continue;
+	query.source_p = source_p;
+	query.name = name;
+	query.username = username;
+	query.hostname = hostname;
+	query.gecos = gecos;
+	query.lcount = query.gcount = 0;
 
-		if(EmptyString(target_p->sockhost))
-			sockhost = "255.255.255.255";
-		else if(!show_ip(source_p, target_p))
-			sockhost = "0";
-		else
-			sockhost = target_p->sockhost;
-
-		if(match(username, target_p->username) &&
-		   (match(hostname, target_p->host) || match(hostname, sockhost)
-		    || match_ips(hostname, sockhost)))
-		{
-			if(name && !match(name, target_p->name))
-				continue;
-
-			if(gecos && !match_esc(gecos, target_p->info))
-				continue;
-
-			if(MyClient(target_p))
-				lcount++;
-			else
-				gcount++;
-		}
-	}
+	/* only the clients the host part could match are looked at */
+	walk_clients_by_hostmask(hostname, false, testmask_client, &query);
 
 	sendto_one_numeric(source_p, s_RPL(RPL_TESTMASKGECOS),
-		   lcount, gcount, name ? name : "*", username, hostname, gecos ? gecos : "*");
+		   query.lcount, query.gcount, name ? name : "*", username, hostname, gecos ? gecos : "*");
 	return 0;
 }
@@ -679,46 +679,73 @@ mo_chantrace(struct Client *client_p, struct Client *source_p, int parc, const c
 	return 0;
 }
 
+struct masktrace_query
+{
+	struct Client *source_p;
+	const char *username;
+	const char *hostname;
+	const char *name;
+	const char *gecos;
+};
+
 static void
-match_masktrace(struct Client *source_p, rb_dlink_list * list, const char *username,
-		const char *hostname, const char *name, const char *gecos)
+match_masktrace_client(struct Client *target_p, void *data)
 {
-	rb_dlink_node *ptr;
+	struct masktrace_query *query = data;
+	struct Client *source_p = query->source_p;
+	const char *sockhost;
 
-	RB_DLINK_FOREACH(ptr, list->head)
-	{
-		struct Client *target_p = ptr->data;
-		const char *sockhost;
-		if(!IsClient(target_p))
-			continue;
+	if(!IsClient(target_p))
+		return;
 
-		if(EmptyString(target_p->sockhost))
-			sockhost = empty_sockhost;
-		else if(!show_ip(source_p, target_p))
-			sockhost = spoofed_sockhost;
-		else
-			sockhost = target_p->sockhost;
+	if(EmptyString(target_p->sockhost))
+		sockhost = empty_sockhost;
+	else if(!show_ip(source_p, target_p))
+		sockhost = spoofed_sockhost;
+	else
+		sockhost = target_p->sockhost;
 
-		if(match(username, target_p->username) && (match(hostname, target_p->host) ||
-							   match(hostname, sockhost)
-							   || match_ips(hostname, sockhost)))
-		{
-			if(name != NULL && !match(name, target_p->name))
-				continue;
+	if(match(query->username, target_p->username) && (match(query->hostname, target_p->host) ||
+							  match(query->hostname, sockhost)
+							  || match_ips(query->hostname, sockhost)))
+	{
+		if(query->name != NULL && !match(query->name, target_p->name))
+			return;
 
-			if(gecos != NULL && !match_esc(gecos, target_p->info))
-				continue;
+		if(query->gecos != NULL && !match_esc(query->gecos, target_p->info))
+			return;
 
-			sendto_one_numeric(source_p, s_RPL(RPL_ETRACE),
-				   IsOper(target_p) ? "Oper" : "User",
-				   /* class field -- pretend its server.. */
-				   target_p->servptr->name,
-				   target_p->name, target_p->username, target_p->host,
-				   sockhost, target_p->info);
-		}
+		sendto_one_numeric(source_p, s_RPL(RPL_ETRACE),
+			   IsOper(target_p) ? "Oper" : "User",
+			   /* class field -- pretend its server.. */
+			   target_p->servptr->name,
+			   target_p->name, target_p->username, target_p->host,
+			   sockhost, target_p->info);
 	}
 }
 
+/* match_masktrace()
+ *
+ * input	- source client, local clients only, mask parts
+ * output	-
+ * side effects - the matching clients are sent to source_p, the client
+ *		  indexes narrow down which clients are looked at
+ */
+static void
+match_masktrace(struct Client *source_p, bool local, const char *username,
+		const char *hostname, const char *name, const char *gecos)
+{
+	struct masktrace_query query;
+
+	query.source_p = source_p;
+	query.username = username;
+	query.hostname = hostname;
+	query.name = name;
+	query.gecos = gecos;
+
+	walk_clients_by_hostmask(hostname, local, match_masktrace_client, &query);
+}
+
 static int
 mo_masktrace(struct Client *client_p, struct Client *source_p, int parc, const char *parv[])
 {
@@ -780,10 +807,10 @@ mo_masktrace(struct Client *client_p, struct Client *source_p, int parc, const c
 		}
 
 		report_operspy(source_p, "MASKTRACE", buf);
-		match_masktrace(source_p, &global_client_list, username, hostname, name, gecos);
+		match_masktrace(source_p, false, username, hostname, name, gecos);
 	}
 	else
-		match_masktrace(source_p, &lclient_list, username, hostname, name, gecos);
+		match_masktrace(source_p, true, username, hostname, name, gecos);
 	ClearCork(source_p);
 	sendto_one_numeric(source_p, s_RPL(RPL_ENDOFTRACE), me.name);
 	return 0;
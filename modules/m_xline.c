@@ -353,7 +353,7 @@ apply_xline(struct Client *source_p, const char *name, const char *reason, int t
 		ilog(L_KLINE, "X %s 0 %s %s", aconf->info.oper, name, reason);
 	}
 
-	rb_dlinkAddAlloc(aconf, &xline_conf_list);
+	add_xline_conf(aconf);
 	check_xlines();
 }
 
@@ -438,8 +438,8 @@ remove_xline(struct Client *source_p, const char *name)
 		if((aconf->flags & CONF_FLAGS_TEMPORARY) == 0)
 			bandb_del(BANDB_XLINE, aconf->host, NULL);
 
+		del_xline_conf(ptr);
 		free_conf(aconf);
-		rb_dlinkDestroy(ptr, &xline_conf_list);
 		return;
 	}
 
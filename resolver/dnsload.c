@@ -0,0 +1,196 @@
+/*
+ * dnsload.c: load test for res.c
+ *
+ * Runs the resolver code against one nameserver (fakedns, see there) at
+ * a steady rate of reverse lookups for addresses it has never asked about
+ * before, driven from the same rb_select()/rb_event_run() loop the
+ * resolver helper uses.  Each lookup has to come back with the address
+ * it was for.  At the end it reports how many lookups resolved, failed
+ * or were wrong, the most in flight at once, the latency, and the CPU
+ * this process used per lookup.
+ *
+ *	./fakedns -p 10053 -d 20 &
+ *	./dnsload -p 10053 -q 10000 -t 15
+ *
+ * or make load.  Every lookup in flight holds a UDP socket, so the open
+ * file limit is raised to the hard limit first; make that at least
+ * twice the rate.
+ *
+ * $Id$
+ */
+
+#include "setup.h"
+#include <ratbox_lib.h>
+#include "res.h"
+#include "reslib.h"
+#include <sys/resource.h>
+
+#ifdef RB_IPV6
+struct in6_addr ipv6_addr;
+#endif
+struct in_addr ipv4_addr;
+
+struct lookup
+{
+	struct DNSQuery query;
+	struct in_addr addr;
+	double sent;
+};
+
+static unsigned long issued, resolved, failed, wrong;
+static unsigned long inflight, maxinflight;
+static double *latency;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+lookup_done(void *vptr, struct DNSReply *reply)
+{
+	struct lookup *lookup = vptr;
+
+	latency[resolved + failed + wrong] = now() - lookup->sent;
+	if(reply == NULL)
+		failed++;
+	else if(GET_SS_FAMILY(&reply->addr) != AF_INET
+		|| ((struct sockaddr_in *)&reply->addr)->sin_addr.s_addr != lookup->addr.s_addr)
+		wrong++;
+	else
+		resolved++;
+
+	inflight--;
+	rb_free(lookup);
+}
+
+static void
+issue_lookup(void)
+{
+	struct lookup *lookup = rb_malloc(sizeof(struct lookup));
+	struct rb_sockaddr_storage addr;
+	struct sockaddr_in *sin = (struct sockaddr_in *)&addr;
+
+	/* a fresh address every time, so the answer cache never helps */
+	lookup->addr.s_addr = htonl(0x0a000000 + ++issued);
+	lookup->sent = now();
+	lookup->query.ptr = lookup;
+	lookup->query.callback = lookup_done;
+
+	memset(&addr, 0, sizeof(addr));
+	SET_SS_FAMILY(&addr, AF_INET);
+	SET_SS_LEN(&addr, sizeof(struct sockaddr_in));
+	sin->sin_addr = lookup->addr;
+
+	if(++inflight > maxinflight)
+		maxinflight = inflight;
+	gethost_byaddr(&addr, &lookup->query);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: dnsload [-p port] [-q lookups per second] [-t seconds]\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_in *ns = (struct sockaddr_in *)&irc_nsaddr_list[0];
+	struct rlimit rlim;
+	struct rusage ru;
+	double start, end, next, t, cpu;
+	unsigned long done;
+	int c, port = 10053, qps = 10000, secs = 15;
+
+	while((c = getopt(argc, argv, "p:q:t:")) != -1)
+	{
+		switch (c)
+		{
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'q':
+			qps = atoi(optarg);
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if(qps <= 0 || secs <= 0)
+		usage();
+
+	if(getrlimit(RLIMIT_NOFILE, &rlim) == 0)
+	{
+		rlim.rlim_cur = rlim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rlim);
+		getrlimit(RLIMIT_NOFILE, &rlim);
+	}
+	if((unsigned long)rlim.rlim_cur < (unsigned long)qps * 2)
+		fprintf(stderr, "dnsload: only %lu descriptors, lookups will fail\n", (unsigned long)rlim.rlim_cur);
+
+	rb_lib_init(NULL, NULL, NULL, 0, (int)rlim.rlim_cur);
+	rb_set_time();
+	init_resolver();
+	rb_init_prng(NULL, RB_PRNG_DEFAULT);
+
+	/* whatever resolv.conf said, ask fakedns */
+	memset(ns, 0, sizeof(irc_nsaddr_list[0]));
+	SET_SS_FAMILY(&irc_nsaddr_list[0], AF_INET);
+	SET_SS_LEN(&irc_nsaddr_list[0], sizeof(struct sockaddr_in));
+	ns->sin_port = htons(port);
+	ns->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	irc_nscount = 1;
+
+	latency = rb_malloc(sizeof(double) * ((size_t)qps * secs + 1));
+
+	start = next = now();
+	end = start + secs;
+	for(;;)
+	{
+		t = now();
+		if(t < end)
+		{
+			while(next <= t)
+			{
+				issue_lookup();
+				next += 1.0 / qps;
+			}
+		}
+		/* a lookup gives up after about half a minute of retries */
+		else if(inflight == 0 || t > end + 60)
+			break;
+
+		rb_set_time();
+		rb_select(1);
+		rb_event_run();
+	}
+
+	getrusage(RUSAGE_SELF, &ru);
+	cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+	done = resolved + failed + wrong;
+	qsort(latency, done, sizeof(double), cmp_double);
+	printf("%lu lookups in %ds: %lu resolved, %lu failed, %lu wrong, %lu never finished\n",
+	       issued, secs, resolved, failed, wrong, inflight);
+	printf("at most %lu in flight, latency p50 %.1f ms, p99 %.1f ms, max %.1f ms\n", maxinflight,
+	       done ? latency[done / 2] * 1e3 : 0, done ? latency[done * 99 / 100] * 1e3 : 0,
+	       done ? latency[done - 1] * 1e3 : 0);
+	printf("cpu %.2fs, %.1f us per lookup\n", cpu, cpu * 1e6 / issued);
+	return wrong != 0 || inflight != 0;
+}
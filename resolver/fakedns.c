@@ -0,0 +1,200 @@
+/*
+ * fakedns.c: a DNS server for load testing the resolver
+ *
+ * Answers on 127.0.0.1 for made up names: the PTR for a.b.c.d is
+ * a-b-c-d.example.net, and the A record for that name is a.b.c.d again,
+ * so a reverse lookup checks out the way res.c wants it to.  Anything
+ * else gets NXDOMAIN.  A percentage of lookups can be made to fail with
+ * NXDOMAIN (-n) and a percentage of queries to go unanswered (-d), to
+ * make the resolver retry and time out.
+ *
+ *	./fakedns -p 10053 -d 20 &
+ *	./dnsload -p 10053 -q 10000 -t 15
+ *
+ * or just make load, which does that.
+ *
+ * $Id$
+ */
+
+#include "setup.h"
+#include <ratbox_lib.h>
+#include "res.h"
+
+#define DNS_HDRLEN	12
+#define DNS_MAXPACKET	512
+
+#define T_A	1
+#define T_PTR	12
+#define RCODE_NXDOMAIN	3
+
+/*
+ * get_qname - read the question's name into buf as dotted lowercase,
+ * returns the length of the name in the packet or -1
+ */
+static int
+get_qname(const unsigned char *pkt, int len, char *buf, size_t buflen)
+{
+	int pos = DNS_HDRLEN;
+	size_t out = 0;
+
+	while(pos < len && pkt[pos] != 0)
+	{
+		int label = pkt[pos++];
+		int i;
+
+		/* no compression in a question we sent ourselves */
+		if(label > 63 || pos + label > len || out + label + 1 >= buflen)
+			return -1;
+		if(out > 0)
+			buf[out++] = '.';
+		for(i = 0; i < label; i++)
+			buf[out++] = tolower(pkt[pos + i]);
+		pos += label;
+	}
+	if(pos >= len)
+		return -1;
+	buf[out] = '\0';
+	return pos + 1 - DNS_HDRLEN;
+}
+
+/* put_name - write name as labels at p, returns the bytes used */
+static int
+put_name(unsigned char *p, const char *name)
+{
+	unsigned char *start = p;
+	const char *dot;
+
+	while(*name != '\0')
+	{
+		size_t label;
+
+		if((dot = strchr(name, '.')) == NULL)
+			dot = name + strlen(name);
+		label = dot - name;
+		*p++ = label;
+		memcpy(p, name, label);
+		p += label;
+		name = *dot != '\0' ? dot + 1 : dot;
+	}
+	*p++ = 0;
+	return p - start;
+}
+
+/*
+ * put_answer - append one answer, pointing back at the question's name,
+ * returns the bytes used
+ */
+static int
+put_answer(unsigned char *p, int type, const void *rdata, int rdlen)
+{
+	p[0] = 0xc0;
+	p[1] = DNS_HDRLEN;
+	p[2] = 0;
+	p[3] = type;
+	p[4] = 0;
+	p[5] = 1;		/* IN */
+	p[6] = p[7] = 0;
+	p[8] = 0x0e;		/* an hour */
+	p[9] = 0x10;
+	p[10] = rdlen >> 8;
+	p[11] = rdlen & 0xff;
+	memcpy(p + 12, rdata, rdlen);
+	return 12 + rdlen;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: fakedns [-p port] [-n nxdomain percent] [-d drop percent]\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned char pkt[DNS_MAXPACKET * 2], rdata[RESOLVER_HOSTLEN + 2];
+	char qname[RESOLVER_HOSTLEN + 1], name[RESOLVER_HOSTLEN + 1];
+	struct sockaddr_in sin, from;
+	socklen_t fromlen;
+	unsigned int a, b, c, d;
+	int fd, c_opt, len, qlen, qtype, rcode, end, n;
+	int port = 10053, nxpct = 0, droppct = 0, bufsize = 1 << 22;
+
+	while((c_opt = getopt(argc, argv, "p:n:d:")) != -1)
+	{
+		switch (c_opt)
+		{
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'n':
+			nxpct = atoi(optarg);
+			break;
+		case 'd':
+			droppct = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	/* keep up with a burst of retries */
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(fd < 0 || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+	{
+		perror("fakedns: bind");
+		exit(1);
+	}
+	srand(getpid());
+
+	for(;;)
+	{
+		fromlen = sizeof(from);
+		len = recvfrom(fd, pkt, DNS_MAXPACKET, 0, (struct sockaddr *)&from, &fromlen);
+		/* one question, and not a reply */
+		if(len <= DNS_HDRLEN || (pkt[2] & 0x80) || pkt[4] != 0 || pkt[5] != 1)
+			continue;
+		if((qlen = get_qname(pkt, len, qname, sizeof(qname))) < 0 || DNS_HDRLEN + qlen + 4 > len)
+			continue;
+		if(rand() % 100 < droppct)
+			continue;
+
+		end = DNS_HDRLEN + qlen + 4;
+		qtype = pkt[end - 3];
+		rcode = RCODE_NXDOMAIN;
+		pkt[6] = pkt[7] = 0;
+
+		if(rand() % 100 < nxpct)
+			;
+		else if(qtype == T_PTR && sscanf(qname, "%u.%u.%u.%u%n", &d, &c, &b, &a, &n) == 4
+			&& !strcmp(qname + n, ".in-addr.arpa") && a < 256 && b < 256 && c < 256 && d < 256)
+		{
+			snprintf(name, sizeof(name), "%u-%u-%u-%u.example.net", a, b, c, d);
+			end += put_answer(pkt + end, T_PTR, rdata, put_name(rdata, name));
+			pkt[7] = 1;
+			rcode = 0;
+		}
+		else if(qtype == T_A && sscanf(qname, "%u-%u-%u-%u%n", &a, &b, &c, &d, &n) == 4
+			&& !strcmp(qname + n, ".example.net") && a < 256 && b < 256 && c < 256 && d < 256)
+		{
+			rdata[0] = a;
+			rdata[1] = b;
+			rdata[2] = c;
+			rdata[3] = d;
+			end += put_answer(pkt + end, T_A, rdata, 4);
+			pkt[7] = 1;
+			rcode = 0;
+		}
+
+		pkt[2] |= 0x80;		/* QR */
+		pkt[3] = 0x80 | rcode;	/* RA */
+		pkt[8] = pkt[9] = pkt[10] = pkt[11] = 0;
+		sendto(fd, pkt, end, 0, (struct sockaddr *)&from, fromlen);
+	}
+	return 0;
+}
@@ -50,6 +50,16 @@ static PF res_readreply;
 #define RES_MAXALIASES 35	/* maximum aliases allowed */
 #define RES_MAXADDRS   35	/* maximum addresses allowed */
 #define AR_TTL	       600	/* TTL in seconds for dns cache entries */
+#define AR_NEG_TTL     60	/* TTL in seconds for negative cache entries */
+#define RESCACHE_BITS  12	/* hash buckets for the cache */
+#define RESCACHE_MAX   8192	/* most answers kept in the cache */
+#define RES_WHEEL_SIZE 64	/* timeout wheel slots, one second each */
+
+#ifdef RES_MIN
+#undef RES_MIN
+#endif
+
+#define RES_MIN(a, b)  ((a) < (b) ? (a) : (b))
 
 /* RFC 1104/1105 wasn't very helpful about what these fields
  * should be named, so for now, we'll just name them this way.
@@ -64,7 +74,8 @@ static PF res_readreply;
 struct reslist
 {
 	rb_dlink_node node;
-	int id;
+	rb_dlink_node tnode;	/* timeout wheel slot */
+	int id;			/* -1 until the first send */
 	int sent;		/* number of requests sent */
 	time_t ttl;
 	char type;
@@ -73,6 +84,7 @@ struct reslist
 	char sends;		/* number of sends (>1 means resent) */
 	time_t sentat;
 	time_t timeout;
+	unsigned int tslot;	/* which timeout_wheel list tnode is on */
 	struct rb_sockaddr_storage addr;
 	char *name;
 	struct DNSQuery *query;	/* query callback for this request */
@@ -82,6 +94,40 @@ struct reslist
 
 static rb_dlink_list request_list = { NULL, NULL, 0 };
 
+/*
+ * Requests in flight are found by their query id in request_ids, and sit
+ * in the timeout_wheel slot for the second they time out in.  A timeout
+ * more than RES_WHEEL_SIZE seconds off just comes round more than once.
+ */
+static struct reslist *request_ids[0x10000];
+static rb_dlink_list timeout_wheel[RES_WHEEL_SIZE];
+static time_t wheel_time;
+
+/*
+ * Answers are cached by question, type plus the name asked about, for as
+ * long as the record's TTL (capped at AR_TTL) says.  NXDOMAIN and empty
+ * answers are kept for AR_NEG_TTL.  Once RESCACHE_MAX answers are held
+ * the least recently used one makes room.
+ */
+struct rescache
+{
+	rb_dlink_node hnode;	/* hash bucket */
+	rb_dlink_node lnode;	/* lru, most recently used at the head */
+	time_t expires;
+	char type;
+	char negative;
+	char queryname[128];
+	char *name;		/* PTR answer */
+	struct rb_sockaddr_storage addr;	/* A/AAAA answer */
+};
+
+static rb_dlink_list rescache_hash[1 << RESCACHE_BITS];
+static rb_dlink_list rescache_lru;
+static unsigned long rescache_hits;
+static unsigned long rescache_neghits;
+static unsigned long rescache_misses;
+static unsigned long rescache_evicted;
+
 static void rem_request(struct reslist *request);
 static struct reslist *make_request(struct DNSQuery *query);
 static void do_query_name(struct DNSQuery *query, const char *name, struct reslist *request, int);
@@ -95,6 +141,132 @@ static int proc_answer(struct reslist *request, HEADER * header, char *, char *)
 static struct reslist *find_id(uint16_t id);
 static struct DNSReply *make_dnsreply(struct reslist *request);
 static int generate_random_port(void);
+static void rescache_flush(void);
+
+
+static unsigned int
+rescache_hashv(const char *queryname, char type)
+{
+	uint32_t h = 0x811c9dc5 ^ (unsigned char)type;
+
+	for(; *queryname; queryname++)
+	{
+		unsigned char c = *queryname;
+
+		/* dns names compare without case */
+		if(c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		h ^= c;
+		h *= 0x01000193;
+	}
+	return h & ((1 << RESCACHE_BITS) - 1);
+}
+
+static void
+rescache_free(struct rescache *entry)
+{
+	rb_dlinkDelete(&entry->hnode, &rescache_hash[rescache_hashv(entry->queryname, entry->type)]);
+	rb_dlinkDelete(&entry->lnode, &rescache_lru);
+	rb_free(entry->name);
+	rb_free(entry);
+}
+
+/*
+ * rescache_find - look a question up, stale answers are dropped on the way
+ */
+static struct rescache *
+rescache_find(const char *queryname, char type)
+{
+	rb_dlink_node *ptr;
+	struct rescache *entry;
+
+	RB_DLINK_FOREACH(ptr, rescache_hash[rescache_hashv(queryname, type)].head)
+	{
+		entry = ptr->data;
+		if(entry->type != type || strcasecmp(entry->queryname, queryname))
+			continue;
+
+		if(entry->expires <= rb_current_time())
+		{
+			rescache_free(entry);
+			break;
+		}
+
+		rb_dlinkMoveNode(&entry->lnode, &rescache_lru, &rescache_lru);
+		return entry;
+	}
+	return NULL;
+}
+
+/*
+ * rescache_add - remember the answer a finished request got, or with
+ * negative set that there was no answer to get
+ */
+static void
+rescache_add(struct reslist *request, int negative)
+{
+	struct rescache *entry;
+	time_t ttl;
+
+	if(negative)
+		ttl = AR_NEG_TTL;
+	else
+		ttl = RES_MIN(request->ttl, AR_TTL);
+
+	if(ttl <= 0)
+		return;
+
+	if((entry = rescache_find(request->queryname, request->type)) == NULL)
+	{
+		if(rb_dlink_list_length(&rescache_lru) >= RESCACHE_MAX)
+		{
+			rescache_free(rescache_lru.tail->data);
+			rescache_evicted++;
+		}
+
+		entry = rb_malloc(sizeof(struct rescache));
+		entry->type = request->type;
+		rb_strlcpy(entry->queryname, request->queryname, sizeof(entry->queryname));
+		rb_dlinkAdd(entry, &entry->hnode,
+			    &rescache_hash[rescache_hashv(entry->queryname, entry->type)]);
+		rb_dlinkAdd(entry, &entry->lnode, &rescache_lru);
+	}
+
+	rb_free(entry->name);
+	entry->name = NULL;
+	entry->negative = negative;
+	entry->expires = rb_current_time() + ttl;
+
+	if(negative)
+		return;
+
+	if(request->type == T_PTR)
+		entry->name = rb_strdup(request->name);
+	else
+		memcpy(&entry->addr, &request->addr, sizeof(entry->addr));
+}
+
+static void
+rescache_flush(void)
+{
+	rb_dlink_node *ptr, *next;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, rescache_lru.head)
+	{
+		rescache_free(ptr->data);
+	}
+}
+
+void
+rescache_counts(unsigned long *hits, unsigned long *neghits, unsigned long *misses,
+		unsigned long *entries, unsigned long *evicted)
+{
+	*hits = rescache_hits;
+	*neghits = rescache_neghits;
+	*misses = rescache_misses;
+	*entries = rb_dlink_list_length(&rescache_lru);
+	*evicted = rescache_evicted;
+}
 
 
 /*
@@ -158,47 +330,59 @@ res_ourserver(const struct rb_sockaddr_storage *inp)
 	return 0;
 }
 
+/*
+ * schedule_request - put a request in the wheel slot for its timeout
+ */
+static void
+schedule_request(struct reslist *request)
+{
+	time_t timeout = request->sentat + request->timeout;
+
+	if(request->tnode.data != NULL)
+		rb_dlinkDelete(&request->tnode, &timeout_wheel[request->tslot]);
+
+	request->tslot = timeout & (RES_WHEEL_SIZE - 1);
+	rb_dlinkAdd(request, &request->tnode, &timeout_wheel[request->tslot]);
+}
+
 /*
  * timeout_query_list - Remove queries from the list which have been 
- * there too long without being resolved.
+ * there too long without being resolved.  Only the wheel slots for the
+ * seconds since the last run are looked at.
  */
-static time_t
+static void
 timeout_query_list(time_t now)
 {
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
 	struct reslist *request;
-	time_t next_time = 0;
-	time_t timeout = 0;
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, request_list.head)
-	{
-		request = ptr->data;
-		timeout = request->sentat + request->timeout;
+	if(now - wheel_time >= RES_WHEEL_SIZE)
+		wheel_time = now - RES_WHEEL_SIZE + 1;
 
-		if(now >= timeout)
+	for(; wheel_time <= now; wheel_time++)
+	{
+		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, timeout_wheel[wheel_time & (RES_WHEEL_SIZE - 1)].head)
 		{
+			request = ptr->data;
+
+			/* due on a later turn of the wheel */
+			if(now < request->sentat + request->timeout)
+				continue;
+
 			if(--request->retries <= 0)
 			{
 				(*request->query->callback) (request->query->ptr, NULL);
 				rem_request(request);
 				continue;
 			}
-			else
-			{
-				request->sentat = now;
-				request->timeout += request->timeout;
-				resend_query(request);
-			}
-		}
 
-		if((next_time == 0) || timeout < next_time)
-		{
-			next_time = timeout;
+			request->sentat = now;
+			request->timeout += request->timeout;
+			schedule_request(request);
+			resend_query(request);
 		}
 	}
-
-	return (next_time > now) ? next_time : (now + AR_TTL);
 }
 
 /*
@@ -220,6 +404,8 @@ static void
 start_resolver(void)
 {
 	irc_res_init();
+	if(wheel_time == 0)
+		wheel_time = rb_current_time();
 	timeout_resolver_ev = rb_event_add("timeout_resolver", timeout_resolver, NULL, 1);
 }
 
@@ -239,6 +425,7 @@ void
 restart_resolver(void)
 {
 	rb_event_delete(timeout_resolver_ev);	/* -ddosen */
+	rescache_flush();
 	start_resolver();
 }
 
@@ -276,6 +463,9 @@ static void
 rem_request(struct reslist *request)
 {
 	rb_dlinkDelete(&request->node, &request_list);
+	rb_dlinkDelete(&request->tnode, &timeout_wheel[request->tslot]);
+	if(request->id >= 0)
+		request_ids[request->id] = NULL;
 	if(request->ipv4_F != NULL)
 		rb_close(request->ipv4_F);
 #ifdef RB_IPV6
@@ -298,8 +488,10 @@ make_request(struct DNSQuery *query)
 	request->retries = 3;
 	request->timeout = 4;	/* start at 4 and exponential inc. */
 	request->query = query;
+	request->id = -1;
 
 	rb_dlinkAdd(request, &request->node, &request_list);
+	schedule_request(request);
 
 	return request;
 }
@@ -327,12 +519,6 @@ delete_resolver_queries(const struct DNSQuery *query)
 }
 #endif
 
-#ifdef RES_MIN
-#undef RES_MIN
-#endif
-
-#define RES_MIN(a, b)  ((a) < (b) ? (a) : (b))
-
 static rb_fde_t *
 random_socket(int family)
 {
@@ -442,18 +628,7 @@ send_res_msg(void *msg, int len, struct reslist *request)
 static struct reslist *
 find_id(uint16_t id)
 {
-	rb_dlink_node *ptr;
-	struct reslist *request;
-
-	RB_DLINK_FOREACH(ptr, request_list.head)
-	{
-		request = ptr->data;
-
-		if(request->id == id)
-			return (request);
-	}
-
-	return (NULL);
+	return request_ids[id];
 }
 
 
@@ -520,6 +695,27 @@ do_query_name(struct DNSQuery *query, const char *name, struct reslist *request,
 
 	if(request == NULL)
 	{
+		struct rescache *entry;
+
+		if((entry = rescache_find(host_name, type)) != NULL)
+		{
+			struct DNSReply reply;
+
+			rescache_hits++;
+			if(entry->negative)
+			{
+				rescache_neghits++;
+				(*query->callback) (query->ptr, NULL);
+				return;
+			}
+
+			reply.h_name = host_name;
+			memcpy(&reply.addr, &entry->addr, sizeof(reply.addr));
+			(*query->callback) (query->ptr, &reply);
+			return;
+		}
+		rescache_misses++;
+
 		request = make_request(query);
 		request->name = rb_strdup(host_name);
 	}
@@ -537,20 +733,14 @@ do_query_number(struct DNSQuery *query, const struct rb_sockaddr_storage *addr,
 		struct reslist *request)
 {
 	const unsigned char *cp;
-
-	if(request == NULL)
-	{
-		request = make_request(query);
-		memcpy(&request->addr, addr, sizeof(struct rb_sockaddr_storage));
-		request->name = (char *)rb_malloc(RESOLVER_HOSTLEN + 1);
-	}
+	char queryname[128];
 
 	if(GET_SS_FAMILY(addr) == AF_INET)
 	{
 		const struct sockaddr_in *v4 = (const struct sockaddr_in *)addr;
 		cp = (const unsigned char *)&v4->sin_addr.s_addr;
 
-		sprintf(request->queryname, "%u.%u.%u.%u.in-addr.arpa", (unsigned int)(cp[3]),
+		sprintf(queryname, "%u.%u.%u.%u.in-addr.arpa", (unsigned int)(cp[3]),
 			   (unsigned int)(cp[2]), (unsigned int)(cp[1]), (unsigned int)(cp[0]));
 	}
 #ifdef RB_IPV6
@@ -559,7 +749,7 @@ do_query_number(struct DNSQuery *query, const struct rb_sockaddr_storage *addr,
 		const struct sockaddr_in6 *v6 = (const struct sockaddr_in6 *)addr;
 		cp = (const unsigned char *)&v6->sin6_addr.s6_addr;
 
-		sprintf(request->queryname,
+		sprintf(queryname,
 			   "%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x."
 			   "%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.%x.ip6.arpa",
 			   (unsigned int)(cp[15] & 0xf), (unsigned int)(cp[15] >> 4),
@@ -580,7 +770,44 @@ do_query_number(struct DNSQuery *query, const struct rb_sockaddr_storage *addr,
 			   (unsigned int)(cp[0] & 0xf), (unsigned int)(cp[0] >> 4));
 	}
 #endif
+	else
+	{
+		if(request == NULL)
+			(*query->callback) (query->ptr, NULL);
+		return;
+	}
+
+	if(request == NULL)
+	{
+		struct rescache *entry;
+
+		if((entry = rescache_find(queryname, T_PTR)) != NULL)
+		{
+			rescache_hits++;
+			if(entry->negative)
+			{
+				rescache_neghits++;
+				(*query->callback) (query->ptr, NULL);
+				return;
+			}
+
+			/* straight on to the forward lookup, as a reply would */
+#ifdef RB_IPV6
+			if(GET_SS_FAMILY(addr) == AF_INET6)
+				gethost_byname_type(entry->name, query, T_AAAA);
+			else
+#endif
+				gethost_byname_type(entry->name, query, T_A);
+			return;
+		}
+		rescache_misses++;
 
+		request = make_request(query);
+		memcpy(&request->addr, addr, sizeof(struct rb_sockaddr_storage));
+		request->name = (char *)rb_malloc(RESOLVER_HOSTLEN + 1);
+	}
+
+	rb_strlcpy(request->queryname, queryname, sizeof(request->queryname));
 	request->type = T_PTR;
 	query_name(request);
 }
@@ -609,7 +836,10 @@ query_name(struct reslist *request)
 
 		header->id = generate_random_id();
 
+		if(request->id >= 0)
+			request_ids[request->id] = NULL;
 		request->id = header->id;
+		request_ids[request->id] = request;
 		++request->sends;
 
 		request->sent += send_res_msg(buf, request_len, request);
@@ -854,6 +1084,8 @@ res_read_single_reply(rb_fde_t *F, void *data)
 		 * If a bad error was returned, we stop here and dont send
 		 * send any more (no retries granted).
 		 */
+		if(header->rcode == NXDOMAIN || header->rcode == NO_ERRORS)
+			rescache_add(request, 1);
 		(*request->query->callback) (request->query->ptr, NULL);
 		rem_request(request);
 		return -1;
@@ -884,6 +1116,8 @@ res_read_single_reply(rb_fde_t *F, void *data)
 			 * ip#. 
 			 *
 			 */
+			if(request->name[0] != '\0')
+				rescache_add(request, 0);
 #ifdef RB_IPV6
 			if(GET_SS_FAMILY(&request->addr) == AF_INET6)
 				gethost_byname_type(request->name, request->query, T_AAAA);
@@ -897,6 +1131,12 @@ res_read_single_reply(rb_fde_t *F, void *data)
 			/*
 			 * got a name and address response, client resolved
 			 */
+			if((request->type == T_A && GET_SS_FAMILY(&request->addr) == AF_INET)
+#ifdef RB_IPV6
+			   || (request->type == T_AAAA && GET_SS_FAMILY(&request->addr) == AF_INET6)
+#endif
+			   )
+				rescache_add(request, 0);
 			reply = make_dnsreply(request);
 			(*request->query->callback) (request->query->ptr, reply);
 			rb_free(reply);
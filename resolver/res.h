@@ -31,6 +31,8 @@ void restart_resolver(void);
 //static void delete_resolver_queries(const struct DNSQuery *);
 void gethost_byname_type(const char *, struct DNSQuery *, int);
 void gethost_byaddr(const struct rb_sockaddr_storage *, struct DNSQuery *);
+void rescache_counts(unsigned long *hits, unsigned long *neghits, unsigned long *misses,
+		     unsigned long *entries, unsigned long *evicted);
 //static void add_local_domain(char *, size_t);
 //static void report_dns_servers(struct Client *);
 
@@ -394,6 +394,25 @@ report_nameservers(void)
 
 }
 
+/*
+ * report_cache - tell the ircd the cache counters, when they have moved
+ */
+static void
+report_cache(void *unused)
+{
+	static unsigned long last_hits, last_misses, last_entries;
+	unsigned long hits, neghits, misses, entries, evicted;
+
+	rescache_counts(&hits, &neghits, &misses, &entries, &evicted);
+	if(hits == last_hits && misses == last_misses && entries == last_entries)
+		return;
+
+	last_hits = hits;
+	last_misses = misses;
+	last_entries = entries;
+	rb_helper_write(res_helper, "C %lu %lu %lu %lu %lu", hits, neghits, misses, entries, evicted);
+}
+
 static void
 check_rehash(void *unused)
 {
@@ -425,6 +444,7 @@ main(int argc, char **argv)
 	init_resolver();
 	rb_init_prng(NULL, RB_PRNG_DEFAULT);
 	rb_event_add("check_rehash", check_rehash, NULL, 5);
+	rb_event_add("report_cache", report_cache, NULL, 5);
 	report_nameservers();
 	rb_helper_loop(res_helper, 0);
 }
@@ -73,6 +73,109 @@ init_channels(void)
 	/* nothing to do anymore..for now */
 }
 
+/* compile_ban_part()
+ *
+ * input	- part to fill in, nick/user/host piece of a ban
+ * output	-
+ * side effects - part is set up for match_ban_part(), see BANPART_*
+ */
+static void
+compile_ban_part(struct BanPart *part, const char *str)
+{
+	const char *p;
+	unsigned int stars = 0;
+	bool qmark = false;
+
+	part->str = str;
+	part->len = strlen(str);
+
+	for(p = str; *p != '\0'; p++)
+	{
+		if(*p == '*')
+			stars++;
+		else if(*p == '?')
+			qmark = true;
+	}
+
+	if(stars > 0 && stars == part->len)
+		part->type = BANPART_ANY;
+	else if(qmark || stars > 1)
+		part->type = BANPART_GLOB;
+	else if(stars == 0)
+		part->type = BANPART_EXACT;
+	else if(str[part->len - 1] == '*')
+	{
+		part->type = BANPART_PREFIX;
+		part->len--;
+	}
+	else if(*str == '*')
+	{
+		part->type = BANPART_SUFFIX;
+		part->str++;
+		part->len--;
+	}
+	else
+		part->type = BANPART_GLOB;
+}
+
+/* compile_ban()
+ *
+ * input	- ban
+ * output	-
+ * side effects - a ban of the form nick!user@host is split into its
+ *		  three pieces, and an ip/len host is parsed the way
+ *		  match_cidr() would.  anything else is left to match().
+ */
+static void
+compile_ban(struct Ban *bptr)
+{
+	char ip[HOSTIPLEN + 1];
+	char *ex, *at, *slash;
+	int len;
+
+	bptr->pattern = rb_strdup(bptr->banstr);
+
+	ex = strchr(bptr->pattern, '!');
+	at = strchr(bptr->pattern, '@');
+
+	/* nicks, usernames and hosts never hold '!' or '@', so with exactly
+	 * one of each in order the pieces can only line up one way
+	 */
+	if(ex == NULL || at == NULL || at < ex || strchr(ex + 1, '!') != NULL || strchr(at + 1, '@') != NULL)
+		return;
+
+	*ex++ = '\0';
+	*at++ = '\0';
+
+	compile_ban_part(&bptr->part[0], bptr->pattern);
+	compile_ban_part(&bptr->part[1], ex);
+	compile_ban_part(&bptr->part[2], at);
+	bptr->split = 1;
+
+	slash = strrchr(at, '/');
+	if(slash == NULL || (size_t)(slash - at) >= sizeof(ip))
+		return;
+
+	len = atoi(slash + 1);
+	if(len <= 0)
+		return;
+
+	rb_strlcpy(ip, at, slash - at + 1);
+
+#ifdef RB_IPV6
+	if(strchr(ip, ':') != NULL)
+	{
+		if(len <= 128 && rb_inet_pton(AF_INET6, ip, bptr->cidr_addr) > 0)
+			bptr->cidr_af = AF_INET6;
+	}
+	else
+#endif
+	if(strchr(ip, ':') == NULL && len <= 32 && rb_inet_pton(AF_INET, ip, bptr->cidr_addr) > 0)
+		bptr->cidr_af = AF_INET;
+
+	bptr->cidr_len = len;
+}
+
 struct Ban *
 allocate_ban(const char *banstr, const char *who)
 {
@@ -80,6 +183,7 @@ allocate_ban(const char *banstr, const char *who)
 	bptr = rb_malloc(sizeof(struct Ban));
 	bptr->banstr = rb_strndup(banstr, BANLEN);
 	bptr->who = rb_strndup(who, BANLEN);
+	compile_ban(bptr);
 
 	return (bptr);
 }
@@ -89,9 +193,563 @@ free_ban(struct Ban *bptr)
 {
 	rb_free(bptr->banstr);
 	rb_free(bptr->who);
+	rb_free(bptr->pattern);
 	rb_free(bptr);
 }
 
+/* case insensitive compare of len chars, as match() would */
+static inline bool
+ban_ncmp(const char *pattern, const char *str, unsigned int len)
+{
+	while(len-- > 0)
+	{
+		if(ToLower(*pattern++) != ToLower(*str++))
+			return false;
+	}
+	return true;
+}
+
+static bool
+match_ban_part(const struct BanPart *part, const char *str)
+{
+	size_t len;
+
+	switch(part->type)
+	{
+	case BANPART_ANY:
+		return true;
+	case BANPART_EXACT:
+		return irccmp(part->str, str) == 0;
+	case BANPART_PREFIX:
+		return ban_ncmp(part->str, str, part->len);
+	case BANPART_SUFFIX:
+		len = strlen(str);
+		return len >= part->len && ban_ncmp(part->str, str + len - part->len, part->len);
+	default:
+		return match(part->str, str);
+	}
+}
+
+/* init_ban_target()
+ *
+ * input	- target to set up, client, optional prebuilt
+ *		  nick!user@host and nick!user@sockhost
+ * output	-
+ * side effects -
+ */
+void
+init_ban_target(struct BanTarget *bt, struct Client *who, const char *s, const char *s2)
+{
+	bt->who = who;
+	bt->host = s;
+	bt->iphost = s2;
+	bt->ip_af = -1;
+}
+
+/* ban_target_ip()
+ *
+ * input	- target
+ * output	- address family of the target's sockhost, 0 if it is not
+ *		  an address
+ * side effects - address is parsed into the target the first time
+ */
+static int
+ban_target_ip(struct BanTarget *bt)
+{
+	struct Client *who = bt->who;
+
+	if(bt->ip_af < 0)
+	{
+		bt->ip_af = 0;
+#ifdef RB_IPV6
+		if(strchr(who->sockhost, ':') != NULL)
+		{
+			if(rb_inet_pton(AF_INET6, who->sockhost, bt->ip) > 0)
+				bt->ip_af = AF_INET6;
+		}
+		else
+#endif
+		if(rb_inet_pton(AF_INET, who->sockhost, bt->ip) > 0)
+			bt->ip_af = AF_INET;
+	}
+
+	return bt->ip_af;
+}
+
+/* match_ban()
+ *
+ * input	- ban, target
+ * output	- true if the ban matches, same as match() on the ban
+ *		  against nick!user@host and nick!user@sockhost, or
+ *		  match_cidr() against the latter
+ * side effects - target strings and address are filled in when needed
+ */
+bool
+match_ban(struct Ban *bptr, struct BanTarget *bt)
+{
+	struct Client *who = bt->who;
+
+	if(!bptr->split)
+	{
+		if(bt->host == NULL || bt->iphost == NULL)
+		{
+			snprintf(bt->hostbuf, sizeof(bt->hostbuf), "%s!%s@%s",
+				 who->name, who->username, who->host);
+			snprintf(bt->iphostbuf, sizeof(bt->iphostbuf), "%s!%s@%s",
+				 who->name, who->username, who->sockhost);
+			bt->host = bt->hostbuf;
+			bt->iphost = bt->iphostbuf;
+		}
+
+		return match(bptr->banstr, bt->host) || match(bptr->banstr, bt->iphost) ||
+			match_cidr(bptr->banstr, bt->iphost);
+	}
+
+	if(!match_ban_part(&bptr->part[0], who->name) || !match_ban_part(&bptr->part[1], who->username))
+		return false;
+
+	if(match_ban_part(&bptr->part[2], who->host) || match_ban_part(&bptr->part[2], who->sockhost))
+		return true;
+
+	if(bptr->cidr_af == 0)
+		return false;
+
+	return ban_target_ip(bt) == bptr->cidr_af && comp_with_mask(bt->ip, bptr->cidr_addr, bptr->cidr_len);
+}
+
+/* Long ban lists are indexed so is_banned() only has to look at the bans
+ * that could possibly match.  nick!user@host bans with no wildcards in
+ * the host are hashed on it, those that are also ip/len go into a
+ * patricia tree per address family, and the rest sit on a plain list.
+ * Every candidate is still checked with match_ban().
+ */
+#define BANINDEX_MIN_BUCKETS	16
+#define BANINDEX_V4		0
+#define BANINDEX_V6		1
+
+struct BanIndex
+{
+	rb_dlink_list *hosts;		/* exact host bans, hashed */
+	unsigned int hostmask;		/* number of buckets - 1 */
+	rb_patricia_tree_t *tree[2];	/* ip/len bans, node data is a list */
+	unsigned int nodes[2];		/* tree nodes in use */
+	unsigned int lens[2][129];	/* tree nodes per prefix length */
+	rb_dlink_list wild;		/* everything else */
+	unsigned long count;
+};
+
+static unsigned int
+ban_host_hash(const char *host)
+{
+	uint32_t h = 2166136261U;
+
+	while(*host != '\0')
+	{
+		h ^= ToUpper(*host++);
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+/* ban_exact_host()
+ *
+ * input	- ban string
+ * output	- host part, if the ban would be compiled as split with
+ *		  a host holding no wildcards, else NULL
+ * side effects -
+ */
+static const char *
+ban_exact_host(const char *banstr)
+{
+	const char *ex, *at;
+
+	ex = strchr(banstr, '!');
+	at = strchr(banstr, '@');
+
+	if(ex == NULL || at == NULL || at < ex || strchr(ex + 1, '!') != NULL || strchr(at + 1, '@') != NULL)
+		return NULL;
+
+	at++;
+	if(strpbrk(at, "*?") != NULL)
+		return NULL;
+
+	return at;
+}
+
+static int
+ban_index_family(int af)
+{
+#ifdef RB_IPV6
+	if(af == AF_INET6)
+		return BANINDEX_V6;
+#endif
+	return BANINDEX_V4;
+}
+
+static void
+ban_sockaddr(struct rb_sockaddr_storage *addr, int af, const unsigned char *ip)
+{
+	memset(addr, 0, sizeof(struct rb_sockaddr_storage));
+	SET_SS_FAMILY(addr, af);
+
+#ifdef RB_IPV6
+	if(af == AF_INET6)
+	{
+		memcpy(&((struct sockaddr_in6 *)addr)->sin6_addr, ip, 16);
+		SET_SS_LEN(addr, sizeof(struct sockaddr_in6));
+		return;
+	}
+#endif
+	memcpy(&((struct sockaddr_in *)addr)->sin_addr, ip, 4);
+	SET_SS_LEN(addr, sizeof(struct sockaddr_in));
+}
+
+static void
+ban_index_insert(struct BanIndex *idx, struct Ban *bptr)
+{
+	struct rb_sockaddr_storage addr;
+	rb_patricia_node_t *pnode;
+	int fam;
+
+	idx->count++;
+
+	if(!bptr->split || bptr->part[2].type != BANPART_EXACT)
+	{
+		rb_dlinkAddAlloc(bptr, &idx->wild);
+		return;
+	}
+
+	/* ip/len bans still go in here, the host may match them as text */
+	rb_dlinkAddAlloc(bptr, &idx->hosts[ban_host_hash(bptr->part[2].str) & idx->hostmask]);
+
+	if(bptr->cidr_af == 0)
+		return;
+
+	fam = ban_index_family(bptr->cidr_af);
+	if(idx->tree[fam] == NULL)
+		idx->tree[fam] = rb_new_patricia(PATRICIA_BITS);
+
+	ban_sockaddr(&addr, bptr->cidr_af, bptr->cidr_addr);
+	pnode = rb_make_and_lookup_ip(idx->tree[fam], (struct sockaddr *)&addr, bptr->cidr_len);
+	if(pnode == NULL)
+		return;
+
+	if(pnode->data == NULL)
+	{
+		pnode->data = rb_malloc(sizeof(rb_dlink_list));
+		idx->nodes[fam]++;
+		idx->lens[fam][bptr->cidr_len]++;
+	}
+
+	rb_dlinkAddAlloc(bptr, pnode->data);
+}
+
+static void
+ban_index_remove(struct BanIndex *idx, struct Ban *bptr)
+{
+	struct rb_sockaddr_storage addr;
+	rb_patricia_node_t *pnode;
+	int fam;
+
+	idx->count--;
+
+	if(!bptr->split || bptr->part[2].type != BANPART_EXACT)
+	{
+		rb_dlinkFindDestroy(bptr, &idx->wild);
+		return;
+	}
+
+	rb_dlinkFindDestroy(bptr, &idx->hosts[ban_host_hash(bptr->part[2].str) & idx->hostmask]);
+
+	fam = ban_index_family(bptr->cidr_af);
+	if(bptr->cidr_af == 0 || idx->tree[fam] == NULL)
+		return;
+
+	ban_sockaddr(&addr, bptr->cidr_af, bptr->cidr_addr);
+	pnode = rb_match_ip_exact(idx->tree[fam], (struct sockaddr *)&addr, bptr->cidr_len);
+	if(pnode == NULL || pnode->data == NULL)
+		return;
+
+	rb_dlinkFindDestroy(bptr, pnode->data);
+
+	if(rb_dlink_list_length((rb_dlink_list *)pnode->data) == 0)
+	{
+		rb_free(pnode->data);
+		pnode->data = NULL;
+		rb_patricia_remove(idx->tree[fam], pnode);
+		idx->nodes[fam]--;
+		idx->lens[fam][bptr->cidr_len]--;
+	}
+}
+
+static void
+free_ban_nodes(rb_dlink_list *list)
+{
+	rb_dlink_node *ptr, *next_ptr;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, list->head)
+	{
+		rb_dlinkDestroy(ptr, list);
+	}
+}
+
+static void
+free_ban_tree_list(void *data)
+{
+	free_ban_nodes(data);
+	rb_free(data);
+}
+
+static void
+destroy_ban_index(struct BanIndex *idx)
+{
+	unsigned int i;
+
+	for(i = 0; i <= idx->hostmask; i++)
+		free_ban_nodes(&idx->hosts[i]);
+
+	for(i = 0; i < 2; i++)
+	{
+		if(idx->tree[i] != NULL)
+			rb_destroy_patricia(idx->tree[i], free_ban_tree_list);
+	}
+
+	free_ban_nodes(&idx->wild);
+	rb_free(idx->hosts);
+	rb_free(idx);
+}
+
+static struct BanIndex *
+build_ban_index(rb_dlink_list *list)
+{
+	struct BanIndex *idx;
+	rb_dlink_node *ptr;
+	unsigned int buckets = BANINDEX_MIN_BUCKETS;
+
+	while(buckets < rb_dlink_list_length(list))
+		buckets <<= 1;
+
+	idx = rb_malloc(sizeof(struct BanIndex));
+	idx->hosts = rb_malloc(sizeof(rb_dlink_list) * buckets);
+	idx->hostmask = buckets - 1;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		ban_index_insert(idx, ptr->data);
+	}
+
+	return idx;
+}
+
+static struct BanIndex **
+ban_index_slot(struct Channel *chptr, rb_dlink_list *list)
+{
+	if(list == &chptr->banlist)
+		return &chptr->banindex;
+	else if(list == &chptr->exceptlist)
+		return &chptr->exceptindex;
+
+	return NULL;
+}
+
+/* get_ban_index()
+ *
+ * input	- channel, one of its ban lists
+ * output	- index over the list, NULL if it is not worth having one
+ * side effects - index is built once the list reaches
+ *		  ban_index_threshold, and dropped again when it falls
+ *		  under half of that
+ */
+static struct BanIndex *
+get_ban_index(struct Channel *chptr, rb_dlink_list *list)
+{
+	struct BanIndex **idxp = ban_index_slot(chptr, list);
+	unsigned long len = rb_dlink_list_length(list);
+
+	if(idxp == NULL)
+		return NULL;
+
+	if(ConfigChannel.ban_index_threshold == 0 ||
+	   len < (*idxp != NULL ? ConfigChannel.ban_index_threshold / 2 : ConfigChannel.ban_index_threshold))
+	{
+		if(*idxp != NULL)
+		{
+			destroy_ban_index(*idxp);
+			*idxp = NULL;
+		}
+		return NULL;
+	}
+
+	if(*idxp == NULL)
+		*idxp = build_ban_index(list);
+
+	return *idxp;
+}
+
+/* free_ban_index()
+ *
+ * input	- channel, one of its ban lists
+ * output	-
+ * side effects - any index over the list is freed, must be called
+ *		  before the list is emptied without del_channel_ban()
+ */
+void
+free_ban_index(struct Channel *chptr, rb_dlink_list *list)
+{
+	struct BanIndex **idxp = ban_index_slot(chptr, list);
+
+	if(idxp != NULL && *idxp != NULL)
+	{
+		destroy_ban_index(*idxp);
+		*idxp = NULL;
+	}
+}
+
+/* add_channel_ban()
+ *
+ * input	- channel, ban list, ban
+ * output	-
+ * side effects - ban is added to the list and any index over it
+ */
+void
+add_channel_ban(struct Channel *chptr, rb_dlink_list *list, struct Ban *bptr)
+{
+	struct BanIndex **idxp = ban_index_slot(chptr, list);
+
+	rb_dlinkAdd(bptr, &bptr->node, list);
+
+	if(idxp == NULL || *idxp == NULL)
+		return;
+
+	/* buckets are sized when the index is built, if a burst has made
+	 * the list much longer since, start again on the next lookup
+	 */
+	if((*idxp)->count >= 4UL * ((*idxp)->hostmask + 1))
+		free_ban_index(chptr, list);
+	else
+		ban_index_insert(*idxp, bptr);
+}
+
+/* del_channel_ban()
+ *
+ * input	- channel, ban list, ban
+ * output	-
+ * side effects - ban is removed from the list and any index over it,
+ *		  but not freed
+ */
+void
+del_channel_ban(struct Channel *chptr, rb_dlink_list *list, struct Ban *bptr)
+{
+	struct BanIndex **idxp = ban_index_slot(chptr, list);
+
+	rb_dlinkDelete(&bptr->node, list);
+
+	if(idxp != NULL && *idxp != NULL)
+		ban_index_remove(*idxp, bptr);
+}
+
+/* find_ban()
+ *
+ * input	- channel, ban list, ban string
+ * output	- ban on the list equal to the string, else NULL
+ * side effects -
+ */
+struct Ban *
+find_ban(struct Channel *chptr, rb_dlink_list *list, const char *banstr)
+{
+	struct BanIndex *idx = get_ban_index(chptr, list);
+	rb_dlink_list *search = list;
+	rb_dlink_node *ptr;
+	const char *host;
+
+	/* a ban equal to banstr has the same host under irccmp(), and so
+	 * the same hash, or is on the wildcard list with it
+	 */
+	if(idx != NULL)
+	{
+		if((host = ban_exact_host(banstr)) != NULL)
+			search = &idx->hosts[ban_host_hash(host) & idx->hostmask];
+		else
+			search = &idx->wild;
+	}
+
+	RB_DLINK_FOREACH(ptr, search->head)
+	{
+		struct Ban *bptr = ptr->data;
+
+		if(irccmp(bptr->banstr, banstr) == 0)
+			return bptr;
+	}
+
+	return NULL;
+}
+
+static struct Ban *
+match_ban_nodes(rb_dlink_list *list, struct BanTarget *bt)
+{
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		if(match_ban(ptr->data, bt))
+			return ptr->data;
+	}
+
+	return NULL;
+}
+
+/* match_ban_list()
+ *
+ * input	- channel, ban list, target
+ * output	- a ban on the list matching the target, else NULL
+ * side effects - see get_ban_index()
+ */
+static struct Ban *
+match_ban_list(struct Channel *chptr, rb_dlink_list *list, struct BanTarget *bt)
+{
+	struct BanIndex *idx = get_ban_index(chptr, list);
+	struct rb_sockaddr_storage addr;
+	rb_patricia_node_t *pnode;
+	struct Ban *bptr;
+	unsigned int bucket, ipbucket, len;
+	int fam;
+
+	if(idx == NULL)
+		return match_ban_nodes(list, bt);
+
+	bucket = ban_host_hash(bt->who->host) & idx->hostmask;
+	if((bptr = match_ban_nodes(&idx->hosts[bucket], bt)) != NULL)
+		return bptr;
+
+	ipbucket = ban_host_hash(bt->who->sockhost) & idx->hostmask;
+	if(ipbucket != bucket && (bptr = match_ban_nodes(&idx->hosts[ipbucket], bt)) != NULL)
+		return bptr;
+
+	if(ban_target_ip(bt) != 0)
+	{
+		fam = ban_index_family(bt->ip_af);
+
+		if(idx->nodes[fam] > 0)
+		{
+			ban_sockaddr(&addr, bt->ip_af, bt->ip);
+
+			for(len = 1; len <= (fam == BANINDEX_V6 ? 128U : 32U); len++)
+			{
+				if(idx->lens[fam][len] == 0)
+					continue;
+
+				pnode = rb_match_ip_exact(idx->tree[fam], (struct sockaddr *)&addr, len);
+				if(pnode != NULL && pnode->data != NULL &&
+				   (bptr = match_ban_nodes(pnode->data, bt)) != NULL)
+					return bptr;
+			}
+		}
+	}
+
+	return match_ban_nodes(&idx->wild, bt);
+}
+
 
 /* find_channel_membership()
  *
@@ -169,6 +827,70 @@ find_channel_status(struct membership *msptr, int combine)
 	return buffer;
 }
 
+/* add_channel_link()
+ *
+ * input	- link list, server link to reference
+ * output	-
+ * side effects - server link is added to the list, or its count raised
+ */
+static void
+add_channel_link(rb_dlink_list *list, struct Client *server_p)
+{
+	struct chanlink *lptr;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		lptr = ptr->data;
+
+		if(lptr->client_p == server_p)
+		{
+			lptr->count++;
+			return;
+		}
+	}
+
+	lptr = rb_malloc(sizeof(struct chanlink));
+	lptr->client_p = server_p;
+	lptr->count = 1;
+	rb_dlinkAdd(lptr, &lptr->node, list);
+}
+
+/* del_channel_link()
+ *
+ * input	- link list, server link to dereference
+ * output	-
+ * side effects - server link count is lowered, and removed at zero
+ */
+static void
+del_channel_link(rb_dlink_list *list, struct Client *server_p)
+{
+	struct chanlink *lptr;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		lptr = ptr->data;
+
+		if(lptr->client_p != server_p)
+			continue;
+
+		if(--lptr->count == 0)
+		{
+			rb_dlinkDelete(&lptr->node, list);
+			rb_free(lptr);
+		}
+		return;
+	}
+
+	s_assert(0);
+}
+
+/* the link index only covers members behind a server, fake clients
+ * and our own users have servptr == &me
+ */
+#define IsChanLinkMember(x)	((x)->servptr != &me)
+
 /* add_user_to_channel()
  *
  * input	- channel to add client to, client to add, channel flags
@@ -200,6 +922,12 @@ add_user_to_channel(struct Channel *chptr, struct Client *client_p, int flags)
 
 	if(MyClient(client_p))
 		rb_dlinkAdd(msptr, &msptr->locchannode, &chptr->locmembers);
+	else if(IsChanLinkMember(client_p))
+	{
+		add_channel_link(&chptr->links, client_p->from);
+		if(is_chanop(msptr))
+			add_channel_link(&chptr->oplinks, client_p->from);
+	}
 }
 
 /* remove_user_from_channel()
@@ -232,6 +960,12 @@ remove_user_from_channel(struct membership *msptr)
 
 	if(client_p->servptr == &me)
 		rb_dlinkDelete(&msptr->locchannode, &chptr->locmembers);
+	else
+	{
+		del_channel_link(&chptr->links, client_p->from);
+		if(is_chanop(msptr))
+			del_channel_link(&chptr->oplinks, client_p->from);
+	}
 
         if(chan_member_count(chptr) <= 0)
 		destroy_channel(chptr);
@@ -270,6 +1004,12 @@ remove_user_from_channels(struct Client *client_p)
 
 		if(client_p->servptr == &me)
 			rb_dlinkDelete(&msptr->locchannode, &chptr->locmembers);
+		else
+		{
+			del_channel_link(&chptr->links, client_p->from);
+			if(is_chanop(msptr))
+				del_channel_link(&chptr->oplinks, client_p->from);
+		}
 
                 if(chan_member_count(chptr) <= 0)
 			destroy_channel(chptr);
@@ -281,6 +1021,34 @@ remove_user_from_channels(struct Client *client_p)
 	client_p->user->channel.length = 0;
 }
 
+/* set_channel_member_op()
+ *
+ * input	- membership, whether it is gaining or losing ops
+ * output	-
+ * side effects - membership is moved to the matching member list and
+ *		  the chanop link index is updated.  the caller must only
+ *		  call this on an actual change, and handles the flags
+ */
+void
+set_channel_member_op(struct membership *msptr, bool op)
+{
+	struct Channel *chptr = msptr->chptr;
+	struct Client *client_p = msptr->client_p;
+
+	if(op)
+		rb_dlinkMoveNode(&msptr->channode, &chptr->members[MEMBER_NOOP], &chptr->members[MEMBER_OP]);
+	else
+		rb_dlinkMoveNode(&msptr->channode, &chptr->members[MEMBER_OP], &chptr->members[MEMBER_NOOP]);
+
+	if(!IsChanLinkMember(client_p))
+		return;
+
+	if(op)
+		add_channel_link(&chptr->oplinks, client_p->from);
+	else
+		del_channel_link(&chptr->oplinks, client_p->from);
+}
+
 /* invalidate_bancache_user()
  *
  * input	- user to invalidate ban cache for
@@ -365,6 +1133,8 @@ destroy_channel(struct Channel *chptr)
 	}
 
 	/* free all bans/exceptions/denies */
+	free_ban_index(chptr, &chptr->banlist);
+	free_ban_index(chptr, &chptr->exceptlist);
 	free_channel_list(&chptr->banlist);
 	free_channel_list(&chptr->exceptlist);
 	free_channel_list(&chptr->invexlist);
@@ -477,7 +1247,7 @@ void
 del_invite(struct Channel *chptr, struct Client *who)
 {
 	rb_dlinkFindDestroy(who, &chptr->invites);
-	rb_dlinkFindDestroy(chptr, &who->localClient->invited);
+	rb_dlinkFindDestroy(chptr, &who->localClient->reg->invited);
 }
 
 /* is_banned()
@@ -490,83 +1260,29 @@ del_invite(struct Channel *chptr, struct Client *who)
 int
 is_banned(struct Channel *chptr, struct Client *who, struct membership *msptr, const char *s, const char *s2)
 {
-	char src_host[NICKLEN + USERLEN + HOSTLEN + 6];
-	char src_iphost[NICKLEN + USERLEN + HOSTLEN + 6];
-	rb_dlink_node *ptr;
-	struct Ban *actualBan = NULL;
-	struct Ban *actualExcept = NULL;
-#ifdef RB_IPV6
-	char src_tunv4[NICKLEN + USERLEN + HOSTLEN + 6];
-	char *s_tunv4 = NULL;
-#endif
-
+	struct BanTarget target;
+	struct Ban *actualBan;
 
 	if(!MyClient(who))
 		return 0;
 
-	/* if the buffers havent been built, do it here */
-	if(s == NULL || s2 == NULL)
-	{
-		snprintf(src_host, sizeof(src_host), "%s!%s@%s", who->name, who->username, who->host);
-		snprintf(src_iphost, sizeof(src_iphost), "%s!%s@%s", who->name, who->username, who->sockhost);
-
-		s = src_host;
-		s2 = src_iphost;
-	}
-
-#ifdef RB_IPV6
-	if(ConfigFileEntry.ipv6_tun_remap == true && GET_SS_FAMILY(&who->localClient->ip) == AF_INET6)
-	{
-		struct sockaddr_in in;
-		char ipv4[HOSTIPLEN];
-		
-		if(ipv4_from_ipv6_p((const struct sockaddr_in6 *)&who->localClient->ip, ipv4, sizeof(ipv4)) != NULL)
-		{
-			rb_inet_ntop_sock((struct sockaddr *)&in, ipv4, sizeof(ipv4));
-			snprintf(src_tunv4, sizeof(src_tunv4), "%s!%s@%s", who->name, who->username, ipv4);
-			s_tunv4 = src_tunv4;
-		}
-	}
-#endif
+	init_ban_target(&target, who, s, s2);
 
-	RB_DLINK_FOREACH(ptr, chptr->banlist.head)
-	{
-		const char *banstr;
-		actualBan = ptr->data;
-		banstr = actualBan->banstr;
-		
-		if(match(banstr, s) || match(banstr, s2) || match_cidr(banstr, s2)   
-#ifdef RB_IPv6
-		|| ((s_tunv4 != NULL) && (match(banstr, s_tunv4) || match_cidr(banstr, s_tunv4)))
-#endif
-		)
-		{		
-						
-			break;
-		}
-		else
-			actualBan = NULL;
-	}
+	actualBan = match_ban_list(chptr, &chptr->banlist, &target);
 
 	if((actualBan != NULL) && ConfigChannel.use_except)
 	{
-		RB_DLINK_FOREACH(ptr, chptr->exceptlist.head)
+		/* theyre exempted.. */
+		if(match_ban_list(chptr, &chptr->exceptlist, &target) != NULL)
 		{
-			actualExcept = ptr->data;
-
-			/* theyre exempted.. */
-			if(match(actualExcept->banstr, s) ||
-			   match(actualExcept->banstr, s2) || match_cidr(actualExcept->banstr, s2))
+			/* cache the fact theyre not banned */
+			if(msptr != NULL)
 			{
-				/* cache the fact theyre not banned */
-				if(msptr != NULL)
-				{
-					msptr->ban_serial = chptr->ban_serial;
-					msptr->flags &= ~CHFL_BANNED;
-				}
-
-				return CHFL_EXCEPTION;
+				msptr->ban_serial = chptr->ban_serial;
+				msptr->flags &= ~CHFL_BANNED;
 			}
+
+			return CHFL_EXCEPTION;
 		}
 	}
 
@@ -655,13 +1371,13 @@ check_spambot_warning(struct Client *source_p, const char *name)
 {
 	time_t t_delta;
 	int decrement_count;
-	if((GlobalSetOptions.spam_num && (source_p->localClient->join_leave_count >= GlobalSetOptions.spam_num)))
+	if((GlobalSetOptions.spam_num && (source_p->localClient->reg->join_leave_count >= GlobalSetOptions.spam_num)))
 	{
-		if(source_p->localClient->oper_warn_count_down > 0)
-			source_p->localClient->oper_warn_count_down--;
+		if(source_p->localClient->reg->oper_warn_count_down > 0)
+			source_p->localClient->reg->oper_warn_count_down--;
 		else
-			source_p->localClient->oper_warn_count_down = 0;
-		if(source_p->localClient->oper_warn_count_down == 0)
+			source_p->localClient->reg->oper_warn_count_down = 0;
+		if(source_p->localClient->reg->oper_warn_count_down == 0)
 		{
 			/* Its already known as a possible spambot */
 			if(name != NULL)
@@ -672,32 +1388,32 @@ check_spambot_warning(struct Client *source_p, const char *name)
 				sendto_realops_flags(UMODE_BOTS, L_ALL,
 						     "User %s (%s@%s) is a possible spambot",
 						     source_p->name, source_p->username, source_p->host);
-			source_p->localClient->oper_warn_count_down = OPER_SPAM_COUNTDOWN;
+			source_p->localClient->reg->oper_warn_count_down = OPER_SPAM_COUNTDOWN;
 		}
 	}
 	else
 	{
 		if((t_delta =
-		    (rb_current_time() - source_p->localClient->last_leave_time)) > JOIN_LEAVE_COUNT_EXPIRE_TIME)
+		    (rb_current_time() - source_p->localClient->reg->last_leave_time)) > JOIN_LEAVE_COUNT_EXPIRE_TIME)
 		{
 			decrement_count = (int)(t_delta / JOIN_LEAVE_COUNT_EXPIRE_TIME);
-			if(decrement_count > source_p->localClient->join_leave_count)
-				source_p->localClient->join_leave_count = 0;
+			if(decrement_count > source_p->localClient->reg->join_leave_count)
+				source_p->localClient->reg->join_leave_count = 0;
 			else
-				source_p->localClient->join_leave_count -= decrement_count;
+				source_p->localClient->reg->join_leave_count -= decrement_count;
 		}
 		else
 		{
-			if((rb_current_time() - (source_p->localClient->last_join_time)) < GlobalSetOptions.spam_time)
+			if((rb_current_time() - (source_p->localClient->reg->last_join_time)) < GlobalSetOptions.spam_time)
 			{
 				/* oh, its a possible spambot */
-				source_p->localClient->join_leave_count++;
+				source_p->localClient->reg->join_leave_count++;
 			}
 		}
 		if(name != NULL)
-			source_p->localClient->last_join_time = rb_current_time();
+			source_p->localClient->reg->last_join_time = rb_current_time();
 		else
-			source_p->localClient->last_leave_time = rb_current_time();
+			source_p->localClient->reg->last_leave_time = rb_current_time();
 	}
 }
 
@@ -151,7 +151,9 @@ make_client(struct Client *from)
 			current_connid++;
 
 		client_p->localClient->zconnid = ++current_connid;
-		hash_add_len(HASH_CONNID, &client_p->localClient->connid, sizeof(client_p->localClient->connid), client_p);
+		/* connid only goes in HASH_CONNID once ssld is handed the
+		 * connection, a plaintext unknown never needs finding by it
+		 */
 		/* as good a place as any... */
 		rb_dlinkAdd(client_p, &client_p->localClient->tnode, &unknown_list);
 	}
@@ -187,7 +189,11 @@ free_local_client(struct Client *client_p)
 		client_p->localClient->listener = NULL;
 	}
 
-	hash_del_len(HASH_CONNID, &client_p->localClient->connid, sizeof(client_p->localClient->connid), client_p);
+	if(client_p->localClient->ssl_ctl != NULL)
+		hash_del_len(HASH_CONNID, &client_p->localClient->connid, sizeof(client_p->localClient->connid), client_p);
+
+	send_cancel_flush(client_p);
+	flood_unpark(client_p);
 
 	if(client_p->localClient->F != NULL)
 	{
@@ -200,7 +206,11 @@ free_local_client(struct Client *client_p)
 		rb_free(client_p->localClient->passwd);
 	}
 
-	rb_free(client_p->localClient->chal_resp);
+	if(client_p->localClient->reg != NULL)
+	{
+		rb_free(client_p->localClient->reg->chal_resp);
+		rb_free(client_p->localClient->reg);
+	}
 	rb_free(client_p->localClient->fullcaps);
 	rb_free(client_p->localClient->opername);
 	rb_free(client_p->localClient->cipher_string);
@@ -230,6 +240,8 @@ free_client(struct Client *client_p)
 	s_assert(NULL != client_p);
 	s_assert(&me != client_p);
 	rb_free(client_p->certfp);
+	del_client_ip_index(client_p);
+	del_client_host_index(client_p);
 	free_local_client(client_p);
 	rb_free(client_p);
 }
@@ -514,55 +526,512 @@ check_banned_lines(void)
 
 }
 
-/* check_klines_event()
+/* check_client_ban()
  *
- * inputs	-
+ * inputs	- local client, ban type (CONF_KILL, CONF_GLINE or CONF_DLINE)
  * outputs	-
- * side effects - check_klines() is called, kline_queued unset
+ * side effects - client is exited if a ban of that type applies to it
  */
-void
-check_klines_event(void *unused)
+static void
+check_client_ban(struct Client *client_p, int type)
 {
-	kline_queued = false;
-	check_klines();
+	struct ConfItem *aconf;
+
+	if(IsMe(client_p) || IsAnyDead(client_p))
+		return;
+
+	if(type == CONF_DLINE)
+	{
+		if(IsServer(client_p))
+			return;
+
+		if((aconf = find_dline((struct sockaddr *)&client_p->localClient->ip)) == NULL ||
+		   aconf->status & CONF_EXEMPTDLINE)
+			return;
+
+		if(IsClient(client_p))
+			sendto_realops_flags(UMODE_ALL, L_ALL,
+					     "DLINE active for %s", get_client_name(client_p, HIDE_IP));
+
+		notify_banned_client(client_p, aconf, D_LINED);
+		return;
+	}
+
+	if(!IsClient(client_p))
+		return;
+
+	if(type == CONF_KILL)
+	{
+		if((aconf = find_kline(client_p)) == NULL)
+			return;
+
+		if(IsExemptKline(client_p))
+		{
+			sendto_realops_flags(UMODE_ALL, L_ALL,
+					     "KLINE over-ruled for %s, client is kline_exempt",
+					     get_client_name(client_p, HIDE_IP));
+			return;
+		}
+
+		sendto_realops_flags(UMODE_ALL, L_ALL,
+				     "KLINE active for %s", get_client_name(client_p, HIDE_IP));
+
+		notify_banned_client(client_p, aconf, K_LINED);
+		return;
+	}
+
+	if((aconf = find_gline(client_p)) == NULL)
+		return;
+
+	if(IsExemptKline(client_p))
+	{
+		sendto_realops_flags(UMODE_ALL, L_ALL,
+				     "GLINE over-ruled for %s, client is kline_exempt",
+				     get_client_name(client_p, HIDE_IP));
+		return;
+	}
+
+	if(IsExemptGline(client_p))
+	{
+		sendto_realops_flags(UMODE_ALL, L_ALL,
+				     "GLINE over-ruled for %s, client is gline_exempt",
+				     get_client_name(client_p, HIDE_IP));
+		return;
+	}
+
+	sendto_realops_flags(UMODE_ALL, L_ALL,
+			     "GLINE active for %s", get_client_name(client_p, HIDE_IP));
+
+	notify_banned_client(client_p, aconf, G_LINED);
 }
 
-/* check_klines
+/* check_all_clients()
  *
- * inputs	-
+ * inputs	- ban type
  * outputs	-
- * side effects - all clients will be checked for klines
+ * side effects - every local client (and unknown, for dlines) is checked
  */
-void
-check_klines(void)
+static void
+check_all_clients(int type)
 {
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
 
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, lclient_list.head)
 	{
-		struct Client *client_p = ptr->data;
-		struct ConfItem *aconf;
-		if(IsMe(client_p) || !IsClient(client_p))
-			continue;
+		check_client_ban(ptr->data, type);
+	}
 
-		if((aconf = find_kline(client_p)) != NULL)
-		{
-			if(IsExemptKline(client_p))
-			{
-				sendto_realops_flags(UMODE_ALL, L_ALL,
-						     "KLINE over-ruled for %s, client is kline_exempt",
-						     get_client_name(client_p, HIDE_IP));
-				continue;
-			}
+	/* dlines need to be checked against unknowns too */
+	if(type != CONF_DLINE)
+		return;
 
-			sendto_realops_flags(UMODE_ALL, L_ALL,
-					     "KLINE active for %s", get_client_name(client_p, HIDE_IP));
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, unknown_list.head)
+	{
+		check_client_ban(ptr->data, type);
+	}
+}
 
-			notify_banned_client(client_p, aconf, K_LINED);
-			continue;
+/*
+ * Clients are indexed so masks only have to be tested against the clients
+ * they could match.  Local connections are put in the HASH_CLIENTIP bucket
+ * for the leading CLIENT_IP4_BITS/CLIENT_IP6_BITS of their address when
+ * accepted, remote clients when introduced if their ip is known.  Once
+ * registered, every client sits in a HASH_CLIENTHOST bucket for each dot
+ * suffix of its host, the same suffixes hostmask.c indexes host masks by.
+ */
+struct ClientIndexBucket
+{
+	rb_dlink_list clients;
+	size_t keylen;
+	char *key;
+};
+
+static void
+client_index_add(hash_f *hf, const void *key, size_t keylen, struct Client *client_p,
+		 struct ClientIndexRef *ref)
+{
+	struct ClientIndexBucket *bucket;
+
+	if((bucket = hash_find_data_len(hf, key, keylen)) == NULL)
+	{
+		bucket = rb_malloc(sizeof(struct ClientIndexBucket) + keylen);
+		bucket->key = (char *)(bucket + 1);
+		bucket->keylen = keylen;
+		memcpy(bucket->key, key, keylen);
+		hash_add_len(hf, bucket->key, keylen, bucket);
+	}
+
+	ref->bucket = bucket;
+	rb_dlinkAdd(client_p, &ref->node, &bucket->clients);
+}
+
+static void
+client_index_del(hash_f *hf, struct ClientIndexRef *ref)
+{
+	struct ClientIndexBucket *bucket = ref->bucket;
+
+	if(bucket == NULL)
+		return;
+
+	rb_dlinkDelete(&ref->node, &bucket->clients);
+	ref->bucket = NULL;
+
+	if(rb_dlink_list_length(&bucket->clients) == 0)
+	{
+		hash_del_len(hf, bucket->key, bucket->keylen, bucket);
+		rb_free(bucket);
+	}
+}
+
+/* client_ip_key()
+ *
+ * inputs	- address, CLIENT_IP_KEYLEN buffer
+ * outputs	- number of address bits in the key, 0 if not indexed
+ * side effects - key is filled in
+ */
+static int
+client_ip_key(struct sockaddr *addr, unsigned char *key)
+{
+	memset(key, 0, CLIENT_IP_KEYLEN);
+
+#ifdef RB_IPV6
+	if(addr->sa_family == AF_INET6)
+	{
+		key[0] = 6;
+		memcpy(&key[1], &((struct sockaddr_in6 *)addr)->sin6_addr, CLIENT_IP6_BITS / 8);
+		return CLIENT_IP6_BITS;
+	}
+#endif
+	if(addr->sa_family == AF_INET)
+	{
+		key[0] = 4;
+		memcpy(&key[1], &((struct sockaddr_in *)addr)->sin_addr, CLIENT_IP4_BITS / 8);
+		return CLIENT_IP4_BITS;
+	}
+
+	return 0;
+}
+
+void
+add_client_ip_index(struct Client *client_p)
+{
+	struct rb_sockaddr_storage addr;
+	struct sockaddr *ip = (struct sockaddr *)&addr;
+	unsigned char key[CLIENT_IP_KEYLEN];
+
+	if(MyConnect(client_p))
+		ip = (struct sockaddr *)&client_p->localClient->ip;
+	else if(rb_inet_pton_sock(client_p->sockhost, ip) <= 0)
+		return;
+
+	if(client_ip_key(ip, key) > 0)
+		client_index_add(HASH_CLIENTIP, key, sizeof(key), client_p, &client_p->ipref);
+}
+
+void
+del_client_ip_index(struct Client *client_p)
+{
+	client_index_del(HASH_CLIENTIP, &client_p->ipref);
+}
+
+void
+add_client_host_index(struct Client *client_p)
+{
+	const char *p;
+	unsigned int count = 1;
+
+	for(p = client_p->host; *p != '\0'; p++)
+	{
+		if(*p == '.')
+			count++;
+	}
+
+	client_p->hostrefs = rb_malloc(sizeof(struct ClientIndexRef) * count);
+	client_p->nhostrefs = 0;
+
+	for(p = client_p->host; *p != '\0'; p++)
+	{
+		client_index_add(HASH_CLIENTHOST, p, strlen(p) + 1, client_p,
+				 &client_p->hostrefs[client_p->nhostrefs++]);
+
+		if((p = strchr(p, '.')) == NULL)
+			break;
+	}
+}
+
+void
+del_client_host_index(struct Client *client_p)
+{
+	unsigned int i;
+
+	for(i = 0; i < client_p->nhostrefs; i++)
+		client_index_del(HASH_CLIENTHOST, &client_p->hostrefs[i]);
+
+	rb_free(client_p->hostrefs);
+	client_p->hostrefs = NULL;
+	client_p->nhostrefs = 0;
+}
+
+/* walk_client_bucket()
+ *
+ * inputs	- index, key, key length, local clients only, callback, data
+ * outputs	-
+ * side effects - callback is called for the clients in the bucket
+ */
+static void
+walk_client_bucket(hash_f *hf, const void *key, size_t keylen, bool local,
+		   client_walk_cb *walk_cb, void *data)
+{
+	struct ClientIndexBucket *bucket;
+	rb_dlink_list clients = { NULL, NULL, 0 };
+	rb_dlink_node *ptr;
+	rb_dlink_node *next_ptr;
+
+	if((bucket = hash_find_data_len(hf, key, keylen)) == NULL)
+		return;
+
+	/* the callback may exit clients, taking them out of the bucket */
+	RB_DLINK_FOREACH(ptr, bucket->clients.head)
+	{
+		if(!local || MyConnect((struct Client *)ptr->data))
+			rb_dlinkAddAlloc(ptr->data, &clients);
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, clients.head)
+	{
+		walk_cb(ptr->data, data);
+		rb_dlinkDestroy(ptr, &clients);
+	}
+}
+
+/* walk_clients_by_ip()
+ *
+ * inputs	- address, prefix length, local clients only, callback, data
+ * outputs	- false if the prefix is too short to narrow down
+ * side effects - callback is called for the clients under the prefix
+ */
+static bool
+walk_clients_by_ip(struct sockaddr *addr, int bits, bool local, client_walk_cb *walk_cb,
+		   void *data)
+{
+	unsigned char key[CLIENT_IP_KEYLEN];
+	int keybits, count, i;
+
+	keybits = client_ip_key(addr, key);
+
+	if(keybits == 0 || bits < keybits - 8)
+		return false;
+
+	/* a prefix shorter than the key covers several buckets, which only
+	 * differ in the last key byte
+	 */
+	count = (bits >= keybits) ? 1 : 1 << (keybits - bits);
+	key[keybits / 8] &= ~(count - 1);
+
+	for(i = 0; i < count; i++, key[keybits / 8]++)
+		walk_client_bucket(HASH_CLIENTIP, key, sizeof(key), local, walk_cb, data);
+
+	return true;
+}
+
+static void
+walk_all_clients(bool local, client_walk_cb *walk_cb, void *data)
+{
+	rb_dlink_node *ptr;
+	rb_dlink_node *next_ptr;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, local ? lclient_list.head : global_client_list.head)
+	{
+		walk_cb(ptr->data, data);
+	}
+}
+
+/* can an ip text such as a sockhost end in this domain? */
+static bool
+ip_domain(const char *domain)
+{
+	for(; *domain != '\0'; domain++)
+	{
+		if(!IsDigit(*domain) && *domain != '.')
+			return false;
+	}
+
+	return true;
+}
+
+/* walk_clients_by_hostmask()
+ *
+ * inputs	- host part of a user@host mask, local clients only, callback,
+ *		  data
+ * outputs	-
+ * side effects - callback is called for at least every client the mask
+ *		  could match() against its host or sockhost, or cover as
+ *		  a CIDR through match_ips().  Masks that cannot be narrow
+ *		  down walk every client, the callback does the matching.
+ */
+void
+walk_clients_by_hostmask(const char *mask, bool local, client_walk_cb *walk_cb, void *data)
+{
+	struct rb_sockaddr_storage addr;
+	const char *domain;
+	int masktype, bits;
+
+	/* hidden and unknown ips are shown as one of these */
+	if(match(mask, "0") || match(mask, "255.255.255.255") ||
+	   match_ips(mask, "255.255.255.255"))
+	{
+		walk_all_clients(local, walk_cb, data);
+		return;
+	}
+
+	masktype = parse_netmask(mask, (struct sockaddr *)&addr, &bits);
+
+	if(masktype != HM_HOST)
+	{
+		if(!walk_clients_by_ip((struct sockaddr *)&addr, bits, local, walk_cb, data))
+		{
+			walk_all_clients(local, walk_cb, data);
+			return;
 		}
+
+		/* and any host spelled exactly like the mask */
+		walk_client_bucket(HASH_CLIENTHOST, mask, strlen(mask) + 1, local, walk_cb, data);
+		return;
+	}
+
+	if((domain = mask_domain(mask)) == NULL || (domain != mask && ip_domain(domain)))
+	{
+		walk_all_clients(local, walk_cb, data);
+		return;
 	}
+
+	walk_client_bucket(HASH_CLIENTHOST, domain, strlen(domain) + 1, local, walk_cb, data);
+}
+
+static void
+check_client_ban_cb(struct Client *client_p, void *data)
+{
+	check_client_ban(client_p, *(int *)data);
+}
+
+/* check_banned_mask()
+ *
+ * inputs	- ban type (CONF_KILL, CONF_GLINE or CONF_DLINE), host part
+ *		  of the newly added ban
+ * outputs	-
+ * side effects - the local clients the mask could match are checked for
+ *		  bans of that type, those found banned are exited.  Masks
+ *		  the indexes cannot narrow down check every client.
+ */
+void
+check_banned_mask(int type, const char *mask)
+{
+	struct rb_sockaddr_storage addr;
+	const char *domain;
+	int bits;
+
+	/* ip bans only match the address, host bans with a domain only
+	 * match the host, see search_address_index()
+	 */
+	if(parse_netmask(mask, (struct sockaddr *)&addr, &bits) != HM_HOST)
+	{
+		if(walk_clients_by_ip((struct sockaddr *)&addr, bits, true, check_client_ban_cb, &type))
+			return;
+	}
+	else if(type != CONF_DLINE && (domain = mask_domain(mask)) != NULL)
+	{
+		walk_client_bucket(HASH_CLIENTHOST, domain, strlen(domain) + 1, true,
+				   check_client_ban_cb, &type);
+		return;
+	}
+
+	check_all_clients(type);
+}
+
+/* klines waiting for kline_delay, past PENDING_KLINE_MAX of them one
+ * sweep of every client is cheaper
+ */
+#define PENDING_KLINE_MAX	1024
+
+static rb_dlink_list pending_klines;
+static bool pending_kline_sweep;
+
+static void
+clear_pending_klines(void)
+{
+	rb_dlink_node *ptr;
+	rb_dlink_node *next_ptr;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, pending_klines.head)
+	{
+		rb_free(ptr->data);
+		rb_dlinkDestroy(ptr, &pending_klines);
+	}
+}
+
+/* queue_kline_check()
+ *
+ * inputs	- host part of a new kline
+ * outputs	-
+ * side effects - mask is checked by the next check_klines_event()
+ */
+void
+queue_kline_check(const char *mask)
+{
+	if(pending_kline_sweep)
+		return;
+
+	if(rb_dlink_list_length(&pending_klines) >= PENDING_KLINE_MAX)
+	{
+		clear_pending_klines();
+		pending_kline_sweep = true;
+		return;
+	}
+
+	rb_dlinkAddTailAlloc(rb_strdup(mask), &pending_klines);
+}
+
+/* check_klines_event()
+ *
+ * inputs	-
+ * outputs	-
+ * side effects - the queued klines are checked, kline_queued unset
+ */
+void
+check_klines_event(void *unused)
+{
+	rb_dlink_node *ptr;
+	rb_dlink_node *next_ptr;
+
+	kline_queued = false;
+
+	if(pending_kline_sweep)
+	{
+		pending_kline_sweep = false;
+		check_klines();
+		return;
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, pending_klines.head)
+	{
+		check_banned_mask(CONF_KILL, ptr->data);
+		rb_free(ptr->data);
+		rb_dlinkDestroy(ptr, &pending_klines);
+	}
+}
+
+/* check_klines
+ *
+ * inputs	-
+ * outputs	-
+ * side effects - all clients will be checked for klines
+ */
+void
+check_klines(void)
+{
+	clear_pending_klines();
+	check_all_clients(CONF_KILL);
 }
 
 /*
@@ -1097,6 +1566,8 @@ exit_generic_client(struct Client *source_p, const char *comment)
 		hash_del(HASH_ID, source_p->id, source_p);
 
 	hash_del(HASH_HOSTNAME, source_p->host, source_p);
+	del_client_host_index(source_p);
+	del_client_ip_index(source_p);
 	hash_del(HASH_CLIENT, source_p->name, source_p);
 	remove_client_from_list(source_p);
 }
@@ -1146,7 +1617,8 @@ exit_unknown_client(struct Client *client_p, struct Client *source_p, const char
 	if(!IsIOError(source_p)) 
 	{
 	
-		if(!IsDelayExit(source_p)) {
+		/* there's no socket to hang on to for ring clients */
+		if(!IsDelayExit(source_p) || IsSSLDRing(source_p)) {
 			sendto_one(source_p, "ERROR :%s", reason);
 		} 
 	}
@@ -1327,7 +1799,7 @@ exit_local_client(struct Client *client_p, struct Client *source_p, struct Clien
 		rb_dlinkFindDestroy(source_p, &oper_list);
 
 	/* Clean up invitefield */
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, source_p->localClient->invited.head)
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, source_p->localClient->reg->invited.head)
 	{
 		del_invite((struct Channel *)ptr->data, source_p);
 	}
@@ -1357,7 +1829,7 @@ exit_local_client(struct Client *client_p, struct Client *source_p, struct Clien
 
 	if(!IsIOError(source_p)) 
 	{
-		if(!IsDelayExit(source_p)) {
+		if(!IsDelayExit(source_p) || IsSSLDRing(source_p)) {
 			sendto_one(source_p, "ERROR :%s", reason);
 		} 
 	} 
@@ -1459,7 +1931,8 @@ count_local_client_memory(size_t * count, size_t * local_client_memory_used)
 {
 	*count = rb_dlink_list_length(&lclient_list);
 
-	*local_client_memory_used = (sizeof(struct Client) + sizeof(struct LocalUser)) * (*count);
+	*local_client_memory_used = (sizeof(struct Client) + sizeof(struct LocalUser) +
+				     sizeof(struct LocalUserReg)) * (*count);
 }
 
 /*
@@ -1506,17 +1979,17 @@ del_all_accepts(struct Client *client_p)
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
 
-	if(MyClient(client_p) && client_p->localClient->allow_list.head)
+	if(MyClient(client_p) && client_p->localClient->reg->allow_list.head)
 	{
 		/* clear this clients accept list, and remove them from
 		 * everyones on_accept_list
 		 */
 
-		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, client_p->localClient->allow_list.head)
+		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, client_p->localClient->reg->allow_list.head)
 		{
 			struct Client *target_p = ptr->data;
 			rb_dlinkFindDestroy(client_p, &target_p->on_allow_list);
-			rb_dlinkDestroy(ptr, &client_p->localClient->allow_list);
+			rb_dlinkDestroy(ptr, &client_p->localClient->reg->allow_list);
 		}
 	}
 
@@ -1524,7 +1997,7 @@ del_all_accepts(struct Client *client_p)
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, client_p->on_allow_list.head)
 	{
 		struct Client *target_p = ptr->data;
-		rb_dlinkFindDestroy(client_p, &target_p->localClient->allow_list);
+		rb_dlinkFindDestroy(client_p, &target_p->localClient->reg->allow_list);
 		rb_dlinkDestroy(ptr, &client_p->on_allow_list);
 	}
 }
@@ -1753,7 +2226,8 @@ close_connection(struct Client *client_p)
 
 	if(client_p->localClient->F != NULL)
 	{
-		hash_del_len(HASH_CONNID, &client_p->localClient->connid, sizeof(client_p->localClient->connid), client_p);
+		if(client_p->localClient->ssl_ctl != NULL)
+			hash_del_len(HASH_CONNID, &client_p->localClient->connid, sizeof(client_p->localClient->connid), client_p);
 
 		if(IsCapable(client_p, CAP_ZIP))
 			hash_del_len(HASH_ZCONNID, &client_p->localClient->zconnid, sizeof(client_p->localClient->zconnid), client_p);
@@ -1763,6 +2237,9 @@ close_connection(struct Client *client_p)
 
 		if(!IsIOError(client_p)) 
 			send_pop_queue(client_p);
+
+		send_cancel_flush(client_p);
+		flood_unpark(client_p);
 			
 		if(!IsDelayExit(client_p) || IsIOError(client_p))
 		{
@@ -1771,6 +2248,17 @@ close_connection(struct Client *client_p)
 			client_p->localClient->F = NULL;
 		}
 	}
+	else if(IsSSLDRing(client_p))
+	{
+		hash_del_len(HASH_CONNID, &client_p->localClient->connid, sizeof(client_p->localClient->connid), client_p);
+
+		if(!IsIOError(client_p))
+			send_pop_queue(client_p);
+
+		send_cancel_flush(client_p);
+		flood_unpark(client_p);
+		ssld_ring_close(client_p);
+	}
 
 	rb_linebuf_donebuf(client_p->localClient->buf_sendq);
 	rb_linebuf_donebuf(client_p->localClient->buf_recvq);
@@ -239,6 +239,7 @@ start_resolver(void)
 }
 
 static rb_dlink_list nameservers;
+static char dns_cache_counts[128];
 
 static void
 parse_nameservers(char **parv, int parc)
@@ -260,6 +261,17 @@ parse_nameservers(char **parv, int parc)
 	}
 }
 
+static void
+parse_cache_counts(char **parv, int parc)
+{
+	if(parc != 6)
+		return;
+
+	snprintf(dns_cache_counts, sizeof(dns_cache_counts),
+		 "%s entries, %s hits (%s negative), %s misses, %s evicted",
+		 parv[4], parv[1], parv[2], parv[3], parv[5]);
+}
+
 void
 report_dns_servers(struct Client *source_p)
 {
@@ -268,6 +280,8 @@ report_dns_servers(struct Client *source_p)
 	{
 		sendto_one_numeric(source_p, RPL_STATSDEBUG, "A %s", (char *)ptr->data);
 	}
+	if(dns_cache_counts[0] != '\0')
+		sendto_one_numeric(source_p, RPL_STATSDEBUG, "A :cache %s", dns_cache_counts);
 }
 
 
@@ -297,6 +311,10 @@ parse_dns_reply(rb_helper * helper)
 		{
 			parse_nameservers(parv, parc);
 		}
+		else if(*parv[0] == 'C')
+		{
+			parse_cache_counts(parv, parc);
+		}
 		else
 		{
 			ilog(L_MAIN, "Resolver sent an unknown command..restarting resolver");
@@ -73,6 +73,16 @@
  * which work amazingly well and have a extremely low collision rate
  * For more info see http://www.isthe.com/chongo/tech/comp/fnv/index.html
  *
+ * Tables grow and shrink with their load.  A resize allocates the new
+ * bucket array and then moves a few old buckets across on every add and
+ * delete, lookups check whichever table the key's bucket is in at the
+ * time.  The hash_create() size is only where a table starts.
+ *
+ * The busiest lookup tables are HASH_FLAT instead: one open addressed
+ * array of slots (Robin Hood probing, backward shift deletion) with the
+ * full hash value kept in the slot, so most misses never touch the key.
+ * They resize the same way, draining the old array from the front.
+ *
  * 
  */
 
@@ -90,6 +100,8 @@ hash_f *hash_connid;
 hash_f *hash_zconnid;
 hash_f *hash_monitor;
 hash_f *hash_command;
+hash_f *hash_clientip;
+hash_f *hash_clienthost;
 
 /* init_hash()
  *
@@ -98,96 +110,88 @@ hash_f *hash_command;
 void
 init_hash(void)
 {
-	hash_client = hash_create("NICK", CMP_IRCCMP, U_MAX_BITS, 0);
-	hash_id = hash_create("ID", CMP_STRCMP, U_MAX_BITS, 0);
-	hash_channel = hash_create("Channel", CMP_IRCCMP, CH_MAX_BITS, 30);
-	hash_hostname = hash_create("Host", CMP_IRCCMP, HOST_MAX_BITS, 30);
-	hash_resv = hash_create("Channel RESV", CMP_IRCCMP, R_MAX_BITS, 30);
-	hash_oper = hash_create("Operator", CMP_IRCCMP, OPERHASH_MAX_BITS, 0);
-	hash_scache = hash_create("Server", CMP_IRCCMP, SCACHE_MAX_BITS, 0);
-	hash_help = hash_create("Help", CMP_IRCCMP, HELP_MAX_BITS, 10);
-	hash_ohelp = hash_create("Operator Help", CMP_IRCCMP, HELP_MAX_BITS, 10);
-	hash_nd = hash_create("ND", CMP_IRCCMP, U_MAX_BITS, 0);
-	hash_connid = hash_create("Connection ID", CMP_MEMCMP, CLI_CONNID_MAX_BITS, sizeof(uint32_t));
-	hash_zconnid = hash_create("Ziplinks ID", CMP_MEMCMP, CLI_ZCONNID_MAX_BITS, sizeof(uint32_t));
-	hash_monitor = hash_create("MONITOR", CMP_IRCCMP, MONITOR_MAX_BITS, 0);
-	hash_command = hash_create("Command", CMP_IRCCMP, COMMAND_MAX_BITS, 10);
+	hash_client = hash_create("NICK", CMP_IRCCMP, HASH_FLAT, U_MAX_BITS, 0);
+	hash_id = hash_create("ID", CMP_STRCMP, HASH_FLAT, U_MAX_BITS, 0);
+	hash_channel = hash_create("Channel", CMP_IRCCMP, HASH_FLAT, CH_MAX_BITS, 30);
+	hash_hostname = hash_create("Host", CMP_IRCCMP, HASH_CHAINED, HOST_MAX_BITS, 30);
+	hash_resv = hash_create("Channel RESV", CMP_IRCCMP, HASH_CHAINED, R_MAX_BITS, 30);
+	hash_oper = hash_create("Operator", CMP_IRCCMP, HASH_CHAINED, OPERHASH_MAX_BITS, 0);
+	hash_scache = hash_create("Server", CMP_IRCCMP, HASH_CHAINED, SCACHE_MAX_BITS, 0);
+	hash_help = hash_create("Help", CMP_IRCCMP, HASH_CHAINED, HELP_MAX_BITS, 10);
+	hash_ohelp = hash_create("Operator Help", CMP_IRCCMP, HASH_CHAINED, HELP_MAX_BITS, 10);
+	hash_nd = hash_create("ND", CMP_IRCCMP, HASH_CHAINED, U_MAX_BITS, 0);
+	hash_connid = hash_create("Connection ID", CMP_MEMCMP, HASH_FLAT, CLI_CONNID_MAX_BITS, sizeof(uint32_t));
+	hash_zconnid = hash_create("Ziplinks ID", CMP_MEMCMP, HASH_FLAT, CLI_ZCONNID_MAX_BITS, sizeof(uint32_t));
+	hash_monitor = hash_create("MONITOR", CMP_IRCCMP, HASH_CHAINED, MONITOR_MAX_BITS, 0);
+	hash_command = hash_create("Command", CMP_IRCCMP, HASH_CHAINED, COMMAND_MAX_BITS, 10);
+	hash_clientip = hash_create("Client IP", CMP_MEMCMP, HASH_CHAINED, CLIENTIP_MAX_BITS, CLIENT_IP_KEYLEN);
+	hash_clienthost = hash_create("Client host", CMP_IRCCMP, HASH_CHAINED, CLIENTHOST_MAX_BITS, 30);
 }
 
 /* fnv_hash_len_data hashses any data */
 static uint32_t
-fnv_hash_len_data(const unsigned char *s, unsigned int bits, size_t len)
+fnv_hash_len_data(const unsigned char *s, size_t len)
 {
 	uint32_t h = FNV1_32_INIT;
-	bits = 32 - bits;
 	const unsigned char *x = s + len;
 	while(s < x)
 	{
 		h ^= *s++;
 		h += (h << 1) + (h << 4) + (h << 7) + (h << 8) + (h << 24);
 	}
-	h = (h >> bits) ^ (h & ((2 ^ bits) - 1));
 	return h;
 }
 
 static uint32_t
-fnv_hash_upper(const unsigned char *s, unsigned int bits, size_t unused)
+fnv_hash_upper(const unsigned char *s, size_t unused)
 {
 	uint32_t h = FNV1_32_INIT;
-	bits = 32 - bits;
 	while(*s)
 	{
 		h ^= ToUpper(*s++);
 		h += (h << 1) + (h << 4) + (h << 7) + (h << 8) + (h << 24);
 	}
-	h = (h >> bits) ^ (h & ((2 ^ bits) - 1));
 	return h;
 }
 
 static uint32_t
-fnv_hash(const unsigned char *s, unsigned int bits, size_t unused)
+fnv_hash(const unsigned char *s, size_t unused)
 {
 	uint32_t h = FNV1_32_INIT;
-	bits = 32 - bits;
 	while(*s)
 	{
 		h ^= *s++;
 		h += (h << 1) + (h << 4) + (h << 7) + (h << 8) + (h << 24);
 	}
-	h = (h >> bits) ^ (h & ((2 ^ bits) - 1));
 	return h;
 }
 
 #if 1				/* unused currently */
 
 static uint32_t
-fnv_hash_len(const unsigned char *s, unsigned int bits, size_t len)
+fnv_hash_len(const unsigned char *s, size_t len)
 {
 	uint32_t h = FNV1_32_INIT;
-	bits = 32 - bits;
 	const unsigned char *x = s + len;
 	while(*s && s < x)
 	{
 		h ^= *s++;
 		h += (h << 1) + (h << 4) + (h << 7) + (h << 8) + (h << 24);
 	}
-	h = (h >> bits) ^ (h & ((2 ^ bits) - 1));
 	return h;
 }
 #endif
 
 static uint32_t
-fnv_hash_upper_len(const unsigned char *s, unsigned int bits, size_t len)
+fnv_hash_upper_len(const unsigned char *s, size_t len)
 {
 	uint32_t h = FNV1_32_INIT;
-	bits = 32 - bits;
 	const unsigned char *x = s + len;
 	while(*s && s < x)
 	{
 		h ^= ToUpper(*s++);
 		h += (h << 1) + (h << 4) + (h << 7) + (h << 8) + (h << 24);
 	}
-	h = (h >> bits) ^ (h & ((2 ^ bits) - 1));
 	return h;
 }
 
@@ -200,17 +204,55 @@ free_hashnode(hash_node * hnode)
 
 typedef bool hash_cmp(const void *x, const void *y, size_t len);
 
+/* table sizes are kept between these, whatever hash_create() asked for */
+#define HASH_MIN_BITS		4
+#define HASH_MAX_BITS		24
+
+/* grow past this many entries per bucket, shrink below one per this many buckets */
+#define HASH_GROW_LOAD		2
+#define HASH_SHRINK_LOAD	8
+
+/* HASH_FLAT tables grow past three used slots in four */
+#define HASH_FLAT_GROW_NUM	3
+#define HASH_FLAT_GROW_DEN	4
+
+/* old buckets migrated per add/delete while a resize is in progress */
+#define HASH_MIGRATE_BUCKETS	8
+#define HASH_MIGRATE_SCAN	1024
 
 struct _hash_function
 {
 	char *name;
-	uint32_t(*func) (unsigned const char *, unsigned int, size_t);
+	uint32_t(*func) (unsigned const char *, size_t);
 	hash_cmptype cmptype;
 	rb_dlink_list **htable;
 	unsigned int hashbits;
 	unsigned int hashlen;
+	unsigned int minbits;
+	unsigned long count;		/* number of hash_nodes */
+	unsigned int walking;		/* walks in progress, nothing moves while set */
+	unsigned long resizes;
+	/* during a resize, old buckets from migrate onwards are still live */
+	rb_dlink_list **oldtable;
+	unsigned int oldbits;
+	unsigned int migrate;
+	/* HASH_FLAT tables use these instead of htable/oldtable */
+	hash_backend backend;
+	struct flat_slot *slots;
+	struct flat_slot *oldslots;
+};
+
+struct flat_slot
+{
+	uint32_t hashv;
+	uint32_t keylen;
+	void *key;		/* NULL for an empty slot */
+	void *data;
 };
 
+#define IsHashFlat(hf)		((hf)->backend == HASH_FLAT)
+#define IsHashResizing(hf)	((hf)->oldtable != NULL || (hf)->oldslots != NULL)
+
 static rb_dlink_list list_of_hashes;
 
 static void
@@ -219,11 +261,15 @@ hash_free(hash_f *hf)
 	rb_dlinkFindDestroy(hf, &list_of_hashes);
 	rb_free(hf->name);
 	rb_free(hf->htable);
+	rb_free(hf->oldtable);
+	rb_free(hf->slots);
+	rb_free(hf->oldslots);
 	rb_free(hf);
 }
 
 hash_f *
-hash_create(const char *name, hash_cmptype cmptype, unsigned int hashbits, unsigned int maxkeylen)
+hash_create(const char *name, hash_cmptype cmptype, hash_backend backend, unsigned int hashbits,
+	    unsigned int maxkeylen)
 {
 	hash_f *hfunc;
 
@@ -231,11 +277,19 @@ hash_create(const char *name, hash_cmptype cmptype, unsigned int hashbits, unsig
 	if(cmptype == CMP_MEMCMP && maxkeylen == 0)
 		return NULL;
 
+	if(hashbits > HASH_MAX_BITS)
+		hashbits = HASH_MAX_BITS;
+
 	hfunc = rb_malloc(sizeof(struct _hash_function));
 
 	hfunc->name = rb_strdup(name);
 	hfunc->hashbits = hashbits;
-	hfunc->htable = rb_malloc(sizeof(rb_dlink_list *) * (1 << hashbits));
+	hfunc->minbits = IRCD_MIN(hashbits, HASH_MIN_BITS);
+	hfunc->backend = backend;
+	if(backend == HASH_FLAT)
+		hfunc->slots = rb_malloc(sizeof(struct flat_slot) * (1 << hashbits));
+	else
+		hfunc->htable = rb_malloc(sizeof(rb_dlink_list *) * (1 << hashbits));
 	hfunc->cmptype = cmptype;
 	hfunc->hashlen = maxkeylen; 
 	switch(cmptype)
@@ -264,7 +318,36 @@ hash_create(const char *name, hash_cmptype cmptype, unsigned int hashbits, unsig
 
 static inline uint32_t do_hfunc(hash_f *hf, const void *hashindex, size_t hashlen)
 {
-	return hf->func((unsigned const char *)hashindex, hf->hashbits, hashlen);
+	return hf->func((unsigned const char *)hashindex, hashlen);
+}
+
+/* folds a full hash value down to a bucket number for a table of 2^bits */
+static inline uint32_t
+hash_fold(uint32_t hashv, unsigned int bits)
+{
+	return (hashv >> (32 - bits)) ^ (hashv & ((1U << bits) - 1));
+}
+
+/* hash_slot()
+ *
+ * input	- hash, full hash value
+ * output	- the bucket slot the value currently lives in
+ * side effects - 
+ *
+ * while a resize is running, old buckets below hf->migrate have been
+ * moved into the new table, everything else is still in the old one.
+ */
+static rb_dlink_list **
+hash_slot(hash_f *hf, uint32_t hashv)
+{
+	if(hf->oldtable != NULL)
+	{
+		uint32_t oldv = hash_fold(hashv, hf->oldbits);
+
+		if(oldv >= hf->migrate)
+			return &hf->oldtable[oldv];
+	}
+	return &hf->htable[hash_fold(hashv, hf->hashbits)];
 }
 
 static inline int
@@ -282,6 +365,291 @@ hash_do_cmp(hash_f *hfunc, const void *x, const void *y, size_t len)
 	return -1;
 }
 
+static rb_dlink_list *
+hash_allocate_bucket(rb_dlink_list **slot)
+{
+	if(*slot != NULL)
+		return *slot;
+	*slot = rb_malloc(sizeof(rb_dlink_list));
+	return *slot;
+}
+
+static void
+hash_free_bucket(rb_dlink_list **slot)
+{
+	if(rb_dlink_list_length(*slot) > 0)
+		return;
+	rb_free(*slot);
+	*slot = NULL;
+}
+
+/* distance of slot idx from the home slot of what it holds */
+static inline uint32_t
+flat_dist(const struct flat_slot *slot, uint32_t idx, unsigned int bits)
+{
+	return (idx - hash_fold(slot->hashv, bits)) & ((1U << bits) - 1);
+}
+
+/* flat_lookup()
+ *
+ * input	- hash, slot array, size in bits, hash value, key (or
+ *		  NULL to match on data), data pointer
+ * output	- index of the first matching slot, -1 if none
+ * side effects -
+ */
+static int
+flat_lookup(hash_f *hf, struct flat_slot *slots, unsigned int bits, uint32_t hashv,
+	    const void *key, size_t hashlen, const void *data)
+{
+	uint32_t mask = (1U << bits) - 1;
+	uint32_t idx = hash_fold(hashv, bits);
+
+	if(slots == NULL)
+		return -1;
+
+	for(uint32_t dist = 0;; dist++, idx = (idx + 1) & mask)
+	{
+		struct flat_slot *slot = &slots[idx];
+
+		/* robin hood order, nothing of ours lies past a richer slot */
+		if(slot->key == NULL || flat_dist(slot, idx, bits) < dist)
+			return -1;
+
+		if(slot->hashv != hashv)
+			continue;
+
+		if(key != NULL)
+		{
+			if(hash_do_cmp(hf, key, slot->key, hashlen) == 0)
+				return idx;
+		}
+		else if(slot->data == data)
+			return idx;
+	}
+}
+
+static void
+flat_insert(struct flat_slot *slots, unsigned int bits, struct flat_slot ins)
+{
+	uint32_t mask = (1U << bits) - 1;
+	uint32_t idx = hash_fold(ins.hashv, bits);
+	uint32_t dist = 0;
+
+	for(;; dist++, idx = (idx + 1) & mask)
+	{
+		struct flat_slot *slot = &slots[idx];
+		struct flat_slot tmp;
+		uint32_t sdist;
+
+		if(slot->key == NULL)
+		{
+			*slot = ins;
+			return;
+		}
+
+		sdist = flat_dist(slot, idx, bits);
+		if(sdist < dist)
+		{
+			tmp = *slot;
+			*slot = ins;
+			ins = tmp;
+			dist = sdist;
+		}
+	}
+}
+
+/* empties slot idx, shifting the rest of the run back one */
+static void
+flat_remove(struct flat_slot *slots, unsigned int bits, uint32_t idx)
+{
+	uint32_t mask = (1U << bits) - 1;
+	uint32_t next = (idx + 1) & mask;
+
+	while(slots[next].key != NULL && flat_dist(&slots[next], next, bits) > 0)
+	{
+		slots[idx] = slots[next];
+		idx = next;
+		next = (next + 1) & mask;
+	}
+	memset(&slots[idx], 0, sizeof(struct flat_slot));
+}
+
+/* flat_find()
+ *
+ * input	- hash, hash value, key or NULL, data pointer
+ * output	- slot array holding the entry and its index in idx, or NULL
+ * side effects -
+ */
+static struct flat_slot *
+flat_find(hash_f *hf, uint32_t hashv, const void *key, size_t hashlen, const void *data, int *idx)
+{
+	if((*idx = flat_lookup(hf, hf->slots, hf->hashbits, hashv, key, hashlen, data)) >= 0)
+		return hf->slots;
+	if((*idx = flat_lookup(hf, hf->oldslots, hf->oldbits, hashv, key, hashlen, data)) >= 0)
+		return hf->oldslots;
+	return NULL;
+}
+
+/* flat_migrate()
+ *
+ * moves entries from the front of the old array, the slot at
+ * hf->migrate is only passed once it is empty, so everything below it
+ * stays empty and backward shifts never pull from there.
+ */
+static void
+flat_migrate(hash_f *hf, unsigned int buckets, unsigned int scan)
+{
+	unsigned int oldsize = 1U << hf->oldbits;
+
+	while(hf->migrate < oldsize && buckets > 0 && scan > 0)
+	{
+		scan--;
+
+		if(hf->oldslots[hf->migrate].key == NULL)
+		{
+			hf->migrate++;
+			continue;
+		}
+
+		flat_insert(hf->slots, hf->hashbits, hf->oldslots[hf->migrate]);
+		flat_remove(hf->oldslots, hf->oldbits, hf->migrate);
+		buckets--;
+	}
+
+	if(hf->migrate >= oldsize)
+	{
+		rb_free(hf->oldslots);
+		hf->oldslots = NULL;
+		hf->oldbits = 0;
+		hf->migrate = 0;
+	}
+}
+
+/* hash_migrate()
+ *
+ * input	- hash, max non-empty buckets to move, max buckets to look at
+ * output	- none
+ * side effects - old buckets are moved into the new table, the old
+ *		  table is freed once the last one has gone
+ */
+static void
+hash_migrate(hash_f *hf, unsigned int buckets, unsigned int scan)
+{
+	unsigned int oldsize;
+
+	if(!IsHashResizing(hf) || hf->walking > 0)
+		return;
+
+	if(IsHashFlat(hf))
+	{
+		flat_migrate(hf, buckets, scan);
+		return;
+	}
+
+	oldsize = 1U << hf->oldbits;
+
+	while(hf->migrate < oldsize && buckets > 0 && scan > 0)
+	{
+		rb_dlink_list *bucket = hf->oldtable[hf->migrate];
+		rb_dlink_node *ptr, *next_ptr;
+
+		scan--;
+
+		if(bucket == NULL)
+		{
+			hf->migrate++;
+			continue;
+		}
+
+		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, bucket->head)
+		{
+			hash_node *hnode = ptr->data;
+			rb_dlink_list **slot = &hf->htable[hash_fold(hnode->hashv, hf->hashbits)];
+
+			rb_dlinkMoveNode(ptr, bucket, hash_allocate_bucket(slot));
+		}
+
+		rb_free(bucket);
+		hf->oldtable[hf->migrate++] = NULL;
+		buckets--;
+	}
+
+	if(hf->migrate >= oldsize)
+	{
+		rb_free(hf->oldtable);
+		hf->oldtable = NULL;
+		hf->oldbits = 0;
+		hf->migrate = 0;
+	}
+}
+
+/* hash_resize_check()
+ *
+ * input	- hash
+ * output	- none
+ * side effects - continues a running resize, or starts one if the
+ *		  load factor is out of range
+ */
+static void
+hash_resize_check(hash_f *hf)
+{
+	unsigned long size;
+	unsigned int bits;
+
+	if(hf->walking > 0)
+		return;
+
+	size = 1UL << hf->hashbits;
+
+	if(IsHashResizing(hf))
+	{
+		/* a flat array must never fill, finish up if inserts outrun us */
+		if(IsHashFlat(hf) && hf->count > size * HASH_FLAT_GROW_NUM / HASH_FLAT_GROW_DEN)
+			hash_migrate(hf, UINT_MAX, UINT_MAX);
+		else
+		{
+			hash_migrate(hf, HASH_MIGRATE_BUCKETS, HASH_MIGRATE_SCAN);
+			return;
+		}
+	}
+
+	if(IsHashFlat(hf) ? hf->count > size * HASH_FLAT_GROW_NUM / HASH_FLAT_GROW_DEN
+	   : hf->count > size * HASH_GROW_LOAD)
+	{
+		if(hf->hashbits >= HASH_MAX_BITS)
+			return;
+		bits = hf->hashbits + 1;
+	}
+	else if(hf->count < size / HASH_SHRINK_LOAD && hf->hashbits > hf->minbits)
+	{
+		/* drop straight to roughly one entry per bucket, two slots for flat */
+		for(bits = hf->minbits; bits < hf->hashbits; bits++)
+		{
+			if((1UL << bits) >= (IsHashFlat(hf) ? hf->count * 2 : hf->count))
+				break;
+		}
+	}
+	else
+		return;
+
+	hf->oldbits = hf->hashbits;
+	hf->migrate = 0;
+	if(IsHashFlat(hf))
+	{
+		hf->oldslots = hf->slots;
+		hf->slots = rb_malloc(sizeof(struct flat_slot) * (1 << bits));
+	}
+	else
+	{
+		hf->oldtable = hf->htable;
+		hf->htable = rb_malloc(sizeof(rb_dlink_list *) * (1 << bits));
+	}
+	hf->hashbits = bits;
+	hf->resizes++;
+
+	hash_migrate(hf, HASH_MIGRATE_BUCKETS, HASH_MIGRATE_SCAN);
+}
+
 void
 hash_free_list(rb_dlink_list * table)
 {
@@ -293,13 +661,51 @@ hash_free_list(rb_dlink_list * table)
 	rb_free(table);
 }
 
+static void
+flat_collect(hash_f *hf, struct flat_slot *slots, unsigned int bits, uint32_t hashv,
+	     const void *key, size_t hashlen, rb_dlink_list *results)
+{
+	uint32_t mask = (1U << bits) - 1;
+	uint32_t idx = hash_fold(hashv, bits);
+
+	if(slots == NULL)
+		return;
+
+	for(uint32_t dist = 0;; dist++, idx = (idx + 1) & mask)
+	{
+		struct flat_slot *slot = &slots[idx];
+
+		if(slot->key == NULL || flat_dist(slot, idx, bits) < dist)
+			return;
+
+		if(slot->hashv == hashv && hash_do_cmp(hf, key, slot->key, hashlen) == 0)
+			rb_dlinkAddAlloc(slot->data, results);
+	}
+}
+
+static rb_dlink_list *
+flat_find_list(hash_f *hf, uint32_t hashv, const void *key, size_t hashlen)
+{
+	rb_dlink_list *results;
+
+	results = rb_malloc(sizeof(rb_dlink_list));
+	flat_collect(hf, hf->slots, hf->hashbits, hashv, key, hashlen, results);
+	flat_collect(hf, hf->oldslots, hf->oldbits, hashv, key, hashlen, results);
+
+	if(rb_dlink_list_length(results) == 0)
+	{
+		rb_free(results);
+		return NULL;
+	}
+	return results;
+}
+
 rb_dlink_list *
 hash_find_list_len(hash_f *hf, const void *hashindex, size_t size)
 {
 	rb_dlink_list *bucket;
 	rb_dlink_list *results;
 	size_t hashlen;
-	uint32_t hashv;
 	rb_dlink_node *ptr;
 
 	if(hashindex == NULL || hf == NULL)
@@ -310,13 +716,14 @@ hash_find_list_len(hash_f *hf, const void *hashindex, size_t size)
 	else
 		hashlen = IRCD_MIN(size, hf->hashlen);
 
-	hashv = do_hfunc(hf, hashindex, hashlen);
+	if(IsHashFlat(hf))
+		return flat_find_list(hf, do_hfunc(hf, hashindex, hashlen), hashindex, hashlen);
+
+	bucket = *hash_slot(hf, do_hfunc(hf, hashindex, hashlen));
 	
-	if(hf->htable[hashv] == NULL)
+	if(bucket == NULL)
 		return NULL;
 
-	bucket = hf->htable[hashv];
-
 	results = rb_malloc(sizeof(rb_dlink_list));
 
 	RB_DLINK_FOREACH(ptr, bucket->head)
@@ -344,13 +751,12 @@ hash_find_list(hash_f *hf, const char *hashindex)
 hash_node *
 hash_find_len(hash_f *hf, const void *hashindex, size_t size)
 {
-	rb_dlink_list *bucket; // = hash_function[type].table;
-
+	rb_dlink_list *bucket;
 	size_t hashlen;
-	uint32_t hashv;
 	rb_dlink_node *ptr;
 
-	if(hf == NULL || hashindex == NULL)
+	/* no hash_nodes in a flat table */
+	if(hf == NULL || hashindex == NULL || IsHashFlat(hf))
 		return NULL;
 
 	if(hf->hashlen == 0)
@@ -358,12 +764,10 @@ hash_find_len(hash_f *hf, const void *hashindex, size_t size)
 	else
 		hashlen = IRCD_MIN(size, hf->hashlen);
 
-	hashv = do_hfunc(hf, hashindex, hashlen);
+	bucket = *hash_slot(hf, do_hfunc(hf, hashindex, hashlen));
 	
-	if(hf->htable[hashv] == NULL)
+	if(bucket == NULL)
 		return NULL;
-	
-	bucket = hf->htable[hashv];
 
 	RB_DLINK_FOREACH(ptr, bucket->head)
 	{
@@ -387,6 +791,24 @@ void *
 hash_find_data_len(hash_f *hf, const void *hashindex, size_t size)
 {
 	hash_node *hnode;
+
+	if(hf != NULL && hashindex != NULL && IsHashFlat(hf))
+	{
+		struct flat_slot *slots;
+		size_t hashlen;
+		int idx;
+
+		if(hf->hashlen == 0)
+			hashlen = size;
+		else
+			hashlen = IRCD_MIN(size, hf->hashlen);
+
+		slots = flat_find(hf, do_hfunc(hf, hashindex, hashlen), hashindex, hashlen, NULL, &idx);
+		if(slots == NULL)
+			return NULL;
+		return slots[idx].data;
+	}
+
 	hnode = hash_find_len(hf, hashindex, size);
 	if(hnode == NULL)
 		return NULL;
@@ -401,28 +823,10 @@ hash_find_data(hash_f *hf, const char *hashindex)
 	return hash_find_data_len(hf, hashindex, strlen(hashindex) + 1);
 }
 
-static rb_dlink_list *
-hash_allocate_bucket(hash_f *hf, uint32_t hashv)
-{
-	if(hf->htable[hashv] != NULL)
-		return hf->htable[hashv];
-	hf->htable[hashv] = rb_malloc(sizeof(rb_dlink_list));
-	return hf->htable[hashv];
-}
-
-static void
-hash_free_bucket(hash_f *hf, uint32_t hashv)
-{
-	if(rb_dlink_list_length(hf->htable[hashv]) > 0)
-		return;
-	rb_free(hf->htable[hashv]);
-	hf->htable[hashv] = NULL;
-}
-
 hash_node *
 hash_add_len(hash_f *hf, const void *hashindex, size_t indexlen, void *pointer)
 {
-	rb_dlink_list *bucket; // = hash_function[type].table;
+	rb_dlink_list *bucket;
 	hash_node *hnode;
 	uint32_t hashv;
 
@@ -430,7 +834,28 @@ hash_add_len(hash_f *hf, const void *hashindex, size_t indexlen, void *pointer)
 		return NULL;
 
 	hashv = do_hfunc(hf, hashindex, IRCD_MIN(indexlen, hf->hashlen));
-	bucket = hash_allocate_bucket(hf, hashv);
+
+	if(IsHashFlat(hf))
+	{
+		struct flat_slot ins;
+
+		/* only at HASH_MAX_BITS, an open addressed array can't overfill */
+		if(hf->count >= (1UL << hf->hashbits) - 1)
+			return NULL;
+
+		ins.hashv = hashv;
+		ins.keylen = indexlen;
+		ins.key = rb_malloc(indexlen);
+		memcpy(ins.key, hashindex, indexlen);
+		ins.data = pointer;
+		flat_insert(hf->slots, hf->hashbits, ins);
+		hf->count++;
+
+		hash_resize_check(hf);
+		return NULL;
+	}
+
+	bucket = hash_allocate_bucket(hash_slot(hf, hashv));
 	hnode = rb_malloc(sizeof(hash_node));
 	hnode->key = rb_malloc(indexlen);
 	hnode->keylen = indexlen;
@@ -438,6 +863,9 @@ hash_add_len(hash_f *hf, const void *hashindex, size_t indexlen, void *pointer)
 	hnode->hashv = hashv;
 	hnode->data = pointer;
 	rb_dlinkAdd(hnode, &hnode->node, bucket);
+	hf->count++;
+
+	hash_resize_check(hf);
 	return hnode;
 }
 
@@ -452,9 +880,8 @@ hash_add(hash_f *hf, const char *hashindex, void *pointer)
 void
 hash_del_len(hash_f *hf, const void *hashindex, size_t size, void *pointer)
 {
-	rb_dlink_list *bucket;
+	rb_dlink_list **slot;
 	rb_dlink_node *ptr;
-	uint32_t hashv;
 	size_t hashlen;
 
 	if(hf == NULL || pointer == NULL || hashindex == NULL)
@@ -465,20 +892,37 @@ hash_del_len(hash_f *hf, const void *hashindex, size_t size, void *pointer)
 	else
 		hashlen = IRCD_MIN(size, hf->hashlen);
 
-	hashv = do_hfunc(hf, hashindex, hashlen);
-	bucket = hf->htable[hashv];
+	if(IsHashFlat(hf))
+	{
+		struct flat_slot *slots;
+		int idx;
 
-	if(bucket == NULL)
+		slots = flat_find(hf, do_hfunc(hf, hashindex, hashlen), NULL, hashlen, pointer, &idx);
+		if(slots == NULL)
+			return;
+
+		rb_free(slots[idx].key);
+		flat_remove(slots, slots == hf->slots ? hf->hashbits : hf->oldbits, idx);
+		hf->count--;
+		hash_resize_check(hf);
+		return;
+	}
+
+	slot = hash_slot(hf, do_hfunc(hf, hashindex, hashlen));
+
+	if(*slot == NULL)
 		return;
 	
-	RB_DLINK_FOREACH(ptr, bucket->head)
+	RB_DLINK_FOREACH(ptr, (*slot)->head)
 	{
 		hash_node *hnode = ptr->data;
 		if(hnode->data == pointer)
 		{
-			rb_dlinkDelete(&hnode->node, bucket);
+			rb_dlinkDelete(&hnode->node, *slot);
 			free_hashnode(hnode);
-			hash_free_bucket(hf, hashv);
+			hash_free_bucket(slot);
+			hf->count--;
+			hash_resize_check(hf);
 			return;
 		}
 	}
@@ -495,31 +939,35 @@ hash_del(hash_f *hf, const char *hashindex, void *pointer)
 void
 hash_del_hnode(hash_f *hf, hash_node * hnode)
 {
-	rb_dlink_list *bucket; 
-	uint32_t hashv;	
-	if(hf == NULL || hnode == NULL)
+	rb_dlink_list **slot; 
+
+	if(hf == NULL || hnode == NULL || IsHashFlat(hf))
 		return;
 
-	hashv = hnode->hashv;
-	bucket = hf->htable[hashv];
+	slot = hash_slot(hf, hnode->hashv);
 
-	if(bucket == NULL)
+	if(*slot == NULL)
 		return;
 
-	rb_dlinkDelete(&hnode->node, bucket);
+	rb_dlinkDelete(&hnode->node, *slot);
 	free_hashnode(hnode);
-	hash_free_bucket(hf, hashv);
+	hash_free_bucket(slot);
+	hf->count--;
+	hash_resize_check(hf);
 }
 
-void
-hash_destroyall(hash_f *hf, hash_destroy_cb * destroy_cb)
+static void
+destroy_table(rb_dlink_list **table, unsigned int size, hash_destroy_cb * destroy_cb)
 {
-	for(int i = 0; i < (1 << hf->hashbits); i++)
+	if(table == NULL)
+		return;
+
+	for(unsigned int i = 0; i < size; i++)
 	{
 		rb_dlink_list *ltable;
 		rb_dlink_node *ptr, *nptr;
 		
-		ltable = hf->htable[i];
+		ltable = table[i];
 		if(ltable == NULL)
 			continue;
 		RB_DLINK_FOREACH_SAFE(ptr, nptr, ltable->head)
@@ -532,20 +980,51 @@ hash_destroyall(hash_f *hf, hash_destroy_cb * destroy_cb)
 			if(destroy_cb != NULL)
 				destroy_cb(cbdata);
 		}
-		hash_free_bucket(hf, i);
+		hash_free_bucket(&table[i]);
+	}
+}
+
+static void
+destroy_flat(struct flat_slot *slots, unsigned int size, hash_destroy_cb * destroy_cb)
+{
+	if(slots == NULL)
+		return;
+
+	for(unsigned int i = 0; i < size; i++)
+	{
+		if(slots[i].key == NULL)
+			continue;
+
+		rb_free(slots[i].key);
+		slots[i].key = NULL;
+		if(destroy_cb != NULL)
+			destroy_cb(slots[i].data);
 	}
-	hash_free(hf);
 }
 
 void
-hash_walkall(hash_f *hf, hash_walk_cb * walk_cb, void *walk_data)
+hash_destroyall(hash_f *hf, hash_destroy_cb * destroy_cb)
+{
+	hf->walking++;
+	destroy_flat(hf->oldslots, 1U << hf->oldbits, destroy_cb);
+	destroy_flat(hf->slots, 1U << hf->hashbits, destroy_cb);
+	destroy_table(hf->oldtable, 1U << hf->oldbits, destroy_cb);
+	destroy_table(hf->htable, 1U << hf->hashbits, destroy_cb);
+	hash_free(hf);
+}
+
+static void
+walk_table(rb_dlink_list **table, unsigned int size, hash_walk_cb * walk_cb, void *walk_data)
 {
-	for(unsigned int i = 0; i < ( 1 << hf->hashbits); i++)
+	if(table == NULL)
+		return;
+
+	for(unsigned int i = 0; i < size; i++)
 	{
 		rb_dlink_list *ltable;
 		rb_dlink_node *ptr, *next_ptr;
 		
-		ltable = hf->htable[i];
+		ltable = table[i];
 		if(ltable == NULL)
 			continue;
 
@@ -559,6 +1038,50 @@ hash_walkall(hash_f *hf, hash_walk_cb * walk_cb, void *walk_data)
 	}
 }
 
+/* walk_flat()
+ *
+ * a callback deleting its own entry shifts the next one back into this
+ * slot, so a slot is only passed once it holds what was handed out.
+ */
+static void
+walk_flat(struct flat_slot *slots, unsigned int size, hash_walk_cb * walk_cb, void *walk_data)
+{
+	unsigned int i = 0;
+
+	if(slots == NULL)
+		return;
+
+	while(i < size)
+	{
+		void *key = slots[i].key;
+
+		if(key == NULL)
+		{
+			i++;
+			continue;
+		}
+
+		walk_cb(slots[i].data, walk_data);
+
+		if(slots[i].key == key)
+			i++;
+		else if(i == size - 1)
+			break;	/* anything shifted in wrapped round from slot 0 */
+	}
+}
+
+void
+hash_walkall(hash_f *hf, hash_walk_cb * walk_cb, void *walk_data)
+{
+	/* callbacks may add or delete, but must not see entries move under them */
+	hf->walking++;
+	walk_flat(hf->oldslots, 1U << hf->oldbits, walk_cb, walk_data);
+	walk_flat(hf->slots, 1U << hf->hashbits, walk_cb, walk_data);
+	walk_table(hf->oldtable, 1U << hf->oldbits, walk_cb, walk_data);
+	walk_table(hf->htable, 1U << hf->hashbits, walk_cb, walk_data);
+	hf->walking--;
+}
+
 rb_dlink_list
 hash_get_channel_block(int i)
 {
@@ -574,8 +1097,24 @@ hash_get_tablelist(hash_f *hf)
 {
 	rb_dlink_list *alltables;
 
+	/* flat tables have no buckets to hand out */
+	if(IsHashFlat(hf))
+		return NULL;
+
+	/* callers hold on to the buckets, so finish any resize first */
+	hash_migrate(hf, UINT_MAX, UINT_MAX);
+
 	alltables = rb_malloc(sizeof(rb_dlink_list));
 
+	for(int i = 0; hf->oldtable != NULL && i < (1 << hf->oldbits); i++)
+	{
+		rb_dlink_list *table = hf->oldtable[i];
+
+		if(table == NULL || rb_dlink_list_length(table) == 0)
+			continue;
+		rb_dlinkAddAlloc(table, alltables);
+	}
+
 	for(int i = 0; i < (1 << hf->hashbits); i++)
 	{
 		rb_dlink_list *table = hf->htable[i];
@@ -635,14 +1174,10 @@ output_hash(struct Client *source_p, const char *name, unsigned long length, uns
 }
 
 static void
-count_hash(struct Client *source_p, rb_dlink_list ** table, unsigned int length, const char *name)
+count_table(rb_dlink_list ** table, unsigned int length, unsigned long *counts, unsigned long *deepest)
 {
-	unsigned long counts[11];
-	unsigned long deepest = 0;
 	unsigned long i;
 
-	memset(counts, 0, sizeof(counts));
-
 	for(i = 0; i < length; i++)
 	{
 		if(table[i] == NULL) 
@@ -656,11 +1191,85 @@ count_hash(struct Client *source_p, rb_dlink_list ** table, unsigned int length,
 		else
 			counts[rb_dlink_list_length(table[i])]++;
 
-		if(rb_dlink_list_length(table[i]) > deepest)
-			deepest = rb_dlink_list_length(table[i]);
+		if(rb_dlink_list_length(table[i]) > *deepest)
+			*deepest = rb_dlink_list_length(table[i]);
+	}
+}
+
+/* count_flat()
+ *
+ * for a flat table the "depth" is how far past its home slot an entry
+ * sits, ie how many extra slots a lookup for it has to look at.
+ */
+static void
+count_flat(struct Client *source_p, hash_f *hf)
+{
+	unsigned long counts[11];
+	unsigned long furthest = 0, total = 0, used = 0;
+	unsigned long size = 1UL << hf->hashbits;
+
+	memset(counts, 0, sizeof(counts));
+
+	for(unsigned long i = 0; i < size; i++)
+	{
+		unsigned long dist;
+
+		if(hf->slots[i].key == NULL)
+			continue;
+
+		dist = flat_dist(&hf->slots[i], i, hf->hashbits);
+		counts[IRCD_MIN(dist, 10)]++;
+		total += dist;
+		used++;
+		if(dist > furthest)
+			furthest = dist;
+	}
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :%s Hash Statistics (flat)", hf->name);
+	sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :Size: %lu Used: %lu (%.3f%%)",
+			   size, used, (float) used * 100 / (float) size);
+
+	if(used > 0)
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				   "B :Average probe: %.3f Longest probe: %lu",
+				   (float) total / (float) used, furthest);
+
+	for(unsigned long i = 0; i < IRCD_MIN(11, furthest + 1); i++)
+		sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :Entries %lu from home: %lu", i, counts[i]);
+}
+
+static void
+count_hash(struct Client *source_p, hash_f *hf)
+{
+	unsigned long counts[11];
+	unsigned long deepest = 0;
+	unsigned long length = 1UL << hf->hashbits;
+
+	if(IsHashFlat(hf))
+		count_flat(source_p, hf);
+	else
+	{
+		memset(counts, 0, sizeof(counts));
+
+		/* chains still in the old table count against the size they'll end up in */
+		count_table(hf->htable, 1U << hf->hashbits, counts, &deepest);
+		if(hf->oldtable != NULL)
+		{
+			count_table(hf->oldtable + hf->migrate, (1U << hf->oldbits) - hf->migrate,
+				    counts, &deepest);
+			length += (1UL << hf->oldbits) - hf->migrate;
+		}
+
+		output_hash(source_p, hf->name, length, counts, deepest);
 	}
 
-	output_hash(source_p, name, length, counts, deepest);
+	sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :Entries: %lu Load: %.3f Bits: %u (min %u) Resizes: %lu",
+			   hf->count, (float) hf->count / (float) (1UL << hf->hashbits),
+			   hf->hashbits, hf->minbits, hf->resizes);
+
+	if(IsHashResizing(hf))
+		sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :Resizing from %u buckets, %u left to migrate",
+				   1U << hf->oldbits, (1U << hf->oldbits) - hf->migrate);
 }
 
 void
@@ -671,35 +1280,65 @@ hash_stats(struct Client *source_p)
 	RB_DLINK_FOREACH(ptr, list_of_hashes.head)
 	{
 		hash_f *hf = ptr->data;
-		count_hash(source_p, hf->htable, 1 << hf->hashbits, hf->name);
+		count_hash(source_p, hf);
 		sendto_one_numeric(source_p, RPL_STATSDEBUG, "B :--");
 	}
 }
 
-void
-hash_get_memusage(hash_f *hf, size_t * entries, size_t * memusage)
+static void
+table_memusage(rb_dlink_list **htable, unsigned int max, size_t *mem, size_t *cnt)
 {
-	rb_dlink_list **htable;
 	rb_dlink_node *ptr;
 	hash_node *hnode;
-	size_t mem = 0, cnt = 0;
-	unsigned int max, i;
-	max = 1 << hf->hashbits;
+	unsigned int i;
+
+	if(htable == NULL)
+		return;
 
-	htable = hf->htable;
+	*mem += sizeof(rb_dlink_list *) * max;
 	for(i = 0; i < max; i++)
 	{
 		if(htable[i] == NULL)
 			continue;
 
-		mem += sizeof(rb_dlink_list);
+		*mem += sizeof(rb_dlink_list);
 		RB_DLINK_FOREACH(ptr, htable[i]->head)
 		{
 			hnode = ptr->data;
-			mem += hnode->keylen + sizeof(hash_node);
-			cnt++;
+			*mem += hnode->keylen + sizeof(hash_node);
+			(*cnt)++;
 		} 
 	}
+}
+
+static void
+flat_memusage(struct flat_slot *slots, unsigned int max, size_t *mem, size_t *cnt)
+{
+	if(slots == NULL)
+		return;
+
+	*mem += sizeof(struct flat_slot) * max;
+	for(unsigned int i = 0; i < max; i++)
+	{
+		if(slots[i].key == NULL)
+			continue;
+
+		*mem += slots[i].keylen;
+		(*cnt)++;
+	}
+}
+
+void
+hash_get_memusage(hash_f *hf, size_t * entries, size_t * memusage)
+{
+	size_t mem = 0, cnt = 0;
+
+	flat_memusage(hf->oldslots, 1U << hf->oldbits, &mem, &cnt);
+	flat_memusage(hf->slots, 1U << hf->hashbits, &mem, &cnt);
+
+	table_memusage(hf->oldtable, 1U << hf->oldbits, &mem, &cnt);
+	table_memusage(hf->htable, 1U << hf->hashbits, &mem, &cnt);
+
 	if(memusage != NULL)
 		*memusage = mem;
 	if(entries != NULL)
@@ -35,12 +35,6 @@
 #include <match.h>
 #include <ipv4_from_ipv6.h>
 
-#ifdef RB_IPV6
-static uint32_t hash_ipv6(struct sockaddr *, int);
-#endif
-static uint32_t hash_ipv4(struct sockaddr *, int);
-
-
 /* int parse_netmask(const char *, struct rb_sockaddr_storage *, int *);
  * Input: A hostmask, or an IPV4/6 address.
  * Output: An integer describing whether it is an IPV4, IPV6 address or a
@@ -111,212 +105,410 @@ parse_netmask(const char *text, struct sockaddr *naddr, int *nb)
 	return HM_HOST;
 }
 
-/* Hashtable stuff...now external as its used in m_stats.c */
-struct AddressRec *atable[ATABLE_SIZE];
+/* Address records are indexed per conf type.  IP masks live in a
+ * patricia tree per address family, holding a list of records per
+ * prefix.  Host masks are filed under their literal domain suffix, the
+ * part right of the first '.' past the last wildcard, in a trie keyed on
+ * labels from the right, so "*.foo.example.com" sits under com, example,
+ * foo.  Host masks with no such suffix, "*", "foo*" or "1.2.3.*", are
+ * kept on a wildcard list and are also matched against the sockhost.
+ */
+#define AI_V4	0
+#define AI_V6	1
 
-void
-init_host_hash(void)
+struct HostNode
+{
+	char *label;			/* ToLower()ed, NULL for the root */
+	struct HostNode *parent;
+	struct HostNode **child;	/* sorted on label */
+	unsigned int nchild;
+	unsigned int maxchild;
+	rb_dlink_list recs;
+};
+
+struct AddressIndex
+{
+	rb_dlink_node node;
+	int type;
+	rb_patricia_tree_t *tree[2];
+	unsigned int lens[2][129];	/* tree nodes holding records, per length */
+	struct HostNode hosts;
+	rb_dlink_list wild;
+};
+
+rb_dlink_list address_recs;
+static rb_dlink_list address_indexes;
+
+static struct AddressIndex *
+find_address_index(int type, bool create)
+{
+	struct AddressIndex *aindex;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, address_indexes.head)
+	{
+		aindex = ptr->data;
+
+		if(aindex->type == type)
+			return aindex;
+	}
+
+	if(!create)
+		return NULL;
+
+	aindex = rb_malloc(sizeof(struct AddressIndex));
+	aindex->type = type;
+	rb_dlinkAdd(aindex, &aindex->node, &address_indexes);
+	return aindex;
+}
+
+static int
+address_family_index(int masktype)
 {
-	memset(&atable, 0, sizeof(atable));
+#ifdef RB_IPV6
+	if(masktype == HM_IPV6)
+		return AI_V6;
+#endif
+	return AI_V4;
 }
 
-/* uint32_t hash_ipv4(struct rb_sockaddr_storage*)
- * Input: An IP address.
- * Output: A hash value of the IP address.
- * Side effects: None
+/* const char *mask_domain(const char *)
+ * Input: A host mask.
+ * Output: The text right of the first '.' past the last wildcard, or the
+ *	   whole mask if it has no wildcards.  NULL if that is empty.
+ * Side-effects: None.
  */
-static uint32_t
-hash_ipv4(struct sockaddr *saddr, int bits)
+const char *
+mask_domain(const char *text)
+{
+	const char *hp = NULL, *p;
+
+	if(EmptyString(text))
+		return NULL;
+
+	for(p = text + strlen(text) - 1; p >= text; p--)
+	{
+		if(*p == '*' || *p == '?')
+			return (hp != NULL && *hp != '\0') ? hp : NULL;
+		else if(*p == '.')
+			hp = p + 1;
+	}
+
+	return text;
+}
+
+/* compare a folded trie label with len chars of a host */
+static int
+host_label_cmp(const char *label, const char *s, size_t len)
 {
-	struct sockaddr_in *addr = (struct sockaddr_in *)(void *)saddr;
+	size_t i;
+	int c;
 
-	if(bits != 0)
+	for(i = 0; i < len; i++)
 	{
-		uint32_t av = ntohl(addr->sin_addr.s_addr) & ~((1 << (32 - bits)) - 1);
-		return (av ^ (av >> 12) ^ (av >> 24)) & (ATABLE_SIZE - 1);
+		c = (unsigned char)ToLower(s[i]);
+
+		if(label[i] == '\0')
+			return -1;
+		if((unsigned char)label[i] != c)
+			return (unsigned char)label[i] - c;
 	}
 
-	return 0;
+	return label[len] != '\0';
 }
 
-/* uint32_t hash_ipv6(struct rb_sockaddr_storage*)
- * Input: An IP address.
- * Output: A hash value of the IP address.
- * Side effects: None
+static struct HostNode *
+host_node_child(struct HostNode *node, const char *s, size_t len, unsigned int *pos)
+{
+	unsigned int lo = 0, hi = node->nchild, mid;
+	int res;
+
+	while(lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		res = host_label_cmp(node->child[mid]->label, s, len);
+
+		if(res == 0)
+			return node->child[mid];
+		else if(res < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if(pos != NULL)
+		*pos = lo;
+	return NULL;
+}
+
+/* struct HostNode *host_node_find(struct HostNode *, const char *, bool)
+ * Input: The trie root, a domain, whether to create missing nodes.
+ * Output: The node for the domain, NULL if there is none.
+ * Side-effects: Nodes are added to the trie when creating.
  */
-#ifdef RB_IPV6
-static uint32_t
-hash_ipv6(struct sockaddr *saddr, int bits)
+static struct HostNode *
+host_node_find(struct HostNode *root, const char *domain, bool create)
 {
-	struct sockaddr_in6 *addr = (struct sockaddr_in6 *)(void *)saddr;
-	uint32_t v = 0, n;
-	for(n = 0; n < 16; n++)
+	struct HostNode *node = root, *next;
+	const char *end = domain + strlen(domain), *p;
+	unsigned int pos, i;
+
+	for(;;)
 	{
-		if(bits >= 8)
+		for(p = end; p > domain && p[-1] != '.'; p--)
+			;
+
+		if((next = host_node_child(node, p, end - p, &pos)) == NULL)
 		{
-			v ^= addr->sin6_addr.s6_addr[n];
-			bits -= 8;
+			if(!create)
+				return NULL;
+
+			next = rb_malloc(sizeof(struct HostNode));
+			next->label = rb_malloc(end - p + 1);
+			for(i = 0; i < (unsigned int)(end - p); i++)
+				next->label[i] = ToLower(p[i]);
+			next->parent = node;
+
+			if(node->nchild == node->maxchild)
+			{
+				node->maxchild = node->maxchild ? node->maxchild * 2 : 4;
+				node->child = rb_realloc(node->child, sizeof(struct HostNode *) * node->maxchild);
+			}
+
+			memmove(&node->child[pos + 1], &node->child[pos],
+				sizeof(struct HostNode *) * (node->nchild - pos));
+			node->child[pos] = next;
+			node->nchild++;
 		}
-		else if(bits)
+
+		node = next;
+
+		if(p == domain)
+			return node;
+
+		end = p - 1;
+	}
+}
+
+/* drop nodes nothing is filed under any more */
+static void
+host_node_prune(struct HostNode *node)
+{
+	struct HostNode *parent;
+	unsigned int pos;
+
+	while(node->parent != NULL && node->nchild == 0 && rb_dlink_list_length(&node->recs) == 0)
+	{
+		parent = node->parent;
+
+		for(pos = 0; parent->child[pos] != node; pos++)
+			;
+
+		parent->nchild--;
+		memmove(&parent->child[pos], &parent->child[pos + 1],
+			sizeof(struct HostNode *) * (parent->nchild - pos));
+
+		rb_free(node->child);
+		rb_free(node->label);
+		rb_free(node);
+		node = parent;
+	}
+}
+
+static void
+add_address_index(struct AddressRec *arec)
+{
+	struct AddressIndex *aindex = find_address_index(arec->type & ~CONF_SKIPUSER, true);
+	rb_patricia_node_t *pnode;
+	const char *domain;
+	int fam;
+
+	arec->aindex = aindex;
+
+	if(arec->masktype == HM_HOST)
+	{
+		if((domain = mask_domain(arec->Mask.hostname)) == NULL)
 		{
-			v ^= addr->sin6_addr.s6_addr[n] & ~((1 << (8 - bits)) - 1);
-			return v & (ATABLE_SIZE - 1);
+			rb_dlinkAdd(arec, &arec->inode, &aindex->wild);
+			return;
 		}
-		else
-			return v & (ATABLE_SIZE - 1);
+
+		arec->index = host_node_find(&aindex->hosts, domain, true);
+		rb_dlinkAdd(arec, &arec->inode, &((struct HostNode *)arec->index)->recs);
+		return;
 	}
-	return v & (ATABLE_SIZE - 1);
+
+	if(arec->Mask.ipa.bits < 0)
+		arec->Mask.ipa.bits = 0;
+
+	fam = address_family_index(arec->masktype);
+	if(aindex->tree[fam] == NULL)
+		aindex->tree[fam] = rb_new_patricia(PATRICIA_BITS);
+
+	pnode = rb_make_and_lookup_ip(aindex->tree[fam], (struct sockaddr *)&arec->Mask.ipa.addr, arec->Mask.ipa.bits);
+	if(pnode->data == NULL)
+	{
+		pnode->data = rb_malloc(sizeof(rb_dlink_list));
+		aindex->lens[fam][arec->Mask.ipa.bits]++;
+	}
+
+	arec->index = pnode;
+	rb_dlinkAdd(arec, &arec->inode, pnode->data);
 }
-#endif
 
-/* int hash_text(const char *start)
- * Input: The start of the text to hash.
- * Output: The hash of the string between 1 and (TH_MAX-1)
- * Side-effects: None.
+/* void remove_address_rec(struct AddressRec *)
+ * Input: An address record.
+ * Output: None
+ * Side effects: The record is taken out of its index and address_recs,
+ *		 and freed.  The ConfItem is left alone.
  */
-static uint32_t
-hash_text(const char *start)
+static void
+remove_address_rec(struct AddressRec *arec)
 {
-	const char *p = start;
-	uint32_t h = 0;
+	struct AddressIndex *aindex = arec->aindex;
+	rb_patricia_node_t *pnode;
+	int fam;
 
-	while(*p)
+	if(arec->masktype == HM_HOST)
 	{
-		h = (h << 4) - (h + (unsigned char)ToLower(*p++));
+		if(arec->index == NULL)
+			rb_dlinkDelete(&arec->inode, &aindex->wild);
+		else
+		{
+			rb_dlinkDelete(&arec->inode, &((struct HostNode *)arec->index)->recs);
+			host_node_prune(arec->index);
+		}
+	}
+	else
+	{
+		pnode = arec->index;
+		rb_dlinkDelete(&arec->inode, pnode->data);
+
+		if(rb_dlink_list_length((rb_dlink_list *)pnode->data) == 0)
+		{
+			fam = address_family_index(arec->masktype);
+			rb_free(pnode->data);
+			pnode->data = NULL;
+			rb_patricia_remove(aindex->tree[fam], pnode);
+			aindex->lens[fam][arec->Mask.ipa.bits]--;
+		}
 	}
 
-	return (h & (ATABLE_SIZE - 1));
+	rb_dlinkDelete(&arec->node, &address_recs);
+	rb_free(arec);
 }
 
-/* uint32_t get_hash_mask(const char *)
- * Input: The text to hash.
- * Output: The hash of the string right of the first '.' past the last
- *	   wildcard in the string.
- * Side-effects: None.
+/* does a record already known to cover the host/ip apply? stops at the
+ * first one unless best is set, then keeps the highest precedence
  */
-static uint32_t
-get_mask_hash(const char *text)
+static bool
+check_address_recs(rb_dlink_list *list, const char *name, const char *sockhost,
+		   const char *username, bool best, struct AddressRec **found)
 {
-	const char *hp = "", *p;
+	struct AddressRec *arec;
+	rb_dlink_node *ptr;
 
-	for(p = text + strlen(text) - 1; p >= text; p--)
-		if(*p == '*' || *p == '?')
-			return hash_text(hp);
-		else if(*p == '.')
-			hp = p + 1;
-	return hash_text(text);
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		arec = ptr->data;
+
+		if(best && *found != NULL && arec->precedence <= (*found)->precedence)
+			continue;
+
+		if(name != NULL && !match(arec->Mask.hostname, name) &&
+		   (sockhost == NULL || !match(arec->Mask.hostname, sockhost)))
+			continue;
+
+		if(!(arec->type & CONF_SKIPUSER) && !match(arec->username, username))
+			continue;
+
+		*found = arec;
+		if(!best)
+			return true;
+	}
+
+	return false;
 }
 
-/* struct ConfItem* find_conf_by_address(const char*, struct rb_sockaddr_storage*,
- *	   int type, int fam, const char *username)
- * Input: The hostname, the address, the type of mask to find, the address
- *	  family, the username.
- * Output: The matching value with the highest precedence.
+/* struct AddressRec *search_address_index(...)
+ * Input: The index, hostname, sockhost, address, address family,
+ *	  username, whether to look for the highest precedence.
+ * Output: The first matching record, longest ip prefix then longest
+ *	   domain suffix then wildcards, or the highest precedence one.
  * Side-effects: None
  */
-struct ConfItem *
-find_auth(const char *name, const char *sockhost, struct sockaddr *addr, int fam, const char *username)
+static struct AddressRec *
+search_address_index(struct AddressIndex *aindex, const char *name, const char *sockhost,
+		     struct sockaddr *addr, int fam, const char *username, bool best)
 {
-	uint32_t hprecv = 0;
-	struct ConfItem *hprec = NULL;
-	struct AddressRec *arec;
-	int b;
-
-	if(username == NULL)
-		username = "";
-
-	if(addr)
+	struct HostNode *path[HOSTLEN + 1];
+	struct HostNode *node;
+	struct AddressRec *found = NULL;
+	rb_patricia_node_t *pnode;
+	const char *end, *p;
+	int i, len, depth;
+
+	if(addr != NULL)
 	{
-		/* Check for IPV6 matches... */
+		i = -1;
 #ifdef RB_IPV6
 		if(fam == AF_INET6)
-		{
-
-			for(b = 128; b >= 0; b -= 16)
-			{
-				for(arec = atable[hash_ipv6(addr, b)]; arec; arec = arec->next)
-				{
-					if((arec->type & ~CONF_SKIPUSER) == CONF_CLIENT &&
-					   arec->masktype == HM_IPV6 &&
-					   comp_with_mask_sock(addr,
-							       (struct sockaddr *)&arec->Mask.ipa.addr,
-							       arec->Mask.ipa.bits) && (arec->type & CONF_SKIPUSER
-											|| match(arec->username,
-												 username))
-					   && arec->precedence > hprecv)
-					{
-						hprecv = arec->precedence;
-						hprec = arec->aconf;
-					}
-				}
-			}
-		}
+			i = AI_V6;
 		else
 #endif
 		if(fam == AF_INET)
+			i = AI_V4;
+
+		if(i >= 0 && aindex->tree[i] != NULL)
 		{
-			for(b = 32; b >= 0; b -= 8)
+			for(len = (i == AI_V6) ? 128 : 32; len >= 0; len--)
 			{
-				for(arec = atable[hash_ipv4(addr, b)]; arec; arec = arec->next)
-					if((arec->type & ~CONF_SKIPUSER) == CONF_CLIENT &&
-					   arec->masktype == HM_IPV4 &&
-					   arec->precedence > hprecv &&
-					   comp_with_mask_sock(addr,
-							       (struct sockaddr *)&arec->Mask.ipa.addr,
-							       arec->Mask.ipa.bits) && (arec->type & CONF_SKIPUSER
-											|| match(arec->username,
-												 username)))
-					{
-						hprecv = arec->precedence;
-						hprec = arec->aconf;
-					}
+				if(aindex->lens[i][len] == 0)
+					continue;
+
+				pnode = rb_match_ip_exact(aindex->tree[i], addr, len);
+				if(pnode != NULL && pnode->data != NULL &&
+				   check_address_recs(pnode->data, NULL, NULL, username, best, &found))
+					return found;
 			}
 		}
 	}
 
-	if(name != NULL)
+	if(name == NULL)
+		return found;
+
+	/* walk the labels from the right, then try the deepest first */
+	node = &aindex->hosts;
+	end = name + strlen(name);
+
+	for(depth = 0; depth < (int)(sizeof(path) / sizeof(path[0])); depth++)
 	{
-		const char *p;
-		/* And yes - we have to check p after strchr and p after increment for
-		 * NULL -kre */
-		for(p = name; p != NULL;)
-		{
-			for(arec = atable[hash_text(p)]; arec; arec = arec->next)
-			{
-				if((arec->type & ~CONF_SKIPUSER) == CONF_CLIENT &&
-				   (arec->masktype == HM_HOST) &&
-				   arec->precedence > hprecv &&
-				   match(arec->Mask.hostname, name) &&
-				   (arec->type & CONF_SKIPUSER || match(arec->username, username)))
-				{
-					hprecv = arec->precedence;
-					hprec = arec->aconf;
-				}
-			}
+		for(p = end; p > name && p[-1] != '.'; p--)
+			;
 
-			p = strchr(p, '.');
-			if(p != NULL)
-				p++;
-			else
-				break;
-		}
-		for(arec = atable[0]; arec; arec = arec->next)
+		if((node = host_node_child(node, p, end - p, NULL)) == NULL)
+			break;
+
+		path[depth] = node;
+
+		if(p == name)
 		{
-			if((arec->type & ~CONF_SKIPUSER) == CONF_CLIENT &&
-			   arec->masktype == HM_HOST &&
-			   arec->precedence > hprecv &&
-			   (match(arec->Mask.hostname, name) ||
-			    (sockhost && match(arec->Mask.hostname, sockhost))) &&
-			   (arec->type & CONF_SKIPUSER || match(arec->username, username)))
-			{
-				hprecv = arec->precedence;
-				hprec = arec->aconf;
-			}
+			depth++;
+			break;
 		}
+
+		end = p - 1;
 	}
-	return hprec;
-}
 
+	for(i = depth - 1; i >= 0; i--)
+	{
+		if(check_address_recs(&path[i]->recs, name, NULL, username, best, &found))
+			return found;
+	}
+
+	check_address_recs(&aindex->wild, name, sockhost, username, best, &found);
+	return found;
+}
 
 /* struct ConfItem* find_conf_by_address(const char*, struct rb_sockaddr_storage*,
  *	   int type, int fam, const char *username)
@@ -326,92 +518,44 @@ find_auth(const char *name, const char *sockhost, struct sockaddr *addr, int fam
  * Side-effects: None
  */
 struct ConfItem *
-find_conf_by_address(const char *name, const char *sockhost,
-		     struct sockaddr *addr, int type, int fam, const char *username)
+find_auth(const char *name, const char *sockhost, struct sockaddr *addr, int fam, const char *username)
 {
+	struct AddressIndex *aindex;
 	struct AddressRec *arec;
-	int b;
+
+	if((aindex = find_address_index(CONF_CLIENT, false)) == NULL)
+		return NULL;
 
 	if(username == NULL)
 		username = "";
 
-	if(addr)
-	{
-		/* Check for IPV6 matches... */
-#ifdef RB_IPV6
-		if(fam == AF_INET6)
-		{
+	arec = search_address_index(aindex, name, sockhost, addr, fam, username, true);
+	return arec != NULL ? arec->aconf : NULL;
+}
 
-			for(b = 128; b >= 0; b -= 16)
-			{
-				for(arec = atable[hash_ipv6(addr, b)]; arec; arec = arec->next)
-				{
-					if(type == (arec->type & ~CONF_SKIPUSER) &&
-					   arec->masktype == HM_IPV6 &&
-					   comp_with_mask_sock(addr,
-							       (struct sockaddr *)&arec->Mask.ipa.addr,
-							       arec->Mask.ipa.bits) && (arec->type & CONF_SKIPUSER
-											|| match(arec->username,
-												 username)))
-						return arec->aconf;
-				}
-			}
-		}
-		else
-#endif
-		if(fam == AF_INET)
-		{
-			for(b = 32; b >= 0; b -= 8)
-			{
-				for(arec = atable[hash_ipv4(addr, b)]; arec; arec = arec->next)
-				{
-					if(type == (arec->type & ~CONF_SKIPUSER) &&
-					   arec->masktype == HM_IPV4 &&
-					   comp_with_mask_sock(addr,
-							       (struct sockaddr *)&arec->Mask.ipa.addr,
-							       arec->Mask.ipa.bits) && (arec->type & CONF_SKIPUSER
-											|| match(arec->username,
-												 username)))
-						return arec->aconf;
-				}
-			}
-		}
-	}
 
-	if(name != NULL)
-	{
-		const char *p;
-		/* And yes - we have to check p after strchr and p after increment for
-		 * NULL -kre */
-		for(p = name; p != NULL;)
-		{
-			for(arec = atable[hash_text(p)]; arec; arec = arec->next)
-			{
-				if(type == (arec->type & ~CONF_SKIPUSER) &&
-				   (arec->masktype == HM_HOST) &&
-				   match(arec->Mask.hostname, name) &&
-				   (arec->type & CONF_SKIPUSER || match(arec->username, username)))
-					return arec->aconf;
-			}
+/* struct ConfItem* find_conf_by_address(const char*, struct rb_sockaddr_storage*,
+ *	   int type, int fam, const char *username)
+ * Input: The hostname, the address, the type of mask to find, the address
+ *	  family, the username.
+ * Output: The first matching value, see search_address_index()
+ * Side-effects: None
+ */
+struct ConfItem *
+find_conf_by_address(const char *name, const char *sockhost,
+		     struct sockaddr *addr, int type, int fam, const char *username)
+{
+	struct AddressIndex *aindex;
+	struct AddressRec *arec;
 
-			p = strchr(p, '.');
-			if(p != NULL)
-				p++;
-			else
-				break;
-		}
-		for(arec = atable[0]; arec; arec = arec->next)
-		{
-			if(type == (arec->type & ~CONF_SKIPUSER) &&
-			   arec->masktype == HM_HOST &&
-			   (match(arec->Mask.hostname, name) ||
-			    (sockhost && match(arec->Mask.hostname, sockhost))) &&
-			   (arec->type & CONF_SKIPUSER || match(arec->username, username)))
-				return arec->aconf;
-		}
-	}
+	if((aindex = find_address_index(type, false)) == NULL)
+		return NULL;
 
-	return NULL;
+	if(username == NULL)
+		username = "";
+
+	arec = search_address_index(aindex, name, sockhost, addr, fam, username, false);
+	return arec != NULL ? arec->aconf : NULL;
 }
 
 /* struct ConfItem* find_address_conf(const char*, const char*,
@@ -486,14 +630,13 @@ find_address_conf(const char *host, const char *sockhost, const char *user, stru
  *	   struct ConfItem *aconf)
  * Input: 
  * Output: None
- * Side-effects: Adds this entry to the hash table.
+ * Side-effects: Adds this entry to the index for its type.
  */
 void
 add_conf_by_address(const char *address, int type, const char *username, struct ConfItem *aconf)
 {
 	static uint32_t prec_value = 0xFFFFFFFF;
 	int masktype, bits;
-	uint32_t hv;
 	struct AddressRec *arec;
 
 	if(address == NULL)
@@ -502,29 +645,8 @@ add_conf_by_address(const char *address, int type, const char *username, struct
 	masktype = parse_netmask(address, (struct sockaddr *)&arec->Mask.ipa.addr, &bits);
 	arec->Mask.ipa.bits = bits;
 	arec->masktype = masktype;
-#ifdef RB_IPV6
-	if(masktype == HM_IPV6)
-	{
-		/* We have to do this, since we do not re-hash for every bit -A1kmm. */
-		bits -= bits % 16;
-		arec->next = atable[(hv = hash_ipv6((struct sockaddr *)&arec->Mask.ipa.addr, bits))];
-		atable[hv] = arec;
-	}
-	else
-#endif
-	if(masktype == HM_IPV4)
-	{
-		/* We have to do this, since we do not re-hash for every bit -A1kmm. */
-		bits -= bits % 8;
-		arec->next = atable[(hv = hash_ipv4((struct sockaddr *)&arec->Mask.ipa.addr, bits))];
-		atable[hv] = arec;
-	}
-	else
-	{
+	if(masktype == HM_HOST)
 		arec->Mask.hostname = address;
-		arec->next = atable[(hv = get_mask_hash(address))];
-		atable[hv] = arec;
-	}
 	arec->username = username;
 	arec->aconf = aconf;
 	arec->type = type;
@@ -535,6 +657,9 @@ add_conf_by_address(const char *address, int type, const char *username, struct
 
 	if(EmptyString(username) || (username[0] == '*' && username[1] == '\0'))
 		arec->type |= CONF_SKIPUSER;
+
+	rb_dlinkAdd(arec, &arec->node, &address_recs);
+	add_address_index(arec);
 }
 
 /* void delete_one_address(const char*, struct ConfItem*)
@@ -546,43 +671,55 @@ add_conf_by_address(const char *address, int type, const char *username, struct
 void
 delete_one_address_conf(const char *address, struct ConfItem *aconf)
 {
-	int masktype, bits;
-	uint32_t hv;
-	struct AddressRec *arec, *arecl = NULL;
+	struct AddressIndex *aindex;
+	struct AddressRec *arec;
+	struct HostNode *hnode;
+	rb_patricia_node_t *pnode;
+	rb_dlink_list *list;
+	rb_dlink_node *ptr, *iptr;
 	struct rb_sockaddr_storage addr;
+	const char *domain;
+	int masktype, bits;
+
 	masktype = parse_netmask(address, (struct sockaddr *)&addr, &bits);
-#ifdef RB_IPV6
-	if(masktype == HM_IPV6)
-	{
-		/* We have to do this, since we do not re-hash for every bit -A1kmm. */
-		bits -= bits % 16;
-		hv = hash_ipv6((struct sockaddr *)&addr, bits);
-	}
-	else
-#endif
-	if(masktype == HM_IPV4)
-	{
-		/* We have to do this, since we do not re-hash for every bit -A1kmm. */
-		bits -= bits % 8;
-		hv = hash_ipv4((struct sockaddr *)&addr, bits);
-	}
-	else
-		hv = get_mask_hash(address);
-	for(arec = atable[hv]; arec; arec = arec->next)
+	if(bits < 0)
+		bits = 0;
+
+	/* find the list the record was filed on, under whichever type */
+	RB_DLINK_FOREACH(ptr, address_indexes.head)
 	{
-		if(arec->aconf == aconf)
+		aindex = ptr->data;
+		list = NULL;
+
+		if(masktype != HM_HOST)
 		{
-			if(arecl)
-				arecl->next = arec->next;
-			else
-				atable[hv] = arec->next;
+			rb_patricia_tree_t *tree = aindex->tree[address_family_index(masktype)];
+
+			if(tree != NULL &&
+			   (pnode = rb_match_ip_exact(tree, (struct sockaddr *)&addr, bits)) != NULL)
+				list = pnode->data;
+		}
+		else if((domain = mask_domain(address)) == NULL)
+			list = &aindex->wild;
+		else if((hnode = host_node_find(&aindex->hosts, domain, false)) != NULL)
+			list = &hnode->recs;
+
+		if(list == NULL)
+			continue;
+
+		RB_DLINK_FOREACH(iptr, list->head)
+		{
+			arec = iptr->data;
+
+			if(arec->aconf != aconf)
+				continue;
+
+			remove_address_rec(arec);
 			aconf->status |= CONF_ILLEGAL;
 			if(!aconf->clients)
 				free_conf(aconf);
-			rb_free(arec);
 			return;
 		}
-		arecl = arec;
 	}
 }
 
@@ -596,69 +733,51 @@ delete_one_address_conf(const char *address, struct ConfItem *aconf)
 void
 clear_out_address_conf(void)
 {
-	int i;
-	struct AddressRec **store_next;
-	struct AddressRec *arec, *arecn;
+	struct AddressRec *arec;
+	struct ConfItem *aconf;
+	rb_dlink_node *ptr, *next_ptr;
 
-	for(i = 0; i < ATABLE_SIZE; i++)
+	HOSTHASH_WALK_SAFE(ptr, next_ptr, arec)
 	{
-		store_next = &atable[i];
-		for(arec = atable[i]; arec; arec = arecn)
-		{
-			arecn = arec->next;
-			/* We keep the temporary K-lines and destroy the
-			 * permanent ones, just to be confusing :) -A1kmm */
-			if(arec->aconf->flags & CONF_FLAGS_TEMPORARY ||
-			   ((arec->type & ~CONF_SKIPUSER) != CONF_CLIENT &&
-			    (arec->type & ~CONF_SKIPUSER) != CONF_EXEMPTDLINE))
-			{
-				*store_next = arec;
-				store_next = &arec->next;
-			}
-			else
-			{
-				arec->aconf->status |= CONF_ILLEGAL;
-				if(!arec->aconf->clients)
-					free_conf(arec->aconf);
-				rb_free(arec);
-			}
-		}
-		*store_next = NULL;
+		/* We keep the temporary K-lines and destroy the
+		 * permanent ones, just to be confusing :) -A1kmm */
+		if(arec->aconf->flags & CONF_FLAGS_TEMPORARY ||
+		   ((arec->type & ~CONF_SKIPUSER) != CONF_CLIENT &&
+		    (arec->type & ~CONF_SKIPUSER) != CONF_EXEMPTDLINE))
+			continue;
+
+		aconf = arec->aconf;
+		remove_address_rec(arec);
+		aconf->status |= CONF_ILLEGAL;
+		if(!aconf->clients)
+			free_conf(aconf);
 	}
+	HOSTHASH_WALK_END;
 }
 
 void
 clear_out_address_conf_bans(void)
 {
-	int i;
-	struct AddressRec **store_next;
-	struct AddressRec *arec, *arecn;
+	struct AddressRec *arec;
+	struct ConfItem *aconf;
+	rb_dlink_node *ptr, *next_ptr;
 
-	for(i = 0; i < ATABLE_SIZE; i++)
+	HOSTHASH_WALK_SAFE(ptr, next_ptr, arec)
 	{
-		store_next = &atable[i];
-		for(arec = atable[i]; arec; arec = arecn)
-		{
-			arecn = arec->next;
-			/* We keep the temporary K-lines and destroy the
-			 * permanent ones, just to be confusing :) -A1kmm */
-			if(arec->aconf->flags & CONF_FLAGS_TEMPORARY ||
-			   ((arec->type & ~CONF_SKIPUSER) == CONF_CLIENT ||
-			    (arec->type & ~CONF_SKIPUSER) == CONF_EXEMPTDLINE))
-			{
-				*store_next = arec;
-				store_next = &arec->next;
-			}
-			else
-			{
-				arec->aconf->status |= CONF_ILLEGAL;
-				if(!arec->aconf->clients)
-					free_conf(arec->aconf);
-				rb_free(arec);
-			}
-		}
-		*store_next = NULL;
+		/* We keep the temporary K-lines and destroy the
+		 * permanent ones, just to be confusing :) -A1kmm */
+		if(arec->aconf->flags & CONF_FLAGS_TEMPORARY ||
+		   ((arec->type & ~CONF_SKIPUSER) == CONF_CLIENT ||
+		    (arec->type & ~CONF_SKIPUSER) == CONF_EXEMPTDLINE))
+			continue;
+
+		aconf = arec->aconf;
+		remove_address_rec(arec);
+		aconf->status |= CONF_ILLEGAL;
+		if(!aconf->clients)
+			free_conf(aconf);
 	}
+	HOSTHASH_WALK_END;
 }
 
 
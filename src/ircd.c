@@ -141,6 +141,8 @@ ircd_shutdown(const char *reason)
 		sendto_one(target_p, ":%s ERROR :Terminated by %s", me.name, reason);
 	}
 
+	send_flush_dirty();
+
 	ilog(L_MAIN, "Server Terminating. %s", reason);
 	close_logfiles();
 
@@ -457,6 +459,46 @@ setup_corefile(void)
 #endif
 }
 
+/*
+ * ircd_main_loop
+ *
+ * inputs	- nothing
+ * output	- never returns
+ * side effects - runs the io/event loop.  this is rb_lib_loop() with
+ *		  the sendq flush tacked onto the end of each pass, so a
+ *		  client that is sent many lines in one pass gets a
+ *		  single write for them.  Commands queued for the ssld
+ *		  processes are batched up the same way.
+ */
+static void ircd_main_loop(void) RB_noreturn;
+
+static void
+ircd_main_loop(void)
+{
+	time_t next;
+
+	rb_set_time();
+
+	while(1)
+	{
+		if((next = rb_event_next()) > 0)
+		{
+			next -= rb_current_time();
+			if(next <= 0)
+				next = 1000;
+			else
+				next *= 1000;
+		}
+		else
+			next = -1;
+
+		rb_select(next);
+		rb_event_run();
+		send_flush_dirty();
+		ssld_flush_dirty();
+	}
+}
+
 static void
 ilogcb(const char *buf)
 {
@@ -619,7 +661,6 @@ ratbox_main(int argc, char *argv[])
 
 	init_main_logfile(logFileName);
 	init_hash();
-	init_host_hash();
 	init_client();
 	init_channels();
 	initclass();
@@ -639,6 +680,7 @@ ratbox_main(int argc, char *argv[])
 	init_ssld();
 
 	load_conf_settings();
+	setup_ip_caches();	/* needs general::ip_cache_size */
 	if(ServerInfo.bandb_path == NULL)
 		ServerInfo.bandb_path = rb_strdup(DBPATH);
 
@@ -721,7 +763,7 @@ ratbox_main(int argc, char *argv[])
 	if(splitmode == true)
 		rb_event_add("check_splitmode", check_splitmode, NULL, 5);
 
-	rb_lib_loop(0);		/* we'll never return from here */
+	ircd_main_loop();	/* we'll never return from here */
 }
 
 void
@@ -48,6 +48,7 @@
 static rb_dlink_list listener_list;
 static int accept_precallback(rb_fde_t * F, struct sockaddr *addr, rb_socklen_t addrlen, void *data);
 static void accept_callback(rb_fde_t * F, int status, struct sockaddr *addr, rb_socklen_t addrlen, void *data);
+static void accept_listener(rb_fde_t * F, void *data);
 
 static struct Listener *
 make_listener(struct rb_sockaddr_storage *addr)
@@ -108,6 +109,30 @@ get_listener_name(struct Listener *listener)
 	return listener->printable_name;
 }
 
+/*
+ * listener_rate_period - start a new accept rate period once the current
+ * one has run for LISTENER_RATE_PERIOD, keeping its counts for STATS P
+ */
+static void
+listener_rate_period(struct Listener *listener)
+{
+	time_t elapsed = rb_current_time() - listener->rate_time;
+
+	if(elapsed < LISTENER_RATE_PERIOD)
+		return;
+
+	if(elapsed < 2 * LISTENER_RATE_PERIOD)
+	{
+		listener->last_accepted = listener->rate_accepted;
+		listener->last_refused = listener->rate_refused;
+	}
+	else
+		listener->last_accepted = listener->last_refused = 0;
+
+	listener->rate_accepted = listener->rate_refused = 0;
+	listener->rate_time = rb_current_time();
+}
+
 /*
  * show_ports - send port listing to a client
  * inputs	- pointer to client to show ports to
@@ -117,11 +142,20 @@ get_listener_name(struct Listener *listener)
 void
 show_ports(struct Client *source_p)
 {
+	char info[IRCD_BUFSIZE];
 	rb_dlink_node *ptr;
 
 	RB_DLINK_FOREACH(ptr, listener_list.head)
 	{
 		struct Listener *listener = ptr->data;
+
+		listener_rate_period(listener);
+		snprintf(info, sizeof(info),
+			 ", %d socket%s, accepted %lu (%u/min), refused %lu (%u/min)",
+			 listener->shards, listener->shards == 1 ? "" : "s",
+			 listener->accepted, listener->last_accepted,
+			 listener->refused, listener->last_refused);
+
 		sendto_one_numeric(source_p, RPL_STATSPLINE, form_str(RPL_STATSPLINE), 'P',
 #ifdef RB_IPV6
 				   ntohs(GET_SS_FAMILY(&listener->addr) ==
@@ -132,13 +166,13 @@ show_ports(struct Client *source_p)
 #endif
 				   IsOperAdmin(source_p) ? listener->name : me.name,
 				   listener->ref_count, (listener->active == true) ? "active" : "disabled",
-				   listener->ssl == true ? " ssl" : "");
+				   listener->ssl == true ? " ssl" : "", info);
 	}
 }
 
 /*
- * inetport - create a listener socket in the AF_INET or AF_INET6 domain,
- * bind it to the port given in 'port' and listen to it
+ * inetport - create the listener sockets in the AF_INET or AF_INET6 domain,
+ * bind them to the port given in 'port' and listen to them
  * returns true (1) if successful false (0) on error.
  *
  * If the operating system has a define for SOMAXCONN, use it, otherwise
@@ -149,45 +183,25 @@ show_ports(struct Client *source_p)
 #define RATBOX_SOMAXCONN SOMAXCONN
 #endif
 
-static bool
-inetport(struct Listener *listener)
+/* listener_socket()
+ *
+ * inputs	- listener, whether the port is shared with SO_REUSEPORT
+ * output	- a listening socket bound to the listeners address, or NULL
+ */
+static rb_fde_t *
+listener_socket(struct Listener *listener, bool reuseport)
 {
 	rb_fde_t *F;
-	int ret;
 	int opt = 1;
 	int saved_errno;
-	/*
-	 * At first, open a new socket
-	 */
 
 	F = rb_socket(GET_SS_FAMILY(&listener->addr), SOCK_STREAM, 0, "Listener socket");
 
-#ifdef RB_IPV6
-	if(GET_SS_FAMILY(&listener->addr) == AF_INET6)
-	{
-		struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&listener->addr;
-		if(!IN6_ARE_ADDR_EQUAL(&in6->sin6_addr, &in6addr_any))
-		{
-			rb_inet_ntop(AF_INET6, &in6->sin6_addr, listener->vhost, sizeof(listener->vhost));
-			listener->name = listener->vhost;
-		}
-	}
-	else
-#endif
-	{
-		struct sockaddr_in *in = (struct sockaddr_in *)&listener->addr;
-		if(in->sin_addr.s_addr != INADDR_ANY)
-		{
-			rb_inet_ntop(AF_INET, &in->sin_addr, listener->vhost, sizeof(listener->vhost));
-			listener->name = listener->vhost;
-		}
-	}
-
 	if(F == NULL)
 	{
 	        saved_errno = errno;
 	        log_listener("opening listener socket %s:%s", get_listener_name(listener), strerror(saved_errno));
-		return false;
+		return NULL;
 	}
 	else if((maxconnections - 10) < rb_get_fd(F))	/* XXX this is kinda bogus */
 	{
@@ -195,7 +209,7 @@ inetport(struct Listener *listener)
 		log_listener("no more connections left for listener %s:%s",
 			     get_listener_name(listener), strerror(saved_errno));
 		rb_close(F);
-		return false;
+		return NULL;
 	}
 	/*
 	 * XXX - we don't want to do all this crap for a listener
@@ -207,9 +221,20 @@ inetport(struct Listener *listener)
 		log_listener("setting SO_REUSEADDR for listener %s:%s",
 			     get_listener_name(listener), strerror(saved_errno));
 		rb_close(F);
-		return false;
+		return NULL;
 	}
 
+#ifdef SO_REUSEPORT
+	if(reuseport && setsockopt(rb_get_fd(F), SOL_SOCKET, SO_REUSEPORT, (char *)&opt, sizeof(opt)))
+	{
+	        saved_errno = errno;
+		log_listener("setting SO_REUSEPORT for listener %s:%s",
+			     get_listener_name(listener), strerror(saved_errno));
+		rb_close(F);
+		return NULL;
+	}
+#endif
+
 	/*
 	 * Bind a port to listen for new connections if port is non-null,
 	 * else assume it is already open and try get something from it.
@@ -220,20 +245,68 @@ inetport(struct Listener *listener)
 		log_listener("binding listener socket %s:%s",
 			     get_listener_name(listener), strerror(errno));
 		rb_close(F);
-		return false;
+		return NULL;
 	}
 
-	if((ret = rb_listen(F, RATBOX_SOMAXCONN, listener->ssl)))
+	if(rb_listen(F, RATBOX_SOMAXCONN, listener->ssl))
 	{
 		log_listener("listen failed for %s:%s",
 			     get_listener_name(listener), strerror(errno));
 		rb_close(F);
-		return false;
+		return NULL;
+	}
+
+	rb_setselect(F, RB_SELECT_ACCEPT, accept_listener, listener);
+	return F;
+}
+
+static bool
+inetport(struct Listener *listener)
+{
+	rb_fde_t *F;
+	int i;
+
+#ifdef RB_IPV6
+	if(GET_SS_FAMILY(&listener->addr) == AF_INET6)
+	{
+		struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&listener->addr;
+		if(!IN6_ARE_ADDR_EQUAL(&in6->sin6_addr, &in6addr_any))
+		{
+			rb_inet_ntop(AF_INET6, &in6->sin6_addr, listener->vhost, sizeof(listener->vhost));
+			listener->name = listener->vhost;
+		}
 	}
+	else
+#endif
+	{
+		struct sockaddr_in *in = (struct sockaddr_in *)&listener->addr;
+		if(in->sin_addr.s_addr != INADDR_ANY)
+		{
+			rb_inet_ntop(AF_INET, &in->sin_addr, listener->vhost, sizeof(listener->vhost));
+			listener->name = listener->vhost;
+		}
+	}
+
+#ifndef SO_REUSEPORT
+	listener->shards = 1;
+#endif
+
+	if((F = listener_socket(listener, listener->shards > 1)) == NULL)
+		return false;
 
 	listener->F = F;
 
-	rb_accept_tcp(listener->F, accept_precallback, accept_callback, listener);
+	/* the kernel spreads new connections over every socket bound with
+	 * SO_REUSEPORT, each with its own backlog.  carry on with fewer if
+	 * some cannot be opened.
+	 */
+	for(i = 1; i < listener->shards; i++)
+	{
+		if((listener->shard_F[i - 1] = listener_socket(listener, true)) == NULL)
+			break;
+	}
+
+	listener->shards = i;
 	return true;
 }
 
@@ -294,9 +367,10 @@ find_listener(struct rb_sockaddr_storage *addr)
  * port - the port number to listen on
  * vhost_ip - if non-null must contain a valid IP address string in
  * the format "255.255.255.255"
+ * shards - number of SO_REUSEPORT sockets to open on the port
  */
 void
-add_listener(int port, const char *vhost_ip, int family, bool ssl)
+add_listener(int port, const char *vhost_ip, int family, bool ssl, int shards)
 {
 	struct Listener *listener;
 	struct rb_sockaddr_storage vaddr;
@@ -360,6 +434,7 @@ add_listener(int port, const char *vhost_ip, int family, bool ssl)
 
 	listener->F = NULL;
 	listener->ssl = ssl;
+	listener->shards = IRCD_MAX(1, IRCD_MIN(shards, LISTENER_MAX_SHARDS));
 	if(inetport(listener) == true)
 		listener->active = true;
 	else
@@ -372,6 +447,8 @@ add_listener(int port, const char *vhost_ip, int family, bool ssl)
 void
 close_listener(struct Listener *listener)
 {
+	int i;
+
 	s_assert(listener != NULL);
 	if(listener == NULL)
 		return;
@@ -381,6 +458,15 @@ close_listener(struct Listener *listener)
 		listener->F = NULL;
 	}
 
+	for(i = 0; i < LISTENER_MAX_SHARDS - 1; i++)
+	{
+		if(listener->shard_F[i] != NULL)
+		{
+			rb_close(listener->shard_F[i]);
+			listener->shard_F[i] = NULL;
+		}
+	}
+
 	listener->active = false;
 
 	if(listener->ref_count)
@@ -421,7 +507,17 @@ add_connection(struct Listener *listener, rb_fde_t * F, struct sockaddr *sai, st
 	 */
 	new_client = make_client(NULL);
 
-	if(listener->ssl == true)
+	if(listener->ssl == true && ServerInfo.ssld_ring
+	   && (new_client->localClient->ssl_ctl = start_ssld_accept_ring(F, new_client->localClient->connid, sai)) != NULL)
+	{
+		/* ssld passes the client's data through its shared ring */
+		hash_add_len(HASH_CONNID, &new_client->localClient->connid, sizeof(new_client->localClient->connid), new_client);
+		F = NULL;
+		SetSSL(new_client);
+		SetSSLDRing(new_client);
+		SetSSLDHold(new_client);
+	}
+	else if(listener->ssl == true)
 	{
 		rb_fde_t *xF[2];
 		if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &xF[0], &xF[1], "Incoming ssld Connection") == -1)
@@ -432,7 +528,7 @@ add_connection(struct Listener *listener, rb_fde_t * F, struct sockaddr *sai, st
 			free_client(new_client);
 			return;
 		}
-		new_client->localClient->ssl_ctl = start_ssld_accept(F, xF[1], new_client->localClient->connid);	/* this will close F for us */
+		new_client->localClient->ssl_ctl = start_ssld_accept(F, xF[1], new_client->localClient->connid, sai);	/* this will close F for us */
 		if(new_client->localClient->ssl_ctl == NULL)
 		{
 			rb_close(xF[0]);
@@ -440,15 +536,17 @@ add_connection(struct Listener *listener, rb_fde_t * F, struct sockaddr *sai, st
 			free_client(new_client);
 			return;
 		}
+		hash_add_len(HASH_CONNID, &new_client->localClient->connid, sizeof(new_client->localClient->connid), new_client);
 		F = xF[0];
 		SetSSL(new_client);
 	}
 
-	if(rb_fd_ssl(F))	/* if you happen to have disabled ssld in the source code... ;) */
+	if(F != NULL && rb_fd_ssl(F))	/* if you happen to have disabled ssld in the source code... ;) */
 		SetSSL(new_client);
 
 
 	memcpy(&new_client->localClient->ip, sai, sizeof(struct rb_sockaddr_storage));
+	add_client_ip_index(new_client);
 	new_client->localClient->lip = rb_malloc(sizeof(struct rb_sockaddr_storage));
 	memcpy(new_client->localClient->lip, lai, sizeof(struct rb_sockaddr_storage));
 
@@ -567,3 +665,93 @@ accept_callback(rb_fde_t * F, int status, struct sockaddr *addr, rb_socklen_t ad
 	}
 	add_connection(listener, F, addr, (struct sockaddr *)&lip);
 }
+
+#ifdef RB_IPV6
+/* turn an IPv4 mapped IPv6 peer address back into a plain IPv4 one */
+static void
+unmap_sockaddr(struct rb_sockaddr_storage *addr, rb_socklen_t *addrlen)
+{
+	struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)addr;
+	struct sockaddr_in in;
+
+	if(GET_SS_FAMILY(addr) != AF_INET6 || !IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr))
+		return;
+
+	memset(&in, 0, sizeof(in));
+	in.sin_family = AF_INET;
+	in.sin_port = in6->sin6_port;
+	memcpy(&in.sin_addr, &in6->sin6_addr.s6_addr[12], sizeof(in.sin_addr));
+
+	memset(addr, 0, sizeof(struct rb_sockaddr_storage));
+	memcpy(addr, &in, sizeof(in));
+	SET_SS_LEN(addr, sizeof(struct sockaddr_in));
+	*addrlen = sizeof(struct sockaddr_in);
+}
+#endif
+
+/*
+ * accept_listener - accept up to accept_budget connections queued on one
+ * of a listener's sockets, then run the whole batch through
+ * accept_precallback() and on to accept_callback()
+ */
+static void
+accept_listener(rb_fde_t * F, void *data)
+{
+	static struct
+	{
+		rb_fde_t *F;
+		struct rb_sockaddr_storage addr;
+		rb_socklen_t addrlen;
+	} batch[ACCEPT_BUDGET_MAX];
+	struct Listener *listener = data;
+	rb_fde_t *new_F;
+	int budget, tries, count = 0, fd, i;
+
+	budget = IRCD_MAX(1, IRCD_MIN(ConfigFileEntry.accept_budget, ACCEPT_BUDGET_MAX));
+
+	for(tries = 0; tries < budget; tries++)
+	{
+		batch[count].addrlen = sizeof(struct rb_sockaddr_storage);
+		fd = accept(rb_get_fd(F), (struct sockaddr *)&batch[count].addr, &batch[count].addrlen);
+		if(fd < 0)
+			break;
+
+		if((new_F = rb_open(fd, RB_FD_SOCKET, "Incoming Connection")) == NULL)
+		{
+			close(fd);
+			continue;
+		}
+
+		if(!rb_set_nb(new_F))
+		{
+			rb_close(new_F);
+			continue;
+		}
+
+#ifdef RB_IPV6
+		unmap_sockaddr(&batch[count].addr, &batch[count].addrlen);
+#endif
+		batch[count++].F = new_F;
+	}
+
+	/* anything left over is picked up on the next pass */
+	rb_setselect(F, RB_SELECT_ACCEPT, accept_listener, listener);
+
+	listener_rate_period(listener);
+
+	for(i = 0; i < count; i++)
+	{
+		struct sockaddr *addr = (struct sockaddr *)&batch[i].addr;
+
+		if(!accept_precallback(batch[i].F, addr, batch[i].addrlen, listener))
+		{
+			listener->refused++;
+			listener->rate_refused++;
+			continue;
+		}
+
+		listener->accepted++;
+		listener->rate_accepted++;
+		accept_callback(batch[i].F, RB_OK, addr, batch[i].addrlen, listener);
+	}
+}
@@ -565,6 +565,387 @@ collapse_esc(char *pattern)
 }
 
 
+/*
+ * match_set - see match.h
+ */
+#define MATCH_SET_MIN_ANCHOR	2	/* shorter runs hit nearly every name */
+#define MATCH_SET_MAX_ANCHOR	32	/* a prefix of a run is still a run */
+
+struct match_set_node
+{
+	struct match_set_node *child;
+	struct match_set_node *sibling;
+	struct match_set_node *fail;	/* longest proper suffix in the trie */
+	struct match_set_node *out;	/* longest proper suffix with masks */
+	rb_dlink_list masks;
+	unsigned char c;
+};
+
+struct match_set_entry
+{
+	rb_dlink_node node;		/* on set->entries */
+	rb_dlink_node anode;		/* on the anchor node, or set->always */
+	struct match_set_node *anchor;
+	char *anchorstr;
+	const char *mask;
+	void *data;
+	unsigned long seq;
+	unsigned long gen;
+};
+
+/* match_set_anchor()
+ *
+ * input	- match_esc() mask, buffer of MATCH_SET_MAX_ANCHOR + 1
+ * output	- length of the longest run of literal chars in the mask,
+ *		  folded with ToLower() and copied to the buffer
+ * side effects -
+ */
+static unsigned int
+match_set_anchor(const char *mask, char *buf)
+{
+	const char *p;
+	char run[MATCH_SET_MAX_ANCHOR + 1];
+	unsigned int len = 0, best = 0;
+
+	for(p = mask;; p++)
+	{
+		char c = *p;
+
+		if(c == '\\' && p[1] != '\0')
+		{
+			p++;
+			c = (*p == 's') ? ' ' : ToLower(*p);
+		}
+		else if(c == '\0' || c == '\\' || c == '*' || c == '?' || c == '@' || c == '#')
+		{
+			if(len > best)
+			{
+				memcpy(buf, run, len);
+				best = len;
+			}
+			len = 0;
+
+			if(c == '\0' || c == '\\')
+				break;
+			continue;
+		}
+		else
+			c = ToLower(c);
+
+		if(len < MATCH_SET_MAX_ANCHOR)
+			run[len++] = c;
+	}
+
+	buf[best] = '\0';
+	return best;
+}
+
+static struct match_set_node *
+match_set_goto(struct match_set *set, struct match_set_node *node, unsigned char c)
+{
+	struct match_set_node *child;
+
+	if(node == NULL)
+		return set->root[c];
+
+	for(child = node->child; child != NULL; child = child->sibling)
+	{
+		if(child->c == c)
+			return child;
+	}
+
+	return NULL;
+}
+
+static struct match_set_node *
+match_set_insert(struct match_set *set, const char *anchor)
+{
+	struct match_set_node *node = NULL, *next, **link;
+	const unsigned char *p;
+
+	for(p = (const unsigned char *)anchor; *p != '\0'; p++)
+	{
+		if((next = match_set_goto(set, node, *p)) == NULL)
+		{
+			next = rb_malloc(sizeof(struct match_set_node));
+			next->c = *p;
+
+			link = (node == NULL) ? &set->root[*p] : &node->child;
+			next->sibling = *link;
+			*link = next;
+			set->nodes++;
+		}
+		node = next;
+	}
+
+	return node;
+}
+
+static void
+match_set_free_nodes(struct match_set_node *node)
+{
+	struct match_set_node *next;
+
+	for(; node != NULL; node = next)
+	{
+		next = node->sibling;
+		match_set_free_nodes(node->child);
+		rb_free(node);
+	}
+}
+
+/* match_set_compact()
+ *
+ * input	- set
+ * output	-
+ * side effects - trie is rebuilt from the live anchors, dropping nodes
+ *		  only deleted masks were using
+ */
+static void
+match_set_compact(struct match_set *set)
+{
+	rb_dlink_node *ptr;
+	unsigned int i;
+
+	for(i = 0; i < 256; i++)
+	{
+		match_set_free_nodes(set->root[i]);
+		set->root[i] = NULL;
+	}
+	set->nodes = 0;
+
+	RB_DLINK_FOREACH(ptr, set->entries.head)
+	{
+		struct match_set_entry *entry = ptr->data;
+
+		if(entry->anchor == NULL)
+			continue;
+
+		entry->anchor = match_set_insert(set, entry->anchorstr);
+		rb_dlinkAdd(entry, &entry->anode, &entry->anchor->masks);
+	}
+
+	set->dirty = true;
+}
+
+/* match_set_link()
+ *
+ * input	- set
+ * output	-
+ * side effects - failure and output links are filled in breadth first
+ */
+static void
+match_set_link(struct match_set *set)
+{
+	struct match_set_node **queue, *node, *child, *fail;
+	unsigned long head = 0, tail = 0;
+	unsigned int i;
+
+	queue = rb_malloc(sizeof(struct match_set_node *) * (set->nodes + 1));
+
+	for(i = 0; i < 256; i++)
+	{
+		if((node = set->root[i]) == NULL)
+			continue;
+
+		node->fail = node->out = NULL;
+		queue[tail++] = node;
+	}
+
+	while(head < tail)
+	{
+		node = queue[head++];
+
+		for(child = node->child; child != NULL; child = child->sibling)
+		{
+			for(fail = node->fail;; fail = fail->fail)
+			{
+				if((child->fail = match_set_goto(set, fail, child->c)) != NULL || fail == NULL)
+					break;
+			}
+
+			fail = child->fail;
+			if(fail == NULL)
+				child->out = NULL;
+			else
+				child->out = rb_dlink_list_length(&fail->masks) ? fail : fail->out;
+
+			queue[tail++] = child;
+		}
+	}
+
+	rb_free(queue);
+	set->dirty = false;
+}
+
+void
+match_set_add(struct match_set *set, const char *mask, void *data)
+{
+	struct match_set_entry *entry;
+	char anchor[MATCH_SET_MAX_ANCHOR + 1];
+	unsigned int len;
+
+	entry = rb_malloc(sizeof(struct match_set_entry));
+	entry->mask = mask;
+	entry->data = data;
+	entry->seq = ++set->seq;
+	rb_dlinkAdd(entry, &entry->node, &set->entries);
+
+	len = match_set_anchor(mask, anchor);
+	if(len < MATCH_SET_MIN_ANCHOR)
+	{
+		rb_dlinkAdd(entry, &entry->anode, &set->always);
+		return;
+	}
+
+	entry->anchorstr = rb_strdup(anchor);
+	entry->anchor = match_set_insert(set, anchor);
+	rb_dlinkAdd(entry, &entry->anode, &entry->anchor->masks);
+	set->anchorlen += len;
+	set->dirty = true;
+}
+
+void
+match_set_del(struct match_set *set, void *data)
+{
+	struct match_set_entry *entry;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, set->entries.head)
+	{
+		entry = ptr->data;
+
+		if(entry->data == data)
+			break;
+	}
+
+	if(ptr == NULL)
+		return;
+
+	rb_dlinkDelete(&entry->node, &set->entries);
+
+	if(entry->anchor == NULL)
+		rb_dlinkDelete(&entry->anode, &set->always);
+	else
+	{
+		rb_dlinkDelete(&entry->anode, &entry->anchor->masks);
+		set->anchorlen -= strlen(entry->anchorstr);
+	}
+
+	rb_free(entry->anchorstr);
+	rb_free(entry);
+
+	/* the links stay valid with empty nodes in the trie, only clear
+	 * them out once most of it is dead
+	 */
+	if(set->nodes > 2 * set->anchorlen + 256)
+		match_set_compact(set);
+}
+
+static void
+match_set_check(rb_dlink_list *list, const char *name, unsigned long gen, struct match_set_entry **best)
+{
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		struct match_set_entry *entry = ptr->data;
+
+		if(entry->gen == gen)
+			continue;
+
+		entry->gen = gen;
+
+		if((*best == NULL || entry->seq > (*best)->seq) && match_esc(entry->mask, name))
+			*best = entry;
+	}
+}
+
+void *
+match_set_find(struct match_set *set, const char *name)
+{
+	struct match_set_entry *best = NULL;
+	struct match_set_node *state = NULL, *next, *node;
+	const char *p;
+	unsigned long gen;
+	unsigned char c;
+
+	if(set->dirty)
+		match_set_link(set);
+
+	gen = ++set->gen;
+
+	for(p = name; *p != '\0'; p++)
+	{
+		c = ToLower(*p);
+
+		for(;;)
+		{
+			if((next = match_set_goto(set, state, c)) != NULL || state == NULL)
+				break;
+			state = state->fail;
+		}
+
+		state = next;
+
+		for(node = state; node != NULL; node = node->out)
+			match_set_check(&node->masks, name, gen, &best);
+	}
+
+	match_set_check(&set->always, name, gen, &best);
+
+	return best != NULL ? best->data : NULL;
+}
+
+#ifdef HAVE_SIMD_CASEFOLD
+/*
+ * irccmp_simd - irccmp() 16 bytes at a time
+ *
+ * Inputs	- strings to compare
+ * Output	- same as the scalar irccmp(), difference of the first
+ *		  pair of folded bytes that differ
+ * Side effects - may read up to 15 bytes past either NUL, but never
+ *		  across a page boundary
+ */
+/* the over-read is deliberate, keep ASan builds quiet about it */
+__attribute__((no_sanitize_address)) int
+irccmp_simd(const char *s1, const char *s2)
+{
+	const unsigned char *str1 = (const unsigned char *)s1;
+	const unsigned char *str2 = (const unsigned char *)s2;
+	int res;
+
+	for(;;)
+	{
+		if(IRC_SIMD_SAFE(str1) && IRC_SIMD_SAFE(str2))
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)str1);
+			__m128i b = _mm_loadu_si128((const __m128i *)str2);
+			unsigned int diff, stop;
+
+			diff = _mm_movemask_epi8(_mm_cmpeq_epi8(irc_toupper16(a), irc_toupper16(b))) ^ 0xffff;
+			stop = diff | _mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_setzero_si128()));
+			if(stop == 0)
+			{
+				str1 += 16;
+				str2 += 16;
+				continue;
+			}
+
+			/* first difference or end of s1, whichever comes first */
+			stop = __builtin_ctz(stop);
+			return ToUpper(str1[stop]) - ToUpper(str2[stop]);
+		}
+
+		/* close to a page end, step a byte until both are clear of it */
+		if((res = ToUpper(*str1) - ToUpper(*str2)) != 0 || *str1 == '\0')
+			return res;
+		str1++;
+		str2++;
+	}
+}
+#endif
+
 /* 
  * valid_hostname - check hostname for validity
  *
@@ -124,7 +124,7 @@ clear_monitor(struct Client *client_p)
 {
 	rb_dlink_node *ptr, *next_ptr;
 
-	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, client_p->localClient->monitor_list.head)
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, client_p->localClient->reg->monitor_list.head)
 	{
 		struct monitor *monptr = ptr->data;
 		rb_dlinkFindDestroy(client_p, &monptr->users);
@@ -136,8 +136,8 @@ clear_monitor(struct Client *client_p)
 		free_monitor(monptr); /* this checks if monptr is still in use */
 	}
 
-	client_p->localClient->monitor_list.head = client_p->localClient->monitor_list.tail = NULL;
-	client_p->localClient->monitor_list.length = 0;
+	client_p->localClient->reg->monitor_list.head = client_p->localClient->reg->monitor_list.tail = NULL;
+	client_p->localClient->reg->monitor_list.length = 0;
 }
 
 
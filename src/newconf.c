@@ -1618,12 +1618,31 @@ conf_set_oper_umodes(confentry_t * entry, conf_t * conf, struct conf_items *item
 
 static char *listener_address;
 static int listener_aftype = -1;
+static int listener_shards = 1;
 static void
 conf_set_listen_init(conf_t * conf)
 {
 	rb_free(listener_address);
 	listener_address = NULL;
 	listener_aftype = -1;
+	listener_shards = 1;
+}
+
+static void
+conf_set_listen_shards(confentry_t * entry, conf_t * conf, struct conf_items *item)
+{
+	if(entry->number < 1 || entry->number > LISTENER_MAX_SHARDS)
+	{
+		conf_report_warning_nl("listen::shards %d at %s:%d is out of range 1..%d, ignoring",
+				       entry->number, entry->filename, entry->line, LISTENER_MAX_SHARDS);
+		return;
+	}
+#ifndef SO_REUSEPORT
+	if(entry->number > 1)
+		conf_report_warning_nl("listen::shards at %s:%d needs SO_REUSEPORT, which this system lacks",
+				       entry->filename, entry->line);
+#endif
+	listener_shards = entry->number;
 }
 
 static void
@@ -1666,7 +1685,7 @@ conf_set_listen_port_both(confentry_t * entry, conf_t * conf, struct conf_items
 			if(listener_aftype > 0)
 				family = listener_aftype;
 #endif
-			add_listener(xentry->number, listener_address, family, ssl);
+			add_listener(xentry->number, listener_address, family, ssl, listener_shards);
 		}
 		else
 		{
@@ -1674,7 +1693,7 @@ conf_set_listen_port_both(confentry_t * entry, conf_t * conf, struct conf_items
 			if(listener_aftype <= 0 && strchr(listener_address, ':') != NULL)
 				family = AF_INET6;
 #endif
-			add_listener(xentry->number, listener_address, family, ssl);
+			add_listener(xentry->number, listener_address, family, ssl, listener_shards);
 		}
 	}
 }
@@ -2475,6 +2494,9 @@ static struct conf_items conf_serverinfo_table[] =
 	{ "ssl_cipher_list",	CF_QSTRING, NULL, 0, &ServerInfo.ssl_cipher_list },
 	{ "ssl_ecdh_named_curve",	CF_QSTRING, NULL, 0, &ServerInfo.ssl_ecdh_named_curve },
 	{ "ssld_count",		CF_INT,	    NULL, 0, &ServerInfo.ssld_count },
+	{ "ssl_ktls",		CF_YESNO,   NULL, 0, &ServerInfo.ssl_ktls },
+	{ "ssld_max_handshakes",	CF_INT,	    NULL, 0, &ServerInfo.ssld_max_handshakes },
+	{ "ssld_ring",		CF_YESNO,   NULL, 0, &ServerInfo.ssld_ring },
 	{ "tls_min_ver",	CF_QSTRING, conf_set_serverinfo_tls_min_ver, 0, NULL },
 	{ "vhost_dns",		CF_QSTRING, conf_set_serverinfo_vhost_dns, 0, NULL },
 #ifdef RB_IPV6
@@ -2543,6 +2565,7 @@ static struct conf_items conf_listen_table[] =
 	{ "port",    CF_INT | CF_FLIST, conf_set_listen_port,	 0, NULL},
 	{ "sslport", CF_INT | CF_FLIST, conf_set_listen_sslport, 0, NULL},
 	{ "aftype",  CF_STRING, conf_set_listen_aftype,	0, NULL},
+	{ "shards",  CF_INT,    conf_set_listen_shards,	0, NULL},
 	{ "\0",		0,	NULL, 0, NULL}
 };
 
@@ -2629,6 +2652,8 @@ static struct conf_items conf_general_table[] =
 	{ "reject_duration",	CF_TIME,  NULL, 0, &ConfigFileEntry.reject_duration	},
 	{ "throttle_count",	CF_INT,	  NULL, 0, &ConfigFileEntry.throttle_count	},
 	{ "throttle_duration",	CF_TIME,  NULL, 0, &ConfigFileEntry.throttle_duration	},
+	{ "ip_cache_size",	CF_TIME,  NULL, 0, &ConfigFileEntry.ip_cache_size	},
+	{ "accept_budget",	CF_INT,	  NULL, 0, &ConfigFileEntry.accept_budget	},
 	{ "post_registration_delay", CF_TIME, NULL, 0, &ConfigFileEntry.post_registration_delay },
 	{ "short_motd",		CF_YESNO, NULL, 0, &ConfigFileEntry.short_motd		},
 	{ "stats_c_oper_only",	CF_YESNO, NULL, 0, &ConfigFileEntry.stats_c_oper_only	},
@@ -2664,6 +2689,7 @@ static struct conf_items conf_channel_table[] =
 	{ "knock_delay",	CF_TIME,  NULL, 0, &ConfigChannel.knock_delay		},
 	{ "knock_delay_channel",CF_TIME,  NULL, 0, &ConfigChannel.knock_delay_channel	},
 	{ "max_bans",		CF_INT,	  NULL, 0, &ConfigChannel.max_bans		},
+	{ "ban_index_threshold", CF_INT,  NULL, 0, &ConfigChannel.ban_index_threshold	},
 	{ "max_chans_per_user", CF_INT,	  NULL, 0, &ConfigChannel.max_chans_per_user	},
 	{ "no_create_on_split", CF_YESNO, NULL, 0, &ConfigChannel.no_create_on_split	},
 	{ "no_join_on_split",	CF_YESNO, NULL, 0, &ConfigChannel.no_join_on_split	},
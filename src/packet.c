@@ -38,6 +38,82 @@
 
 static void client_dopacket(struct Client *client_p, char *buffer, size_t length);
 
+/* clients that were stopped by flood control with lines still queued */
+static rb_dlink_list parked_list;
+
+/*
+ * flood_decay - apply the per second flood decay for the time that has
+ * passed since we last looked at this client.  this used to be done by
+ * flood_recalc() for every local client every second.
+ */
+static void
+flood_decay(struct Client *client_p)
+{
+	struct LocalUser *lclient_p = client_p->localClient;
+	time_t elapsed = rb_current_time() - lclient_p->flood_lasttime;
+	time_t decay;
+
+	if(elapsed <= 0)
+		return;
+
+	lclient_p->flood_lasttime = rb_current_time();
+
+	if(IsClient(client_p))
+	{
+		if(!IsFloodDone(client_p) && ((lclient_p->firsttime + 30) < rb_current_time()))
+			flood_endgrace(client_p);
+
+		/* still in the grace period, they get a clean slate each second */
+		if(!IsFloodDone(client_p))
+			decay = lclient_p->sent_parsed;
+		else
+			decay = 2 * elapsed;
+	}
+	else
+		decay = elapsed;
+
+	if(lclient_p->sent_parsed > decay)
+		lclient_p->sent_parsed -= decay;
+	else
+		lclient_p->sent_parsed = 0;
+
+	if(lclient_p->actually_read > elapsed)
+		lclient_p->actually_read -= elapsed;
+	else
+		lclient_p->actually_read = 0;
+}
+
+/*
+ * flood_park - track whether flood control left lines queued for this
+ * client, so flood_recalc() only has to look at those clients.
+ */
+static void
+flood_park(struct Client *client_p, int throttled)
+{
+	if(throttled && rb_linebuf_len(client_p->localClient->buf_recvq) > 0)
+	{
+		if(!IsParked(client_p))
+		{
+			SetParked(client_p);
+			rb_dlinkAddTail(client_p, &client_p->localClient->parknode, &parked_list);
+		}
+	}
+	else
+		flood_unpark(client_p);
+}
+
+/*
+ * flood_unpark - remove a client from the throttled list
+ */
+void
+flood_unpark(struct Client *client_p)
+{
+	if(client_p->localClient == NULL || !IsParked(client_p))
+		return;
+
+	rb_dlinkDelete(&client_p->localClient->parknode, &parked_list);
+	ClearParked(client_p);
+}
 
 /*
  * parse_client_queued - parse client queued messages
@@ -49,16 +125,26 @@ parse_client_queued(struct Client *client_p)
 	int tested = 0;
 	int dolen = 0;
 	int checkflood = 1;
+	int throttled = 0;
 
-	if(IsAnyDead(client_p))
+	/* nothing gets parsed until ssld has finished handing the socket
+	 * over, so a link can't become a server and start ziplinks on it
+	 * while ssld may still be writing to it
+	 */
+	if(IsAnyDead(client_p) || IsHandoff(client_p))
 		return;
 
 	if(IsUnknown(client_p))
 	{
+		flood_decay(client_p);
+
 		for(;;)
 		{
 			if(client_p->localClient->sent_parsed >= client_p->localClient->allow_read)
+			{
+				throttled = 1;
 				break;
+			}
 
 			dolen = rb_linebuf_get(client_p->localClient->buf_recvq, readBuf,
 					       sizeof(readBuf), LINEBUF_COMPLETE, LINEBUF_PARSED);
@@ -88,6 +174,8 @@ parse_client_queued(struct Client *client_p)
 
 	if(IsAnyServer(client_p) || IsExemptFlood(client_p))
 	{
+		throttled = 0;
+
 		while(!IsAnyDead(client_p)
 		      && (dolen =
 			  rb_linebuf_get(client_p->localClient->buf_recvq, readBuf, sizeof(readBuf),
@@ -98,6 +186,8 @@ parse_client_queued(struct Client *client_p)
 	}
 	else if(IsClient(client_p))
 	{
+		throttled = 0;
+		flood_decay(client_p);
 
 		if(IsOper(client_p) && ConfigFileEntry.no_oper_flood)
 			checkflood = 0;
@@ -115,7 +205,10 @@ parse_client_queued(struct Client *client_p)
 			if(!tested &&
 			   (client_p->localClient->firsttime + ConfigFileEntry.post_registration_delay) >
 			   rb_current_time())
+			{
+				throttled = 1;
 				break;
+			}
 			else
 				tested = 1;
 
@@ -123,10 +216,12 @@ parse_client_queued(struct Client *client_p)
 			 *
 			 * A client is given allow_read lines to send to the server.  Every
 			 * time a line is parsed, sent_parsed is increased.  sent_parsed
-			 * is decreased by 1 every time flood_recalc is called.
+			 * is decreased by 2 for every second that passes, see
+			 * flood_decay().
 			 *
 			 * Thus a client can 'burst' allow_read lines to the server, any
-			 * excess lines will be parsed one per flood_recalc() call.
+			 * excess lines are parked and parsed as the decay allows, from
+			 * flood_recalc().
 			 *
 			 * Therefore a client will be penalised more if they keep flooding,
 			 * as sent_parsed will always hover around the allow_read limit
@@ -135,14 +230,20 @@ parse_client_queued(struct Client *client_p)
 			if(checkflood)
 			{
 				if(client_p->localClient->sent_parsed >= client_p->localClient->allow_read)
+				{
+					throttled = 1;
 					break;
+				}
 			}
 
 			/* allow opers 4 times the amount of messages as users. why 4?
 			 * why not. :) --fl_
 			 */
 			else if(client_p->localClient->sent_parsed >= (4 * client_p->localClient->allow_read))
+			{
+				throttled = 1;
 				break;
+			}
 
 			dolen = rb_linebuf_get(client_p->localClient->buf_recvq, readBuf,
 					       sizeof(readBuf), LINEBUF_COMPLETE, LINEBUF_PARSED);
@@ -156,69 +257,85 @@ parse_client_queued(struct Client *client_p)
 			client_p->localClient->sent_parsed++;
 		}
 	}
+
+	flood_park(client_p, throttled);
 }
 
 /*
  * flood_recalc
  *
- * recalculate the number of allowed flood lines. this should be called
- * once a second on any given client. We then attempt to flush some data.
+ * called once a second.  the flood decay itself is worked out when a
+ * client is parsed, so all we do here is give clients that were
+ * throttled with lines still queued another go.
  */
 void
 flood_recalc(void *unused)
 {
 	rb_dlink_node *ptr, *next;
 
-	RB_DLINK_FOREACH_SAFE(ptr, next, lclient_list.head)
+	RB_DLINK_FOREACH_SAFE(ptr, next, parked_list.head)
 	{
 		struct Client *client_p = ptr->data;
 
-		if(rb_unlikely(IsMe(client_p)))
-			continue;
-
 		if(rb_unlikely(client_p->localClient == NULL))
 			continue;
 
-		if(IsFloodDone(client_p))
-			client_p->localClient->sent_parsed -= 2;
-		else
-			client_p->localClient->sent_parsed = 0;
+		parse_client_queued(client_p);
+	}
+}
 
-		if(client_p->localClient->sent_parsed < 0)
-			client_p->localClient->sent_parsed = 0;
 
-		if(--client_p->localClient->actually_read < 0)
-			client_p->localClient->actually_read = 0;
+/*
+ * read_packet_data - queue up and parse what was read from a client,
+ * returns false if the client was exited over it
+ */
+static bool
+read_packet_data(struct Client *client_p, char *readBuf, int length)
+{
+	struct LocalUser *lclient_p = client_p->localClient;
+	int lbuf_len;
+	int binary = 0;
 
-		parse_client_queued(client_p);
+	if(client_p->localClient->lasttime < rb_current_time())
+		client_p->localClient->lasttime = rb_current_time();
+	client_p->flags &= ~FLAGS_PINGSENT;
 
-		if(rb_unlikely(IsAnyDead(client_p)))
-			continue;
+	/*
+	 * Before we even think of parsing what we just read, stick
+	 * it on the end of the receive queue and do it when its
+	 * turn comes around.
+	 */
+	if(IsHandshake(client_p) || IsUnknown(client_p))
+		binary = 1;
 
-		if(!IsFloodDone(client_p) && ((client_p->localClient->firsttime + 30) < rb_current_time()))
-			flood_endgrace(client_p);
-	}
+	lbuf_len = rb_linebuf_parse(client_p->localClient->buf_recvq, readBuf, length, binary);
 
-	RB_DLINK_FOREACH_SAFE(ptr, next, unknown_list.head)
-	{
-		struct Client *client_p = ptr->data;
+	lclient_p->actually_read += lbuf_len;
 
-		if(client_p->localClient == NULL)
-			continue;
+	if(IsAnyDead(client_p))
+		return false;
 
-		client_p->localClient->sent_parsed--;
+	/* Attempt to parse what we have, unless we're still doing auth */
+	if(lclient_p->auth_request == NULL)
+		parse_client_queued(client_p);
 
-		if(client_p->localClient->sent_parsed < 0)
-			client_p->localClient->sent_parsed = 0;
+	if(IsAnyDead(client_p))
+		return false;
 
-		if(--client_p->localClient->actually_read < 0)
-			client_p->localClient->actually_read = 0;
+	/* Check to make sure we're not flooding */
+	if(!IsAnyServer(client_p) &&
+	   (rb_linebuf_alloclen(client_p->localClient->buf_recvq) > ConfigFileEntry.client_flood))
+	{
+		if(!(ConfigFileEntry.no_oper_flood && IsOper(client_p)))
+		{
+			exit_client(client_p, client_p, client_p, "Excess Flood");
+			return false;
+		}
 
-		parse_client_queued(client_p);
 	}
+	return true;
 }
 
-
 /*
  * read_packet - Read a 'packet' of data from a connection and process it.
  */
@@ -226,12 +343,16 @@ void
 read_packet(rb_fde_t * F, void *data)
 {
 	struct Client *client_p = data;
-	struct LocalUser *lclient_p = client_p->localClient;
 	char readBuf[READBUF_SIZE];
 	int length = 0;
-	int lbuf_len;
 
-	int binary = 0;
+	/* ssld has been putting what it gets on the recvq all along */
+	if(IsSSLDRing(client_p))
+	{
+		if(!IsAnyDead(client_p))
+			parse_client_queued(client_p);
+		return;
+	}
 
 	while(1)		
 	{
@@ -262,43 +383,9 @@ read_packet(rb_fde_t * F, void *data)
 			return;
 		}
 
-		if(client_p->localClient->lasttime < rb_current_time())
-			client_p->localClient->lasttime = rb_current_time();
-		client_p->flags &= ~FLAGS_PINGSENT;
-
-		/*
-		 * Before we even think of parsing what we just read, stick
-		 * it on the end of the receive queue and do it when its
-		 * turn comes around.
-		 */
-		if(IsHandshake(client_p) || IsUnknown(client_p))
-			binary = 1;
-
-		lbuf_len = rb_linebuf_parse(client_p->localClient->buf_recvq, readBuf, length, binary);
-
-		lclient_p->actually_read += lbuf_len;
-
-		if(IsAnyDead(client_p))
+		if(!read_packet_data(client_p, readBuf, length))
 			return;
 
-		/* Attempt to parse what we have */
-		parse_client_queued(client_p);
-
-		if(IsAnyDead(client_p))
-			return;
-
-		/* Check to make sure we're not flooding */
-		if(!IsAnyServer(client_p) &&
-		   (rb_linebuf_alloclen(client_p->localClient->buf_recvq) > ConfigFileEntry.client_flood))
-		{
-			if(!(ConfigFileEntry.no_oper_flood && IsOper(client_p)))
-			{
-				exit_client(client_p, client_p, client_p, "Excess Flood");
-				return;
-			}
-
-		}
-
 		/* bail if short read */
 		if(length < sizeof(readBuf))
 		{
@@ -308,6 +395,18 @@ read_packet(rb_fde_t * F, void *data)
 	}
 }
 
+/*
+ * read_packet_buf - process data for a client that ssld passed us
+ * through its shared ring rather than a socket of the client's own
+ */
+void
+read_packet_buf(struct Client *client_p, char *buf, int length)
+{
+	if(IsAnyDead(client_p))
+		return;
+	read_packet_data(client_p, buf, length);
+}
+
 /*
  * client_dopacket - copy packet to client buf and parse it
  *	client_p - pointer to client structure for which the buffer data
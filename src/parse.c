@@ -52,6 +52,150 @@ static void do_numeric(char[], struct Client *, struct Client *, int, char **);
 
 static int handle_command(struct Message *, struct Client *, struct Client *, int, const char **);
 
+/*
+ * Command dispatch index.
+ *
+ * HASH_COMMAND remains the registry of loaded commands, but parse()
+ * looks commands up in a trie that mod_add_cmd()/mod_del_cmd() rebuild
+ * from it.  Every byte that appears in a command name is given a small
+ * symbol number, and cmd_symtab maps both cases of a byte straight to
+ * that symbol, so the lookup does the RFC1459 case folding and the
+ * child lookup with one table access per byte and no hashing.  On
+ * typical client traffic that's about 3.5 times as fast as the hash,
+ * see tools/cmdbench.
+ */
+#define CMD_TRIE_MAXNODES	65535
+
+static unsigned char cmd_symtab[256];
+static unsigned int cmd_nsyms;
+static uint16_t *cmd_child;		/* cmd_nnodes * cmd_nsyms */
+static struct Message **cmd_msg;	/* cmd_nnodes */
+static bool cmd_trie_valid;
+
+struct cmd_trie_build
+{
+	unsigned int nodes;
+	unsigned int alloc;
+};
+
+static void
+cmd_trie_count_cb(void *data, void *arg)
+{
+	struct Message *msg = data;
+	struct cmd_trie_build *build = arg;
+	const unsigned char *p;
+
+	for(p = (const unsigned char *)msg->cmd; *p; p++)
+	{
+		if(cmd_symtab[ToUpper(*p)] == 0)
+			cmd_symtab[ToUpper(*p)] = ++cmd_nsyms;
+	}
+	build->alloc += strlen(msg->cmd);
+}
+
+static void
+cmd_trie_insert_cb(void *data, void *arg)
+{
+	struct Message *msg = data;
+	struct cmd_trie_build *build = arg;
+	const unsigned char *p;
+	unsigned int node = 0;
+
+	for(p = (const unsigned char *)msg->cmd; *p; p++)
+	{
+		uint16_t *child = &cmd_child[node * cmd_nsyms + cmd_symtab[*p] - 1];
+
+		if(*child == 0)
+			*child = build->nodes++;
+		node = *child;
+	}
+	cmd_msg[node] = msg;
+}
+
+/* rebuild_command_trie()
+ *
+ * inputs	-
+ * output	-
+ * side effects - dispatch trie is rebuilt from HASH_COMMAND, if it
+ *		  would be too big parse() falls back to the hash
+ */
+static void
+rebuild_command_trie(void)
+{
+	struct cmd_trie_build build;
+	int i;
+
+	rb_free(cmd_child);
+	rb_free(cmd_msg);
+	cmd_child = NULL;
+	cmd_msg = NULL;
+	cmd_trie_valid = false;
+
+	memset(cmd_symtab, 0, sizeof(cmd_symtab));
+	cmd_nsyms = 0;
+
+	/* first pass numbers the symbols and sizes the node array */
+	build.nodes = 1;
+	build.alloc = 1;
+	hash_walkall(HASH_COMMAND, cmd_trie_count_cb, &build);
+
+	if(cmd_nsyms == 0 || build.alloc > CMD_TRIE_MAXNODES)
+		return;
+
+	/* fold the lowercase side onto the symbols we've seen */
+	for(i = 0; i < 256; i++)
+		cmd_symtab[i] = cmd_symtab[ToUpper(i)];
+
+	cmd_child = rb_malloc(sizeof(uint16_t) * build.alloc * cmd_nsyms);
+	cmd_msg = rb_malloc(sizeof(struct Message *) * build.alloc);
+	hash_walkall(HASH_COMMAND, cmd_trie_insert_cb, &build);
+
+	cmd_trie_valid = true;
+}
+
+/* find_command()
+ *
+ * inputs	- command name as sent
+ * output	- struct Message for the command, or NULL
+ * side effects -
+ */
+static inline struct Message *
+find_command(const char *command)
+{
+	const unsigned char *p = (const unsigned char *)command;
+	unsigned int node = 0;
+
+	if(rb_unlikely(!cmd_trie_valid))
+		return hash_find_data(HASH_COMMAND, command);
+
+	for(; *p; p++)
+	{
+		unsigned int sym = cmd_symtab[*p];
+
+		if(sym == 0)
+			return NULL;
+
+		node = cmd_child[node * cmd_nsyms + sym - 1];
+
+		if(node == 0)
+			return NULL;
+	}
+
+	return cmd_msg[node];
+}
+
+/* lookup_command()
+ *
+ * inputs	- command name
+ * output	- find_command() for callers outside parse()
+ * side effects -
+ */
+struct Message *
+lookup_command(const char *command)
+{
+	return find_command(command);
+}
+
 /* parse()
  *
  * given a raw buffer, parses it and generates parv, parc and sender
@@ -156,7 +300,7 @@ parse(struct Client *client_p, char *pbuffer, char *bufend)
 		if((s = strchr(ch, ' ')))
 			*s++ = '\0';
 
-		mptr = hash_find_data(HASH_COMMAND, ch);
+		mptr = find_command(ch);
 
 		/* no command or its encap only, error */
 		if(mptr == NULL || mptr->cmd == NULL)
@@ -234,6 +378,95 @@ parse(struct Client *client_p, char *pbuffer, char *bufend)
 
 }
 
+/* command_clock()
+ *
+ * input	- none
+ * output	- monotonic time in microseconds
+ * side effects -
+ */
+static unsigned long long
+command_clock(void)
+{
+	struct timespec ts;
+
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 0;
+
+	return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* record_command_time()
+ *
+ * input	- timing block, elapsed usec
+ * output	- none
+ * side effects - elapsed time is added to the histogram, bucket n
+ *		  holds calls that took less than 2^n usec
+ */
+static void
+record_command_time(struct MessageTime *mt, unsigned long long usec)
+{
+	unsigned int bucket = 0;
+
+	while(bucket < MSG_TIME_BUCKETS - 1 && (usec >> bucket) != 0)
+		bucket++;
+
+	mt->count++;
+	mt->total += usec;
+	if(usec > mt->max)
+		mt->max = usec;
+	mt->hist[bucket]++;
+}
+
+/* command_time_percentile()
+ *
+ * input	- timing block, percentile (0-100)
+ * output	- upper bound in usec of the bucket holding that percentile,
+ *		  clamped to the slowest call seen
+ * side effects -
+ */
+unsigned long
+command_time_percentile(const struct MessageTime *mt, unsigned int pct)
+{
+	unsigned long long want, seen = 0;
+	unsigned int i;
+
+	if(mt->count == 0)
+		return 0;
+
+	want = ((unsigned long long)mt->count * pct + 99) / 100;
+	for(i = 0; i < MSG_TIME_BUCKETS; i++)
+	{
+		seen += mt->hist[i];
+		if(seen >= want)
+			break;
+	}
+
+	if(i >= MSG_TIME_BUCKETS - 1 || (1UL << i) > mt->max)
+		return mt->max;
+
+	return 1UL << i;
+}
+
+static void
+clear_command_times_cb(void *data, void *unused)
+{
+	struct Message *msg = data;
+
+	memset(msg->times, 0, sizeof(msg->times));
+}
+
+/* clear_command_times()
+ *
+ * input	- none
+ * output	- none
+ * side effects - handler timings for every command are zeroed
+ */
+void
+clear_command_times(void)
+{
+	hash_walkall(HASH_COMMAND, clear_command_times_cb, NULL);
+}
+
 /*
  * handle_command
  *
@@ -251,6 +484,8 @@ handle_command(struct Message *mptr, struct Client *client_p, struct Client *fro
 	struct MessageEntry ehandler;
 	MessageHandler handler = NULL;
 	static time_t last_warning;
+	unsigned long long start;
+	int which;
 
 	if(IsAnyDead(client_p))
 		return -1;
@@ -288,7 +523,11 @@ handle_command(struct Message *mptr, struct Client *client_p, struct Client *fro
 	if(handler == NULL) /* module hasn't set a handler, just use m_ignore */
 		handler = m_ignore; 
 
+	which = IsServer(client_p) ? MSG_TIME_SERVER : MSG_TIME_LOCAL;
+	start = command_clock();
 	(*handler) (client_p, from, i, hpara);
+	record_command_time(&mptr->times[which], command_clock() - start);
+
 	if(!IsAnyDead(client_p) && IsCork(client_p) && !IsCapable(client_p, CAP_ZIP))
 	{
 		if(last_warning + 300 <= rb_current_time())
@@ -313,7 +552,7 @@ handle_encap(struct Client *client_p, struct Client *source_p, const char *comma
 
 	parv[0] = source_p->name;
 
-	mptr = hash_find_data(HASH_COMMAND, command);
+	mptr = find_command(command);
 
 	if(mptr == NULL || mptr->cmd == NULL)
 		return;
@@ -332,7 +571,7 @@ handle_encap(struct Client *client_p, struct Client *source_p, const char *comma
  * inputs	- command name
  *		- pointer to struct Message
  * output	- none
- * side effects - load this one command name
+ * side effects - load this one command name, dispatch trie is rebuilt
  *		  msg->count msg->bytes is modified in place, in
  *		  modules address space. Might not want to do that...
  */
@@ -350,13 +589,16 @@ mod_add_cmd(struct Message *msg)
 	msg->count = 0;
 	msg->rcount = 0;
 	msg->bytes = 0;
+	memset(msg->times, 0, sizeof(msg->times));
+
+	rebuild_command_trie();
 }
 
 /* mod_del_cmd
  *
  * inputs	- command name
  * output	- none
- * side effects - unload this one command name
+ * side effects - unload this one command name, dispatch trie is rebuilt
  */
 void
 mod_del_cmd(struct Message *msg)
@@ -366,7 +608,10 @@ mod_del_cmd(struct Message *msg)
 	hnode = hash_find(HASH_COMMAND, msg->cmd);
 
 	if(hnode != NULL)
+	{
 		hash_del_hnode(HASH_COMMAND, hnode);
+		rebuild_command_trie();
+	}
 	return;
 }
 
@@ -45,6 +45,7 @@ static rb_dlink_list reject_list;
 static rb_dlink_list throttle_list;
 static rb_patricia_tree_t *throttle_tree;
 static void throttle_expires(void *unused);
+static void flush_throttle(void);
 
 
 typedef struct _reject_data
@@ -74,6 +75,54 @@ typedef struct _global_data
 	int count;
 } global_t;
 
+/*
+ * With general::ip_cache_size set, throttle and reject stop keeping a
+ * patricia node per address.  Every address is counted in a count-min
+ * sketch instead, two generations of it so an estimate covers between
+ * one and two durations, and only an address whose estimate goes over
+ * the limit is given a real entry.  The entries live in a fixed table of
+ * IPCACHE_WAYS slot sets; a full set gives up a slot by second chance.
+ * Sketch counters are a byte and stop at 255 a generation.
+ * Nothing here grows after setup_ip_caches(), however many addresses
+ * come knocking.
+ */
+#define IPCACHE_DEPTH	3
+#define IPCACHE_WAYS	4
+#define IPCACHE_KEYLEN	16
+#define IPCACHE_MIN_WIDTH 1024
+#define IPCACHE_MIN_SETS 64
+
+struct ipcache_entry
+{
+	time_t time;
+	unsigned int count;
+	unsigned char key[IPCACHE_KEYLEN];
+	unsigned char keylen;	/* 0 for a free slot */
+	unsigned char ref;	/* second chance bit */
+	unsigned char hit;	/* has gone over the limit */
+};
+
+struct ipcache
+{
+	const char *name;
+	uint8_t *sketch[2];	/* current and previous generation */
+	unsigned int width;
+	time_t rotated;
+	struct ipcache_entry *table;
+	unsigned int sets;
+	unsigned int hand;
+	size_t memory;
+	unsigned long promoted;
+	unsigned long evicted;
+	unsigned long falsepos;
+};
+
+static struct ipcache throttle_cache = { .name = "throttle" };
+static struct ipcache reject_cache = { .name = "reject" };
+static size_t cache_memory;
+
+#define IPCacheActive(x)	((x)->table != NULL)
+
 
 static rb_patricia_node_t *
 add_ipline(struct ConfItem *aconf, rb_patricia_tree_t * tree, struct sockaddr *addr, int cidr)
@@ -159,11 +208,300 @@ delay_exit(void *unused)
 	}
 }
 
+/* ipcache_key - copy the address bytes of addr into key, returns how many */
+static unsigned int
+ipcache_key(struct sockaddr *addr, unsigned char *key)
+{
+#ifdef RB_IPV6
+	if(GET_SS_FAMILY(addr) == AF_INET6)
+	{
+		memcpy(key, &((struct sockaddr_in6 *)addr)->sin6_addr, 16);
+		return 16;
+	}
+#endif
+	memcpy(key, &((struct sockaddr_in *)addr)->sin_addr, 4);
+	return 4;
+}
+
+static uint32_t
+ipcache_hash(const unsigned char *key, unsigned int keylen)
+{
+	uint32_t h = 0x811c9dc5;
+	unsigned int i;
+
+	for(i = 0; i < keylen; i++)
+	{
+		h ^= key[i];
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+/* the second hash for the sketch rows, odd so every row walks the width */
+static uint32_t
+ipcache_step(uint32_t h)
+{
+	return (((h >> 16) | (h << 16)) * 0x9e3779b1) | 1;
+}
+
+static struct ipcache_entry *
+ipcache_set(struct ipcache *cache, uint32_t h)
+{
+	return &cache->table[((ipcache_step(h) >> 1) & (cache->sets - 1)) * IPCACHE_WAYS];
+}
+
+static void
+ipcache_cells(struct ipcache *cache, uint32_t h, unsigned int *cell)
+{
+	uint32_t step = ipcache_step(h);
+	unsigned int i;
+
+	for(i = 0; i < IPCACHE_DEPTH; i++)
+		cell[i] = i * cache->width + ((h + i * step) & (cache->width - 1));
+}
+
+/* ipcache_bump()
+ *
+ * inputs	- cache, address hash
+ * output	- estimated count for the address, this time included
+ * side effects - the address is counted in the current generation,
+ *		  only in the rows holding the minimum (conservative update)
+ */
+static unsigned int
+ipcache_bump(struct ipcache *cache, uint32_t h)
+{
+	unsigned int cell[IPCACHE_DEPTH];
+	unsigned int i, sum, est = UINT_MAX;
+
+	ipcache_cells(cache, h, cell);
+	for(i = 0; i < IPCACHE_DEPTH; i++)
+	{
+		sum = cache->sketch[0][cell[i]] + cache->sketch[1][cell[i]];
+		if(sum < est)
+			est = sum;
+	}
+
+	for(i = 0; i < IPCACHE_DEPTH; i++)
+	{
+		if(cache->sketch[0][cell[i]] + cache->sketch[1][cell[i]] == est &&
+		   cache->sketch[0][cell[i]] < UINT8_MAX)
+			cache->sketch[0][cell[i]]++;
+	}
+	return est + 1;
+}
+
+/* ipcache_forget - zero an address's cells, whoever else shares them */
+static void
+ipcache_forget(struct ipcache *cache, uint32_t h)
+{
+	unsigned int cell[IPCACHE_DEPTH];
+	unsigned int i;
+
+	ipcache_cells(cache, h, cell);
+	for(i = 0; i < IPCACHE_DEPTH; i++)
+		cache->sketch[0][cell[i]] = cache->sketch[1][cell[i]] = 0;
+}
+
+/* ipcache_release()
+ *
+ * inputs	- cache, entry, whether it timed out rather than being evicted
+ * output	-
+ * side effects - the slot is freed.  An address that timed out has its
+ *		  sketch counts dropped too, so when it comes back it has
+ *		  the whole limit again as the tree version would give it.
+ *		  An evicted one is still counted and can be promoted again.
+ */
+static void
+ipcache_release(struct ipcache *cache, struct ipcache_entry *e, bool expired)
+{
+	/* promoted on the sketch's word, but never went on to hold the
+	 * address off.  a collision, or a host that stopped right at the
+	 * limit -- there is no telling those apart without exact counts
+	 */
+	if(!e->hit)
+		cache->falsepos++;
+	if(expired)
+		ipcache_forget(cache, ipcache_hash(e->key, e->keylen));
+	e->keylen = 0;
+}
+
+static struct ipcache_entry *
+ipcache_find(struct ipcache *cache, uint32_t h, const unsigned char *key, unsigned int keylen,
+	     time_t duration)
+{
+	struct ipcache_entry *e = ipcache_set(cache, h);
+	unsigned int i;
+
+	for(i = 0; i < IPCACHE_WAYS; i++, e++)
+	{
+		if(e->keylen != keylen || memcmp(e->key, key, keylen))
+			continue;
+
+		if(e->time + duration <= rb_current_time())
+		{
+			ipcache_release(cache, e, true);
+			return NULL;
+		}
+		e->ref = 1;
+		return e;
+	}
+	return NULL;
+}
+
+/* ipcache_promote()
+ *
+ * inputs	- cache, address hash and key, count to start from, duration
+ * output	- the new entry
+ * side effects - a free or stale slot in the set is used if there is
+ *		  one, else the clock hand goes round the set clearing
+ *		  second chances until it finds a slot without one
+ */
+static struct ipcache_entry *
+ipcache_promote(struct ipcache *cache, uint32_t h, const unsigned char *key, unsigned int keylen,
+		unsigned int count, time_t duration)
+{
+	struct ipcache_entry *set = ipcache_set(cache, h);
+	struct ipcache_entry *e = NULL;
+	unsigned int i;
+
+	for(i = 0; i < IPCACHE_WAYS; i++)
+	{
+		if(set[i].keylen == 0)
+		{
+			e = &set[i];
+			break;
+		}
+		if(set[i].time + duration <= rb_current_time())
+		{
+			e = &set[i];
+			ipcache_release(cache, e, true);
+			break;
+		}
+	}
+
+	while(e == NULL)
+	{
+		struct ipcache_entry *victim = &set[cache->hand++ & (IPCACHE_WAYS - 1)];
+
+		if(victim->ref)
+		{
+			victim->ref = 0;
+			continue;
+		}
+		e = victim;
+		cache->evicted++;
+		ipcache_release(cache, e, false);
+	}
+
+	memcpy(e->key, key, keylen);
+	e->keylen = keylen;
+	e->count = count;
+	e->time = rb_current_time();
+	e->ref = 1;
+	e->hit = 0;
+	cache->promoted++;
+	return e;
+}
+
+/* ipcache_expire - free stale entries, start a new sketch generation
+ * once the current one is a duration old
+ */
+static void
+ipcache_expire(struct ipcache *cache, time_t duration)
+{
+	struct ipcache_entry *e = cache->table;
+	unsigned int i;
+	uint8_t *old;
+
+	for(i = 0; i < cache->sets * IPCACHE_WAYS; i++, e++)
+	{
+		if(e->keylen != 0 && e->time + duration <= rb_current_time())
+			ipcache_release(cache, e, true);
+	}
+
+	if(cache->rotated + duration > rb_current_time())
+		return;
+
+	old = cache->sketch[1];
+	memset(old, 0, sizeof(uint8_t) * IPCACHE_DEPTH * cache->width);
+	cache->sketch[1] = cache->sketch[0];
+	cache->sketch[0] = old;
+	cache->rotated = rb_current_time();
+}
+
+static unsigned long
+ipcache_count(struct ipcache *cache, unsigned int over)
+{
+	struct ipcache_entry *e = cache->table;
+	unsigned long count = 0;
+	unsigned int i;
+
+	for(i = 0; i < cache->sets * IPCACHE_WAYS; i++, e++)
+	{
+		if(e->keylen != 0 && e->count > over)
+			count++;
+	}
+	return count;
+}
+
+static void
+ipcache_flush(struct ipcache *cache)
+{
+	memset(cache->sketch[0], 0, sizeof(uint8_t) * IPCACHE_DEPTH * cache->width);
+	memset(cache->sketch[1], 0, sizeof(uint8_t) * IPCACHE_DEPTH * cache->width);
+	memset(cache->table, 0, sizeof(struct ipcache_entry) * IPCACHE_WAYS * cache->sets);
+}
+
+/* ipcache_create()
+ *
+ * inputs	- cache, memory it may use
+ * output	-
+ * side effects - a quarter of the memory goes to the sketch, the rest
+ *		  to entries, both rounded down to a power of two
+ */
+static void
+ipcache_create(struct ipcache *cache, size_t memory)
+{
+	size_t n;
+
+	n = (memory - memory / 4) / (2 * IPCACHE_DEPTH * sizeof(uint8_t));
+	for(cache->width = IPCACHE_MIN_WIDTH; cache->width * 2 <= n; cache->width *= 2)
+		;
+	n = memory / 4 / (IPCACHE_WAYS * sizeof(struct ipcache_entry));
+	for(cache->sets = IPCACHE_MIN_SETS; cache->sets * 2 <= n; cache->sets *= 2)
+		;
+
+	cache->sketch[0] = rb_malloc(sizeof(uint8_t) * IPCACHE_DEPTH * cache->width);
+	cache->sketch[1] = rb_malloc(sizeof(uint8_t) * IPCACHE_DEPTH * cache->width);
+	cache->table = rb_malloc(sizeof(struct ipcache_entry) * IPCACHE_WAYS * cache->sets);
+	cache->memory = 2 * sizeof(uint8_t) * IPCACHE_DEPTH * cache->width +
+		sizeof(struct ipcache_entry) * IPCACHE_WAYS * cache->sets;
+	cache->rotated = rb_current_time();
+	cache->hand = 0;
+	cache->promoted = cache->evicted = cache->falsepos = 0;
+}
+
+static void
+ipcache_destroy(struct ipcache *cache)
+{
+	rb_free(cache->sketch[0]);
+	rb_free(cache->sketch[1]);
+	rb_free(cache->table);
+	cache->sketch[0] = cache->sketch[1] = NULL;
+	cache->table = NULL;
+}
+
 static void
 reject_expires(void *unused)
 {
 	rb_dlink_node *ptr, *next;
 
+	if(IPCacheActive(&reject_cache))
+	{
+		ipcache_expire(&reject_cache, ConfigFileEntry.reject_duration);
+		return;
+	}
+
 	RB_DLINK_FOREACH_SAFE(ptr, next, reject_list.head)
 	{
 		rb_patricia_node_t *pnode = ptr->data;
@@ -192,6 +530,59 @@ init_reject(void)
 	rb_event_add("throttle_expires", throttle_expires, NULL, 10);
 }
 
+/* setup_ip_caches()
+ *
+ * inputs	-
+ * output	-
+ * side effects - throttle and reject are switched between the patricia
+ *		  trees and the fixed size caches to match ip_cache_size,
+ *		  everything they held is dropped if it changed
+ */
+void
+setup_ip_caches(void)
+{
+	size_t memory = ConfigFileEntry.ip_cache_size > 0 ? ConfigFileEntry.ip_cache_size : 0;
+
+	if(memory == cache_memory)
+		return;
+
+	flush_reject();
+	flush_throttle();
+	if(IPCacheActive(&throttle_cache))
+	{
+		ipcache_destroy(&throttle_cache);
+		ipcache_destroy(&reject_cache);
+	}
+
+	if(memory > 0)
+	{
+		ipcache_create(&throttle_cache, memory / 2);
+		ipcache_create(&reject_cache, memory / 2);
+	}
+	cache_memory = memory;
+}
+
+void
+report_ip_caches(struct Client *source_p)
+{
+	struct ipcache *caches[] = { &throttle_cache, &reject_cache };
+	unsigned int i;
+
+	for(i = 0; i < sizeof(caches) / sizeof(caches[0]); i++)
+	{
+		struct ipcache *cache = caches[i];
+
+		if(!IPCacheActive(cache))
+			continue;
+
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				   "T :%s cache %luk tracking %lu promoted %lu evicted %lu false positives %lu",
+				   cache->name, (unsigned long)(cache->memory / 1024),
+				   ipcache_count(cache, 0), cache->promoted, cache->evicted,
+				   cache->falsepos);
+	}
+}
+
 
 void
 add_reject(struct Client *client_p)
@@ -203,6 +594,28 @@ add_reject(struct Client *client_p)
 	if(ConfigFileEntry.reject_after_count == 0 || ConfigFileEntry.reject_duration == 0)
 		return;
 
+	if(IPCacheActive(&reject_cache))
+	{
+		struct ipcache_entry *e;
+		unsigned char key[IPCACHE_KEYLEN];
+		unsigned int keylen, count;
+		uint32_t h;
+
+		keylen = ipcache_key((struct sockaddr *)&client_p->localClient->ip, key);
+		h = ipcache_hash(key, keylen);
+		if((e = ipcache_find(&reject_cache, h, key, keylen, ConfigFileEntry.reject_duration)) != NULL)
+		{
+			e->time = rb_current_time();
+			e->count++;
+			return;
+		}
+
+		count = ipcache_bump(&reject_cache, h);
+		if(count > (unsigned int)ConfigFileEntry.reject_after_count)
+			ipcache_promote(&reject_cache, h, key, keylen, count, ConfigFileEntry.reject_duration);
+		return;
+	}
+
 	if((pnode = rb_match_ip(reject_tree, (struct sockaddr *)&client_p->localClient->ip)) != NULL)
 	{
 		rdata = pnode->data;
@@ -234,6 +647,29 @@ check_reject(rb_fde_t * F, struct sockaddr *addr)
 	if(ConfigFileEntry.reject_after_count == 0 || ConfigFileEntry.reject_duration == 0)
 		return 0;
 
+	if(IPCacheActive(&reject_cache))
+	{
+		struct ipcache_entry *e;
+		unsigned char key[IPCACHE_KEYLEN];
+		unsigned int keylen;
+
+		keylen = ipcache_key(addr, key);
+		e = ipcache_find(&reject_cache, ipcache_hash(key, keylen), key, keylen,
+				 ConfigFileEntry.reject_duration);
+		if(e == NULL)
+			return 0;
+
+		e->time = rb_current_time();
+		if(e->count > (unsigned int)ConfigFileEntry.reject_after_count)
+		{
+			e->hit = 1;
+			add_delay_exit(F, "Closing Link: (*** Banned (cache))");
+			ServerStats.is_rej++;
+			return 1;
+		}
+		return 0;
+	}
+
 	pnode = rb_match_ip(reject_tree, addr);
 	if(pnode != NULL)
 	{
@@ -256,6 +692,9 @@ flush_reject(void)
 {
 	rb_dlink_node *ptr, *next;
 
+	if(IPCacheActive(&reject_cache))
+		ipcache_flush(&reject_cache);
+
 	RB_DLINK_FOREACH_SAFE(ptr, next, reject_list.head)
 	{
 		rb_patricia_node_t *pnode = ptr->data;
@@ -275,6 +714,26 @@ remove_reject(const char *ip)
 	if(ConfigFileEntry.reject_after_count == 0 || ConfigFileEntry.reject_duration == 0)
 		return -1;
 
+	if(IPCacheActive(&reject_cache))
+	{
+		struct rb_sockaddr_storage st;
+		struct ipcache_entry *e;
+		unsigned char key[IPCACHE_KEYLEN];
+		unsigned int keylen;
+		uint32_t h;
+
+		if(!rb_inet_pton_sock(ip, (struct sockaddr *)&st))
+			return 0;
+
+		keylen = ipcache_key((struct sockaddr *)&st, key);
+		h = ipcache_hash(key, keylen);
+		ipcache_forget(&reject_cache, h);
+		if((e = ipcache_find(&reject_cache, h, key, keylen, ConfigFileEntry.reject_duration)) == NULL)
+			return 0;
+		e->keylen = 0;
+		return 1;
+	}
+
 	if((pnode = rb_match_string(reject_tree, ip)) != NULL)
 	{
 		reject_t *rdata = pnode->data;
@@ -453,6 +912,9 @@ throttle_size(void)
 	unsigned long count = 0;
 	rb_dlink_node *ptr;
 
+	if(IPCacheActive(&throttle_cache))
+		return ipcache_count(&throttle_cache, ConfigFileEntry.throttle_count);
+
 	RB_DLINK_FOREACH(ptr, throttle_list.head)
 	{
 		rb_patricia_node_t *pnode = ptr->data;
@@ -464,12 +926,60 @@ throttle_size(void)
 	return count;
 }
 
+/* throttle_cache_add()
+ *
+ * inputs	- address connecting
+ * output	- 1 if it is throttled
+ * side effects - as throttle_add(), except an address only gets an
+ *		  entry once the sketch has it over throttle_count
+ */
+static int
+throttle_cache_add(struct sockaddr *addr)
+{
+	struct ipcache_entry *e;
+	unsigned char key[IPCACHE_KEYLEN];
+	unsigned int keylen, count;
+	uint32_t h;
+	char sockhost[HOSTIPLEN + 1];
+
+	keylen = ipcache_key(addr, key);
+	h = ipcache_hash(key, keylen);
+	if((e = ipcache_find(&throttle_cache, h, key, keylen, ConfigFileEntry.throttle_duration)) == NULL)
+	{
+		count = ipcache_bump(&throttle_cache, h);
+		if(count > (unsigned int)ConfigFileEntry.throttle_count)
+			ipcache_promote(&throttle_cache, h, key, keylen, count,
+					ConfigFileEntry.throttle_duration);
+		return 0;
+	}
+
+	if(e->count > (unsigned int)ConfigFileEntry.throttle_count)
+	{
+		if(e->count == (unsigned int)ConfigFileEntry.throttle_count + 1)
+		{
+			rb_inet_ntop_sock(addr, sockhost, sizeof(sockhost));
+			sendto_realops_flags(UMODE_REJ, L_ALL, "Adding throttle for %s", sockhost);
+		}
+		e->count++;
+		e->hit = 1;
+		ServerStats.is_thr++;
+		return 1;
+	}
+	e->time = rb_current_time();
+	e->count++;
+	return 0;
+}
+
 int
 throttle_add(struct sockaddr *addr)
 {
 	throttle_t *t;
 	rb_patricia_node_t *pnode;
 	char sockhost[HOSTIPLEN + 1];
+
+	if(IPCacheActive(&throttle_cache))
+		return throttle_cache_add(addr);
+
 	if((pnode = rb_match_ip(throttle_tree, addr)) != NULL)
 	{
 		t = pnode->data;
@@ -511,6 +1021,12 @@ throttle_expires(void *unused)
 {
 	rb_dlink_node *ptr, *next;
 
+	if(IPCacheActive(&throttle_cache))
+	{
+		ipcache_expire(&throttle_cache, ConfigFileEntry.throttle_duration);
+		return;
+	}
+
 	RB_DLINK_FOREACH_SAFE(ptr, next, throttle_list.head)
 	{
 		rb_patricia_node_t *pnode = ptr->data;
@@ -525,6 +1041,22 @@ throttle_expires(void *unused)
 	}
 }
 
+static void
+flush_throttle(void)
+{
+	rb_dlink_node *ptr, *next;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, throttle_list.head)
+	{
+		rb_patricia_node_t *pnode = ptr->data;
+		throttle_t *t = pnode->data;
+
+		rb_dlinkDelete(ptr, &throttle_list);
+		rb_free(t);
+		rb_patricia_remove(throttle_tree, pnode);
+	}
+}
+
 static int
 get_global_count(struct sockaddr *addr)
 {
@@ -49,6 +49,7 @@
 #include <send.h>
 #include <hook.h>
 #include <dns.h>
+#include <hash.h>
 #include <substitution.h>
 
 #define RBL_FLAG_ISV4 0x1	
@@ -86,12 +87,28 @@ struct AuthRequest
 	int rport;
 };
 
+/* one dns lookup for a zone and address, shared by every client from that
+ * address while it is in flight, then kept for RBL_CACHE_TTL seconds
+ */
+typedef struct _rbllookup
+{
+	rb_dlink_node node;	/* rbl_cache, once answered */
+	hash_node *hnode;
+	char *host;
+	rb_dlink_list queries;	/* rblquery_t waiting on the answer */
+	uint16_t queryid;
+	time_t expires;		/* 0 while the lookup is in flight */
+	bool listed;
+	char result[HOSTIPLEN + 1];
+} rbllookup_t;
+
 typedef struct _rblquery
 {
         rb_dlink_node node;
+        rb_dlink_node lnode;
         struct AuthRequest *auth;
         rbl_t *rbl;
-        uint16_t queryid;
+        rbllookup_t *lookup;
 } rblquery_t;
 
 
@@ -146,14 +163,21 @@ static const char *HeaderMessages[] = {
 
 #define sendheader(c, r) sendto_one(c, "%s", HeaderMessages[(r)])
 
+#define RBL_CACHE_TTL	60
+#define RBL_CACHE_MAX	4096
+#define RBL_HASH_BITS	10
+
 static rb_dlink_list auth_poll_list;
 static rb_dlink_list rbl_lists;
+static rb_dlink_list rbl_cache;
+static hash_f *rbl_hash;
 
 static EVH timeout_auth_queries_event;
 static void read_auth(rb_fde_t * F, void *data);
 static void rbl_check_rbls(struct AuthRequest *auth);
 static void rbl_cancel_lookups(struct AuthRequest *);
 static void rbl_free_answer(rbl_answer_t *res);
+static void rbl_expire_cache(void);
 
 /*
  * init_auth()
@@ -164,6 +188,7 @@ void
 init_auth(void)
 {
 	memset(&auth_poll_list, 0, sizeof(auth_poll_list));
+	rbl_hash = hash_create("RBL lookups", CMP_IRCCMP, HASH_CHAINED, RBL_HASH_BITS, 0);
 	rb_event_addish("timeout_auth_queries_event", timeout_auth_queries_event, NULL, 3);
 
 }
@@ -493,6 +518,7 @@ timeout_auth_queries_event(void *notused)
 			release_auth_client(auth);
 		}
 	}
+	rbl_expire_cache();
 	return;
 }
 
@@ -775,25 +801,24 @@ rbl_set_banned(struct AuthRequest *auth, const char *rblname, const char *answer
 	SetRBLBanned(source_p);
 }
 
+/*
+ * rbl_check_answer - apply a lookup's answer to one client, using the
+ * answers configured for this rbl
+ */
 static void
-rbl_dns_callback(const char *result, int status, int aftype, void *data)
+rbl_check_answer(struct AuthRequest *auth, rbl_t *t, rbllookup_t *lookup)
 {
-        rblquery_t *query = data;
-	struct AuthRequest *auth;
-	struct Client *client;
 	struct in_addr in;
 	rb_dlink_node *ptr;
+	const char *result = lookup->result;
 
-	auth = query->auth;
-	client = auth->client;
-
-	if(status != 1 || aftype != AF_INET)
-	        goto cleanup;
+	if(lookup->listed == false)
+		return;
 
 	if(rb_inet_pton(AF_INET, result, &in) != 1)
-	        goto cleanup;
+		return;
 
-        RB_DLINK_FOREACH(ptr, query->rbl->answers.head)
+        RB_DLINK_FOREACH(ptr, t->answers.head)
         {
                 rbl_answer_t *res = ptr->data;
                 const char *mask = res->mask;
@@ -805,32 +830,86 @@ rbl_dns_callback(const char *result, int status, int aftype, void *data)
 			uint8_t c = ((uint8_t *)&in.s_addr)[3];
 			if(c == val)
 			{
-				rbl_set_banned(auth, query->rbl->rblname, res->answer);
-				goto cleanup;	 
+				rbl_set_banned(auth, t->rblname, res->answer);
+				return;
 			}
 		} 
 		if(match(mask, result) || match_ips(mask, result))
 		{
-			rbl_set_banned(auth, query->rbl->rblname, res->answer);
-			goto cleanup;
+			rbl_set_banned(auth, t->rblname, res->answer);
+			return;
 		}
         }
 
-	if(rbl_ismatchother(query->rbl))
+	if(rbl_ismatchother(t))
 	{
-		const char *reason = query->rbl->mo_answer;
+		const char *reason = t->mo_answer;
 		
 		if(EmptyString(reason))
 			reason = "IP Address: ${ip} banned by RBL";
-		rbl_set_banned(auth, query->rbl->rblname, reason);
+		rbl_set_banned(auth, t->rblname, reason);
 	}	
+}
 
-cleanup:
-        rbl_detach_rbl_from_query(query);
-	rb_dlinkDelete(&query->node, &auth->rbl_queries);
-        rb_free(query);
-        rbl_release_auth(auth);
-        
+static void
+rbl_free_lookup(rbllookup_t *lookup)
+{
+	hash_del_hnode(rbl_hash, lookup->hnode);
+	if(lookup->expires != 0)
+		rb_dlinkDelete(&lookup->node, &rbl_cache);
+	rb_free(lookup->host);
+	rb_free(lookup);
+}
+
+/*
+ * rbl_expire_cache - drop answers older than RBL_CACHE_TTL, the cache is
+ * in the order the answers came back so only the head needs looking at
+ */
+static void
+rbl_expire_cache(void)
+{
+	while(rbl_cache.head != NULL)
+	{
+		rbllookup_t *lookup = rbl_cache.head->data;
+
+		if(lookup->expires > rb_current_time())
+			break;
+		rbl_free_lookup(lookup);
+	}
+}
+
+static void
+rbl_dns_callback(const char *result, int status, int aftype, void *data)
+{
+	rbllookup_t *lookup = data;
+	rb_dlink_node *ptr;
+
+	lookup->queryid = 0;
+	if(status == 1 && aftype == AF_INET)
+	{
+		lookup->listed = true;
+		rb_strlcpy(lookup->result, result, sizeof(lookup->result));
+	}
+
+	/* cache it before the fan out, so a cancel from in there leaves it be */
+	lookup->expires = rb_current_time() + RBL_CACHE_TTL;
+	rb_dlinkAddTail(lookup, &lookup->node, &rbl_cache);
+	if(rb_dlink_list_length(&rbl_cache) > RBL_CACHE_MAX)
+		rbl_free_lookup(rbl_cache.head->data);
+
+	while((ptr = lookup->queries.head) != NULL)
+	{
+		rblquery_t *query = ptr->data;
+		struct AuthRequest *auth = query->auth;
+
+		rb_dlinkDelete(&query->lnode, &lookup->queries);
+		rbl_check_answer(auth, query->rbl, lookup);
+
+		rbl_detach_rbl_from_query(query);
+		rb_dlinkDelete(&query->node, &auth->rbl_queries);
+		rb_free(query);
+		rbl_release_auth(auth);
+	}
 }
 
 #define RBL_HOSTLEN 255
@@ -847,10 +926,13 @@ rbl_check_rbls(struct AuthRequest *auth)
 	}
 
 	sendheader(auth->client, REPORT_DO_RBL);
+
+	rbl_expire_cache();
                 
 	RB_DLINK_FOREACH_SAFE(ptr, next, rbl_lists.head)
 	{
 		rblquery_t *query;
+		rbllookup_t *lookup;
 		rbl_t *t = ptr->data;
 		int safamily = GET_SS_FAMILY(&auth->client->localClient->ip);
 
@@ -860,13 +942,37 @@ rbl_check_rbls(struct AuthRequest *auth)
 		if(safamily == AF_INET && rbl_isv4(t) != true)
 			continue;
 			
+		if(rbl_string((struct sockaddr *)&auth->client->localClient->ip, t->rblname, hostbuf, sizeof(hostbuf)) == NULL)
+			continue;
+
+		lookup = hash_find_data(rbl_hash, hostbuf);
+		if(lookup != NULL && lookup->expires != 0)
+		{
+			ServerStats.is_rbl_cached++;
+			rbl_check_answer(auth, t, lookup);
+			continue;
+		}
 
                 query = rb_malloc(sizeof(rblquery_t));
                 query->auth = auth;
-		rbl_string((struct sockaddr *)&auth->client->localClient->ip, t->rblname, hostbuf, sizeof(hostbuf));
                 rbl_attach_rbl_to_query(query, t);
                 rb_dlinkAdd(query, &query->node, &auth->rbl_queries);
-		query->queryid = lookup_hostname(hostbuf, AF_INET, rbl_dns_callback, query);
+
+		if(lookup != NULL)
+		{
+			ServerStats.is_rbl_shared++;
+			query->lookup = lookup;
+			rb_dlinkAdd(query, &query->lnode, &lookup->queries);
+			continue;
+		}
+
+		lookup = rb_malloc(sizeof(rbllookup_t));
+		lookup->host = rb_strdup(hostbuf);
+		lookup->hnode = hash_add(rbl_hash, lookup->host, lookup);
+		query->lookup = lookup;
+		rb_dlinkAdd(query, &query->lnode, &lookup->queries);
+		ServerStats.is_rbl++;
+		lookup->queryid = lookup_hostname(hostbuf, AF_INET, rbl_dns_callback, lookup);
         }
 
         if(rb_dlink_list_length(&auth->rbl_queries) <= 0)
@@ -908,12 +1014,17 @@ rbl_cancel_lookups(struct AuthRequest *auth)
         RB_DLINK_FOREACH_SAFE(ptr, next, auth->rbl_queries.head)
         {
                 rblquery_t *query = ptr->data;
-                cancel_lookup(query->queryid);
+                rbllookup_t *lookup = query->lookup;
+
+                /* the lookup carries on for anyone else waiting on it */
+                rb_dlinkDelete(&query->lnode, &lookup->queries);
+                if(lookup->expires == 0 && rb_dlink_list_length(&lookup->queries) == 0)
+                {
+                	cancel_lookup(lookup->queryid);
+                	rbl_free_lookup(lookup);
+                }
                 rbl_detach_rbl_from_query(query);
                 rb_dlinkDelete(&query->node, &auth->rbl_queries);
                 rb_free(query);
         } 
 }
-
-
-
@@ -682,6 +682,7 @@ rehash(int sig)
 	   old_global_ipv6_cidr != ConfigFileEntry.global_cidr_ipv6_bitlen)
 		rehash_global_cidr_tree();
 
+	setup_ip_caches();
 	rehash_dns_vhost();
 	return;
 }
@@ -731,6 +732,7 @@ set_default_conf(void)
 #endif
 	ServerInfo.default_max_clients = MAXCONNECTIONS;
 	ServerInfo.ssld_count = 1;
+	ServerInfo.ssld_max_handshakes = 64;
 
 
 	/* Don't reset hub, as that will break lazylinks */
@@ -814,6 +816,7 @@ set_default_conf(void)
 	ConfigChannel.knock_delay_channel = 60;
 	ConfigChannel.max_chans_per_user = 15;
 	ConfigChannel.max_bans = 100;
+	ConfigChannel.ban_index_threshold = 32;
 	ConfigChannel.burst_topicwho = YES;
 	ConfigChannel.invite_ops_only = YES;
 
@@ -838,6 +841,8 @@ set_default_conf(void)
 	ConfigFileEntry.reject_duration = 120;
 	ConfigFileEntry.throttle_count = 4;
 	ConfigFileEntry.throttle_duration = 60;
+	ConfigFileEntry.ip_cache_size = 0;
+	ConfigFileEntry.accept_budget = 64;
 	ConfigFileEntry.global_cidr_ipv4_bitlen = 24;
 	ConfigFileEntry.global_cidr_ipv4_count = 384;
 	ConfigFileEntry.global_cidr_ipv6_bitlen = 64;
@@ -1203,6 +1208,9 @@ clear_out_old_conf(void)
 	
 	ServerInfo.tls_min_ver = RB_TLS_VER_TLS1;
 	ServerInfo.ssld_count = 0;
+	ServerInfo.ssl_ktls = 0;
+	ServerInfo.ssld_ring = 0;
+	ServerInfo.ssld_max_handshakes = 64;
 	ServerInfo.hub = 0;
 
 	memset(&ServerInfo.ip, 0, sizeof(ServerInfo.ip));
@@ -66,6 +66,12 @@ rb_dlink_list tgchange_list;
 
 rb_patricia_tree_t *tgchange_tree;
 
+/* xline_conf_list and resv_nick_list compiled for find_xline() and
+ * find_nick_resv(), keep them in step through add_/del_ below
+ */
+static struct match_set xline_set;
+static struct match_set resv_nick_set;
+
 
 static void expire_temp_rxlines(void *unused);
 static void expire_nd_entries(void *unused);
@@ -138,8 +144,8 @@ clear_s_newconf_bans(void)
 		if(aconf->flags & CONF_FLAGS_TEMPORARY)
 			continue;
 
+		del_xline_conf(ptr);
 		free_conf(aconf);
-		rb_dlinkDestroy(ptr, &xline_conf_list);
 	}
 
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, resv_nick_list.head)
@@ -150,8 +156,8 @@ clear_s_newconf_bans(void)
 		if(aconf->flags & CONF_FLAGS_TEMPORARY)
 			continue;
 
+		del_nick_resv(ptr);
 		free_conf(aconf);
-		rb_dlinkDestroy(ptr, &resv_nick_list);
 	}
 
 	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, resv_channel_perm_list.head)
@@ -529,24 +535,43 @@ set_server_conf_autoconn(struct Client *source_p, char *name, int newval)
 		sendto_one_notice(source_p, ":Can't find %s", name);
 }
 
+/* add_xline_conf()
+ *
+ * input	- xline
+ * output	-
+ * side effects - xline is added to xline_conf_list and the set
+ *		  find_xline() searches
+ */
+void
+add_xline_conf(struct ConfItem *aconf)
+{
+	rb_dlinkAddAlloc(aconf, &xline_conf_list);
+	match_set_add(&xline_set, aconf->host, aconf);
+}
+
+/* del_xline_conf()
+ *
+ * input	- node of an xline on xline_conf_list
+ * output	-
+ * side effects - xline is removed from the list and set, but not freed
+ */
+void
+del_xline_conf(rb_dlink_node *ptr)
+{
+	match_set_del(&xline_set, ptr->data);
+	rb_dlinkDestroy(ptr, &xline_conf_list);
+}
+
 struct ConfItem *
 find_xline(const char *gecos, int counter)
 {
-	rb_dlink_node *ptr;
-
-	RB_DLINK_FOREACH(ptr, xline_conf_list.head)
-	{
-		struct ConfItem *aconf = ptr->data;
+	struct ConfItem *aconf;
 
-		if(match_esc(aconf->host, gecos))
-		{
-			if(counter)
-				aconf->port++;
-			return aconf;
-		}
-	}
+	aconf = match_set_find(&xline_set, gecos);
+	if(aconf != NULL && counter)
+		aconf->port++;
 
-	return NULL;
+	return aconf;
 }
 
 struct ConfItem *
@@ -565,23 +590,42 @@ find_xline_mask(const char *gecos)
 	return NULL;
 }
 
+/* add_nick_resv()
+ *
+ * input	- nick resv
+ * output	-
+ * side effects - resv is added to resv_nick_list and the set
+ *		  find_nick_resv() searches
+ */
+void
+add_nick_resv(struct ConfItem *aconf)
+{
+	rb_dlinkAddAlloc(aconf, &resv_nick_list);
+	match_set_add(&resv_nick_set, aconf->host, aconf);
+}
+
+/* del_nick_resv()
+ *
+ * input	- node of a resv on resv_nick_list
+ * output	-
+ * side effects - resv is removed from the list and set, but not freed
+ */
+void
+del_nick_resv(rb_dlink_node *ptr)
+{
+	match_set_del(&resv_nick_set, ptr->data);
+	rb_dlinkDestroy(ptr, &resv_nick_list);
+}
+
 struct ConfItem *
 find_nick_resv(const char *name)
 {
-	rb_dlink_node *ptr;
-
-	RB_DLINK_FOREACH(ptr, resv_nick_list.head)
-	{
-		struct ConfItem *aconf = ptr->data;
+	struct ConfItem *aconf;
 
-		if(match_esc(aconf->host, name))
-		{
-			aconf->port++;
-			return aconf;
-		}
-	}
+	if((aconf = match_set_find(&resv_nick_set, name)) != NULL)
+		aconf->port++;
 
-	return NULL;
+	return aconf;
 }
 
 struct ConfItem *
@@ -722,8 +766,8 @@ expire_temp_rxlines(void *unused)
 		{
 			if(ConfigFileEntry.tkline_expire_notices)
 				sendto_realops_flags(UMODE_ALL, L_ALL, "Temporary RESV for [%s] expired", aconf->host);
+			del_nick_resv(ptr);
 			free_conf(aconf);
-			rb_dlinkDestroy(ptr, &resv_nick_list);
 		}
 	}
 
@@ -736,8 +780,8 @@ expire_temp_rxlines(void *unused)
 			if(ConfigFileEntry.tkline_expire_notices)
 				sendto_realops_flags(UMODE_ALL, L_ALL,
 						     "Temporary X-line for [%s] expired", aconf->host);
+			del_xline_conf(ptr);
 			free_conf(aconf);
-			rb_dlinkDestroy(ptr, &xline_conf_list);
 		}
 	}
 }
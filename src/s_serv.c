@@ -581,6 +581,7 @@ serv_connect_ssl_callback(rb_fde_t * F, int status, void *data)
 		serv_connect_callback(F, RB_ERROR, data);
 		return;
 	}
+	hash_add_len(HASH_CONNID, &client_p->localClient->connid, sizeof(client_p->localClient->connid), client_p);
 	SetSSL(client_p);
 	serv_connect_callback(client_p->localClient->F, RB_OK, client_p);
 }
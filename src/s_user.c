@@ -498,6 +498,7 @@ register_local_user(struct Client *client_p, struct Client *source_p, const char
 		return CLIENT_EXITED;
 
 	hash_add(HASH_HOSTNAME, source_p->host, source_p);
+	add_client_host_index(source_p);
 
 	strcpy(source_p->id, generate_uid());
 	hash_add(HASH_ID, source_p->id, source_p);
@@ -509,6 +510,7 @@ register_local_user(struct Client *client_p, struct Client *source_p, const char
 	}
 
 	s_assert(!IsClient(source_p));
+	source_p->localClient->reg = rb_malloc(sizeof(struct LocalUserReg));
 	rb_dlinkMoveNode(&source_p->localClient->tnode, &unknown_list, &lclient_list);
 	SetClient(source_p);
 
@@ -39,9 +39,16 @@
 #include <s_log.h>
 #include <hook.h>
 #include <monitor.h>
+#include <sslproc.h>
 
 
+/* once a sendq holds this much we write it out straight away rather
+ * than waiting for the end of the io loop, so bursts dont balloon
+ */
+#define SENDQ_FLUSH_WATERMARK	16384
+
 static unsigned long current_serial = 0L;
+static rb_dlink_list dirty_list;
 static void send_queued_write(rb_fde_t * F, void *data);
 static void send_queued(struct Client *to);
 
@@ -98,8 +105,13 @@ send_linebuf(struct Client *to, rb_buf_head_t * linebuf)
 	to->localClient->sendM += 1;
 	me.localClient->sendM += 1;
 
-	if(rb_linebuf_len(to->localClient->buf_sendq) > 0)
+	if(rb_linebuf_len(to->localClient->buf_sendq) >= SENDQ_FLUSH_WATERMARK)
 		send_queued(to);
+	else if(!IsDirty(to))
+	{
+		SetDirty(to);
+		rb_dlinkAddTail(to, &to->localClient->dirtynode, &dirty_list);
+	}
 	return 0;
 }
 
@@ -114,6 +126,52 @@ send_pop_queue(struct Client *to)
 		send_queued(to);
 }
 
+/* send_flush_dirty()
+ *
+ * inputs	-
+ * outputs	-
+ * side effects - every client with data queued since the last call has
+ *		  its sendq written out, called once per io loop pass
+ */
+void
+send_flush_dirty(void)
+{
+	rb_dlink_node *ptr;
+
+	/* flushing can queue more (write errors notice opers), so keep
+	 * going until the list is empty
+	 */
+	while((ptr = dirty_list.head) != NULL)
+	{
+		struct Client *to = ptr->data;
+
+		rb_dlinkDelete(ptr, &dirty_list);
+		ClearDirty(to);
+
+		if(!MyConnect(to) || IsIOError(to))
+			continue;
+
+		if(rb_linebuf_len(to->localClient->buf_sendq) > 0)
+			send_queued(to);
+	}
+}
+
+/* send_cancel_flush()
+ *
+ * inputs	- client being closed
+ * outputs	-
+ * side effects - client is removed from the pending flush list
+ */
+void
+send_cancel_flush(struct Client *to)
+{
+	if(to->localClient == NULL || !IsDirty(to))
+		return;
+
+	rb_dlinkDelete(&to->localClient->dirtynode, &dirty_list);
+	ClearDirty(to);
+}
+
 /* send_rb_linebuf_remote()
  *
  * inputs	- client to attach to, sender, linebuf
@@ -174,6 +232,16 @@ send_queued(struct Client *to)
 	if(IsFlush(to))
 		return;
 
+	/* ssld is still writing out what we gave it before the handoff */
+	if(IsHandoff(to))
+		return;
+
+	if(IsSSLDRing(to))
+	{
+		ssld_ring_send(to);
+		return;
+	}
+
 	if(rb_linebuf_len(to->localClient->buf_sendq))
 	{
 		while((retlen = rb_linebuf_flush(to->localClient->F, to->localClient->buf_sendq)) > 0)
@@ -490,7 +558,9 @@ sendto_server(struct Client *one, struct Channel *chptr, unsigned long caps,
  *
  * inputs	- server not to send to, flags needed, source, channel, va_args
  * outputs	- message is sent to channel members
- * side effects -
+ * side effects - local members are walked directly, remote members are
+ *		  reached through the channels server link index, so each
+ *		  link gets one copy regardless of how many members it has
  */
 void
 sendto_channel_flags(struct Client *one, int type, struct Client *source_p,
@@ -501,6 +571,7 @@ sendto_channel_flags(struct Client *one, int type, struct Client *source_p,
 	rb_buf_head_t rb_linebuf_local;
 	rb_buf_head_t rb_linebuf_name; 
 	rb_buf_head_t rb_linebuf_id;
+	rb_dlink_list *links;
 	rb_dlink_node *ptr;
 	rb_dlink_node *next_ptr;
 
@@ -508,8 +579,6 @@ sendto_channel_flags(struct Client *one, int type, struct Client *source_p,
 	rb_linebuf_newbuf(&rb_linebuf_name);
 	rb_linebuf_newbuf(&rb_linebuf_id);
 
-	current_serial++;
-
 	va_start(args, pattern);
 	vsnprintf(buf, sizeof(buf), pattern, args);
 	va_end(args);
@@ -523,49 +592,49 @@ sendto_channel_flags(struct Client *one, int type, struct Client *source_p,
 	rb_linebuf_putmsg(&rb_linebuf_name, NULL, NULL, ":%s %s", source_p->name, buf);
 	rb_linebuf_putmsg(&rb_linebuf_id, NULL, NULL, ":%s %s", use_id(source_p), buf);
 
-
-	for(int i = MEMBER_NOOP; i < MEMBER_LAST; i++)
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, chptr->locmembers.head)
 	{
-		if(type == ONLY_CHANOPS && i == MEMBER_NOOP)
-		{
+		struct membership *msptr = ptr->data;
+		struct Client *target_p = msptr->client_p;
+
+		if(IsIOError(target_p->from) || target_p->from == one)
 			continue;
-		}
 
-		RB_DLINK_FOREACH_SAFE(ptr, next_ptr, chptr->members[i].head)
-		{
-			struct membership *msptr = ptr->data;
-			struct Client *target_p = msptr->client_p;
+		if(type && ((msptr->flags & type) == 0))
+			continue;
 
-			if(IsIOError(target_p->from) || target_p->from == one)
-				continue;
+		if(IsDeaf(target_p))
+			continue;
 
-			if(type && ((msptr->flags & type) == 0))
-				continue;
+		send_linebuf(target_p, &rb_linebuf_local);
+	}
 
-			if(IsDeaf(target_p))
-				continue;
+	/* the remote server applies the flags and +D to its own users,
+	 * we only need to know whether anyone behind a link could want it
+	 */
+	if(type == ONLY_CHANOPS)
+		links = &chptr->oplinks;
+	else
+		links = &chptr->links;
 
-			if(!MyClient(target_p))
-			{
-				/* if we've got a specific type, target must support
-				 * CHW.. --fl
-				 */
-				if(type && NotCapable(target_p->from, CAP_CHW))
-					continue;
-
-				if(target_p->from->localClient->serial != current_serial)
-				{
-					if(has_id(target_p->from))
-						send_rb_linebuf_remote(target_p, source_p, &rb_linebuf_id);
-					else
-						send_rb_linebuf_remote(target_p, source_p, &rb_linebuf_name);
-
-					target_p->from->localClient->serial = current_serial;
-				}
-			}
-			else
-				send_linebuf(target_p, &rb_linebuf_local);
-		}
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, links->head)
+	{
+		struct chanlink *lptr = ptr->data;
+		struct Client *server_p = lptr->client_p;
+
+		if(IsIOError(server_p) || server_p == one)
+			continue;
+
+		/* if we've got a specific type, target must support
+		 * CHW.. --fl
+		 */
+		if(type && NotCapable(server_p, CAP_CHW))
+			continue;
+
+		if(has_id(server_p))
+			send_rb_linebuf_remote(server_p, source_p, &rb_linebuf_id);
+		else
+			send_rb_linebuf_remote(server_p, source_p, &rb_linebuf_name);
 	}
 
 	rb_linebuf_donebuf(&rb_linebuf_local);
@@ -502,6 +502,7 @@ create_fake_client(const char *name, const char *username, const char *host,
 	make_user(fake_p);
 	
 	fake_p->localClient = rb_malloc(sizeof(struct LocalUser));
+	fake_p->localClient->reg = rb_malloc(sizeof(struct LocalUserReg));
 	
 	fake_p->from = fake_p;
 	
@@ -527,6 +528,7 @@ create_fake_client(const char *name, const char *username, const char *host,
 	fake_p->servptr = &me;
 	
 	hash_add(HASH_HOSTNAME, fake_p->host, fake_p);
+	add_client_host_index(fake_p);
 
 	strcpy(fake_p->id, generate_uid());
 
@@ -552,9 +554,11 @@ destroy_fake_client(struct Client *fake_p)
 
 	hash_del(HASH_ID, fake_p->id, fake_p);
 	hash_del(HASH_CLIENT, fake_p->name, fake_p);
+	del_client_host_index(fake_p);
 	
 	rb_dlinkDelete(&fake_p->node, &global_client_list);
 	free_user(fake_p->user, fake_p);
+	rb_free(fake_p->localClient->reg);
 	rb_free(fake_p->localClient);
 	rb_free(fake_p);
 }
@@ -37,11 +37,31 @@
 #include <send.h>
 #include <packet.h>
 #include <match.h>
+#include <numeric.h>
+#include <ssld_ring.h>
 
 #define ZIPSTATS_TIME		60
+#define SSLD_RING_BATCH		1024	/* records to take before letting others run */
 #define MAXPASSFD 4
 #define READSIZE 1024
 
+/* commands queued for an ssld in one pass of the io loop go out packed
+ * into as few datagrams as these allow.  ssld's MAXPASSFD must be at
+ * least MAXBATCHFD.
+ */
+#define MAXBATCHFD 32
+#define MAXBATCHSIZE 8192
+
+/* a handshake in progress costs an ssld about as much as this many
+ * established clients
+ */
+#define SSLD_HANDSHAKE_WEIGHT	100
+
+/* how much busier than the least loaded ssld a client's home ssld can be
+ * before the client is sent to the least loaded one instead
+ */
+#define SSLD_AFFINITY_SLACK(x)	((x) / 4 + 2 * SSLD_HANDSHAKE_WEIGHT)
+
 static void collect_zipstats(void *unused);
 static void ssl_read_ctl(rb_fde_t * F, void *data);
 static int ssld_count;
@@ -49,6 +69,9 @@ static char *ssld_path;
 static int ssld_spin_count = 0;
 static time_t last_spin;
 static int ssld_wait = 0;
+static unsigned long ssld_affinity_kept;
+static unsigned long ssld_affinity_moved;
+static unsigned long ssld_accepts_queued;
 
 typedef struct _ssl_ctl_buf
 {
@@ -68,7 +91,21 @@ struct _ssl_ctl
 	pid_t pid;
 	rb_dlink_list readq;
 	rb_dlink_list writeq;
+	rb_dlink_node dirty_node;	/* on ssl_dirty_list */
+	bool dirty;
 	bool dead;
+	unsigned long handshakes;	/* as last reported by the ssld */
+	unsigned long handshake_fails;
+	unsigned long cpu_ms;
+	int hs_pending;		/* accepts/connects the ssld hasn't finished */
+	rb_dlink_list acceptq;	/* accepts waiting for a handshake slot */
+#ifdef HAVE_SSLD_RING
+	struct ssld_rings *rings;	/* NULL until the first ring client */
+	rb_fde_t *ring_F;	/* eventfd the ssld kicks us on */
+	int ring_kick_fd;	/* eventfd we kick the ssld on */
+	rb_dlink_list ring_blocked;	/* clients waiting for room in to_ssld */
+	bool ring_failed;
+#endif
 };
 
 static void send_new_ssl_certs_one(ssl_ctl_t * ctl, const char *ssl_ca_cert, const char *ssl_cert,
@@ -78,6 +115,14 @@ static void ssl_cmd_write_queue_fmt(ssl_ctl_t * ctl, rb_fde_t ** F, int count, c
 #endif
 
 static rb_dlink_list ssl_daemons;
+static rb_dlink_list ssl_dirty_list;	/* ssld with commands to flush */
+
+static void ssld_flush_acceptq(ssl_ctl_t * ctl);
+static void ssld_drop_orphans(ssl_ctl_t * ctl);
+#ifdef HAVE_SSLD_RING
+static void ssld_ring_free(ssl_ctl_t * ctl);
+#endif
+static void ssl_process_handshake_done(ssl_ctl_t * ctl);
 
 static inline uint32_t
 buf_to_uint32(void *buf)
@@ -137,6 +182,12 @@ free_ssl_daemon(ssl_ctl_t * ctl)
 		rb_free(ctl_buf->buf);
 		rb_free(ctl_buf);
 	}
+	ssld_flush_acceptq(ctl);
+#ifdef HAVE_SSLD_RING
+	ssld_ring_free(ctl);
+#endif
+	if(ctl->dirty == true)
+		rb_dlinkDelete(&ctl->dirty_node, &ssl_dirty_list);
 	rb_close(ctl->F);
 	rb_close(ctl->P);
 	rb_dlinkDelete(&ctl->node, &ssl_daemons);
@@ -157,6 +208,35 @@ ssl_killall(void)
 		ctl->dead = true;
 		ssld_count--;
 		rb_kill(ctl->pid, SIGKILL);
+		ssld_flush_acceptq(ctl);
+		ssld_drop_orphans(ctl);
+	}
+}
+
+/*
+ * ssld_drop_orphans - nothing will close the sockets of some of a dead
+ * ssld's clients for us.  Ring clients have none of their own, and a
+ * client in the middle of a handoff has had output held for a 't' that
+ * won't come now, with no telling what the ssld got written first.
+ */
+static void
+ssld_drop_orphans(ssl_ctl_t * ctl)
+{
+	rb_dlink_list *lists[] = { &unknown_list, &lclient_list };
+	rb_dlink_node *ptr;
+	unsigned int i;
+
+	for(i = 0; i < sizeof(lists) / sizeof(lists[0]); i++)
+	{
+		RB_DLINK_FOREACH(ptr, lists[i]->head)
+		{
+			struct Client *client_p = ptr->data;
+			if(client_p->localClient->ssl_ctl == ctl && (IsHandoff(client_p) || IsSSLDRing(client_p)))
+			{
+				errno = EPIPE;
+				dead_link(client_p, false);
+			}
+		}
 	}
 }
 
@@ -169,6 +249,8 @@ ssl_dead(ssl_ctl_t * ctl)
 	ctl->dead = true;
 	ssld_count--;
 	rb_kill(ctl->pid, SIGKILL);	/* make sure the process is really gone */
+	ssld_flush_acceptq(ctl);	/* so the clients waiting on it notice */
+	ssld_drop_orphans(ctl);
 	ilog(L_MAIN, "ssld helper died - attempting to restart");
 	sendto_realops_flags(UMODE_ALL, L_ALL, "ssld helper died - attempting to restart");
 	start_ssldaemon(1, ServerInfo.ssl_ca_cert, ServerInfo.ssl_cert, ServerInfo.ssl_private_key,
@@ -421,6 +503,40 @@ ssl_process_zipstats(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
 		zips->out_ratio = 0;
 }
 
+static void
+ssl_process_handshake_stats(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
+{
+	int parc;
+	char *parv[5];
+
+	parc = rb_string_to_array((char *)ctl_buf->buf, parv, 4);
+	if(parc != 4)
+		return;
+
+	ctl->handshakes = strtoul(parv[1], NULL, 10);
+	ctl->handshake_fails = strtoul(parv[2], NULL, 10);
+	ctl->cpu_ms = strtoul(parv[3], NULL, 10);
+}
+
+static void
+ssl_client_closed(struct Client *client_p, const char *reason)
+{
+	if(IsAnyServer(client_p) || IsRegistered(client_p))
+	{
+		/* read any last moment ERROR, QUIT or the like -- jilles */
+		if(!strcmp(reason, "Remote host closed the connection"))
+			read_packet(client_p->localClient->F, client_p);
+		if(IsAnyDead(client_p))
+			return;
+	}
+	if(IsAnyServer(client_p))
+	{
+		sendto_realops_flags(UMODE_ALL, L_ALL, "ssld error for %s: %s", client_p->name, reason);
+		ilog(L_SERVER, "ssld error for %s: %s", log_client_name(client_p, SHOW_IP), reason);
+	}
+	exit_client(client_p, client_p, &me, reason);
+}
+
 static void
 ssl_process_dead_connid(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
 {
@@ -436,22 +552,91 @@ ssl_process_dead_connid(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
 	client_p = find_cli_connid_hash(connid);
 	if(client_p == NULL)
 		return;
-	if(IsAnyServer(client_p) || IsRegistered(client_p))
+	ssl_client_closed(client_p, reason);
+}
+
+/*
+ * ssl_process_handoff - ssld has a client whose socket the kernel does
+ * TLS on, take the socket and close our end of the socketpair, so ssld
+ * sees EOF once it has passed on everything we wrote before this.
+ * Output and parsing are held until ssld says it is done, reads start
+ * now as ssld never read anything from the client after the handshake.
+ */
+static void
+ssl_process_handoff(ssl_ctl_t *ctl, ssl_ctl_buf_t *ctl_buf)
+{
+	struct Client *client_p;
+	rb_fde_t *F = ctl_buf->F[0];
+	uint32_t connid;
+
+	if(ctl_buf->buflen < 5 || ctl_buf->nfds != 1)
 	{
-		/* read any last moment ERROR, QUIT or the like -- jilles */
-		if(!strcmp(reason, "Remote host closed the connection"))
-			read_packet(client_p->localClient->F, client_p);
-		if(IsAnyDead(client_p))
-			return;
+		for(int i = 0; i < ctl_buf->nfds; i++)
+			rb_close(ctl_buf->F[i]);
+		return;
 	}
-	if(IsAnyServer(client_p))
+
+	connid = buf_to_uint32(&ctl_buf->buf[1]);
+	client_p = find_cli_connid_hash(connid);
+	if(client_p == NULL || client_p->localClient == NULL || IsAnyDead(client_p))
 	{
-		sendto_realops_flags(UMODE_ALL, L_ALL, "ssld error for %s: %s", client_p->name, reason);
-		ilog(L_SERVER, "ssld error for %s: %s", log_client_name(client_p, SHOW_IP), reason);
+		rb_close(F);
+		return;
 	}
-	exit_client(client_p, client_p, &me, reason);
+
+	if(rb_get_type(F) & RB_FD_UNKNOWN)
+		rb_set_type(F, RB_FD_SOCKET);
+	rb_set_nb(F);
+
+	rb_close(client_p->localClient->F);
+	client_p->localClient->F = F;
+	ClearFlush(client_p);
+	SetHandoff(client_p);
+
+	/* auth starts reading when it lets the client go */
+	if(client_p->localClient->auth_request == NULL)
+		read_packet(F, client_p);
+}
+
+static void
+ssl_process_handoff_done(ssl_ctl_t *ctl, ssl_ctl_buf_t *ctl_buf)
+{
+	struct Client *client_p;
+	uint32_t connid;
+
+	if(ctl_buf->buflen < 5)
+		return;
+
+	connid = buf_to_uint32(&ctl_buf->buf[1]);
+	client_p = find_cli_connid_hash(connid);
+	if(client_p == NULL || client_p->localClient == NULL || !IsHandoff(client_p))
+		return;
+
+	ClearHandoff(client_p);
+	hash_del_len(HASH_CONNID, &client_p->localClient->connid, sizeof(client_p->localClient->connid), client_p);
+	ssld_decrement_clicount(client_p->localClient->ssl_ctl);
+	client_p->localClient->ssl_ctl = NULL;
+	send_pop_queue(client_p);
+
+	/* and whatever it sent meanwhile can be parsed now */
+	if(!IsAnyDead(client_p) && client_p->localClient->auth_request == NULL)
+		read_packet(client_p->localClient->F, client_p);
 }
 
+#ifdef HAVE_SSLD_RING
+/*
+ * ssl_process_ring_failed - the ssld couldn't map the rings we sent it.
+ * The ring clients it was given are refused, new ones use socketpairs.
+ */
+static void
+ssl_process_ring_failed(ssl_ctl_t * ctl)
+{
+	ilog(L_MAIN, "ssld %d could not map the shared rings, using socketpairs", (int)ctl->pid);
+	ctl->ring_failed = true;
+	ssld_ring_free(ctl);
+}
+#endif
+
 static void
 ssl_process_cmd_recv(ssl_ctl_t * ctl)
 {
@@ -475,12 +660,29 @@ ssl_process_cmd_recv(ssl_ctl_t * ctl)
 		case 'S':
 			ssl_process_zipstats(ctl, ctl_buf);
 			break;
+		case 'H':
+			ssl_process_handshake_stats(ctl, ctl_buf);
+			break;
+		case 'h':
+			ssl_process_handshake_done(ctl);
+			break;
 		case 'C':
 			ssl_process_cipher_string(ctl, ctl_buf);
 			break;
 		case 'F':
 			ssl_process_certfp(ctl, ctl_buf);
 			break;
+		case 'T':
+			ssl_process_handoff(ctl, ctl_buf);
+			break;
+		case 't':
+			ssl_process_handoff_done(ctl, ctl_buf);
+			break;
+#ifdef HAVE_SSLD_RING
+		case 'r':
+			ssl_process_ring_failed(ctl);
+			break;
+#endif
 		case 'I':
 			ircd_ssl_ok = false;
 			ilog(L_MAIN, "%s", cannot_setup_ssl);
@@ -529,7 +731,11 @@ ssl_read_ctl(rb_fde_t * F, void *data)
 			rb_free(ctl_buf);
 		}
 		else
+		{
+			while(ctl_buf->nfds < MAXPASSFD && ctl_buf->F[ctl_buf->nfds] != NULL)
+				ctl_buf->nfds++;
 			rb_dlinkAddTail(ctl_buf, &ctl_buf->node, &ctl->readq);
+		}
 	}
 	while(retlen > 0);
 
@@ -542,6 +748,22 @@ ssl_read_ctl(rb_fde_t * F, void *data)
 	rb_setselect(ctl->F, RB_SELECT_READ, ssl_read_ctl, ctl);
 }
 
+/*
+ * ssld_load - how busy an ssld is, counting handshakes in progress or
+ * waiting for a slot as much heavier than established clients
+ */
+static int
+ssld_load(ssl_ctl_t * ctl)
+{
+	return ctl->cli_count + (ctl->hs_pending + (int)rb_dlink_list_length(&ctl->acceptq)) * SSLD_HANDSHAKE_WEIGHT;
+}
+
+static bool
+ssld_handshakes_full(ssl_ctl_t * ctl)
+{
+	return ServerInfo.ssld_max_handshakes > 0 && ctl->hs_pending >= ServerInfo.ssld_max_handshakes;
+}
+
 static ssl_ctl_t *
 which_ssld(void)
 {
@@ -558,59 +780,232 @@ which_ssld(void)
 			lowest = ctl;
 			continue;
 		}
-		if(ctl->cli_count < lowest->cli_count)
+		if(ssld_load(ctl) < ssld_load(lowest))
 			lowest = ctl;
 	}
 	return (lowest);
 }
 
+static uint32_t
+ssld_addr_hash(struct sockaddr *addr)
+{
+	const uint8_t *p;
+	size_t len;
+	uint32_t h = 2166136261U;
+
+	switch(addr->sa_family)
+	{
+	case AF_INET:
+		p = (const uint8_t *)&((struct sockaddr_in *)addr)->sin_addr;
+		len = 4;
+		break;
+#ifdef RB_IPV6
+	case AF_INET6:
+		/* just the /64, privacy addresses change the rest */
+		p = (const uint8_t *)&((struct sockaddr_in6 *)addr)->sin6_addr;
+		len = 8;
+		break;
+#endif
+	default:
+		return 0;
+	}
+
+	while(len--)
+	{
+		h ^= *p++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static uint32_t
+ssld_weight(uint32_t h, pid_t pid)
+{
+	h ^= (uint32_t)pid * 0x9e3779b1U;
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h;
+}
+
+/*
+ * which_ssld_for - pick the ssld a client's address hashes to, so a
+ * client coming back lands on the ssld holding its TLS session and can
+ * resume it rather than doing a full handshake.  Rendezvous hashing on
+ * the ssld pids means only the clients of an ssld that goes away move.
+ * *homep is set to the address's own ssld, NULL if there wasn't one.
+ */
+static ssl_ctl_t *
+which_ssld_for(struct sockaddr *addr, ssl_ctl_t ** homep)
+{
+	ssl_ctl_t *lowest, *home = NULL;
+	rb_dlink_node *ptr;
+	uint32_t h, w, best = 0;
+
+	*homep = NULL;
+	lowest = which_ssld();
+	if(lowest == NULL || addr == NULL)
+		return lowest;
+
+	h = ssld_addr_hash(addr);
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ssl_ctl_t *ctl = ptr->data;
+		if(ctl->dead == true)
+			continue;
+		w = ssld_weight(h, ctl->pid);
+		if(home == NULL || w > best)
+		{
+			home = ctl;
+			best = w;
+		}
+	}
+
+	*homep = home;
+	if((ssld_handshakes_full(home) && !ssld_handshakes_full(lowest))
+	   || ssld_load(home) > ssld_load(lowest) + SSLD_AFFINITY_SLACK(ssld_load(lowest)))
+		return lowest;
+	return home;
+}
+
+/*
+ * ssld_count_affinity - count whether an accept that is actually being
+ * sent stayed on its address's ssld
+ */
+static void
+ssld_count_affinity(ssl_ctl_t * ctl, ssl_ctl_t * home)
+{
+	if(home == NULL)
+		return;
+	if(ctl == home)
+		ssld_affinity_kept++;
+	else
+		ssld_affinity_moved++;
+}
+
+/*
+ * ssl_write_ctl - send what's on an ssld's writeq.  A run of commands
+ * that fit in one datagram goes as a single 'B' command, each packed as
+ * its length (uint16), how many fds it has (uint8) and the command itself,
+ * with all of their fds passed along in order.
+ */
 static void
 ssl_write_ctl(rb_fde_t * F, void *data)
 {
 	ssl_ctl_t *ctl = data;
-	rb_dlink_node *ptr, *next;
-	int retlen, x;
+	rb_dlink_node *ptr, *next, *last;
+	ssl_ctl_buf_t *ctl_buf;
+	rb_fde_t *xF[MAXBATCHFD];
+	uint8_t batch[MAXBATCHSIZE];
+	uint16_t len;
+	size_t blen;
+	int retlen, nfds, count, x;
 
 	if(ctl->dead == true)
 		return;
 
-	RB_DLINK_FOREACH_SAFE(ptr, next, ctl->writeq.head)
+	while(ctl->writeq.head != NULL)
 	{
-		ssl_ctl_buf_t *ctl_buf = ptr->data;
-		/* in theory unix sock_dgram shouldn't ever short write this.. */
-		retlen = rb_send_fd_buf(ctl->F, ctl_buf->F, ctl_buf->nfds, ctl_buf->buf, ctl_buf->buflen, ctl->pid);
-		if(retlen > 0)
+		blen = 1;
+		nfds = 0;
+		count = 0;
+		RB_DLINK_FOREACH(ptr, ctl->writeq.head)
 		{
-			rb_dlinkDelete(ptr, &ctl->writeq);
+			ctl_buf = ptr->data;
+			if(nfds + ctl_buf->nfds > MAXBATCHFD || blen + 3 + ctl_buf->buflen > sizeof(batch))
+				break;
+			len = (uint16_t)ctl_buf->buflen;
+			memcpy(&batch[blen], &len, sizeof(len));
+			batch[blen + 2] = (uint8_t)ctl_buf->nfds;
+			memcpy(&batch[blen + 3], ctl_buf->buf, ctl_buf->buflen);
+			blen += 3 + ctl_buf->buflen;
 			for(x = 0; x < ctl_buf->nfds; x++)
-				rb_close(ctl_buf->F[x]);
-			rb_free(ctl_buf->buf);
-			rb_free(ctl_buf);
+				xF[nfds++] = ctl_buf->F[x];
+			count++;
+		}
+		last = ptr;
 
+		/* in theory unix sock_dgram shouldn't ever short write this.. */
+		ctl_buf = ctl->writeq.head->data;
+		if(count <= 1)
+		{
+			last = ctl->writeq.head->next;
+			retlen = rb_send_fd_buf(ctl->F, ctl_buf->F, ctl_buf->nfds, ctl_buf->buf, ctl_buf->buflen, ctl->pid);
+		}
+		else
+		{
+			batch[0] = 'B';
+			retlen = rb_send_fd_buf(ctl->F, xF, nfds, batch, blen, ctl->pid);
 		}
+
 		if(retlen == 0 || (retlen < 0 && !rb_ignore_errno(errno)))
 		{
 			ssl_dead(ctl);
 			return;
 		}
-		else
+		if(retlen < 0)
 		{
 			rb_setselect(ctl->F, RB_SELECT_WRITE, ssl_write_ctl, ctl);
+			return;
+		}
+
+		RB_DLINK_FOREACH_SAFE(ptr, next, ctl->writeq.head)
+		{
+			if(ptr == last)
+				break;
+			ctl_buf = ptr->data;
+			rb_dlinkDelete(ptr, &ctl->writeq);
+			for(x = 0; x < ctl_buf->nfds; x++)
+				rb_close(ctl_buf->F[x]);
+			rb_free(ctl_buf->buf);
+			rb_free(ctl_buf);
 		}
 	}
+	rb_setselect(ctl->F, RB_SELECT_WRITE, NULL, NULL);
 }
 
-
+/*
+ * ssl_write_ctl_later - have the ssld's writeq sent at the end of this
+ * pass of the io loop, so everything queued for it meanwhile can be
+ * batched up
+ */
 static void
-ssl_cmd_write_queue(ssl_ctl_t * ctl, rb_fde_t ** F, int count, const void *buf, size_t buflen)
+ssl_write_ctl_later(ssl_ctl_t * ctl)
+{
+	if(ctl->dirty == true || ctl->dead == true)
+		return;
+	ctl->dirty = true;
+	rb_dlinkAdd(ctl, &ctl->dirty_node, &ssl_dirty_list);
+}
+
+/*
+ * ssld_flush_dirty - called at the end of each pass of the io loop.  An
+ * ssld can be queued for while flushing another, a replacement for one
+ * that died gets its certs, so keep going until none are left.
+ */
+void
+ssld_flush_dirty(void)
+{
+	rb_dlink_node *ptr;
+
+	while((ptr = ssl_dirty_list.head) != NULL)
+	{
+		ssl_ctl_t *ctl = ptr->data;
+		rb_dlinkDelete(ptr, &ssl_dirty_list);
+		ctl->dirty = false;
+		ssl_write_ctl(ctl->F, ctl);
+	}
+}
+
+
+static ssl_ctl_buf_t *
+ssl_make_ctl_buf(rb_fde_t ** F, int count, const void *buf, size_t buflen)
 {
 	ssl_ctl_buf_t *ctl_buf;
 	int x;
 
-	/* don't bother */
-	if(ctl->dead == true)
-		return;
-
 	ctl_buf = rb_malloc(sizeof(ssl_ctl_buf_t));
 	ctl_buf->buf = rb_malloc(buflen);
 	memcpy(ctl_buf->buf, buf, buflen);
@@ -621,8 +1016,74 @@ ssl_cmd_write_queue(ssl_ctl_t * ctl, rb_fde_t ** F, int count, const void *buf,
 		ctl_buf->F[x] = F[x];
 	}
 	ctl_buf->nfds = count;
+	return ctl_buf;
+}
+
+static void
+ssl_cmd_write_queue(ssl_ctl_t * ctl, rb_fde_t ** F, int count, const void *buf, size_t buflen)
+{
+	ssl_ctl_buf_t *ctl_buf;
+
+	/* don't bother */
+	if(ctl->dead == true)
+		return;
+
+	ctl_buf = ssl_make_ctl_buf(F, count, buf, buflen);
 	rb_dlinkAddTail(ctl_buf, &ctl_buf->node, &ctl->writeq);
-	ssl_write_ctl(ctl->F, ctl);
+	ssl_write_ctl_later(ctl);
+}
+
+static void
+ssld_flush_acceptq(ssl_ctl_t * ctl)
+{
+	rb_dlink_node *ptr, *next;
+	int x;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, ctl->acceptq.head)
+	{
+		ssl_ctl_buf_t *ctl_buf = ptr->data;
+		rb_dlinkDelete(ptr, &ctl->acceptq);
+		for(x = 0; x < ctl_buf->nfds; x++)
+			rb_close(ctl_buf->F[x]);
+		rb_free(ctl_buf->buf);
+		rb_free(ctl_buf);
+	}
+}
+
+/*
+ * ssl_process_handshake_done - the ssld finished (or gave up on) one of
+ * the handshakes we gave it, so let the next queued accept have its slot.
+ * Clients that went away while they were queued are skipped.
+ */
+static void
+ssl_process_handshake_done(ssl_ctl_t * ctl)
+{
+	ssl_ctl_buf_t *ctl_buf;
+	bool wrote = false;
+	int x;
+
+	if(ctl->hs_pending > 0)
+		ctl->hs_pending--;
+
+	while(ctl->acceptq.head != NULL && !ssld_handshakes_full(ctl))
+	{
+		ctl_buf = ctl->acceptq.head->data;
+		rb_dlinkDelete(&ctl_buf->node, &ctl->acceptq);
+
+		if(find_cli_connid_hash(buf_to_uint32(&ctl_buf->buf[1])) == NULL)
+		{
+			for(x = 0; x < ctl_buf->nfds; x++)
+				rb_close(ctl_buf->F[x]);
+			rb_free(ctl_buf->buf);
+			rb_free(ctl_buf);
+			continue;
+		}
+		ctl->hs_pending++;
+		rb_dlinkAddTail(ctl_buf, &ctl_buf->node, &ctl->writeq);
+		wrote = true;
+	}
+	if(wrote == true)
+		ssl_write_ctl_later(ctl);
 }
 
 #if 0
@@ -663,7 +1124,7 @@ send_new_ssl_certs_one(ssl_ctl_t * ctl, const char *ssl_ca_cert, const char *ssl
 	void *x;
 	char tls_ver[20];
 	size_t len;
-	uint8_t argcnt = 7; /* modify if you add more arguments... */
+	uint8_t argcnt = 8; /* modify if you add more arguments... */
 	
 	zs = rb_zstring_alloc();
 	snprintf(tls_ver, sizeof(tls_ver), "%d", tls_min_ver);
@@ -677,6 +1138,7 @@ send_new_ssl_certs_one(ssl_ctl_t * ctl, const char *ssl_ca_cert, const char *ssl
 	zs_append(zs, ssl_cipher_list);
 	zs_append(zs, ssl_ecdh_named_curve);
 	zs_append(zs, tls_ver);
+	zs_append(zs, ServerInfo.ssl_ktls ? "1" : "0");
 
 	len = rb_zstring_to_ptr(zs, &x);	
 				
@@ -706,25 +1168,306 @@ send_new_ssl_certs(const char *ssl_ca_cert, const char *ssl_cert, const char *ss
 }
 
 
+static void
+ssld_send_accept(ssl_ctl_t * ctl, rb_fde_t ** F, int count, const char *buf, size_t buflen)
+{
+	ctl->cli_count++;
+	if(ssld_handshakes_full(ctl))
+	{
+		/* the ssld has enough on its plate, hold this one back until
+		 * it finishes a handshake
+		 */
+		ssl_ctl_buf_t *ctl_buf = ssl_make_ctl_buf(F, count, buf, buflen);
+		rb_dlinkAddTail(ctl_buf, &ctl_buf->node, &ctl->acceptq);
+		ssld_accepts_queued++;
+		return;
+	}
+	ctl->hs_pending++;
+	ssl_cmd_write_queue(ctl, F, count, buf, buflen);
+}
+
 ssl_ctl_t *
-start_ssld_accept(rb_fde_t * sslF, rb_fde_t * plainF, uint32_t id)
+start_ssld_accept(rb_fde_t * sslF, rb_fde_t * plainF, uint32_t id, struct sockaddr *addr)
 {
 	rb_fde_t *F[2];
-	ssl_ctl_t *ctl;
+	ssl_ctl_t *ctl, *home;
 	char buf[5];
 	F[0] = sslF;
 	F[1] = plainF;
 
 	buf[0] = 'A';
 	uint32_to_buf(&buf[1], id);
-	ctl = which_ssld();
+	ctl = which_ssld_for(addr, &home);
 	if(ctl == NULL)
 		return NULL;
-	ctl->cli_count++;
-	ssl_cmd_write_queue(ctl, F, 2, buf, sizeof(buf));
+	ssld_count_affinity(ctl, home);
+	ssld_send_accept(ctl, F, 2, buf, sizeof(buf));
 	return ctl;
 }
 
+#ifdef HAVE_SSLD_RING
+static void
+ssld_ring_process(ssl_ctl_t * ctl, struct ssld_ring_rec *rec, char *buf)
+{
+	struct Client *client_p;
+
+	client_p = find_cli_connid_hash(rec->connid);
+	if(client_p == NULL || !IsSSLDRing(client_p) || IsAnyDead(client_p))
+		return;
+
+	switch (rec->type)
+	{
+	case SSLD_RING_DATA:
+		read_packet_buf(client_p, buf, rec->len);
+		break;
+	case SSLD_RING_CLOSE:
+		buf[rec->len] = '\0';
+		ssl_client_closed(client_p, rec->len > 0 ? buf : "Remote host closed the connection");
+		break;
+	case SSLD_RING_CORK:
+		SetSSLDHold(client_p);
+		break;
+	case SSLD_RING_UNCORK:
+		SetSSLDOpen(client_p);
+		ClearSSLDHold(client_p);
+		send_pop_queue(client_p);
+		break;
+	}
+}
+
+/*
+ * ssld_ring_read - the ssld kicked us, either it put records in to_ircd
+ * after we'd gone to sleep on it or it made room in to_ssld for clients
+ * that were waiting for some
+ */
+static void
+ssld_ring_read(rb_fde_t * F, void *data)
+{
+	ssl_ctl_t *ctl = data;
+	struct ssld_ring *r;
+	struct ssld_ring_rec rec;
+	char buf[SSLD_RING_MAXDATA + 1];
+	rb_dlink_node *ptr, *next;
+	int count = 0;
+
+	if(ctl->dead == true)
+		return;
+
+	r = &ctl->rings->to_ircd;
+	ssld_ring_unkick(rb_get_fd(F));
+	do
+	{
+		while(count < SSLD_RING_BATCH && ssld_ring_get(r, &rec, buf))
+		{
+			ssld_ring_process(ctl, &rec, buf);
+			count++;
+		}
+		if(ssld_ring_wake_producer(r))
+			ssld_ring_kick(ctl->ring_kick_fd);
+		if(count >= SSLD_RING_BATCH)
+		{
+			/* come back for the rest after everyone else */
+			ssld_ring_kick(rb_get_fd(F));
+			break;
+		}
+	}
+	while(!ssld_ring_sleep(r));
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, ctl->ring_blocked.head)
+	{
+		struct Client *client_p = ptr->data;
+		rb_dlinkDestroy(ptr, &ctl->ring_blocked);
+		ClearFlush(client_p);
+		send_pop_queue(client_p);
+	}
+	rb_setselect(F, RB_SELECT_READ, ssld_ring_read, ctl);
+}
+
+/*
+ * ssld_ring_attach - set up the rings with an ssld the first time a client
+ * is to go through them, and pass it the memory, the eventfd it waits on
+ * and the one it kicks us on
+ */
+static bool
+ssld_ring_attach(ssl_ctl_t * ctl)
+{
+	rb_fde_t *F[3];
+	int memfd, ircd_efd = -1, ssld_efd = -1, ircd_dup = -1, ssld_dup = -1;
+	void *p = MAP_FAILED;
+
+	if(ctl->rings != NULL)
+		return true;
+	if(ctl->ring_failed == true)
+		return false;
+
+	if((memfd = memfd_create("ssld rings", MFD_CLOEXEC)) < 0
+	   || ftruncate(memfd, sizeof(struct ssld_rings)) < 0
+	   || (p = mmap(NULL, sizeof(struct ssld_rings), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED
+	   || (ircd_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0
+	   || (ssld_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0
+	   || (ircd_dup = dup(ircd_efd)) < 0 || (ssld_dup = dup(ssld_efd)) < 0)
+	{
+		ilog(L_MAIN, "Unable to set up shared rings with ssld %d, using socketpairs: %s",
+		     (int)ctl->pid, strerror(errno));
+		if(p != MAP_FAILED)
+			munmap(p, sizeof(struct ssld_rings));
+		if(memfd >= 0)
+			close(memfd);
+		if(ircd_efd >= 0)
+			close(ircd_efd);
+		if(ssld_efd >= 0)
+			close(ssld_efd);
+		if(ircd_dup >= 0)
+			close(ircd_dup);
+		ctl->ring_failed = true;
+		return false;
+	}
+
+	ctl->rings = p;
+	ctl->ring_F = rb_open(ircd_efd, RB_FD_PIPE, "ssld ring eventfd");
+	ctl->ring_kick_fd = ssld_efd;
+
+	F[0] = rb_open(memfd, RB_FD_FILE, "ssld ring memory");
+	F[1] = rb_open(ssld_dup, RB_FD_PIPE, "ssld ring eventfd");
+	F[2] = rb_open(ircd_dup, RB_FD_PIPE, "ssld ring eventfd");
+	ssl_cmd_write_queue(ctl, F, 3, "R", 1);
+
+	rb_setselect(ctl->ring_F, RB_SELECT_READ, ssld_ring_read, ctl);
+	return true;
+}
+
+static void
+ssld_ring_free(ssl_ctl_t * ctl)
+{
+	rb_dlink_node *ptr, *next;
+
+	if(ctl->rings == NULL)
+		return;
+	RB_DLINK_FOREACH_SAFE(ptr, next, ctl->ring_blocked.head)
+	{
+		ClearFlush((struct Client *)ptr->data);
+		rb_dlinkDestroy(ptr, &ctl->ring_blocked);
+	}
+	munmap(ctl->rings, sizeof(struct ssld_rings));
+	rb_close(ctl->ring_F);
+	close(ctl->ring_kick_fd);
+	ctl->rings = NULL;
+}
+
+ssl_ctl_t *
+start_ssld_accept_ring(rb_fde_t * sslF, uint32_t id, struct sockaddr *addr)
+{
+	ssl_ctl_t *ctl, *home;
+	char buf[5];
+
+	buf[0] = 'a';
+	uint32_to_buf(&buf[1], id);
+	ctl = which_ssld_for(addr, &home);
+	if(ctl == NULL || !ssld_ring_attach(ctl))
+		return NULL;	/* add_connection falls back and picks again */
+	ssld_count_affinity(ctl, home);
+	ssld_send_accept(ctl, &sslF, 1, buf, sizeof(buf));
+	return ctl;
+}
+
+/*
+ * ssld_ring_send - move a ring client's sendq into to_ssld, as many whole
+ * lines to a record as fit.  If there's no room the client waits on the
+ * ssld's ring_blocked list until it makes some.
+ */
+void
+ssld_ring_send(struct Client *to)
+{
+	ssl_ctl_t *ctl = to->localClient->ssl_ctl;
+	struct ssld_ring *r;
+	char buf[SSLD_RING_MAXDATA];
+	int len, retlen;
+
+	if(IsSSLDHold(to) || ctl == NULL || ctl->dead == true || ctl->rings == NULL)
+		return;
+
+	r = &ctl->rings->to_ssld;
+	while(rb_linebuf_len(to->localClient->buf_sendq))
+	{
+		if(!ssld_ring_reserve(r, sizeof(buf)))
+		{
+			if(!IsFlush(to))
+			{
+				SetFlush(to);
+				rb_dlinkAddAlloc(to, &ctl->ring_blocked);
+			}
+			break;
+		}
+
+		len = 0;
+		while(sizeof(buf) - len > LINEBUF_SIZE + 2
+		      && (retlen = rb_linebuf_get(to->localClient->buf_sendq, buf + len, sizeof(buf) - len,
+						  LINEBUF_COMPLETE, LINEBUF_RAW)) > 0)
+			len += retlen;
+		if(len == 0)
+			break;
+
+		ssld_ring_put(r, to->localClient->connid, SSLD_RING_DATA, buf, len);
+		to->localClient->sendB += len;
+		me.localClient->sendB += len;
+	}
+
+	if(ssld_ring_wake_consumer(r))
+		ssld_ring_kick(ctl->ring_kick_fd);
+}
+
+/*
+ * ssld_ring_close - tell the ssld a ring client is gone.  Until its
+ * handshake is done ssld may not even have the connection yet, so that
+ * goes the same way as the accept did, otherwise it follows the data.
+ */
+void
+ssld_ring_close(struct Client *client_p)
+{
+	ssl_ctl_t *ctl = client_p->localClient->ssl_ctl;
+	struct ssld_ring *r;
+	char buf[5];
+
+	if(ctl == NULL || ctl->rings == NULL)
+		return;
+	if(IsFlush(client_p))
+	{
+		rb_dlinkFindDestroy(client_p, &ctl->ring_blocked);
+		ClearFlush(client_p);
+	}
+	if(ctl->dead == true)
+		return;
+
+	r = &ctl->rings->to_ssld;
+	if(IsSSLDOpen(client_p) && ssld_ring_put(r, client_p->localClient->connid, SSLD_RING_CLOSE, "", 0))
+	{
+		if(ssld_ring_wake_consumer(r))
+			ssld_ring_kick(ctl->ring_kick_fd);
+		return;
+	}
+
+	buf[0] = 'c';
+	uint32_to_buf(&buf[1], client_p->localClient->connid);
+	ssl_cmd_write_queue(ctl, NULL, 0, buf, sizeof(buf));
+}
+#else
+ssl_ctl_t *
+start_ssld_accept_ring(rb_fde_t * sslF, uint32_t id, struct sockaddr *addr)
+{
+	return NULL;
+}
+
+void
+ssld_ring_send(struct Client *to)
+{
+}
+
+void
+ssld_ring_close(struct Client *client_p)
+{
+}
+#endif /* HAVE_SSLD_RING */
+
 ssl_ctl_t *
 start_ssld_connect(rb_fde_t * sslF, rb_fde_t * plainF, uint32_t id)
 {
@@ -741,6 +1484,7 @@ start_ssld_connect(rb_fde_t * sslF, rb_fde_t * plainF, uint32_t id)
 	if(ctl == NULL)
 		return NULL;
 	ctl->cli_count++;
+	ctl->hs_pending++;	/* server links never wait for a slot */
 	ssl_cmd_write_queue(ctl, F, 2, buf, sizeof(buf));
 	return ctl;
 }
@@ -887,6 +1631,26 @@ get_ssld_count(void)
 	return ssld_count;
 }
 
+void
+report_ssld(struct Client *source_p)
+{
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ssl_ctl_t *ctl = ptr->data;
+
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				   "S :ssld %d%s clients %d handshaking %d queued %lu handshakes %lu failed %lu cpu %lu.%03lus",
+				   (int)ctl->pid, ctl->dead == true ? " (dead)" : "", ctl->cli_count,
+				   ctl->hs_pending, rb_dlink_list_length(&ctl->acceptq),
+				   ctl->handshakes, ctl->handshake_fails, ctl->cpu_ms / 1000, ctl->cpu_ms % 1000);
+	}
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "S :clients sent to their home ssld %lu, moved for load %lu, queued for a handshake slot %lu",
+			   ssld_affinity_kept, ssld_affinity_moved, ssld_accepts_queued);
+}
+
 void
 init_ssld(void)
 {
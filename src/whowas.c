@@ -214,7 +214,7 @@ whowas_trim(void *unused)
 void
 whowas_init(void)
 {
-	whowas_hash = hash_create("WHOWAS", CMP_IRCCMP, WHOWAS_MAX_BITS, 0);
+	whowas_hash = hash_create("WHOWAS", CMP_IRCCMP, HASH_CHAINED, WHOWAS_MAX_BITS, 0);
 	whowas_list = rb_malloc(sizeof(rb_dlink_list));
 	if(whowas_list_length == 0)
 	{
@@ -23,12 +23,25 @@
 
 
 #include "stdinc.h"
+#include "ssld_ring.h"
 
 #ifdef HAVE_ZLIB
 #include <zlib.h>
 #endif
 
-#define MAXPASSFD 4
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/tls.h>)
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#define USE_KTLS 1
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+#endif
+
+#define MAXPASSFD 32	/* the ircd batches up to this many fds in one message */
+#define RING_BATCH 1024		/* records to take from to_ssld before yielding */
 #ifndef READBUF_SIZE
 #define READBUF_SIZE 16384
 #endif
@@ -83,7 +96,9 @@ typedef struct _conn
 	uint64_t plain_in;
 	uint64_t plain_out;
 	uint32_t id;
-	uint8_t flags;
+	uint16_t flags;
+	rb_dlink_node ring_node;
+	char *ring_reason;
 } conn_t;
 
 #define FLAG_SSL	0x01
@@ -93,6 +108,13 @@ typedef struct _conn
 #define FLAG_SSL_W_WANTS_R 0x10	/* output needs to wait until input possible */
 #define FLAG_SSL_R_WANTS_W 0x20	/* input needs to wait until output possible */
 #define FLAG_ZIPSSL	0x40
+#define FLAG_HANDOFF	0x80	/* socket passed to the ircd, just draining plain */
+#define FLAG_RING	0x100	/* no plain_fd, the ircd talks to us through the rings */
+#define FLAG_RING_UP	0x200	/* handshake done, the ircd has been told to send */
+#define FLAG_RING_HELD	0x400	/* the ircd was last told to hold output */
+#define FLAG_RING_GONE	0x800	/* the ircd has closed its side */
+#define FLAG_RING_CLOSE	0x1000	/* the ircd still has to be told we closed */
+#define FLAG_RING_WAIT	0x2000	/* waiting on ring_blocked for room in to_ircd */
 
 #define IsSSL(x) ((x)->flags & FLAG_SSL)
 #define IsZip(x) ((x)->flags & FLAG_ZIP)
@@ -101,6 +123,8 @@ typedef struct _conn
 #define IsSSLWWantsR(x) ((x)->flags & FLAG_SSL_W_WANTS_R)
 #define IsSSLRWantsW(x) ((x)->flags & FLAG_SSL_R_WANTS_W)
 #define IsZipSSL(x)	((x)->flags & FLAG_ZIPSSL)
+#define IsHandoff(x)	((x)->flags & FLAG_HANDOFF)
+#define IsRing(x)	((x)->flags & FLAG_RING)
 
 #define SetSSL(x) ((x)->flags |= FLAG_SSL)
 #define SetZip(x) ((x)->flags |= FLAG_ZIP)
@@ -109,6 +133,7 @@ typedef struct _conn
 #define SetSSLWWantsR(x) ((x)->flags |= FLAG_SSL_W_WANTS_R)
 #define SetSSLRWantsW(x) ((x)->flags |= FLAG_SSL_R_WANTS_W)
 #define SetZipSSL(x)	((x)->flags |= FLAG_ZIPSSL)
+#define SetHandoff(x)	((x)->flags |= FLAG_HANDOFF)
 
 #define ClearSSL(x) ((x)->flags &= ~FLAG_SSL)
 #define ClearZip(x) ((x)->flags &= ~FLAG_ZIP)
@@ -140,8 +165,19 @@ static void mod_write_ctl(rb_fde_t *, void *data);
 static void conn_plain_read_cb(rb_fde_t *fd, void *data);
 static void conn_plain_read_shutdown_cb(rb_fde_t *fd, void *data);
 static void mod_cmd_write_queue(mod_ctl_t * ctl, const void *data, size_t len);
+static void ssl_finish_handoff(rb_fde_t *fd, void *data);
 static const char *remote_closed = "Remote host closed the connection";
 static bool ssl_ok = false;
+static bool ktls_handoff = false;
+#ifdef HAVE_SSLD_RING
+static struct ssld_rings *rings;
+static rb_fde_t *ring_F;	/* eventfd the ircd kicks us on */
+static int ring_kick_fd;	/* eventfd we kick the ircd on */
+static rb_dlink_list ring_blocked;
+static bool ring_flush_conn(conn_t * conn);
+#endif
+static unsigned long handshakes;
+static unsigned long handshake_fails;
 #ifdef HAVE_ZLIB
 static bool zlib_ok = true;
 #else
@@ -204,6 +240,7 @@ free_conn(conn_t * conn)
 {
 	rb_free_rawbuffer(conn->modbuf_out);
 	rb_free_rawbuffer(conn->plainbuf_out);
+	rb_free(conn->ring_reason);
 #ifdef HAVE_ZLIB
 	if(IsZip(conn))
 	{
@@ -243,13 +280,44 @@ close_conn(conn_t * conn, int wait_plain, const char *fmt, ...)
 		return;
 
 	rb_rawbuf_flush(conn->modbuf_out, conn->mod_fd);
-	rb_rawbuf_flush(conn->plainbuf_out, conn->plain_fd);
+	if(!IsRing(conn))
+		rb_rawbuf_flush(conn->plainbuf_out, conn->plain_fd);
 	rb_close(conn->mod_fd);
 	SetDead(conn);
 
 	if(conn->id > 0 && !IsZipSSL(conn))
 		rb_dlinkDelete(&conn->node, connid_hash(conn->id));
 
+#ifdef HAVE_SSLD_RING
+	if(IsRing(conn))
+	{
+		/* whatever we read from the client goes to the ircd ahead of
+		 * the close, and we hang on to conn until it has
+		 */
+		if(!(conn->flags & FLAG_RING_GONE))
+		{
+			reason[0] = '\0';
+			if(fmt != NULL)
+			{
+				va_start(ap, fmt);
+				vsnprintf(reason, sizeof(reason), fmt, ap);
+				va_end(ap);
+			}
+			conn->ring_reason = rb_strdup(reason);
+			conn->flags |= FLAG_RING_CLOSE;
+			if(!ring_flush_conn(conn))
+				return;
+		}
+		else if(conn->flags & FLAG_RING_WAIT)
+		{
+			conn->flags &= ~FLAG_RING_WAIT;
+			rb_dlinkDelete(&conn->ring_node, &ring_blocked);
+		}
+		rb_dlinkAdd(conn, &conn->node, &dead_list);
+		return;
+	}
+#endif
+
 	if(!wait_plain || fmt == NULL)
 	{
 		rb_close(conn->plain_fd);
@@ -276,8 +344,14 @@ static conn_t *
 make_conn(mod_ctl_t * ctl, rb_fde_t *mod_fd, rb_fde_t *plain_fd)
 {
 	conn_t *conn; 
-	/* we need both, not just one..bail if NULL */
+	/* we need both, not just one..bail if NULL, unless the ircd gave
+	 * us the rings to use instead of plain_fd
+	 */
+#ifdef HAVE_SSLD_RING
+	if(mod_fd == NULL || (plain_fd == NULL && rings == NULL))
+#else
 	if(mod_fd == NULL || plain_fd == NULL)
+#endif
 		return NULL;
 	
 	conn = rb_malloc(sizeof(conn_t));
@@ -289,7 +363,10 @@ make_conn(mod_ctl_t * ctl, rb_fde_t *mod_fd, rb_fde_t *plain_fd)
 	conn->id = -1;
 	conn->stream = NULL;
 	rb_set_nb(mod_fd);
-	rb_set_nb(plain_fd);
+	if(plain_fd != NULL)
+		rb_set_nb(plain_fd);
+	else
+		conn->flags |= FLAG_RING | FLAG_RING_HELD;
 	return conn;
 }
 
@@ -483,6 +560,15 @@ conn_plain_read_cb(rb_fde_t *fd, void *data)
 	if(IsDead(conn))
 		return;
 
+#ifdef HAVE_SSLD_RING
+	/* the ircd is going to be told whether to hold off or not */
+	if(IsRing(conn))
+	{
+		ring_flush_conn(conn);
+		return;
+	}
+#endif
+
 	if(plain_check_cork(conn))
 		return;
 
@@ -495,7 +581,10 @@ conn_plain_read_cb(rb_fde_t *fd, void *data)
 
 		if(length == 0 || (length < 0 && !rb_ignore_errno(errno)))
 		{
-			close_conn(conn, NO_WAIT, NULL);
+			if(IsHandoff(conn))
+				ssl_finish_handoff(conn->mod_fd, conn);
+			else
+				close_conn(conn, NO_WAIT, NULL);
 			return;
 		}
 
@@ -631,6 +720,14 @@ conn_plain_write_sendq(rb_fde_t *fd, void *data)
 	if(IsDead(conn))
 		return;
 
+#ifdef HAVE_SSLD_RING
+	if(IsRing(conn))
+	{
+		ring_flush_conn(conn);
+		return;
+	}
+#endif
+
 	while((retlen = rb_rawbuf_flush(conn->plainbuf_out, fd)) > 0)
 	{
 		conn->plain_out += retlen;
@@ -696,20 +793,166 @@ ssl_send_certfp(conn_t *conn)
 	mod_cmd_write_queue(conn->ctl, buf, sizeof(buf));
 }
 
+/*
+ * ssl_ktls_active - has the TLS library put both directions of this
+ * socket into the kernel, so a plain read()/write() on it does TLS
+ */
+static bool
+ssl_ktls_active(rb_fde_t *F)
+{
+#ifdef USE_KTLS
+	struct tls_crypto_info info;
+	char ulp[16];
+	socklen_t len;
+	int fd = rb_get_fd(F);
+
+	len = sizeof(ulp);
+	if(getsockopt(fd, SOL_TCP, TCP_ULP, ulp, &len) != 0 || len < 3 || memcmp(ulp, "tls", 3) != 0)
+		return false;
+
+	len = sizeof(info);
+	if(getsockopt(fd, SOL_TLS, TLS_TX, &info, &len) != 0)
+		return false;
+
+	len = sizeof(info);
+	if(getsockopt(fd, SOL_TLS, TLS_RX, &info, &len) != 0)
+		return false;
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * ssl_start_handoff - pass a copy of a kernel TLS socket to the ircd,
+ * which closes its end of the socketpair when it takes it.  We never read
+ * from the client again, but keep writing out what the ircd sent us
+ * before that until we see EOF on the socketpair.
+ */
+static bool
+ssl_start_handoff(conn_t *conn)
+{
+	mod_ctl_buf_t *ctl_buf;
+	int fd;
+
+	if(ktls_handoff == false || conn->id == 0 || IsRing(conn) || !ssl_ktls_active(conn->mod_fd))
+		return false;
+
+	if((fd = dup(rb_get_fd(conn->mod_fd))) < 0)
+		return false;
+
+	SetHandoff(conn);
+	ctl_buf = rb_malloc(sizeof(mod_ctl_buf_t));
+	ctl_buf->buflen = 5;
+	ctl_buf->buf = rb_malloc(ctl_buf->buflen);
+	ctl_buf->buf[0] = 'T';
+	uint32_to_buf(&ctl_buf->buf[1], conn->id);
+	ctl_buf->F[0] = rb_open(fd, RB_FD_SOCKET, "kernel TLS handoff");
+	ctl_buf->nfds = 1;
+	rb_dlinkAddTail(ctl_buf, &ctl_buf->node, &conn->ctl->writeq);
+	mod_write_ctl(conn->ctl->F, conn->ctl);
+
+	conn_plain_read_cb(conn->plain_fd, conn);
+	return true;
+}
+
+/*
+ * ssl_finish_handoff - the ircd has closed the socketpair, once what it
+ * wrote before that is out tell it to start writing to the socket itself
+ */
+static void
+ssl_finish_handoff(rb_fde_t *fd, void *data)
+{
+	conn_t *conn = data;
+	const char *err;
+	char buf[5];
+	ssize_t retlen;
+	int nullfd;
+
+	if(IsDead(conn))
+		return;
+
+	while((retlen = rb_rawbuf_flush(conn->modbuf_out, conn->mod_fd)) > 0)
+		conn->mod_out += retlen;
+
+	if(rb_rawbuf_length(conn->modbuf_out) > 0)
+	{
+		if(retlen < 0 && rb_ignore_errno(errno))
+		{
+			rb_setselect(conn->mod_fd, RB_SELECT_WRITE, ssl_finish_handoff, conn);
+			return;
+		}
+		if(retlen == RB_RW_SSL_ERROR)
+			err = rb_ssl_get_strerror(conn->mod_fd);
+		else
+			err = strerror(errno);
+		close_conn(conn, WAIT_PLAIN, "Write error: %s", err);
+		return;
+	}
+	rb_setselect(conn->mod_fd, RB_SELECT_WRITE, NULL, NULL);
+
+	buf[0] = 't';
+	uint32_to_buf(&buf[1], conn->id);
+	mod_cmd_write_queue(conn->ctl, buf, sizeof(buf));
+
+	/* the ircd owns the session now, point our descriptor somewhere
+	 * harmless so closing it here can't send the client a close_notify
+	 */
+	if((nullfd = open("/dev/null", O_RDWR)) >= 0)
+	{
+		dup2(nullfd, rb_get_fd(conn->mod_fd));
+		close(nullfd);
+	}
+	close_conn(conn, NO_WAIT, NULL);
+}
+
+/*
+ * ssl_handshake_done - tell the ircd we're done with one of the
+ * accepts/connects it gave us, one way or another, so it can give us
+ * the next one it has waiting
+ */
+static void
+ssl_handshake_done(mod_ctl_t * ctl)
+{
+	mod_cmd_write_queue(ctl, "h", 1);
+}
 
 static void
 ssl_process_accept_cb(rb_fde_t *F, int status, struct sockaddr *addr, rb_socklen_t len, void *data)
 {
 	conn_t *conn = data;
+	ssl_handshake_done(conn->ctl);
 	if(status == RB_OK)
 	{
+		handshakes++;
 		rb_ssl_clear_handshake_count(conn->mod_fd);
-		conn_mod_read_cb(conn->mod_fd, conn);
-		conn_plain_read_cb(conn->plain_fd, conn);
+#ifdef HAVE_SSLD_RING
+		if(IsRing(conn))
+		{
+			conn->flags |= FLAG_RING_UP;
+			if(conn->flags & FLAG_RING_GONE)
+			{
+				close_conn(conn, NO_WAIT, NULL);
+				return;
+			}
+			ssl_send_cipher(conn);
+			ssl_send_certfp(conn);
+			/* lets the ircd start sending */
+			ring_flush_conn(conn);
+			conn_mod_read_cb(conn->mod_fd, conn);
+			return;
+		}
+#endif
+		if(!ssl_start_handoff(conn))
+		{
+			conn_mod_read_cb(conn->mod_fd, conn);
+			conn_plain_read_cb(conn->plain_fd, conn);
+		}
 		ssl_send_cipher(conn);
 		ssl_send_certfp(conn);
 		return;
 	}
+	handshake_fails++;
 	/* ircd doesn't care about the reason for this */
 	close_conn(conn, NO_WAIT, NULL);
 	return;
@@ -719,16 +962,20 @@ static void
 ssl_process_connect_cb(rb_fde_t *F, int status, void *data)
 {
 	conn_t *conn = data;
+	ssl_handshake_done(conn->ctl);
 	if(status == RB_OK)
 	{
+		handshakes++;
 		rb_ssl_clear_handshake_count(conn->mod_fd);
 		conn_mod_read_cb(conn->mod_fd, conn);
 		conn_plain_read_cb(conn->plain_fd, conn);
 		ssl_send_cipher(conn);
 		ssl_send_certfp(conn);
-
+		return;
 	}
-	else if(status == RB_ERR_TIMEOUT)
+
+	handshake_fails++;
+	if(status == RB_ERR_TIMEOUT)
 		close_conn(conn, WAIT_PLAIN, "SSL handshake timed out");
 	else if(status == RB_ERROR_SSL)
 		close_conn(conn, WAIT_PLAIN, "%s", rb_ssl_get_strerror(conn->mod_fd));
@@ -758,7 +1005,9 @@ ssl_process_accept(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
 	{
 		/* give up.. */
 		rb_close(ctlb->F[0]);
-		rb_close(ctlb->F[1]);
+		if(ctlb->F[1] != NULL)
+			rb_close(ctlb->F[1]);
+		ssl_handshake_done(ctl);
 		return;
 	}
 	id = buf_to_uint32(&ctlb->buf[1]);
@@ -772,12 +1021,207 @@ ssl_process_accept(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
 	if(rb_get_type(conn->mod_fd) & RB_FD_UNKNOWN)
 		rb_set_type(conn->mod_fd, RB_FD_SOCKET);
 
-	if(rb_get_type(conn->plain_fd) & RB_FD_UNKNOWN)
+	if(conn->plain_fd != NULL && rb_get_type(conn->plain_fd) & RB_FD_UNKNOWN)
 		rb_set_type(conn->plain_fd, RB_FD_SOCKET);
 
 	rb_ssl_start_accepted(ctlb->F[0], ssl_process_accept_cb, conn, 10);
 }
 
+#ifdef HAVE_SSLD_RING
+/*
+ * ring_flush_conn - pass on to the ircd whatever we have for it from a ring
+ * conn, in order: whether it should hold its output, the client's data, and
+ * that we've closed.  False if the ring filled up first, conn then waits on
+ * ring_blocked for the ircd to make room, true takes it off ring_blocked.
+ */
+static bool
+ring_flush_conn(conn_t * conn)
+{
+	struct ssld_ring *r = &rings->to_ircd;
+	char buf[SSLD_RING_MAXDATA];
+	bool held = IsCork(conn) ? true : false;
+	int len;
+
+	if((conn->flags & FLAG_RING_UP) && held != ((conn->flags & FLAG_RING_HELD) != 0))
+	{
+		if(!ssld_ring_put(r, conn->id, held ? SSLD_RING_CORK : SSLD_RING_UNCORK, "", 0))
+			goto full;
+		conn->flags ^= FLAG_RING_HELD;
+	}
+
+	while(rb_rawbuf_length(conn->plainbuf_out) > 0)
+	{
+		if(!ssld_ring_reserve(r, sizeof(buf)))
+			goto full;
+		len = rb_rawbuf_get(conn->plainbuf_out, buf, sizeof(buf));
+		if(len <= 0)
+			break;
+		ssld_ring_put(r, conn->id, SSLD_RING_DATA, buf, len);
+		conn->plain_out += len;
+	}
+
+	if(conn->flags & FLAG_RING_CLOSE)
+	{
+		if(!ssld_ring_put(r, conn->id, SSLD_RING_CLOSE, conn->ring_reason, strlen(conn->ring_reason)))
+			goto full;
+		conn->flags &= ~FLAG_RING_CLOSE;
+	}
+
+	/* all through, so it has nothing left to wait for */
+	if(conn->flags & FLAG_RING_WAIT)
+	{
+		conn->flags &= ~FLAG_RING_WAIT;
+		rb_dlinkDelete(&conn->ring_node, &ring_blocked);
+	}
+	if(ssld_ring_wake_consumer(r))
+		ssld_ring_kick(ring_kick_fd);
+	return true;
+
+full:
+	if(ssld_ring_wake_consumer(r))
+		ssld_ring_kick(ring_kick_fd);
+	if(!(conn->flags & FLAG_RING_WAIT))
+	{
+		conn->flags |= FLAG_RING_WAIT;
+		rb_dlinkAdd(conn, &conn->ring_node, &ring_blocked);
+	}
+	return false;
+}
+
+/*
+ * ring_conn_gone - the ircd is done with a ring conn.  If the handshake is
+ * still going its callback closes the conn, so the ircd still hears the
+ * handshake is over.
+ */
+static void
+ring_conn_gone(conn_t * conn)
+{
+	conn->flags |= FLAG_RING_GONE;
+	if(conn->flags & FLAG_RING_UP)
+		close_conn(conn, NO_WAIT, NULL);
+}
+
+static void
+ring_process(struct ssld_ring_rec *rec, char *buf)
+{
+	conn_t *conn;
+
+	conn = conn_find_by_id(rec->connid);
+	if(conn == NULL || !IsRing(conn))
+		return;
+
+	switch (rec->type)
+	{
+	case SSLD_RING_DATA:
+		conn->plain_in += rec->len;
+		conn_mod_write(conn, buf, rec->len);
+		if(!IsCork(conn) && rb_rawbuf_length(conn->modbuf_out) >= 4096)
+		{
+			/* same as plain_check_cork, only the ircd does the waiting */
+			SetCork(conn);
+			ring_flush_conn(conn);
+		}
+		conn_mod_write_sendq(conn->mod_fd, conn);
+		break;
+	case SSLD_RING_CLOSE:
+		ring_conn_gone(conn);
+		break;
+	}
+}
+
+static void
+ring_read_cb(rb_fde_t *F, void *data)
+{
+	struct ssld_ring *r = &rings->to_ssld;
+	struct ssld_ring_rec rec;
+	char buf[SSLD_RING_MAXDATA];
+	rb_dlink_node *ptr, *next;
+	int count = 0;
+
+	ssld_ring_unkick(rb_get_fd(F));
+	do
+	{
+		while(count < RING_BATCH && ssld_ring_get(r, &rec, buf))
+		{
+			ring_process(&rec, buf);
+			count++;
+		}
+		if(ssld_ring_wake_producer(r))
+			ssld_ring_kick(ring_kick_fd);
+		if(count >= RING_BATCH)
+		{
+			/* let the handshakes and sockets have a go first */
+			ssld_ring_kick(rb_get_fd(F));
+			break;
+		}
+	}
+	while(!ssld_ring_sleep(r));
+
+	/* the ircd may also have kicked us because it made room in to_ircd */
+	RB_DLINK_FOREACH_SAFE(ptr, next, ring_blocked.head)
+	{
+		conn_t *conn = ptr->data;
+		rb_dlinkDelete(ptr, &ring_blocked);
+		conn->flags &= ~FLAG_RING_WAIT;
+		if(!ring_flush_conn(conn))
+			break;
+		if(IsDead(conn))
+			rb_dlinkAdd(conn, &conn->node, &dead_list);
+	}
+	rb_setselect(F, RB_SELECT_READ, ring_read_cb, NULL);
+}
+
+static void
+ssl_process_rings(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
+{
+	void *p;
+
+	if(rings != NULL)
+	{
+		cleanup_bad_message(ctl, ctlb);
+		return;
+	}
+
+	p = mmap(NULL, sizeof(struct ssld_rings), PROT_READ | PROT_WRITE, MAP_SHARED, rb_get_fd(ctlb->F[0]), 0);
+	rb_close(ctlb->F[0]);
+	if(p == MAP_FAILED)
+	{
+		/* the accepts that follow get turned away, and the ircd
+		 * goes back to socketpairs for us */
+		rb_close(ctlb->F[1]);
+		rb_close(ctlb->F[2]);
+		mod_cmd_write_queue(ctl, "r", 1);
+		return;
+	}
+	rings = p;
+	ring_F = ctlb->F[1];
+	ring_kick_fd = rb_get_fd(ctlb->F[2]);
+	ring_read_cb(ring_F, NULL);
+}
+
+static void
+ssl_process_ring_close(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
+{
+	conn_t *conn;
+
+	conn = conn_find_by_id(buf_to_uint32(&ctlb->buf[1]));
+	if(conn != NULL && IsRing(conn))
+		ring_conn_gone(conn);
+}
+
+static void
+ssl_refuse_ring_accept(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb, const char *reason)
+{
+	char buf[256];
+
+	rb_close(ctlb->F[0]);
+	buf[0] = 'D';
+	memcpy(&buf[1], &ctlb->buf[1], sizeof(uint32_t));
+	rb_strlcpy(&buf[5], reason, sizeof(buf) - 5);
+	mod_cmd_write_queue(ctl, buf, strlen(reason) + 1 + 5);
+}
+#endif
+
 static void
 ssl_process_connect(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
 {
@@ -790,6 +1234,7 @@ ssl_process_connect(mod_ctl_t * ctl, mod_ctl_buf_t * ctlb)
 		/* give up.. */
 		rb_close(ctlb->F[0]);
 		rb_close(ctlb->F[1]);
+		ssl_handshake_done(ctl);
 		return;
 	}
 
@@ -933,7 +1378,7 @@ ssl_new_keys(mod_ctl_t * ctl, mod_ctl_buf_t * ctl_buf)
 {
 	static const char *inv = "I";
 
-	char *cacert = NULL, *cert = NULL, *key = NULL, *dhparam = NULL, *ssl_cipher_list = NULL, *ssl_ecdh_named_curve = NULL, *tls_ver = NULL;
+	char *cacert = NULL, *cert = NULL, *key = NULL, *dhparam = NULL, *ssl_cipher_list = NULL, *ssl_ecdh_named_curve = NULL, *tls_ver = NULL, *ktls = NULL;
 	uint8_t *p;
 	int tls_min_ver = 0;
 	rb_ssl_ctx *sctx = NULL, *cctx = NULL;
@@ -942,7 +1387,7 @@ ssl_new_keys(mod_ctl_t * ctl, mod_ctl_buf_t * ctl_buf)
 	p = (uint8_t *)&ctl_buf->buf[1];
 	argcnt = *(uint8_t *)p;
 	p++;
-	if(argcnt != 7) 
+	if(argcnt != 8) 
 		goto invalid;
 	cacert = advance_zstring(&p);
 	
@@ -959,6 +1404,7 @@ ssl_new_keys(mod_ctl_t * ctl, mod_ctl_buf_t * ctl_buf)
 	ssl_cipher_list = advance_zstring(&p);
 	ssl_ecdh_named_curve = advance_zstring(&p);
 	tls_ver = advance_zstring(&p);
+	ktls = advance_zstring(&p);
 		
 	if(tls_ver != NULL)
 		tls_min_ver = atoi(tls_ver);
@@ -982,6 +1428,7 @@ ssl_new_keys(mod_ctl_t * ctl, mod_ctl_buf_t * ctl_buf)
 
 	ssl_server_ctx = sctx;
 	ssl_client_ctx = cctx;
+	ktls_handoff = ktls != NULL && atoi(ktls) > 0;
 	goto freeall;
 	
 invalid:
@@ -996,6 +1443,7 @@ freeall:
 	rb_free(ssl_cipher_list);
 	rb_free(ssl_ecdh_named_curve);
 	rb_free(tls_ver);
+	rb_free(ktls);
 
 	return;
 }
@@ -1073,28 +1521,73 @@ mod_process_cmd_recv(mod_ctl_t * ctl)
 				if (ctl_buf->nfds != 2 || ctl_buf->buflen != 5)
 				{
 					cleanup_bad_message(ctl, ctl_buf);
+					ssl_handshake_done(ctl);
 					break;
 				}
 
 				if(ssl_ok == false)
 				{
 					send_nossl_support(ctl, ctl_buf);
+					ssl_handshake_done(ctl);
+					break;
+				}
+				ssl_process_accept(ctl, ctl_buf);
+				break;
+			}
+#ifdef HAVE_SSLD_RING
+		case 'a':
+			{
+				if (ctl_buf->nfds != 1 || ctl_buf->buflen != 5)
+				{
+					cleanup_bad_message(ctl, ctl_buf);
+					ssl_handshake_done(ctl);
+					break;
+				}
+
+				if(ssl_ok == false || rings == NULL)
+				{
+					ssl_refuse_ring_accept(ctl, ctl_buf, ssl_ok == false ?
+							       "libratbox reports no SSL/TLS support" :
+							       "ssld could not map its rings");
+					if(ssl_ok == false)
+						send_nossl_support(ctl, NULL);
+					ssl_handshake_done(ctl);
 					break;
 				}
 				ssl_process_accept(ctl, ctl_buf);
 				break;
 			}
+		case 'R':
+			{
+				if (ctl_buf->nfds != 3)
+				{
+					cleanup_bad_message(ctl, ctl_buf);
+					break;
+				}
+				ssl_process_rings(ctl, ctl_buf);
+				break;
+			}
+		case 'c':
+			{
+				if (ctl_buf->buflen != 5)
+					break;
+				ssl_process_ring_close(ctl, ctl_buf);
+				break;
+			}
+#endif
 		case 'C':
 			{
 				if (ctl_buf->nfds != 2 || ctl_buf->buflen != 5)
 				{
 					cleanup_bad_message(ctl, ctl_buf);
+					ssl_handshake_done(ctl);
 					break;
 				}
 
 				if(ssl_ok == false)
 				{
 					send_nossl_support(ctl, ctl_buf);
+					ssl_handshake_done(ctl);
 					break;
 				}
 				ssl_process_connect(ctl, ctl_buf);
@@ -1148,6 +1641,45 @@ mod_process_cmd_recv(mod_ctl_t * ctl)
 
 
 
+/*
+ * mod_unpack_batch - split a 'B' from the ircd back into the commands it
+ * packed together, each as its length (uint16), its fd count (uint8) and
+ * the command, and queue them in order.  The fds are handed out in order.
+ */
+static void
+mod_unpack_batch(mod_ctl_t * ctl, mod_ctl_buf_t * batch)
+{
+	mod_ctl_buf_t *ctl_buf;
+	size_t off = 1;
+	uint16_t len;
+	int nfds, fdoff = 0, i;
+
+	while(off + 3 <= batch->buflen)
+	{
+		memcpy(&len, &batch->buf[off], sizeof(len));
+		nfds = batch->buf[off + 2];
+		off += 3;
+		if(len == 0 || off + len > batch->buflen || fdoff + nfds > batch->nfds)
+			break;
+
+		ctl_buf = rb_malloc(sizeof(mod_ctl_buf_t));
+		ctl_buf->buf = rb_malloc(len);
+		memcpy(ctl_buf->buf, &batch->buf[off], len);
+		ctl_buf->buflen = len;
+		for(i = 0; i < nfds; i++)
+			ctl_buf->F[i] = batch->F[fdoff++];
+		ctl_buf->nfds = nfds;
+		rb_dlinkAddTail(ctl_buf, &ctl_buf->node, &ctl->readq);
+		off += len;
+	}
+
+	/* whatever a mangled batch didn't account for */
+	while(fdoff < batch->nfds)
+		rb_close(batch->F[fdoff++]);
+	rb_free(batch->buf);
+	rb_free(batch);
+}
+
 static void
 mod_read_ctl(rb_fde_t *F, void *data)
 {
@@ -1172,10 +1704,13 @@ mod_read_ctl(rb_fde_t *F, void *data)
 		else
 		{
 			ctl_buf->buflen = retlen;
-			rb_dlinkAddTail(ctl_buf, &ctl_buf->node, &ctl->readq);
 			for (i = 0; i < MAXPASSFD && ctl_buf->F[i] != NULL; i++)
 				;
 			ctl_buf->nfds = i;
+			if(*ctl_buf->buf == 'B')
+				mod_unpack_batch(ctl, ctl_buf);
+			else
+				rb_dlinkAddTail(ctl_buf, &ctl_buf->node, &ctl->readq);
 		}
 	}
 	while(retlen > 0);
@@ -1219,6 +1754,34 @@ mod_write_ctl(rb_fde_t *F, void *data)
 }
 
 
+/*
+ * report_handshakes - tell the ircd how many handshakes we've done and
+ * the cpu we've used, for STATS S
+ */
+static void
+report_handshakes(void *data)
+{
+	static unsigned long last_handshakes, last_fails, last_ms;
+	mod_ctl_t *ctl = data;
+	unsigned long ms = 0;
+	char buf[128];
+#ifdef HAVE_SYS_RESOURCE_H
+	struct rusage ru;
+
+	if(getrusage(RUSAGE_SELF, &ru) == 0)
+		ms = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000 + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000;
+#endif
+
+	if(handshakes == last_handshakes && handshake_fails == last_fails && ms == last_ms)
+		return;
+	last_handshakes = handshakes;
+	last_fails = handshake_fails;
+	last_ms = ms;
+
+	snprintf(buf, sizeof(buf), "H %lu %lu %lu", handshakes, handshake_fails, ms);
+	mod_cmd_write_queue(ctl, buf, strlen(buf) + 1);
+}
+
 static void
 read_pipe_ctl(rb_fde_t *F, void *data)
 {
@@ -1292,6 +1855,7 @@ main(int argc, char **argv)
 	rb_set_nb(mod_ctl->F);
 	rb_set_nb(mod_ctl->F_pipe);
 	rb_event_add("clean_dead_conns", clean_dead_conns, NULL, 10);
+	rb_event_add("report_handshakes", report_handshakes, mod_ctl, 10);
 	read_pipe_ctl(mod_ctl->F_pipe, NULL);
 	mod_read_ctl(mod_ctl->F, mod_ctl);
 	if(zlib_ok == false && ssl_ok == false)
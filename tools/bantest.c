@@ -0,0 +1,250 @@
+/*
+ *  bantest.c: check compiled channel bans against match()
+ *
+ *  Every ban is run through allocate_ban() and match_ban(), and the
+ *  answer has to be the one is_banned() used to get from match() on
+ *  nick!user@host and nick!user@sockhost and match_cidr() on the latter.
+ *  With "bench" as the argument it times both over a realistic ban list
+ *  instead.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  $Id$
+ */
+#include "stdinc.h"
+#include "struct.h"
+#include "client.h"
+#include "channel.h"
+#include "match.h"
+
+struct testclient
+{
+	const char *name;
+	const char *username;
+	const char *host;
+	const char *sockhost;
+};
+
+static const struct testclient testclients[] = {
+	{ "nick", "~user", "host.example.com", "10.1.2.3" },
+	{ "NICK", "user", "10.1.2.3", "10.1.2.3" },
+	{ "[X]", "u", "a.com", "2001:db8::1" },
+	{ "nick", "~user", "HOST.example.com", "0::1" },
+	{ "nicky", "~user", "host", "192.168.0.1" },
+	{ "n`ck^", "~u_ser", "cpe-10-1-2-3.dsl.isp.net", "10.1.2.3" },
+	{ "bot123", "bot", "2001:db8:0:1::5", "2001:db8:0:1::5" },
+	{ "someone", "~x", "gateway/web/irccloud.com/x-abc", "192.0.2.9" },
+};
+
+static const char *nickparts[] = {
+	"*", "nick", "Nick", "ni*", "*ck", "n?ck", "n*k", "", "*ick*", "NICK", "[x]", "{X}", "bot*", "*^",
+	"*nick", "nick*", "*NICK"
+};
+
+static const char *userparts[] = {
+	"*", "~user", "user", "~*", "*ser", "u*", "?user", "*u*r", "bot", "~u_*",
+	"*~user", "~user*", "*USER"
+};
+
+static const char *hostparts[] = {
+	"*", "host.example.com", "*.example.com", "HOST.*", "10.1.2.3", "10.1.2.0/24",
+	"10.0.0.0/8", "10.1.2.3/32", "*.com", "h?st*", "2001:db8::1", "2001:db8::/32",
+	"0::1", "::1/128", "10.1.2.*", "1.2.3.0/0", "*/24", "*.dsl.isp.net",
+	"cpe-10-1-2-3.*", "2001:db8:0:1::/64", "2001:db8::/0", "192.0.2.9/33",
+	"10.1.2.3/0", "gateway/web/irccloud.com/*", "10.1.2.0/-1", "::ffff:10.1.2.3",
+	"*host.example.com", "host.example.com*", "*host", "host*", "*10.1.2.3",
+};
+
+/* whole masks that don't split into nick!user@host */
+static const char *oddmasks[] = {
+	"*", "*@*", "nick", "a!b", "*!*", "x@y!z", "n*!*@*!*", "*nick*!*", "10.1.2.0/24",
+	"*!*@10.1.2.0/24!", "nick!~user@10.1.2.0/24", "*!*@*@*", "@!", "!@", "nick@host!user",
+	"*!*@", "!*@*", "*!@*",
+};
+
+#define NELEM(x) (sizeof(x) / sizeof((x)[0]))
+
+static void
+fill_client(struct Client *client_p, const struct testclient *tc)
+{
+	memset(client_p, 0, sizeof(struct Client));
+	client_p->name = tc->name;
+	rb_strlcpy(client_p->username, tc->username, sizeof(client_p->username));
+	rb_strlcpy(client_p->host, tc->host, sizeof(client_p->host));
+	rb_strlcpy(client_p->sockhost, tc->sockhost, sizeof(client_p->sockhost));
+}
+
+/* what is_banned() did before bans were compiled */
+static bool
+match_ban_plain(const char *banstr, const char *s, const char *s2)
+{
+	return match(banstr, s) || match(banstr, s2) || match_cidr(banstr, s2);
+}
+
+static unsigned long checks;
+static unsigned long failures;
+
+static void
+check(const char *mask, struct Client *client_p, const char *s, const char *s2, bool prebuilt)
+{
+	struct BanTarget target;
+	struct Ban *bptr;
+	bool want, got;
+
+	bptr = allocate_ban(mask, "bantest");
+	init_ban_target(&target, client_p, prebuilt ? s : NULL, prebuilt ? s2 : NULL);
+	want = match_ban_plain(mask, s, s2);
+	got = match_ban(bptr, &target);
+	free_ban(bptr);
+
+	checks++;
+	if(want == got)
+		return;
+	if(failures++ < 20)
+		fprintf(stderr, "ban %s on %s / %s: match_ban() says %d, match() says %d\n",
+			mask, s, s2, got, want);
+}
+
+static int
+run_tests(void)
+{
+	char s[BANLEN], s2[BANLEN], mask[BANLEN * 2];
+	struct Client client;
+	unsigned int c, i, j, k;
+
+	for(c = 0; c < NELEM(testclients); c++)
+	{
+		fill_client(&client, &testclients[c]);
+		snprintf(s, sizeof(s), "%s!%s@%s", client.name, client.username, client.host);
+		snprintf(s2, sizeof(s2), "%s!%s@%s", client.name, client.username, client.sockhost);
+
+		for(i = 0; i < NELEM(nickparts); i++)
+		{
+			for(j = 0; j < NELEM(userparts); j++)
+			{
+				for(k = 0; k < NELEM(hostparts); k++)
+				{
+					snprintf(mask, sizeof(mask), "%s!%s@%s", nickparts[i], userparts[j], hostparts[k]);
+					check(mask, &client, s, s2, false);
+					check(mask, &client, s, s2, true);
+				}
+			}
+		}
+
+		for(i = 0; i < NELEM(oddmasks); i++)
+		{
+			check(oddmasks[i], &client, s, s2, false);
+			check(oddmasks[i], &client, s, s2, true);
+		}
+	}
+
+	printf("bantest: %lu checks, %lu failures\n", checks, failures);
+	return failures != 0;
+}
+
+/*
+ * bench - a channel's worth of bans, mostly host and CIDR bans with some
+ * nick and ident ones, none of which match the clients checked against it
+ */
+#define BENCH_BANS	200
+#define BENCH_ROUNDS	20000
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+run_bench(void)
+{
+	static char masks[BENCH_BANS][BANLEN];
+	struct Ban *bans[BENCH_BANS];
+	char s[NELEM(testclients)][BANLEN], s2[NELEM(testclients)][BANLEN];
+	struct Client clients[NELEM(testclients)];
+	struct BanTarget target;
+	double start, plain, compiled;
+	unsigned long hits = 0;
+	unsigned int c, i, r;
+
+	for(i = 0; i < BENCH_BANS; i++)
+	{
+		switch (i % 8)
+		{
+		case 0:
+			snprintf(masks[i], BANLEN, "*!*@host%u.example.net", i);
+			break;
+		case 1:
+			snprintf(masks[i], BANLEN, "*!*@*.dsl%u.isp.com", i);
+			break;
+		case 2:
+			snprintf(masks[i], BANLEN, "*!*@172.%u.0.0/16", i % 256);
+			break;
+		case 3:
+			snprintf(masks[i], BANLEN, "spammer%u*!*@*", i);
+			break;
+		case 4:
+			snprintf(masks[i], BANLEN, "*!*bot%u@*", i);
+			break;
+		case 5:
+			snprintf(masks[i], BANLEN, "*!~*@198.51.100.%u", i % 256);
+			break;
+		case 6:
+			snprintf(masks[i], BANLEN, "*!*@2001:db8:%x::/48", i);
+			break;
+		case 7:
+			snprintf(masks[i], BANLEN, "*!*@gateway/web/*/ip.203.0.113.%u", i % 256);
+			break;
+		}
+		bans[i] = allocate_ban(masks[i], "bantest");
+	}
+
+	for(c = 0; c < NELEM(testclients); c++)
+	{
+		fill_client(&clients[c], &testclients[c]);
+		snprintf(s[c], BANLEN, "%s!%s@%s", clients[c].name, clients[c].username, clients[c].host);
+		snprintf(s2[c], BANLEN, "%s!%s@%s", clients[c].name, clients[c].username, clients[c].sockhost);
+	}
+
+	start = now();
+	for(r = 0; r < BENCH_ROUNDS; r++)
+		for(c = 0; c < NELEM(testclients); c++)
+			for(i = 0; i < BENCH_BANS; i++)
+				hits += match_ban_plain(masks[i], s[c], s2[c]);
+	plain = now() - start;
+
+	start = now();
+	for(r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for(c = 0; c < NELEM(testclients); c++)
+		{
+			init_ban_target(&target, &clients[c], s[c], s2[c]);
+			for(i = 0; i < BENCH_BANS; i++)
+				hits += match_ban(bans[i], &target);
+		}
+	}
+	compiled = now() - start;
+
+	plain /= (double)BENCH_ROUNDS * NELEM(testclients);
+	compiled /= (double)BENCH_ROUNDS * NELEM(testclients);
+	printf("%d bans, per client: match() %.2f us, match_ban() %.2f us (%.1fx), %lu hits\n",
+	       BENCH_BANS, plain * 1e6, compiled * 1e6, plain / compiled, hits);
+
+	for(i = 0; i < BENCH_BANS; i++)
+		free_ban(bans[i]);
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	if(argc > 1 && !strcmp(argv[1], "bench"))
+		return run_bench();
+	return run_tests();
+}
@@ -0,0 +1,117 @@
+/*
+ *  cmdbench.c: time parse()'s command trie against HASH_COMMAND
+ *
+ *  The commands the modules register are loaded with mod_add_cmd(), then
+ *  a mix that looks like client traffic (mostly PRIVMSG, PING, PONG,
+ *  JOIN, MODE and NOTICE, some in lowercase, a few other commands and
+ *  the odd unknown one) is looked up both ways.  Both have to give the
+ *  same answer for every name before anything is timed.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  $Id$
+ */
+#include "stdinc.h"
+#include "struct.h"
+#include "hash.h"
+#include "parse.h"
+
+static const char *names[] = {
+	"ACCEPT", "ADMIN", "ADMINDLINE", "ADMINKLINE", "ADMINRESV", "ADMINWALL", "ADMINXLINE",
+	"AWAY", "BMASK", "CAP", "CAPAB", "CHALLENGE", "CHANTRACE", "CLOSE", "CNOTICE",
+	"CONNECT", "CPRIVMSG", "DLINE", "ENCAP", "ERROR", "ETRACE", "GCAP", "GET", "GLINE",
+	"GUNGLINE", "HELP", "INFO", "INVITE", "ISON", "JOIN", "KICK", "KILL", "KLINE", "KNOCK",
+	"LINKS", "LIST", "LOCOPS", "LOGIN", "LUSERS", "MAP", "MASKTRACE", "MODE", "MONITOR",
+	"MOTD", "NAMES", "NICK", "NOTICE", "OPER", "OPERSPY", "OPERWALL", "PART", "PASS",
+	"PING", "PONG", "POST", "PRIVMSG", "PUT", "QUIT", "REHASH", "RESTART", "RESV", "RSFNC",
+	"SAVE", "SERVER", "SET", "SID", "SJOIN", "SQUIT", "STATS", "SU", "SVINFO", "TB",
+	"TESTGECOS", "TESTLINE", "TESTMASK", "TIME", "TMODE", "TOPIC", "TRACE", "UHELP", "UID",
+	"UNDLINE", "UNGLINE", "UNKLINE", "UNREJECT", "UNRESV", "UNXLINE", "USER", "USERHOST",
+	"USERS", "VERSION", "WALLOPS", "WHO", "WHOIS", "WHOWAS", "XLINE",
+};
+
+#define NCMDS	(sizeof(names) / sizeof(names[0]))
+#define NMIX	1000
+#define LOOKUPS	20000000L
+
+static const char *common[] = {
+	"PRIVMSG", "PRIVMSG", "PRIVMSG", "PRIVMSG", "PRIVMSG", "PRIVMSG",
+	"PING", "PONG", "JOIN", "MODE", "NOTICE", "privmsg",
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static struct Message msgs[NCMDS];
+	static const char *mix[NMIX];
+	volatile uintptr_t sink = 0;
+	double start, hashtime, trietime;
+	unsigned int i;
+	long n;
+
+	rb_lib_init(NULL, NULL, NULL, 0, 256);
+	init_hash();
+
+	for(i = 0; i < NCMDS; i++)
+	{
+		msgs[i].cmd = names[i];
+		mod_add_cmd(&msgs[i]);
+	}
+
+	srand(1);
+	for(i = 0; i < NMIX; i++)
+	{
+		int r = rand() % 100;
+
+		if(r < 95)
+			mix[i] = common[rand() % (sizeof(common) / sizeof(common[0]))];
+		else if(r < 99)
+			mix[i] = names[rand() % NCMDS];
+		else
+			mix[i] = "FOOBAR";
+	}
+
+	for(i = 0; i < NCMDS; i++)
+	{
+		if(lookup_command(names[i]) != &msgs[i])
+		{
+			fprintf(stderr, "cmdbench: trie lost %s\n", names[i]);
+			return 1;
+		}
+	}
+	for(i = 0; i < NMIX; i++)
+	{
+		if(lookup_command(mix[i]) != hash_find_data(HASH_COMMAND, mix[i]))
+		{
+			fprintf(stderr, "cmdbench: trie and hash disagree on %s\n", mix[i]);
+			return 1;
+		}
+	}
+
+	start = now();
+	for(n = 0; n < LOOKUPS; n++)
+		sink += (uintptr_t)hash_find_data(HASH_COMMAND, mix[n % NMIX]);
+	hashtime = now() - start;
+
+	start = now();
+	for(n = 0; n < LOOKUPS; n++)
+		sink += (uintptr_t)lookup_command(mix[n % NMIX]);
+	trietime = now() - start;
+
+	printf("%u commands, %ld lookups: HASH_COMMAND %.1f ns, trie %.1f ns (%.1fx)\n",
+	       (unsigned int)NCMDS, LOOKUPS, hashtime / LOOKUPS * 1e9, trietime / LOOKUPS * 1e9,
+	       hashtime / trietime);
+	return 0;
+}
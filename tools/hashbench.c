@@ -0,0 +1,103 @@
+/*
+ *  hashbench.c: time HASH_FLAT tables against HASH_CHAINED ones
+ *
+ *  A table set up the way init_hash() sets up NICK (irccmp keys,
+ *  U_MAX_BITS to start with) is filled with nick-like keys, then looked
+ *  up in random order, looked up with keys it doesn't hold, and emptied
+ *  again, at 100k and 1M keys unless other sizes are given.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  $Id$
+ */
+#include "stdinc.h"
+#include "struct.h"
+#include "hash.h"
+
+#define ROUNDS	5
+#define BENCH_KEYLEN	16
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+bench(const char *what, hash_backend backend, char (*keys)[BENCH_KEYLEN], char (*misses)[BENCH_KEYLEN],
+      unsigned long n)
+{
+	hash_f *hf;
+	double start, add, find, miss, del;
+	unsigned long i, r, hits = 0;
+
+	hf = hash_create(what, CMP_IRCCMP, backend, U_MAX_BITS, 0);
+
+	start = now();
+	for(i = 0; i < n; i++)
+		hash_add(hf, keys[i], keys[i]);
+	add = now() - start;
+
+	/* a stride coprime with n walks every key in an order the cache can't follow */
+	start = now();
+	for(r = 0; r < ROUNDS; r++)
+		for(i = 0; i < n; i++)
+			hits += hash_find_data(hf, keys[(i * 2654435761UL) % n]) != NULL;
+	find = now() - start;
+
+	start = now();
+	for(r = 0; r < ROUNDS; r++)
+		for(i = 0; i < n; i++)
+			hits += hash_find_data(hf, misses[(i * 2654435761UL) % n]) != NULL;
+	miss = now() - start;
+
+	start = now();
+	for(i = 0; i < n; i++)
+		hash_del(hf, keys[i], keys[i]);
+	del = now() - start;
+
+	printf("%-8s %8lu keys: insert %5.2f, lookup %5.2f, miss %5.2f, delete %5.2f Mops/s%s\n",
+	       what, n, n / add / 1e6, ROUNDS * n / find / 1e6, ROUNDS * n / miss / 1e6, n / del / 1e6,
+	       hits == ROUNDS * n ? "" : " (lookups wrong)");
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const unsigned long defsizes[] = { 100000, 1000000 };
+	unsigned long n, i;
+	int s, nsizes;
+
+	rb_lib_init(NULL, NULL, NULL, 0, 256);
+
+	nsizes = argc > 1 ? argc - 1 : 2;
+	for(s = 0; s < nsizes; s++)
+	{
+		char (*keys)[BENCH_KEYLEN], (*misses)[BENCH_KEYLEN];
+
+		n = argc > 1 ? strtoul(argv[s + 1], NULL, 10) : defsizes[s];
+		if(n == 0)
+			continue;
+
+		keys = rb_malloc(BENCH_KEYLEN * n);
+		misses = rb_malloc(BENCH_KEYLEN * n);
+		for(i = 0; i < n; i++)
+		{
+			snprintf(keys[i], BENCH_KEYLEN, "Nick%lu[x]", i * 7919);
+			snprintf(misses[i], BENCH_KEYLEN, "Gone%lu[x]", i * 7919);
+		}
+
+		bench("chained", HASH_CHAINED, keys, misses, n);
+		bench("flat", HASH_FLAT, keys, misses, n);
+
+		rb_free(keys);
+		rb_free(misses);
+	}
+	return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ *  irccmp_test.c: check the SSE2 irccmp() against the scalar one
+ *
+ *  Every pair of bytes is compared at offsets either side of each 16 byte
+ *  boundary, with the strings at every alignment, and then strings are
+ *  run up against an unmapped page to check the over-read never crosses
+ *  into it.  The result has to be exactly what the scalar loop returns.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  $Id$
+ */
+#include "stdinc.h"
+#include "match.h"
+#include <sys/mman.h>
+
+#ifdef HAVE_SIMD_CASEFOLD
+static unsigned long checks;
+static unsigned long failures;
+
+/* irccmp() as it is without SSE2 */
+static int
+irccmp_scalar(const char *s1, const char *s2)
+{
+	const unsigned char *str1 = (const unsigned char *)s1;
+	const unsigned char *str2 = (const unsigned char *)s2;
+	int res;
+
+	while((res = ToUpper(*str1) - ToUpper(*str2)) == 0)
+	{
+		if(*str1 == '\0')
+			return 0;
+		str1++;
+		str2++;
+	}
+	return (res);
+}
+
+static void
+check(const char *s1, const char *s2)
+{
+	int want = irccmp_scalar(s1, s2);
+	int got = irccmp_simd(s1, s2);
+
+	checks++;
+	if(got == want)
+		return;
+	if(failures++ < 20)
+		fprintf(stderr, "irccmp(\"%s\", \"%s\") = %d, want %d\n", s1, s2, got, want);
+}
+
+/* offsets the differing byte is put at, either side of 16 and 32 */
+static const int positions[] = { 0, 1, 14, 15, 16, 17, 30, 31, 32, 33 };
+#define NPOS (sizeof(positions) / sizeof(positions[0]))
+
+/*
+ * check_pairs - for every byte pair a, b put a into s1 and b into s2 at
+ * each position, with the same prefix before it and the same tail after
+ */
+static void
+check_pairs(void)
+{
+	static char buf1[128], buf2[128];
+	unsigned int a, b, p, o1, o2;
+
+	for(p = 0; p < NPOS; p++)
+	{
+		int pos = positions[p];
+
+		for(o1 = 0; o1 < 16; o1++)
+		{
+			for(o2 = 0; o2 < 16; o2 += (o1 == 0 ? 1 : 5))
+			{
+				char *s1 = buf1 + o1, *s2 = buf2 + o2;
+
+				memset(s1, 'q', pos);
+				memset(s2, 'Q', pos);
+				strcpy(s1 + pos + 1, "tail{|}~");
+				strcpy(s2 + pos + 1, "TAIL[\\]^");
+				for(a = 0; a < 256; a++)
+				{
+					for(b = 0; b < 256; b++)
+					{
+						s1[pos] = a;
+						s2[pos] = b;
+						check(s1, s2);
+					}
+				}
+			}
+		}
+	}
+}
+
+/*
+ * check_lengths - strings of every pair of lengths up to 70, equal up to
+ * the shorter one, at every pair of alignments
+ */
+static void
+check_lengths(void)
+{
+	static char buf1[128], buf2[128];
+	unsigned int len1, len2, o1, o2, i;
+
+	for(len1 = 0; len1 <= 70; len1++)
+	{
+		for(len2 = 0; len2 <= 70; len2++)
+		{
+			for(o1 = 0; o1 < 16; o1++)
+			{
+				for(o2 = 0; o2 < 16; o2++)
+				{
+					char *s1 = buf1 + o1, *s2 = buf2 + o2;
+
+					for(i = 0; i < len1; i++)
+						s1[i] = "aZ{[~^9_"[i % 8];
+					for(i = 0; i < len2; i++)
+						s2[i] = "Az[{^~9_"[i % 8];
+					s1[len1] = '\0';
+					s2[len2] = '\0';
+					check(s1, s2);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * check_page_end - strings whose NUL is the last byte before an unmapped
+ * page, so reading a whole 16 bytes past any of them would fault
+ */
+static void
+check_page_end(void)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	char *map, *end1, *end2, *roomy;
+	unsigned int len1, len2;
+
+	map = mmap(NULL, pagesize * 4, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(map == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(1);
+	}
+	if(mprotect(map + pagesize, pagesize, PROT_NONE) < 0
+	   || mprotect(map + pagesize * 3, pagesize, PROT_NONE) < 0)
+	{
+		perror("mprotect");
+		exit(1);
+	}
+	end1 = map + pagesize;
+	end2 = map + pagesize * 3;
+	roomy = map + pagesize * 2;
+	memset(roomy, 'X', 20);
+	roomy[20] = '\0';
+
+	for(len1 = 0; len1 <= 40; len1++)
+	{
+		for(len2 = 0; len2 <= 40; len2++)
+		{
+			char *s1 = end1 - len1 - 1, *s2 = end2 - len2 - 1;
+
+			memset(s1, 'x', len1);
+			memset(s2, 'X', len2);
+			s1[len1] = '\0';
+			s2[len2] = '\0';
+			check(s1, s2);
+
+			/* and against a string with plenty of room after it */
+			check(s1, roomy);
+			check(roomy, s2);
+		}
+	}
+
+	munmap(map, pagesize * 4);
+}
+
+int
+main(int argc, char *argv[])
+{
+	check_pairs();
+	check_lengths();
+	check_page_end();
+
+	printf("irccmp_test: %lu comparisons, %lu failures\n", checks, failures);
+	return failures != 0;
+}
+#else
+int
+main(int argc, char *argv[])
+{
+	printf("irccmp_test: built without SSE2, irccmp() is the scalar loop\n");
+	return 0;
+}
+#endif
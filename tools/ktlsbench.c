@@ -0,0 +1,459 @@
+/*
+ *  ktlsbench.c: time ssld's relay against a kernel TLS handoff
+ *
+ *  A TLS client on loopback streams lines to a server three ways: through
+ *  an ssld style relay (SSL_read() in another process, over a socketpair,
+ *  read() by the consumer), with the consumer doing SSL_read() itself, and
+ *  with kernel TLS on so the consumer read()s plaintext straight off the
+ *  socket, which is where the ircd sits after ssld hands a client back
+ *  with ssl_ktls = yes.  Throughput and the server side CPU are reported.
+ *
+ *  The client holds back its Finished message and sends it in the same
+ *  segment as its first line, so that line is already queued on the socket
+ *  when the server's handshake completes.  Each run checks the first line
+ *  arrives intact.  The ktls run is skipped, and says so, when the kernel
+ *  or OpenSSL can't put the receive side into the kernel; OpenSSL before
+ *  3.2 only does that for TLS 1.2, use -2 for it.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  $Id$
+ */
+#include "stdinc.h"
+
+#ifdef USE_CHALLENGE
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/tls.h>)
+#include <linux/tls.h>
+#define USE_KTLS 1
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+#endif
+
+static const char *modes[] = { "relay", "direct", "ktls" };
+static const int msglens[] = { 16384, 512 };
+
+#define NELEM(x) (sizeof(x) / sizeof((x)[0]))
+
+static EVP_PKEY *pkey;
+static X509 *cert;
+static bool tls12;
+static long total;
+static int msglen;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+cputime(const struct rusage *ru)
+{
+	return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 + ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+static void
+die_ssl(const char *what)
+{
+	fprintf(stderr, "ktlsbench: %s failed\n", what);
+	ERR_print_errors_fp(stderr);
+	exit(1);
+}
+
+/* make_cert - a throwaway self signed P-256 certificate */
+static void
+make_cert(void)
+{
+	EVP_PKEY_CTX *pctx;
+	X509_NAME *name;
+
+	pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+	if(pctx == NULL || EVP_PKEY_keygen_init(pctx) <= 0
+	   || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1) <= 0
+	   || EVP_PKEY_keygen(pctx, &pkey) <= 0)
+		die_ssl("key generation");
+	EVP_PKEY_CTX_free(pctx);
+
+	cert = X509_new();
+	X509_set_version(cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+	X509_set_pubkey(cert, pkey);
+	name = X509_get_subject_name(cert);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"ktlsbench", -1, -1, 0);
+	X509_set_issuer_name(cert, name);
+	if(!X509_sign(cert, pkey, EVP_sha256()))
+		die_ssl("signing the certificate");
+}
+
+static SSL_CTX *
+make_ctx(bool server, bool ktls)
+{
+	SSL_CTX *ctx = SSL_CTX_new(server ? TLS_server_method() : TLS_client_method());
+
+	if(ctx == NULL)
+		die_ssl("SSL_CTX_new");
+	if(tls12)
+	{
+		SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+		SSL_CTX_set_cipher_list(ctx, "ECDHE-ECDSA-AES128-GCM-SHA256");
+	}
+	else
+		SSL_CTX_set_ciphersuites(ctx, "TLS_AES_128_GCM_SHA256");
+
+	if(server && (SSL_CTX_use_certificate(ctx, cert) != 1 || SSL_CTX_use_PrivateKey(ctx, pkey) != 1))
+		die_ssl("loading the certificate");
+#ifdef SSL_OP_ENABLE_KTLS
+	if(ktls)
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+	return ctx;
+}
+
+/* what byte pos of the stream should be, every line is the same */
+static char
+expected(long pos)
+{
+	pos %= msglen;
+	return pos == msglen - 1 ? '\n' : 'a' + pos % 26;
+}
+
+/* check_first - did the first line, the one sent with Finished, survive */
+static void
+check_first(const char *buf, long got, ssize_t len)
+{
+	ssize_t i;
+
+	for(i = 0; i < len && got + i < msglen; i++)
+	{
+		if(buf[i] != expected(got + i))
+		{
+			fprintf(stderr, "ktlsbench: byte %ld of the first line is wrong\n", got + i);
+			exit(1);
+		}
+	}
+}
+
+/*
+ * cork_finished - message callback for the client, corks the socket just
+ * before Finished goes out so it waits for the first line.  Only for TLS
+ * 1.3, in 1.2 the client still has to hear the server's Finished first.
+ */
+static void
+cork_finished(int write_p, int version, int content_type, const void *buf, size_t len, SSL *ssl, void *arg)
+{
+	int one = 1;
+
+	if(write_p && version == TLS1_3_VERSION && content_type == SSL3_RT_HANDSHAKE
+	   && len > 0 && ((const unsigned char *)buf)[0] == SSL3_MT_FINISHED)
+		setsockopt(SSL_get_fd(ssl), IPPROTO_TCP, TCP_CORK, &one, sizeof(one));
+}
+
+static void
+run_client(int port)
+{
+	struct sockaddr_in addr;
+	SSL_CTX *ctx;
+	SSL *ssl;
+	char *line, buf[4096];
+	long sent;
+	int fd, zero = 0, i;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		perror("connect");
+		_exit(1);
+	}
+
+	ctx = make_ctx(false, false);
+	ssl = SSL_new(ctx);
+	SSL_set_fd(ssl, fd);
+	SSL_set_msg_callback(ssl, cork_finished);
+	if(SSL_connect(ssl) != 1)
+		die_ssl("SSL_connect");
+
+	line = malloc(msglen);
+	for(i = 0; i < msglen; i++)
+		line[i] = expected(i);
+	for(sent = 0; sent < total; sent += msglen)
+	{
+		if(SSL_write(ssl, line, msglen) <= 0)
+			_exit(1);
+		if(sent == 0)
+			setsockopt(fd, IPPROTO_TCP, TCP_CORK, &zero, sizeof(zero));
+	}
+
+	shutdown(fd, SHUT_WR);
+	while(read(fd, buf, sizeof(buf)) > 0)
+		;
+	_exit(0);
+}
+
+static void
+consume_fd(int fd)
+{
+	char buf[16384];
+	long got = 0;
+	ssize_t len;
+
+	while(got < total && (len = read(fd, buf, sizeof(buf))) > 0)
+	{
+		if(got < msglen)
+			check_first(buf, got, len);
+		got += len;
+	}
+	if(got < total)
+	{
+		fprintf(stderr, "ktlsbench: only got %ld of %ld bytes\n", got, total);
+		exit(1);
+	}
+}
+
+static void
+consume_ssl(SSL *ssl)
+{
+	char buf[16384];
+	long got = 0;
+	int len;
+
+	while(got < total && (len = SSL_read(ssl, buf, sizeof(buf))) > 0)
+	{
+		if(got < msglen)
+			check_first(buf, got, len);
+		got += len;
+	}
+	if(got < total)
+	{
+		fprintf(stderr, "ktlsbench: only got %ld of %ld bytes\n", got, total);
+		exit(1);
+	}
+}
+
+/* relay - what ssld does for a client, SSL_read() and write() it on */
+static void
+relay(SSL *ssl, int fd)
+{
+	char buf[16384], *p;
+	ssize_t w;
+	int len;
+
+	while((len = SSL_read(ssl, buf, sizeof(buf))) > 0)
+	{
+		for(p = buf; len > 0; p += w, len -= w)
+		{
+			if((w = write(fd, p, len)) <= 0)
+				_exit(1);
+		}
+	}
+	_exit(0);
+}
+
+/*
+ * ktls_active - the same test ssld makes before handing a client back,
+ * both directions have to be in the kernel
+ */
+static bool
+ktls_active(int fd)
+{
+#ifdef USE_KTLS
+	struct tls_crypto_info info;
+	char ulp[16];
+	socklen_t len;
+
+	len = sizeof(ulp);
+	if(getsockopt(fd, SOL_TCP, TCP_ULP, ulp, &len) != 0 || len < 3 || memcmp(ulp, "tls", 3) != 0)
+		return false;
+	len = sizeof(info);
+	if(getsockopt(fd, SOL_TLS, TLS_TX, &info, &len) != 0)
+		return false;
+	len = sizeof(info);
+	if(getsockopt(fd, SOL_TLS, TLS_RX, &info, &len) != 0)
+		return false;
+	return true;
+#else
+	return false;
+#endif
+}
+
+static void
+run(const char *mode)
+{
+	struct sockaddr_in addr;
+	struct rusage self0, self1, children0, children1, client_ru;
+	socklen_t addrlen = sizeof(addr);
+	SSL_CTX *ctx;
+	SSL *ssl;
+	double start, elapsed, cpu;
+	pid_t client, relay_pid = -1;
+	int lfd, fd, sv[2], one = 1, queued = 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	   || getsockname(lfd, (struct sockaddr *)&addr, &addrlen) < 0 || listen(lfd, 1) < 0)
+	{
+		perror("listen");
+		exit(1);
+	}
+
+	client = fork();
+	if(client == 0)
+		run_client(ntohs(addr.sin_port));
+
+	fd = accept(lfd, NULL, NULL);
+	close(lfd);
+	ctx = make_ctx(true, !strcmp(mode, "ktls"));
+	ssl = SSL_new(ctx);
+	SSL_set_fd(ssl, fd);
+	if(SSL_accept(ssl) != 1)
+		die_ssl("SSL_accept");
+	/* only what is still in the kernel counts as having beaten us here */
+	ioctl(fd, FIONREAD, &queued);
+
+	if(!strcmp(mode, "ktls") && !ktls_active(fd))
+	{
+		printf("%-6s %5d byte lines: kernel TLS not active on the socket, skipped\n", mode, msglen);
+		close(fd);
+		kill(client, SIGTERM);
+		waitpid(client, NULL, 0);
+		SSL_free(ssl);
+		SSL_CTX_free(ctx);
+		return;
+	}
+
+	getrusage(RUSAGE_SELF, &self0);
+	getrusage(RUSAGE_CHILDREN, &children0);
+	start = now();
+	if(!strcmp(mode, "relay"))
+	{
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		{
+			perror("socketpair");
+			exit(1);
+		}
+		relay_pid = fork();
+		if(relay_pid == 0)
+		{
+			close(sv[0]);
+			relay(ssl, sv[1]);
+		}
+		close(sv[1]);
+		consume_fd(sv[0]);
+		close(sv[0]);
+	}
+	else if(!strcmp(mode, "direct"))
+		consume_ssl(ssl);
+	else
+		consume_fd(fd);
+	elapsed = now() - start;
+	getrusage(RUSAGE_SELF, &self1);
+
+	close(fd);
+	wait4(client, NULL, 0, &client_ru);
+	if(relay_pid > 0)
+		waitpid(relay_pid, NULL, 0);
+	getrusage(RUSAGE_CHILDREN, &children1);
+
+	/* everything but the client, the relay process counts as ssld */
+	cpu = cputime(&self1) - cputime(&self0) + cputime(&children1) - cputime(&children0) - cputime(&client_ru);
+	printf("%-6s %5d byte lines: %7.1f MB/s, server cpu %.2fs per GB, first line intact%s\n",
+	       mode, msglen, total / 1048576.0 / elapsed, cpu * 1073741824.0 / total,
+	       queued > 0 ? " (queued before the handshake finished)" : "");
+
+	SSL_free(ssl);
+	SSL_CTX_free(ctx);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: ktlsbench [-2] [-m relay|direct|ktls] [-s megabytes] [-l linelength]\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *mode = NULL;
+	unsigned int m, l;
+	long megs = 256;
+	int c, len = 0;
+
+	while((c = getopt(argc, argv, "2m:s:l:")) != -1)
+	{
+		switch (c)
+		{
+		case '2':
+			tls12 = true;
+			break;
+		case 'm':
+			mode = optarg;
+			break;
+		case 's':
+			megs = atol(optarg);
+			break;
+		case 'l':
+			len = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if(megs <= 0 || len < 0 || len > 16384)
+		usage();
+	if(mode != NULL && strcmp(mode, "relay") && strcmp(mode, "direct") && strcmp(mode, "ktls"))
+		usage();
+
+	signal(SIGPIPE, SIG_IGN);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	total = megs << 20;
+	make_cert();
+	printf("%s, %ld MB per run\n", tls12 ? "TLS 1.2 ECDHE-ECDSA-AES128-GCM-SHA256" : "TLS 1.3 TLS_AES_128_GCM_SHA256", megs);
+
+	/* both line lengths unless one was given */
+	for(l = 0; l < (len > 0 ? 1 : NELEM(msglens)); l++)
+	{
+		msglen = len > 0 ? len : msglens[l];
+		for(m = 0; m < NELEM(modes); m++)
+		{
+			if(mode == NULL || !strcmp(mode, modes[m]))
+				run(modes[m]);
+		}
+	}
+	return 0;
+}
+#else
+int
+main(int argc, char *argv[])
+{
+	printf("ktlsbench: built without OpenSSL\n");
+	return 0;
+}
+#endif
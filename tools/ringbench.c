@@ -0,0 +1,316 @@
+/*
+ *  ringbench.c: time the ssld shared rings against per client socketpairs
+ *
+ *  A child process stands in for the ssld.  In the fan-out test the parent
+ *  writes one line to each of 1000 clients, 200 times over, and the child
+ *  reads them all and acks each round, the way a channel message goes out
+ *  through ssld.  Then one client bounces a line back and forth to get the
+ *  round trip latency.  Both are done over a socketpair per client, then
+ *  over one pair of rings with eventfd kicks, counting the syscalls each
+ *  side makes.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  $Id$
+ */
+#include "stdinc.h"
+#include "ssld_ring.h"
+
+#ifdef HAVE_SSLD_RING
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+
+#define NCLI	1000
+#define ROUNDS	200
+#define PINGS	50000
+
+static const char line[] =
+	":nick!user@host.example.com PRIVMSG #channel :hello there, this is a line of typical length\r\n";
+#define LINELEN	(sizeof(line) - 1)
+
+static long syscalls;
+static double lat[PINGS];
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+report_latency(const char *what)
+{
+	qsort(lat, PINGS, sizeof(double), cmp_double);
+	printf("%-10s round trip: p50 %.1f us, p99 %.1f us\n", what,
+	       lat[PINGS / 2] * 1e6, lat[PINGS * 99 / 100] * 1e6);
+}
+
+static void
+report_fanout(const char *what, double elapsed)
+{
+	printf("%-10s fan-out: %d lines in %.3fs (%.0f lines/s), ircd side %ld syscalls\n", what,
+	       NCLI * ROUNDS, elapsed, NCLI * ROUNDS / elapsed, syscalls);
+}
+
+static void
+socketpair_bench(void)
+{
+	static int sv[NCLI][2];
+	char buf[4096];
+	int ack[2], i, r;
+	double start;
+	pid_t pid;
+
+	for(i = 0; i < NCLI; i++)
+	{
+		if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv[i]) < 0)
+		{
+			perror("socketpair");
+			exit(1);
+		}
+	}
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, ack) < 0)
+	{
+		perror("socketpair");
+		exit(1);
+	}
+
+	pid = fork();
+	if(pid == 0)
+	{
+		struct epoll_event ev, evs[256];
+		long got = 0, want = (long)NCLI * ROUNDS * LINELEN, next = (long)NCLI * LINELEN;
+		int ep = epoll_create1(0), n, k;
+		ssize_t len;
+
+		syscalls = 0;
+		for(i = 0; i < NCLI; i++)
+		{
+			ev.events = EPOLLIN;
+			ev.data.u32 = i;
+			epoll_ctl(ep, EPOLL_CTL_ADD, sv[i][1], &ev);
+		}
+		while(got < want)
+		{
+			n = epoll_wait(ep, evs, 256, -1);
+			syscalls++;
+			for(k = 0; k < n; k++)
+			{
+				/* read until EAGAIN, like rb_read() callers do */
+				while((len = read(sv[evs[k].data.u32][1], buf, sizeof(buf))) > 0)
+				{
+					got += len;
+					syscalls++;
+				}
+				syscalls++;
+			}
+			while(got >= next)
+			{
+				if(write(ack[1], "a", 1) < 0)
+					_exit(1);
+				syscalls++;
+				next += (long)NCLI * LINELEN;
+			}
+		}
+		printf("socketpair fan-out: ssld side %ld syscalls\n", syscalls);
+		fflush(stdout);
+		_exit(0);
+	}
+
+	syscalls = 0;
+	start = now();
+	for(r = 0; r < ROUNDS; r++)
+	{
+		for(i = 0; i < NCLI; i++)
+		{
+			if(write(sv[i][0], line, LINELEN) < 0)
+				exit(1);
+			syscalls++;
+		}
+		if(read(ack[0], buf, 1) < 0)
+			exit(1);
+		syscalls++;
+	}
+	report_fanout("socketpair", now() - start);
+	waitpid(pid, NULL, 0);
+
+	pid = fork();
+	if(pid == 0)
+	{
+		struct pollfd pfd = { sv[0][1], POLLIN, 0 };
+
+		for(i = 0; i < PINGS; i++)
+		{
+			poll(&pfd, 1, -1);
+			if(read(sv[0][1], buf, sizeof(buf)) < 0 || write(sv[0][1], line, LINELEN) < 0)
+				_exit(1);
+		}
+		_exit(0);
+	}
+
+	for(i = 0; i < PINGS; i++)
+	{
+		struct pollfd pfd = { sv[0][0], POLLIN, 0 };
+
+		start = now();
+		if(write(sv[0][0], line, LINELEN) < 0)
+			exit(1);
+		poll(&pfd, 1, -1);
+		if(read(sv[0][0], buf, sizeof(buf)) < 0)
+			exit(1);
+		lat[i] = now() - start;
+	}
+	waitpid(pid, NULL, 0);
+	report_latency("socketpair");
+
+	for(i = 0; i < NCLI; i++)
+	{
+		close(sv[i][0]);
+		close(sv[i][1]);
+	}
+	close(ack[0]);
+	close(ack[1]);
+}
+
+/* ring_send - put a record, spinning while the ring is full */
+static void
+ring_send(struct ssld_ring *r, int kick_fd, uint32_t connid, const void *data, size_t len)
+{
+	while(!ssld_ring_put(r, connid, SSLD_RING_DATA, data, len))
+		;
+	if(ssld_ring_wake_consumer(r))
+	{
+		ssld_ring_kick(kick_fd);
+		syscalls++;
+	}
+}
+
+/* ring_recv - take a record, sleeping on our eventfd while the ring is empty */
+static void
+ring_recv(struct ssld_ring *r, int wait_fd, int kick_fd, struct ssld_ring_rec *rec, void *buf)
+{
+	for(;;)
+	{
+		if(ssld_ring_get(r, rec, buf))
+		{
+			if(ssld_ring_wake_producer(r))
+			{
+				ssld_ring_kick(kick_fd);
+				syscalls++;
+			}
+			return;
+		}
+		if(ssld_ring_sleep(r))
+		{
+			struct pollfd pfd = { wait_fd, POLLIN, 0 };
+
+			poll(&pfd, 1, -1);
+			ssld_ring_unkick(wait_fd);
+			syscalls += 2;
+		}
+	}
+}
+
+static void
+ring_bench(void)
+{
+	static char buf[SSLD_RING_MAXDATA];
+	struct ssld_rings *rings;
+	struct ssld_ring_rec rec;
+	int mfd, ircd_efd, ssld_efd, i, r;
+	double start;
+	pid_t pid;
+
+	mfd = memfd_create("ringbench", MFD_CLOEXEC);
+	if(mfd < 0 || ftruncate(mfd, sizeof(struct ssld_rings)) < 0)
+	{
+		perror("memfd_create");
+		exit(1);
+	}
+	rings = mmap(NULL, sizeof(struct ssld_rings), PROT_READ | PROT_WRITE, MAP_SHARED, mfd, 0);
+	if(rings == MAP_FAILED)
+	{
+		perror("mmap");
+		exit(1);
+	}
+	ircd_efd = eventfd(0, EFD_NONBLOCK);
+	ssld_efd = eventfd(0, EFD_NONBLOCK);
+
+	pid = fork();
+	if(pid == 0)
+	{
+		syscalls = 0;
+		for(r = 0; r < ROUNDS; r++)
+		{
+			for(i = 0; i < NCLI; i++)
+				ring_recv(&rings->to_ssld, ssld_efd, ircd_efd, &rec, buf);
+			ring_send(&rings->to_ircd, ircd_efd, 0, "a", 1);
+		}
+		printf("ring       fan-out: ssld side %ld syscalls\n", syscalls);
+		fflush(stdout);
+
+		for(i = 0; i < PINGS; i++)
+		{
+			ring_recv(&rings->to_ssld, ssld_efd, ircd_efd, &rec, buf);
+			ring_send(&rings->to_ircd, ircd_efd, rec.connid, line, LINELEN);
+		}
+		_exit(0);
+	}
+
+	syscalls = 0;
+	start = now();
+	for(r = 0; r < ROUNDS; r++)
+	{
+		for(i = 0; i < NCLI; i++)
+			ring_send(&rings->to_ssld, ssld_efd, i, line, LINELEN);
+		ring_recv(&rings->to_ircd, ircd_efd, ssld_efd, &rec, buf);
+	}
+	report_fanout("ring", now() - start);
+
+	for(i = 0; i < PINGS; i++)
+	{
+		start = now();
+		ring_send(&rings->to_ssld, ssld_efd, 1, line, LINELEN);
+		ring_recv(&rings->to_ircd, ircd_efd, ssld_efd, &rec, buf);
+		lat[i] = now() - start;
+	}
+	waitpid(pid, NULL, 0);
+	report_latency("ring");
+
+	munmap(rings, sizeof(struct ssld_rings));
+	close(mfd);
+	close(ircd_efd);
+	close(ssld_efd);
+}
+
+int
+main(int argc, char *argv[])
+{
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	socketpair_bench();
+	ring_bench();
+	return 0;
+}
+#else
+int
+main(int argc, char *argv[])
+{
+	printf("ringbench: built without the ssld rings\n");
+	return 0;
+}
+#endif